@@ -0,0 +1,209 @@
+/* SPDX-License-Identifier: GPL-2.0 OR MIT */
+/*
+ * lhandoff - 调度策略决策
+ *
+ * 只依赖任务的锁状态快照，不访问 map / task_struct，
+ * 同时被 scx_lhandoff.bpf.c 和用户态模拟器 (tests/lh_sim.c) 使用，
+ * 修改策略时可以先在模拟器里验证，不需要 sched_ext 内核和 root。
+ * 锁亲和组的计票和 LLC 域分配也在这里，拓扑和负载数组由调用者传入。
+ *
+ * 包含前需提供 u8/u16/u32/s32/u64 以及 LH_SLICE_* / LH_GROUP_* / LH_LLC_MAX 定义
+ * （BPF 侧类型来自 vmlinux.h，常量两边都来自 lh_shared.h）。
+ */
+#ifndef __LH_POLICY_H
+#define __LH_POLICY_H
+
+#ifndef __bpf__
+#include <stdbool.h>
+#endif
+
+#ifndef __always_inline
+#define __always_inline inline __attribute__((always_inline))
+#endif
+
+/* 一次调度决策看到的任务状态 */
+struct lh_task_state {
+    bool controlled;    /* 在 allowlist 中 */
+    bool in_cs;         /* cs_table: 持有锁 */
+    bool cs_predicted;  /* 有持锁时间预测（hold_ewma_ns） */
+    u64 cs_remaining_ns;/* 预测剩余持锁时间，已超出预测时为 0 */
+    bool chain_root;    /* 持有的锁阻塞了一条等待链（waiter → owner → ... → 本任务） */
+    s32 waiter_cpu;     /* 等待的锁 owner 所在 CPU，-1 = 不是 waiter */
+    bool waiter_aged;   /* waiter 已等待超过老化上限（LH_HANDOFF_AGE_US） */
+    s32 group_cpu;      /* 锁亲和组所在 LLC 里选出的 CPU，-1 = 不放置 */
+};
+
+/* enqueue 决策 */
+struct lh_enq_decision {
+    u64 slice_ns;
+    bool preempt;       /* 对应 SCX_ENQ_PREEMPT */
+    bool head;          /* 对应 SCX_ENQ_HEAD：插到 DSQ 队首 */
+};
+
+/* ========== select_cpu ========== */
+static __always_inline s32 lh_policy_select_cpu(const struct lh_task_state *t,
+                                                s32 prev_cpu, u32 nr_cpus)
+{
+    /* 确保 prev_cpu 有效 */
+    if (prev_cpu < 0 || prev_cpu >= (s32)nr_cpus)
+        prev_cpu = 0;
+
+    if (!t->controlled)
+        return prev_cpu;
+
+    /* IN_CS owner: 保持在当前 CPU */
+    if (t->in_cs)
+        return prev_cpu;
+
+    /* waiter: 尝试定向到 owner CPU */
+    if (t->waiter_cpu >= 0 && t->waiter_cpu < (s32)nr_cpus)
+        return t->waiter_cpu;
+
+    /* 其它时候软放置到锁亲和组的 LLC（那里没有空闲 CPU 时 group_cpu 为 -1） */
+    if (t->group_cpu >= 0 && t->group_cpu < (s32)nr_cpus)
+        return t->group_cpu;
+
+    return prev_cpu;
+}
+
+/* ========== enqueue ==========
+ * IN_CS slice：有预测时给够剩余持锁时间的 2 倍，至少普通 slice，
+ * 最多 LH_SLICE_IN_CS_MAX_NS。已超出预测的 owner（可能卡住）只拿普通 slice，
+ * 不能长期占住 CPU。没有预测时沿用上限。
+ */
+static __always_inline u64 lh_policy_in_cs_slice(const struct lh_task_state *t)
+{
+    u64 slice;
+
+    if (!t->cs_predicted)
+        return LH_SLICE_IN_CS_MAX_NS;
+
+    slice = t->cs_remaining_ns * 2;
+    if (slice < LH_SLICE_NORMAL_NS)
+        slice = LH_SLICE_NORMAL_NS;
+    if (slice > LH_SLICE_IN_CS_MAX_NS)
+        slice = LH_SLICE_IN_CS_MAX_NS;
+    return slice;
+}
+
+static __always_inline void lh_policy_enqueue(const struct lh_task_state *t,
+                                              struct lh_enq_decision *d)
+{
+    d->slice_ns = LH_SLICE_NORMAL_NS;
+    d->preempt = false;
+    d->head = false;
+
+    if (!t->controlled)
+        return;
+
+    /*
+     * waiter: 短 slice + PREEMPT。等待超过老化上限的插到队首，
+     * 不再排在反复 yield 的年轻 waiter 后面（liblh 同时把锁指定给它）。
+     */
+    if (t->waiter_cpu >= 0) {
+        d->slice_ns = LH_SLICE_WAITER_NS;
+        d->preempt = true;
+        d->head = t->waiter_aged;
+        return;
+    }
+
+    /* IN_CS owner: 更长 slice */
+    if (t->in_cs)
+        d->slice_ns = lh_policy_in_cs_slice(t);
+
+    /* 等待链的根 owner：整条链都在等它，抢占并给足 slice */
+    if (t->in_cs && t->chain_root) {
+        d->slice_ns = LH_SLICE_IN_CS_MAX_NS;
+        d->preempt = true;
+    }
+}
+
+/* ========== 锁亲和组 ==========
+ * 每个线程按多数票记一把"最常竞争的锁"：同一把锁上的等待加票，别的锁上的等待
+ * 减票，票数归零时换成新锁。票数达到 LH_GROUP_JOIN_SCORE 的线程是该锁亲和组的
+ * 成员，每个周期在组里计一次。周期结束时把成员数折算出来，给成员 >= 2 的组分配
+ * 一个 LLC 域；域里的成员数超过 CPU 数时把组挪到放得下的域，哪个域都放不下的组
+ * 不放置。
+ */
+struct lh_lock_group {
+    s32 home_llc;           /* 放置到的 LLC 域，-1 = 不放置（成员太少或哪个域都放不下） */
+    s32 owner_cpu;          /* 最近看到的 owner CPU，首次放置优先它所在的域 */
+    u32 members;            /* 上个周期的成员线程数 */
+    u32 members_next;       /* 本周期已计入的成员线程数 */
+};
+
+/* 线程在 lock_addr 上的一次等待计一票；返回 true 表示投票后是 lock_addr 组的成员 */
+static __always_inline bool lh_policy_group_vote(u64 *group_lock, u32 *score, u64 *epoch,
+                                                 u64 lock_addr)
+{
+    if (*group_lock == lock_addr) {
+        if (*score < LH_GROUP_SCORE_MAX)
+            (*score)++;
+    } else if (*score > 0) {
+        (*score)--;
+        return false;
+    } else {
+        *group_lock = lock_addr;
+        *score = 1;
+        *epoch = 0;
+    }
+    return *score >= LH_GROUP_JOIN_SCORE;
+}
+
+/* 能放下 n 个成员的 LLC 域：优先 prefer，其次空闲容量最大的；都放不下返回 -1 */
+static __always_inline s32 lh_policy_group_pick_llc(u32 n, s32 prefer, const u32 *load,
+                                                    const volatile u16 *cap, u32 nr_llcs)
+{
+    s32 best = -1;
+    u32 best_free = 0;
+
+    if (prefer >= 0 && prefer < LH_LLC_MAX && load[prefer] + n <= cap[prefer])
+        return prefer;
+
+    for (s32 llc = 0; llc < LH_LLC_MAX && llc < (s32)nr_llcs; llc++) {
+        u32 c = cap[llc], l = load[llc];
+        u32 avail = c > l ? c - l : 0;
+
+        if (avail >= n && avail > best_free) {
+            best = llc;
+            best_free = avail;
+        }
+    }
+    return best;
+}
+
+/* 周期结束第一遍（每个组）：折算成员数，统计各域负载；本周期没有成员竞争的组不再放置 */
+static __always_inline void lh_policy_group_fold(struct lh_lock_group *g, u32 *load)
+{
+    g->members = g->members_next;
+    g->members_next = 0;
+    if (g->members < 2)
+        g->home_llc = -1;
+    if (g->home_llc >= 0 && g->home_llc < LH_LLC_MAX)
+        load[g->home_llc] += g->members;
+}
+
+/* 第二遍（每个组）：没放置的组和所在域超载的组重新选域 */
+static __always_inline void lh_policy_group_balance(struct lh_lock_group *g, u32 *load,
+                                                    const volatile u16 *cap, u32 nr_llcs,
+                                                    const volatile u8 *cpu_llc)
+{
+    s32 home = g->home_llc, prefer = -1;
+
+    if (g->members < 2)
+        return;
+    if (home >= 0 && home < LH_LLC_MAX) {
+        if (load[home] <= cap[home])
+            return;
+        load[home] -= g->members;
+    } else if (g->owner_cpu >= 0 && g->owner_cpu < LH_CPU_TABLE_SLOTS) {
+        prefer = cpu_llc[g->owner_cpu];
+    }
+
+    home = lh_policy_group_pick_llc(g->members, prefer, load, cap, nr_llcs);
+    if (home >= 0 && home < LH_LLC_MAX)
+        load[home] += g->members;
+    g->home_llc = home;
+}
+
+#endif /* __LH_POLICY_H */
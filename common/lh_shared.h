@@ -1,13 +1,17 @@
 /* SPDX-License-Identifier: GPL-2.0 OR MIT */
 /*
  * lhandoff - 共享数据结构定义
- * 用户态 (liblh.so) 和内核态 (scx_lhandoff) 共享
+ * 用户态 (liblh.so) 和内核态 (scx_lhandoff) 共享，两边只有这一份定义。
+ * BPF 侧先 include "vmlinux.h"（提供 u32 等类型）再 include 本文件。
  */
 #ifndef __LH_SHARED_H
 #define __LH_SHARED_H
 
-#ifdef __KERNEL__
+#if defined(__bpf__)
+#define LH_ATOMIC(t)    t
+#elif defined(__KERNEL__)
 #include <linux/types.h>
+#define LH_ATOMIC(t)    t
 #else
 #include <stdint.h>
 #include <stdatomic.h>
@@ -15,88 +19,151 @@ typedef uint8_t  u8;
 typedef uint16_t u16;
 typedef uint32_t u32;
 typedef uint64_t u64;
+typedef int16_t  s16;
 typedef int32_t  s32;
 typedef int64_t  s64;
+#define LH_ATOMIC(t)    _Atomic t
 #endif
 
 #define CACHELINE_SIZE 64
 
 /* ========== 配置参数 ========== */
 #define LH_LOCK_TABLE_BUCKETS   1024    /* 2-way 组相联 bucket 数 */
-#define LH_WAITER_TABLE_SLOTS   4096    /* waiter hint 表 slot 数 */
-#define LH_CS_TABLE_SLOTS       4096    /* IN_CS 表 slot 数 */
+#define LH_LOCK_WAYS            2
+#define LH_THREAD_TABLE_SLOTS   4096    /* per-thread cs + waiter 状态表 slot 数 */
+#define LH_CPU_TABLE_SLOTS      1024    /* per-CPU 当前 tid 表（最大 CPU 数） */
 #define LH_MAX_ALLOWED_TGIDS    256     /* 最大允许的 TGID 数 */
+#define LH_NUMA_NODES_MAX       4       /* lock_table / thread_table 的分区数上限（每 NUMA 节点一份） */
 
 /* 降级策略参数 */
 #define LH_YIELD_BUDGET         64      /* 最大 yield 次数 */
 #define LH_FALLBACK_US          500     /* 超时回退阈值 (微秒) */
+#define LH_SPIN_US              50      /* owner 在运行时的 spin 上限 (微秒) */
+
+/* handoff 顺序（LH_HANDOFF_ORDER，见 DESIGN.md 4.10） */
+#define LH_ORDER_RACE           0       /* 不指定，谁先 trylock 成功谁拿到（默认） */
+#define LH_ORDER_FIFO           1       /* 等得最久的 waiter */
+#define LH_ORDER_LIFO           2       /* 最近开始等的 waiter（cache 热） */
+#define LH_ORDER_CPU            3       /* 与 unlock 者同 CPU 的 waiter 优先，其次 FIFO */
+#define LH_HANDOFF_AGE_US       1000    /* 非 RACE 顺序的默认老化上限：等待超过它的 waiter 下一个被服务 */
+#define LH_HANDOFF_GRANT_US     200     /* 被指定的 waiter 这么久没拿锁，其它 waiter 可以再竞争 */
 
 /* slice 配置 (纳秒) */
 #define LH_SLICE_NORMAL_NS      (5 * 1000 * 1000)   /* 5ms */
 #define LH_SLICE_IN_CS_MULT     4                    /* IN_CS 倍数 */
 #define LH_SLICE_WAITER_NS      (1 * 1000 * 1000)   /* 1ms - waiter 短 slice */
+#define LH_SLICE_IN_CS_MAX_NS   (LH_SLICE_NORMAL_NS * LH_SLICE_IN_CS_MULT)  /* IN_CS slice 上限 */
+
+/* 嵌套锁：每线程记录的持有锁个数上限，BPF 沿 waiter→owner 链最多走几跳 */
+#define LH_HELD_LOCKS_MAX       4
+#define LH_CHAIN_MAX_HOPS       4
+#define LH_CHAIN_BOOST_TTL_NS   (1 * 1000 * 1000)   /* 链根 owner 的提升有效期 */
+
+/* 持锁时间预测：lock_entry.hold_ewma_ns = ewma + (hold - ewma) >> SHIFT */
+#define LH_HOLD_EWMA_SHIFT      3
+
+/* futex 追踪 (launcher -f) */
+#define LH_FUTEX_OWNER_ENTRIES  4096    /* futex_owners LRU 容量 */
+#define LH_FUTEX_TTL_NS         (2 * 1000 * 1000)   /* 推断结果的有效期 */
+
+/* 锁亲和组 (launcher -g，见 DESIGN.md 5.5) */
+#define LH_LLC_MAX              32      /* LLC 域个数上限 */
+#define LH_LLC_CPUS_MAX         64      /* select_cpu 在一个 LLC 里找空闲 CPU 时最多看几个 */
+#define LH_GROUP_ENTRIES        4096    /* lock_groups LRU 容量 */
+#define LH_GROUP_JOIN_SCORE     2       /* 在同一把锁上连续竞争几次算作组成员 */
+#define LH_GROUP_SCORE_MAX      8
+#define LH_GROUP_EPOCH_NS       (100 * 1000 * 1000) /* 成员计数与重新平衡的周期 */
 
 /* DSQ IDs */
 #define LH_DSQ_NORMAL           0
 #define LH_DSQ_LOCKWAIT_BASE    1000    /* per-cpu: 1000 + cpu_id */
 
-/* ========== waiter_slot flags ========== */
+/* ========== thread_slot.waiter_flags ========== */
 #define LH_WAITER_INACTIVE      0
 #define LH_WAITER_ACTIVE        1
+#define LH_WAITER_PARKED        2       /* 回退到阻塞加锁（futex 睡眠），仍在等 lock_addr */
+
+/* ========== NUMA 分区 ==========
+ * lock_table 和 thread_table 每个 NUMA 节点一份（内存分配在该节点上），
+ * 线程第一次发布 hint 时所在的节点是它的 home 节点，之后只写 home 分区：
+ * - thread_slot 只存在于 home 分区，读者按 tid 在各分区中查找（slot->tid 校验）
+ * - lock_entry 由 owner 写入自己的 home 分区，按锁地址查找时扫描所有分区
+ * 单节点机器上只有分区 0，与不分区时相同。
+ */
 
-/* ========== lock_entry: 2-way 组相联 cacheline 对齐 ========== */
+/* ========== lock_table: 2-way 组相联，一个 bucket 占一条 cacheline ==========
+ * tag 是完整的锁地址（不会有两把锁匹配同一个 entry），两路放在行首；
+ * 查找、加锁、释放只碰这一条 cacheline。
+ */
 struct lh_lock_entry {
-#ifdef __KERNEL__
-    u32 tag;            /* 发布字段：最后 release store */
-#else
-    _Atomic u32 tag;
-#endif
     u32 owner_tid;
     s32 owner_cpu;
-    u32 gen;
-    u64 t_start_ns;     /* 可选：用于降级决策 */
-    u8  pad[CACHELINE_SIZE - (4 + 4 + 4 + 4 + 8)];
-} __attribute__((aligned(CACHELINE_SIZE)));
+    u64 t_start_ns;     /* 加锁时间 (CLOCK_MONOTONIC，与 bpf_ktime_get_ns 一致) */
+    u32 ewma_tag;       /* hold_ewma_ns 属于哪把锁（LH_EWMA_TAG，entry 被复用时重置） */
+    u32 hold_ewma_ns;   /* 持锁时间 EWMA，0 = 尚无样本 */
+};
 
 struct lh_lock_bucket {
-    struct lh_lock_entry way[2];
-} __attribute__((aligned(CACHELINE_SIZE * 2)));
+    LH_ATOMIC(u64) tag[LH_LOCK_WAYS];   /* 锁地址，发布字段：entry 写完后 release store，0 = 空 */
+    struct lh_lock_entry way[LH_LOCK_WAYS];
+} __attribute__((aligned(CACHELINE_SIZE)));
 
-/* ========== waiter_slot: tid-index mmapable array ========== */
-struct lh_waiter_slot {
-#ifdef __KERNEL__
-    u32 flags;          /* 0/ACTIVE，发布字段 */
-#else
-    _Atomic u32 flags;
-#endif
-    u32 tid;            /* 校验 */
-    u64 lock_addr;      /* 或 (bucket, tag) */
-    s32 target_cpu;     /* 可填 -1，由内核算 */
-    u32 pad0;
-    u8  pad[CACHELINE_SIZE - (4 + 4 + 8 + 4 + 4)];
+/* ========== thread_slot: tid-index，cs 与 waiter 状态共用一条 cacheline ==========
+ * 只由本线程写，BPF 和其它线程读。
+ */
+struct lh_thread_slot {
+    LH_ATOMIC(u32) in_cs;           /* IN_CS 深度（含读锁） */
+    u32 nr_held;                    /* held[] 有效个数（超过上限的锁不记录） */
+    LH_ATOMIC(u32) waiter_flags;    /* INACTIVE/ACTIVE/PARKED，waiter 字段的发布字段 */
+    u32 tid;                        /* slot 属于哪个线程（按 tid 取模可能冲突；跨分区查找用它区分） */
+    u64 lock_addr;                  /* 正在等待的锁 */
+    s32 target_cpu;                 /* 可填 -1，由内核算 */
+    u32 wait_start_us;              /* 开始等待的时间 (CLOCK_MONOTONIC 微秒的低 32 位)，老化用 */
+    u64 held[LH_HELD_LOCKS_MAX];    /* 持有的锁（写者/mutex），栈顶为最内层 */
 } __attribute__((aligned(CACHELINE_SIZE)));
 
-/* ========== cs_slot: IN_CS 表 ========== */
-struct lh_cs_slot {
-#ifdef __KERNEL__
-    u32 in_cs;          /* 0/1 或 depth */
-#else
-    _Atomic u32 in_cs;
-#endif
+/* ========== cpu_slot: per-CPU 当前运行的 tid ==========
+ * BPF 在 ops.running / ops.stopping 中更新，用户态只读。
+ * curr_tid == 0 表示该 CPU 上没有受控任务在运行（或 idle）。
+ */
+struct lh_cpu_slot {
+    LH_ATOMIC(u32) curr_tid;
     u32 pad;
-    u8  pad2[CACHELINE_SIZE - 8];
+    u64 t_running_ns;   /* 最近一次 running 的时间 */
+    u8  pad2[CACHELINE_SIZE - 16];
 } __attribute__((aligned(CACHELINE_SIZE)));
 
 /* ========== 辅助宏 ========== */
+
+/*
+ * murmur3 fmix64：地址的每一位都影响结果。同一进程的堆 / .bss 地址高 32 位
+ * 几乎相同、低位按对象大小对齐，只用其中一部分位会让很多锁挤进同一个 bucket。
+ */
+static inline u64 lh_mix64(u64 x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
 #define LH_BUCKET_IDX(lock_addr, salt) \
-    (((u32)((lock_addr) ^ (salt)) * 2654435761u) % LH_LOCK_TABLE_BUCKETS)
+    ((u32)(lh_mix64((u64)(lock_addr) ^ (salt)) % LH_LOCK_TABLE_BUCKETS))
 
-#define LH_TAG_FROM_ADDR(lock_addr, salt) \
-    ((u32)(((lock_addr) ^ (salt)) >> 32) | 1)  /* 确保非零 */
+/* EWMA 归属校验用的 32 位指纹（与 bucket 下标取哈希的不同位），非零 */
+#define LH_EWMA_TAG(lock_addr, salt) \
+    ((u32)(lh_mix64((u64)(lock_addr) ^ (salt)) >> 32) | 1)
 
-#define LH_WAITER_SLOT_IDX(tid) ((tid) % LH_WAITER_TABLE_SLOTS)
-#define LH_CS_SLOT_IDX(tid)     ((tid) % LH_CS_TABLE_SLOTS)
+#define LH_THREAD_SLOT_IDX(tid) ((tid) % LH_THREAD_TABLE_SLOTS)
 
 #define LH_DSQ_LOCKWAIT(cpu)    (LH_DSQ_LOCKWAIT_BASE + (cpu))
 
+#ifndef __cplusplus
+_Static_assert(sizeof(struct lh_lock_bucket) == CACHELINE_SIZE, "lock bucket must fit one cacheline");
+_Static_assert(sizeof(struct lh_thread_slot) == CACHELINE_SIZE, "thread slot must fit one cacheline");
+_Static_assert(sizeof(struct lh_cpu_slot) == CACHELINE_SIZE, "cpu slot must fit one cacheline");
+#endif
+
 #endif /* __LH_SHARED_H */
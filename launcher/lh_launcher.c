@@ -1,7 +1,9 @@
 /* SPDX-License-Identifier: MIT */
 /*
  * lh_launcher - 控制进程
- * fork+SIGSTOP → load scx → allowlist TGID → SIGCONT → wait
+ * load scx → fork+SIGSTOP → allowlist TGID → SIGCONT → wait
+ *
+ * BPF 在 fork 前加载，子进程继承 map fd（清除 CLOEXEC）和 LH_* 环境变量。
  */
 #define _GNU_SOURCE
 #include <stdio.h>
@@ -12,8 +14,11 @@
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
 #include <bpf/libbpf.h>
 #include <bpf/bpf.h>
+#include <bpf/btf.h>
 
 #include "../common/lh_shared.h"
 
@@ -21,16 +26,54 @@
 static struct bpf_object *g_obj = NULL;
 static struct bpf_link *g_ops_link = NULL;
 static struct bpf_link *g_fork_link = NULL;
+static struct bpf_link *g_futex_enter_link = NULL;
+static struct bpf_link *g_futex_exit_link = NULL;
 static pid_t g_child_pid = -1;
 
 /* Map fds */
 static int g_allowed_tgids_fd = -1;
-static int g_lock_table_fd = -1;
-static int g_waiter_table_fd = -1;
-static int g_cs_table_fd = -1;
+static int g_cpu_table_fd = -1;
+
+/* lock_table / thread_table 每个 NUMA 节点一个分区，下标为节点号 */
+static u32 g_nr_nodes = 1;
+static u64 g_online_nodes = 1;      /* 在线节点位图 */
+static int g_lock_table_fds[LH_NUMA_NODES_MAX] = { [0 ... LH_NUMA_NODES_MAX - 1] = -1 };
+static int g_thread_table_fds[LH_NUMA_NODES_MAX] = { [0 ... LH_NUMA_NODES_MAX - 1] = -1 };
+static u8 g_cpu_node[LH_CPU_TABLE_SLOTS];   /* CPU → NUMA 节点号，交给调度器做 cohort */
+
+/* LLC 域（锁亲和组放置用）：域下标按 CPU 号顺序首次出现编号 */
+static u32 g_nr_llcs = 1;
+static u8 g_cpu_llc[LH_CPU_TABLE_SLOTS];
+static u16 g_llc_nr_cpus[LH_LLC_MAX];
+static s16 g_llc_cpus[LH_LLC_MAX][LH_LLC_CPUS_MAX];
+
+/* 选项 */
+static bool g_futex_track = false;
+static bool g_group_place = false;     /* -g：锁亲和组放置 */
+/* handoff 顺序（-o / -a 或 LH_HANDOFF_ORDER / LH_HANDOFF_AGE_US），liblh 和调度器用同一份 */
+static const char *g_handoff_order = NULL;
+static long g_handoff_age_us = -1;     /* -1 = 按顺序策略取默认 */
+static long g_handoff_cohort = -1;     /* 连续同节点交接上限（-k 或 LH_HANDOFF_COHORT），-1 = 0 */
+
+static void close_partitions(int *fds)
+{
+    for (int i = 0; i < LH_NUMA_NODES_MAX; i++) {
+        if (fds[i] >= 0)
+            close(fds[i]);
+        fds[i] = -1;
+    }
+}
 
 static void cleanup(void)
 {
+    if (g_futex_exit_link) {
+        bpf_link__destroy(g_futex_exit_link);
+        g_futex_exit_link = NULL;
+    }
+    if (g_futex_enter_link) {
+        bpf_link__destroy(g_futex_enter_link);
+        g_futex_enter_link = NULL;
+    }
     if (g_fork_link) {
         bpf_link__destroy(g_fork_link);
         g_fork_link = NULL;
@@ -43,6 +86,8 @@ static void cleanup(void)
         bpf_object__close(g_obj);
         g_obj = NULL;
     }
+    close_partitions(g_lock_table_fds);
+    close_partitions(g_thread_table_fds);
 }
 
 static void sig_handler(int sig)
@@ -61,6 +106,157 @@ static int get_nr_cpus(void)
     return nr > 0 ? nr : 1;
 }
 
+/* "0-3,8-11" 格式的下一个区间，没有时返回 false */
+static bool next_range(char **p, unsigned long *lo, unsigned long *hi)
+{
+    char *end;
+
+    if (**p < '0' || **p > '9')
+        return false;
+    *lo = *hi = strtoul(*p, &end, 10);
+    if (*end == '-')
+        *hi = strtoul(end + 1, &end, 10);
+    *p = *end == ',' ? end + 1 : end;
+    return true;
+}
+
+static bool read_line(const char *path, char *buf, int size)
+{
+    FILE *f = fopen(path, "r");
+    bool ok;
+
+    if (!f)
+        return false;
+    ok = fgets(buf, size, f) != NULL;
+    fclose(f);
+    return ok;
+}
+
+/* nodeN/cpulist → g_cpu_node */
+static void detect_cpu_node(unsigned long node)
+{
+    char path[64], buf[4096];
+    unsigned long lo, hi;
+    char *p = buf;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%lu/cpulist", node);
+    if (!read_line(path, buf, sizeof(buf)))
+        return;
+    while (next_range(&p, &lo, &hi)) {
+        for (unsigned long cpu = lo; cpu <= hi && cpu < LH_CPU_TABLE_SLOTS; cpu++)
+            g_cpu_node[cpu] = (u8)node;
+    }
+}
+
+/*
+ * 分区数 = 最大在线节点号 + 1（"0-1" / "0,2-3" 格式），超过 LH_NUMA_NODES_MAX 的
+ * 节点由 liblh 折回到已有分区。读不到时按单节点处理。
+ * 同时记录每个 CPU 所在节点（cohort 用真实节点号，不折回）。
+ */
+static void detect_numa_nodes(void)
+{
+    char buf[256];
+    unsigned long lo, hi;
+    u32 max_node = 0;
+    char *p = buf;
+
+    if (!read_line("/sys/devices/system/node/online", buf, sizeof(buf)))
+        return;
+
+    g_online_nodes = 0;
+    while (next_range(&p, &lo, &hi)) {
+        for (unsigned long n = lo; n <= hi && n < 256; n++) {
+            if (n < 64)
+                g_online_nodes |= 1ULL << n;
+            detect_cpu_node(n);
+        }
+        if (hi > max_node)
+            max_node = hi;
+    }
+    if (!g_online_nodes)
+        g_online_nodes = 1;
+
+    g_nr_nodes = max_node + 1;
+    if (g_nr_nodes > LH_NUMA_NODES_MAX) {
+        fprintf(stderr, "[launcher] %u NUMA nodes, sharing %d table partitions\n",
+                g_nr_nodes, LH_NUMA_NODES_MAX);
+        g_nr_nodes = LH_NUMA_NODES_MAX;
+    }
+}
+
+/* g_cpu_node 交给 liblh（LH_CPU_NODES，按 CPU 号排列的节点号），cohort 与调度器用同一份映射 */
+static void export_cpu_nodes(void)
+{
+    static char buf[LH_CPU_TABLE_SLOTS * 4];
+    int nr_cpus = get_nr_cpus();
+    int len = 0;
+
+    for (int cpu = 0; cpu < nr_cpus && cpu < LH_CPU_TABLE_SLOTS; cpu++)
+        len += snprintf(buf + len, sizeof(buf) - len, "%s%u", cpu ? "," : "", g_cpu_node[cpu]);
+    setenv("LH_CPU_NODES", buf, 1);
+}
+
+/* cpu 最高一级 cache 的共享 CPU 列表里最小的 CPU 号，作为它所在 LLC 域的标识；读不到返回 -1 */
+static long llc_leader(int cpu)
+{
+    char path[96], buf[4096];
+    unsigned long lo, hi;
+    int best_level = 0;
+    long leader = -1;
+
+    for (int idx = 0; idx < 8; idx++) {
+        char *p = buf;
+        int level;
+
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/level", cpu, idx);
+        if (!read_line(path, buf, sizeof(buf)))
+            break;
+        level = atoi(buf);
+        if (level <= best_level)
+            continue;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/cache/index%d/shared_cpu_list",
+                 cpu, idx);
+        if (!read_line(path, buf, sizeof(buf)) || !next_range(&p, &lo, &hi))
+            continue;
+        best_level = level;
+        leader = (long)lo;
+    }
+    return leader;
+}
+
+/*
+ * CPU → LLC 域。超过 LH_LLC_MAX 的域折回到已有的域，每个域最多记录
+ * LH_LLC_CPUS_MAX 个 CPU 供调度器找空闲 CPU（容量仍按真实 CPU 数）。
+ */
+static void detect_llcs(void)
+{
+    long leaders[LH_LLC_MAX];
+    int nr_cpus = get_nr_cpus();
+    u32 nr = 0;
+
+    memset(g_llc_cpus, 0xff, sizeof(g_llc_cpus));
+    for (int cpu = 0; cpu < nr_cpus && cpu < LH_CPU_TABLE_SLOTS; cpu++) {
+        long leader = llc_leader(cpu);
+        u32 llc;
+
+        for (llc = 0; llc < nr; llc++) {
+            if (leaders[llc] == leader)
+                break;
+        }
+        if (llc == nr) {
+            if (nr < LH_LLC_MAX)
+                leaders[nr++] = leader;
+            else
+                llc = (u32)cpu % LH_LLC_MAX;
+        }
+        g_cpu_llc[cpu] = (u8)llc;
+        if (g_llc_nr_cpus[llc] < LH_LLC_CPUS_MAX)
+            g_llc_cpus[llc][g_llc_nr_cpus[llc]] = (s16)cpu;
+        g_llc_nr_cpus[llc]++;
+    }
+    g_nr_llcs = nr ? nr : 1;
+}
+
 static int libbpf_print_fn(enum libbpf_print_level level, const char *format, va_list args)
 {
     if (level == LIBBPF_DEBUG)
@@ -68,6 +264,78 @@ static int libbpf_print_fn(enum libbpf_print_level level, const char *format, va
     return vfprintf(stderr, format, args);
 }
 
+/*
+ * 每个节点创建一个 mmapable array（内存分配在该节点上）并填入外层 map。
+ * map_flags 必须与 BPF 中的内层模板一致；不在线的节点号不指定节点。
+ */
+static int create_partitions(const char *outer_name, const char *name, u32 value_size,
+                             u32 max_entries, int *fds)
+{
+    struct bpf_map *outer = bpf_object__find_map_by_name(g_obj, outer_name);
+    int outer_fd = outer ? bpf_map__fd(outer) : -1;
+
+    if (outer_fd < 0) {
+        fprintf(stderr, "[launcher] %s map not found\n", outer_name);
+        return -1;
+    }
+
+    for (u32 node = 0; node < g_nr_nodes; node++) {
+        LIBBPF_OPTS(bpf_map_create_opts, opts,
+                    .map_flags = BPF_F_MMAPABLE | BPF_F_NUMA_NODE,
+                    .numa_node = (g_online_nodes >> node) & 1 ? node : (u32)-1);
+
+        fds[node] = bpf_map_create(BPF_MAP_TYPE_ARRAY, name, sizeof(u32), value_size,
+                                   max_entries, &opts);
+        if (fds[node] < 0) {
+            fprintf(stderr, "[launcher] Failed to create %s for node %u: %d\n",
+                    name, node, fds[node]);
+            return -1;
+        }
+        if (bpf_map_update_elem(outer_fd, &node, &fds[node], BPF_ANY) != 0) {
+            fprintf(stderr, "[launcher] Failed to install %s for node %u\n", name, node);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * 按 BTF 里 .rodata 的变量偏移写初值，不依赖 BPF 端的声明顺序和对齐；
+ * 变量不存在或大小不符（两边类型不一致）时报错
+ */
+static int set_rodata(struct bpf_map *map, const char *name, const void *val, size_t size)
+{
+    const struct btf *btf = bpf_object__btf(g_obj);
+    size_t data_sz = 0;
+    char *data = bpf_map__initial_value(map, &data_sz);
+    const struct btf_type *sec;
+    const struct btf_var_secinfo *vsi;
+    int id;
+
+    if (!btf || !data)
+        return -1;
+    id = btf__find_by_name_kind(btf, ".rodata", BTF_KIND_DATASEC);
+    if (id < 0)
+        return -1;
+
+    sec = btf__type_by_id(btf, id);
+    vsi = btf_var_secinfos(sec);
+    for (int i = 0; i < btf_vlen(sec); i++, vsi++) {
+        const struct btf_type *var = btf__type_by_id(btf, vsi->type);
+
+        if (strcmp(btf__name_by_offset(btf, var->name_off), name) != 0)
+            continue;
+        if (vsi->size != size || vsi->offset + size > data_sz) {
+            fprintf(stderr, "[launcher] rodata %s: size %u, expected %zu\n", name, vsi->size, size);
+            return -1;
+        }
+        memcpy(data + vsi->offset, val, size);
+        return 0;
+    }
+    fprintf(stderr, "[launcher] rodata %s not found\n", name);
+    return -1;
+}
+
 static int load_bpf(const char *bpf_path)
 {
     struct bpf_program *prog;
@@ -83,24 +351,31 @@ static int load_bpf(const char *bpf_path)
         return -1;
     }
 
-    /* 设置全局变量 */
+    /* 设置全局变量（rodata 在 load 前设置） */
     map = bpf_object__find_map_by_name(g_obj, ".rodata");
     if (map) {
-        /* 设置 nr_cpus 和 hash_salt */
         u32 nr_cpus = get_nr_cpus();
         u64 hash_salt = 0x12345678deadbeef;
-        
-        /* rodata 在 load 前设置 */
-        struct {
-            u32 nr_cpus;
-            u32 pad;
-            u64 hash_salt;
-        } rodata = { nr_cpus, 0, hash_salt };
-        
-        err = bpf_map__set_initial_value(map, &rodata, sizeof(rodata));
-        if (err) {
-            fprintf(stderr, "[launcher] Warning: Failed to set rodata: %d\n", err);
-        }
+        u64 handoff_age_ns = (u64)g_handoff_age_us * 1000;
+        u32 cohort_max = (u32)g_handoff_cohort;
+        u32 futex_track = g_futex_track;
+        u32 group_place = g_group_place;
+
+        err = 0;
+        err |= set_rodata(map, "nr_cpus", &nr_cpus, sizeof(nr_cpus));
+        err |= set_rodata(map, "hash_salt", &hash_salt, sizeof(hash_salt));
+        err |= set_rodata(map, "futex_track", &futex_track, sizeof(futex_track));
+        err |= set_rodata(map, "nr_nodes", &g_nr_nodes, sizeof(g_nr_nodes));
+        err |= set_rodata(map, "handoff_age_ns", &handoff_age_ns, sizeof(handoff_age_ns));
+        err |= set_rodata(map, "cohort_max", &cohort_max, sizeof(cohort_max));
+        err |= set_rodata(map, "cpu_node", g_cpu_node, sizeof(g_cpu_node));
+        err |= set_rodata(map, "group_place", &group_place, sizeof(group_place));
+        err |= set_rodata(map, "nr_llcs", &g_nr_llcs, sizeof(g_nr_llcs));
+        err |= set_rodata(map, "llc_nr_cpus", g_llc_nr_cpus, sizeof(g_llc_nr_cpus));
+        err |= set_rodata(map, "llc_cpus", g_llc_cpus, sizeof(g_llc_cpus));
+        err |= set_rodata(map, "cpu_llc", g_cpu_llc, sizeof(g_cpu_llc));
+        if (err)
+            fprintf(stderr, "[launcher] Warning: Failed to set rodata\n");
     }
 
     /* 加载 BPF 程序 */
@@ -116,14 +391,17 @@ static int load_bpf(const char *bpf_path)
     map = bpf_object__find_map_by_name(g_obj, "allowed_tgids");
     if (map) g_allowed_tgids_fd = bpf_map__fd(map);
 
-    map = bpf_object__find_map_by_name(g_obj, "lock_table");
-    if (map) g_lock_table_fd = bpf_map__fd(map);
+    map = bpf_object__find_map_by_name(g_obj, "cpu_table");
+    if (map) g_cpu_table_fd = bpf_map__fd(map);
 
-    map = bpf_object__find_map_by_name(g_obj, "waiter_table");
-    if (map) g_waiter_table_fd = bpf_map__fd(map);
-
-    map = bpf_object__find_map_by_name(g_obj, "cs_table");
-    if (map) g_cs_table_fd = bpf_map__fd(map);
+    /* 调度器开始查表之前建好各节点的分区 */
+    if (create_partitions("lock_tables", "lock_table", sizeof(struct lh_lock_bucket),
+                          LH_LOCK_TABLE_BUCKETS, g_lock_table_fds) != 0 ||
+        create_partitions("thread_tables", "thread_table", sizeof(struct lh_thread_slot),
+                          LH_THREAD_TABLE_SLOTS, g_thread_table_fds) != 0) {
+        cleanup();
+        return -1;
+    }
 
     /* Attach struct_ops (sched_ext) */
     map = bpf_object__find_map_by_name(g_obj, "lhandoff_ops");
@@ -149,6 +427,66 @@ static int load_bpf(const char *bpf_path)
         }
     }
 
+    /* futex 追踪：推断直接基于 futex 实现的锁的 owner/waiter */
+    if (g_futex_track) {
+        prog = bpf_object__find_program_by_name(g_obj, "handle_futex_enter");
+        if (prog)
+            g_futex_enter_link = bpf_program__attach(prog);
+        prog = bpf_object__find_program_by_name(g_obj, "handle_futex_exit");
+        if (prog)
+            g_futex_exit_link = bpf_program__attach(prog);
+        if (!g_futex_enter_link || !g_futex_exit_link) {
+            fprintf(stderr, "[launcher] Failed to attach futex tracking\n");
+            cleanup();
+            return -1;
+        }
+        fprintf(stderr, "[launcher] futex tracking enabled\n");
+    }
+
+    return 0;
+}
+
+/* 让 map fd 在 exec 后仍然有效，供 liblh mmap */
+static int keep_fd(int fd)
+{
+    int flags;
+
+    if (fd < 0)
+        return -1;
+
+    flags = fcntl(fd, F_GETFD);
+    if (flags < 0 || fcntl(fd, F_SETFD, flags & ~FD_CLOEXEC) < 0) {
+        perror("[launcher] fcntl");
+        return -1;
+    }
+    return 0;
+}
+
+static int export_fd(const char *name, int fd)
+{
+    char env_buf[64];
+
+    if (keep_fd(fd) != 0)
+        return -1;
+
+    snprintf(env_buf, sizeof(env_buf), "%d", fd);
+    setenv(name, env_buf, 1);
+    return 0;
+}
+
+/* 分区表导出为 "fd0,fd1,..."，按节点号排列 */
+static int export_partitions(const char *name, const int *fds)
+{
+    char env_buf[64];
+    int len = 0;
+
+    for (u32 node = 0; node < g_nr_nodes; node++) {
+        if (keep_fd(fds[node]) != 0)
+            return -1;
+        len += snprintf(env_buf + len, sizeof(env_buf) - len, "%s%d",
+                        node ? "," : "", fds[node]);
+    }
+    setenv(name, env_buf, 1);
     return 0;
 }
 
@@ -172,12 +510,50 @@ static int add_tgid_to_allowlist(pid_t tgid)
     return 0;
 }
 
+/* 没有 -o / -a / -k 时取环境变量；老化上限默认：race 不老化，其它策略 LH_HANDOFF_AGE_US */
+static int resolve_handoff_order(void)
+{
+    static const char *const names[] = { "race", "fifo", "lifo", "cpu" };
+    const char *age = getenv("LH_HANDOFF_AGE_US");
+    const char *cohort;
+    bool known = false;
+
+    if (!g_handoff_order)
+        g_handoff_order = getenv("LH_HANDOFF_ORDER");
+    if (!g_handoff_order || !*g_handoff_order)
+        g_handoff_order = "race";
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+        known |= strcmp(g_handoff_order, names[i]) == 0;
+    if (!known) {
+        fprintf(stderr, "[launcher] Unknown handoff order: %s\n", g_handoff_order);
+        return -1;
+    }
+
+    if (g_handoff_age_us < 0 && age && *age)
+        g_handoff_age_us = strtol(age, NULL, 0);
+    if (g_handoff_age_us < 0)
+        g_handoff_age_us = strcmp(g_handoff_order, "race") != 0 ? LH_HANDOFF_AGE_US : 0;
+
+    if (g_handoff_cohort < 0 && (cohort = getenv("LH_HANDOFF_COHORT")) && *cohort)
+        g_handoff_cohort = strtol(cohort, NULL, 0);
+    if (g_handoff_cohort < 0)
+        g_handoff_cohort = 0;
+    return 0;
+}
+
 static void print_usage(const char *prog)
 {
     fprintf(stderr, "Usage: %s [options] <program> [args...]\n", prog);
     fprintf(stderr, "Options:\n");
     fprintf(stderr, "  -b <path>   BPF object file (default: ./scx/scx_lhandoff.bpf.o)\n");
     fprintf(stderr, "  -l <path>   liblh.so path (default: ./liblh/liblh.so)\n");
+    fprintf(stderr, "  -f          Track futex(2) to infer owners of locks liblh cannot see\n");
+    fprintf(stderr, "  -n          Do not LD_PRELOAD liblh (futex tracking / IN_CS hints only)\n");
+    fprintf(stderr, "  -o <order>  Handoff order: race|fifo|lifo|cpu (default: race)\n");
+    fprintf(stderr, "  -a <us>     Serve any waiter older than this next, 0 = off\n");
+    fprintf(stderr, "              (default: %d for fifo/lifo/cpu, 0 for race)\n", LH_HANDOFF_AGE_US);
+    fprintf(stderr, "  -k <n>      Hand off to same-NUMA-node waiters up to n times in a row, 0 = off\n");
+    fprintf(stderr, "  -g          Place threads that contend on the same lock within one LLC\n");
     fprintf(stderr, "  -h          Show this help\n");
 }
 
@@ -185,10 +561,12 @@ int main(int argc, char *argv[])
 {
     const char *bpf_path = "./scx/scx_lhandoff.bpf.o";
     const char *liblh_path = "./liblh/liblh.so";
+    bool preload = true;
+    char age_buf[32], cohort_buf[32];
     int opt;
 
     /* 使用 '+' 前缀让 getopt 在遇到非选项参数时停止 */
-    while ((opt = getopt(argc, argv, "+hb:l:")) != -1) {
+    while ((opt = getopt(argc, argv, "+hb:l:fgno:a:k:")) != -1) {
         switch (opt) {
         case 'h':
             print_usage(argv[0]);
@@ -199,6 +577,32 @@ int main(int argc, char *argv[])
         case 'l':
             liblh_path = optarg;
             break;
+        case 'f':
+            g_futex_track = true;
+            break;
+        case 'g':
+            g_group_place = true;
+            break;
+        case 'n':
+            preload = false;
+            break;
+        case 'o':
+            g_handoff_order = optarg;
+            break;
+        case 'a':
+            g_handoff_age_us = strtol(optarg, NULL, 0);
+            if (g_handoff_age_us < 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'k':
+            g_handoff_cohort = strtol(optarg, NULL, 0);
+            if (g_handoff_cohort < 0) {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
         default:
             print_usage(argv[0]);
             return 1;
@@ -210,6 +614,10 @@ int main(int argc, char *argv[])
         print_usage(argv[0]);
         return 1;
     }
+    if (resolve_handoff_order() != 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
 
     char *target_prog = argv[optind];
     char **target_argv = &argv[optind];
@@ -217,10 +625,39 @@ int main(int argc, char *argv[])
     signal(SIGINT, sig_handler);
     signal(SIGTERM, sig_handler);
 
-    /* Step 1: fork 子进程并暂停 */
+    /* Step 1: 加载 BPF（子进程需要继承 map fd） */
+    detect_numa_nodes();
+    detect_llcs();
+    if (g_group_place && g_nr_llcs < 2)
+        fprintf(stderr, "[launcher] Only one LLC domain, -g has no effect\n");
+    if (load_bpf(bpf_path) != 0)
+        return 1;
+
+    /* Step 2: 设置环境变量，fork 后由子进程继承 */
+    if (export_partitions("LH_LOCK_TABLE_FD", g_lock_table_fds) != 0 ||
+        export_partitions("LH_THREAD_TABLE_FD", g_thread_table_fds) != 0 ||
+        export_fd("LH_CPU_TABLE_FD", g_cpu_table_fd) != 0) {
+        fprintf(stderr, "[launcher] Failed to export shared tables\n");
+        cleanup();
+        return 1;
+    }
+
+    setenv("LH_HASH_SALT", "12345678deadbeef", 1);
+    setenv("LH_ENABLED", "1", 1);
+    setenv("LH_HANDOFF_ORDER", g_handoff_order, 1);
+    snprintf(age_buf, sizeof(age_buf), "%ld", g_handoff_age_us);
+    setenv("LH_HANDOFF_AGE_US", age_buf, 1);
+    snprintf(cohort_buf, sizeof(cohort_buf), "%ld", g_handoff_cohort);
+    setenv("LH_HANDOFF_COHORT", cohort_buf, 1);
+    export_cpu_nodes();
+    if (preload)
+        setenv("LD_PRELOAD", liblh_path, 1);
+
+    /* Step 3: fork 子进程并暂停 */
     g_child_pid = fork();
     if (g_child_pid < 0) {
         perror("[launcher] fork");
+        cleanup();
         return 1;
     }
 
@@ -239,55 +676,33 @@ int main(int argc, char *argv[])
     int status;
     if (waitpid(g_child_pid, &status, WUNTRACED) < 0) {
         perror("[launcher] waitpid");
+        cleanup();
         return 1;
     }
 
     if (!WIFSTOPPED(status)) {
         fprintf(stderr, "[launcher] Child did not stop\n");
+        cleanup();
         return 1;
     }
 
-    fprintf(stderr, "[launcher] Child stopped, loading BPF...\n");
-
-    /* Step 2: 加载 BPF */
-    if (load_bpf(bpf_path) != 0) {
-        kill(g_child_pid, SIGKILL);
-        return 1;
-    }
-
-    /* Step 3: 添加 TGID 到 allowlist */
+    /* Step 4: 添加 TGID 到 allowlist */
     if (add_tgid_to_allowlist(g_child_pid) != 0) {
         cleanup();
         kill(g_child_pid, SIGKILL);
         return 1;
     }
 
-    /* 设置环境变量 */
-    char env_buf[64];
-    
-    snprintf(env_buf, sizeof(env_buf), "%d", g_lock_table_fd);
-    setenv("LH_LOCK_TABLE_FD", env_buf, 1);
-    
-    snprintf(env_buf, sizeof(env_buf), "%d", g_waiter_table_fd);
-    setenv("LH_WAITER_TABLE_FD", env_buf, 1);
-    
-    snprintf(env_buf, sizeof(env_buf), "%d", g_cs_table_fd);
-    setenv("LH_CS_TABLE_FD", env_buf, 1);
-    
-    setenv("LH_HASH_SALT", "12345678deadbeef", 1);
-    setenv("LH_ENABLED", "1", 1);
-    setenv("LD_PRELOAD", liblh_path, 1);
-
     fprintf(stderr, "[launcher] Resuming child...\n");
 
-    /* Step 4: 恢复子进程 */
+    /* Step 5: 恢复子进程 */
     if (kill(g_child_pid, SIGCONT) < 0) {
         perror("[launcher] SIGCONT");
         cleanup();
         return 1;
     }
 
-    /* Step 5: 等待子进程完成 */
+    /* Step 6: 等待子进程完成 */
     while (1) {
         pid_t wpid = waitpid(-1, &status, 0);
         if (wpid < 0) {
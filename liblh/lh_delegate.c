@@ -0,0 +1,173 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * lh_delegate.c - 委托执行的合并队列
+ *
+ * 请求用无锁栈挂到队列上，只有持锁的 combiner 取（一次 exchange 取走整条链），
+ * 所以取出和执行之间没有 ABA。combiner 先读 next 再置 done：置位之后调用者
+ * 可能立刻返回，请求所在的栈帧随之失效。一次执行满 max 个时，链上剩下的
+ * 请求留在 pending，下一个 combiner 先执行它们，顺序不变。
+ *
+ * 睡眠的调用者都等在队列的 seq 上。combiner 置完 done（release）后经过一次
+ * seq_cst fence 再看 nr_parked，调用者登记 nr_parked 后同样经过 fence 再看 done，
+ * 至少一方看到对方：要么 combiner 推进 seq 唤醒，要么调用者不睡。
+ */
+#define _GNU_SOURCE
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "lh_delegate.h"
+
+_Atomic u32 g_lh_delegate_nr_queues = 0;
+static struct lh_delegate_queue g_lh_delegate_queues[LH_DELEGATE_QUEUES];
+
+static long futex(_Atomic u32 *uaddr, int op, u32 val, const struct timespec *ts)
+{
+    return syscall(SYS_futex, uaddr, op | FUTEX_PRIVATE_FLAG, val, ts, NULL, 0);
+}
+
+/* ========== 队列 ========== */
+static inline struct lh_delegate_queue *queue_at(u64 lock_addr, int i)
+{
+    u32 h = (u32)lh_mix64(lock_addr) + (u32)i;
+
+    return &g_lh_delegate_queues[h & (LH_DELEGATE_QUEUES - 1)];
+}
+
+struct lh_delegate_queue *lh_delegate_queue_find(u64 lock_addr)
+{
+    for (int i = 0; i < LH_DELEGATE_PROBE_MAX; i++) {
+        struct lh_delegate_queue *q = queue_at(lock_addr, i);
+        u64 cur = atomic_load_explicit(&q->lock_addr, memory_order_acquire);
+
+        if (cur == lock_addr)
+            return q;
+        if (!cur)
+            break;
+    }
+    return NULL;
+}
+
+struct lh_delegate_queue *lh_delegate_queue_get(u64 lock_addr)
+{
+    for (;;) {
+        struct lh_delegate_queue *free_q = NULL;
+        u64 cur = 0;
+
+        /* 墓碑后面可能还有这把锁的队列，先找完整个探测范围再占空位 */
+        for (int i = 0; i < LH_DELEGATE_PROBE_MAX; i++) {
+            struct lh_delegate_queue *q = queue_at(lock_addr, i);
+            u64 v = atomic_load_explicit(&q->lock_addr, memory_order_acquire);
+
+            if (v == lock_addr)
+                return q;
+            if (!free_q && (!v || v == LH_DELEGATE_TOMBSTONE)) {
+                free_q = q;
+                cur = v;
+            }
+            if (!v)
+                break;
+        }
+        if (!free_q)
+            return NULL;
+        if (atomic_compare_exchange_strong(&free_q->lock_addr, &cur, lock_addr)) {
+            atomic_fetch_add(&g_lh_delegate_nr_queues, 1);
+            return free_q;
+        }
+        /* 空位被别的锁（或同一把锁的另一个线程）抢先占用，重新找 */
+    }
+}
+
+void lh_delegate_queue_release(u64 lock_addr)
+{
+    struct lh_delegate_queue *q = lh_delegate_queue_find(lock_addr);
+    u64 cur = lock_addr;
+
+    /* 还有请求或睡眠的调用者说明锁在销毁时仍在使用，保留队列 */
+    if (!q || atomic_load(&q->head) || atomic_load(&q->pending) || atomic_load(&q->nr_parked))
+        return;
+    if (atomic_compare_exchange_strong(&q->lock_addr, &cur, LH_DELEGATE_TOMBSTONE))
+        atomic_fetch_sub(&g_lh_delegate_nr_queues, 1);
+}
+
+/* ========== combiner ========== */
+u32 lh_delegate_combine(struct lh_delegate_queue *q, u32 max)
+{
+    /* 上一个 combiner 剩下的请求比栈里的早，先执行 */
+    struct lh_delegate_req *fifo = atomic_load_explicit(&q->pending, memory_order_relaxed);
+    u32 n = 0;
+
+    while (n < max) {
+        struct lh_delegate_req *next;
+
+        if (!fifo) {
+            struct lh_delegate_req *list;
+
+            if (!atomic_load_explicit(&q->head, memory_order_relaxed))
+                break;
+            list = atomic_exchange_explicit(&q->head, NULL, memory_order_acquire);
+            /* 栈是后进先出，反转后按提交顺序执行 */
+            while (list) {
+                next = list->next;
+                list->next = fifo;
+                fifo = list;
+                list = next;
+            }
+        }
+        next = fifo->next;
+        fifo->fn(fifo->arg);
+        atomic_store_explicit(&fifo->done, 1, memory_order_release);
+        fifo = next;
+        n++;
+    }
+    atomic_store_explicit(&q->pending, fifo, memory_order_relaxed);
+
+    /* done 的 release store 与下面的 load 之间要 StoreLoad：与 park_prepare 的 fence 配对 */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (n && atomic_load(&q->nr_parked)) {
+        atomic_fetch_add(&q->seq, 1);
+        futex(&q->seq, FUTEX_WAKE, INT_MAX, NULL);
+    }
+    return n;
+}
+
+/* ========== 调用者睡眠 ========== */
+u32 lh_delegate_park_prepare(struct lh_delegate_queue *q)
+{
+    u32 seq = atomic_load(&q->seq);
+
+    atomic_fetch_add(&q->nr_parked, 1);
+    /* 登记之后调用者才看 done / trylock：与 combine、kick 的 fence 配对 */
+    atomic_thread_fence(memory_order_seq_cst);
+    return seq;
+}
+
+void lh_delegate_park(struct lh_delegate_queue *q, u32 seq, u32 timeout_us)
+{
+    struct timespec ts = { timeout_us / 1000000, (timeout_us % 1000000) * 1000 };
+
+    futex(&q->seq, FUTEX_WAIT, seq, &ts);
+}
+
+void lh_delegate_unpark(struct lh_delegate_queue *q)
+{
+    atomic_fetch_sub(&q->nr_parked, 1);
+}
+
+void lh_delegate_kick(u64 lock_addr)
+{
+    struct lh_delegate_queue *q = lh_delegate_queue_find(lock_addr);
+
+    /* 没有待执行的请求就没有要唤醒的：请求被取走时由 combiner 唤醒 */
+    if (!q || (!atomic_load_explicit(&q->head, memory_order_relaxed) &&
+               !atomic_load_explicit(&q->pending, memory_order_relaxed)))
+        return;
+    /* 锁字已释放：与调用者"登记 nr_parked → trylock"配对 */
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load(&q->nr_parked)) {
+        atomic_fetch_add(&q->seq, 1);
+        futex(&q->seq, FUTEX_WAKE, 1, NULL);
+    }
+}
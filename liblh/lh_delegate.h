@@ -0,0 +1,85 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * lh_delegate.h - 委托执行（flat combining，liblh.h 的 lh_delegate）
+ *
+ * 每把用过 lh_delegate 的锁在进程内有一个合并队列。调用者把临界区
+ * （fn, arg）挂到队列上，然后尝试拿锁：拿到锁的线程成为 combiner，
+ * 在一次持锁里把队列中所有请求依次执行完（包括别人的），其它调用者
+ * 只等自己的请求被标记完成。锁和被保护的数据留在 combiner 的 cache 里，
+ * 不再随每次加锁在 CPU 之间搬动。
+ *
+ * 请求放在调用者的栈上，完成标记之后 combiner 不再访问它。
+ * 队列按锁地址开放寻址，锁 destroy 时回收；探测范围内没有空位时退化为普通的
+ * 加锁执行。
+ */
+#ifndef __LH_DELEGATE_H
+#define __LH_DELEGATE_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "../common/lh_shared.h"
+
+#define LH_DELEGATE_QUEUES      256     /* 2 的幂 */
+#define LH_DELEGATE_PROBE_MAX   4
+#define LH_DELEGATE_BATCH_MAX   64      /* combiner 一次持锁最多执行的请求数，剩下的留给下一个 combiner */
+#define LH_DELEGATE_TOMBSTONE   1       /* 回收后的 lock_addr：探测时跳过，可以重新占用 */
+
+struct lh_delegate_req {
+    void (*fn)(void *arg);
+    void *arg;
+    struct lh_delegate_req *next;
+    _Atomic u32 done;                   /* combiner 执行完后置 1（release） */
+};
+
+struct lh_delegate_queue {
+    _Atomic u64 lock_addr;              /* 0 = 空闲，LH_DELEGATE_TOMBSTONE = 已回收 */
+    _Atomic(struct lh_delegate_req *) head;     /* 待执行的请求（后进先出，取出后反转为 FIFO） */
+    _Atomic(struct lh_delegate_req *) pending;  /* 已取出、超过批量上限没执行的（FIFO），只在持锁时读写 */
+    _Atomic u32 seq;                    /* 睡眠的调用者在上面 futex 等待 */
+    _Atomic u32 nr_parked;              /* 正在（或将要）睡眠的调用者数 */
+} __attribute__((aligned(CACHELINE_SIZE)));
+
+_Static_assert(sizeof(struct lh_delegate_queue) == CACHELINE_SIZE, "delegate queue must fit one cacheline");
+
+extern _Atomic u32 g_lh_delegate_nr_queues;    /* 在用的队列数；0 时 unlock 路径不用查 */
+
+/* 找到或建立 lock_addr 的队列，没有空位时返回 NULL */
+struct lh_delegate_queue *lh_delegate_queue_get(u64 lock_addr);
+
+/* 按锁地址找队列，没有时返回 NULL */
+struct lh_delegate_queue *lh_delegate_queue_find(u64 lock_addr);
+
+/* 锁 destroy 后调用：队列里没有请求、没人睡眠时回收 */
+void lh_delegate_queue_release(u64 lock_addr);
+
+static inline void lh_delegate_post(struct lh_delegate_queue *q, struct lh_delegate_req *req)
+{
+    struct lh_delegate_req *head = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+    do {
+        req->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&q->head, &head, req,
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+static inline bool lh_delegate_done(struct lh_delegate_req *req)
+{
+    return atomic_load_explicit(&req->done, memory_order_acquire) != 0;
+}
+
+/* 持锁时调用：按提交顺序执行最多 max 个请求，唤醒睡眠的调用者；返回执行的个数 */
+u32 lh_delegate_combine(struct lh_delegate_queue *q, u32 max);
+
+/*
+ * 睡眠分两步，保证不丢唤醒：park_prepare 登记并取 seq，调用者再检查自己的请求
+ * 和锁（锁空闲就自己去 combine，之后 unpark），都不行才 lh_delegate_park。
+ */
+u32 lh_delegate_park_prepare(struct lh_delegate_queue *q);
+void lh_delegate_park(struct lh_delegate_queue *q, u32 seq, u32 timeout_us);
+void lh_delegate_unpark(struct lh_delegate_queue *q);
+
+/* 锁释放后调用：队列里还有请求且有人在睡眠时唤醒一个，让它来拿锁 combine */
+void lh_delegate_kick(u64 lock_addr);
+
+#endif /* __LH_DELEGATE_H */
@@ -0,0 +1,287 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * lh_filter.c - 按锁选择是否启用 handoff
+ *
+ * LH_INCLUDE / LH_EXCLUDE 为逗号分隔的规则列表：
+ *
+ *   0xA-0xB               锁地址在 [A, B] 内（0xA 单独一个地址）
+ *   sym:NAME              锁本身是全局变量 NAME（NAME* 为前缀匹配）
+ *   func:NAME             加锁调用点位于函数 NAME 内
+ *   (sym / func 用 dladdr 查找，需要符号在动态符号表中：共享库默认导出，
+ *    可执行文件需要 -rdynamic；堆上的锁没有符号，用 caller 或地址区间)
+ *   caller:MOD            加锁调用点位于模块 MOD（按文件名匹配，不含目录）
+ *   caller:MOD+0xA[-0xB]  调用点在 MOD 内偏移 A（或 [A, B]），即 LH_PROFILE 报告的格式
+ *
+ * 先匹配 LH_EXCLUDE，命中即关闭；设置了 LH_INCLUDE 时只有命中的锁开启，
+ * 否则默认开启。每把锁只在第一次被拦截时解析（调用点取那一次的），
+ * 关闭的锁所有 pthread 调用直接转给 glibc，不发布任何 hint。
+ *
+ * 同一把锁的 lock 和 unlock 必须得到相同决定，否则持锁时的 IN_CS 不会被清除。
+ * 只用 0x / sym: 规则时决定只取决于锁地址，探测范围满了可以随意替换旧项，
+ * 重新解析结果不变；有 func: / caller: 规则时缓存项不能替换（换出后从另一个
+ * 调用点重新解析可能得到相反结果），放不进缓存的锁一律关闭。
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <link.h>
+
+#include "lh_filter.h"
+
+/* ========== 配置常量 ========== */
+#define FILTER_RULES_MAX    32
+#define FILTER_NAME_MAX     128
+
+/* ========== 规则 ========== */
+enum filter_kind {
+    FILTER_ADDR,        /* 锁地址区间 */
+    FILTER_SYM,         /* 锁所在的数据符号 */
+    FILTER_FUNC,        /* 调用点所在函数 */
+    FILTER_CALLER,      /* 调用点所在模块 + 偏移区间 */
+};
+
+struct filter_rule {
+    enum filter_kind kind;
+    bool exclude;
+    bool any_offset;            /* FILTER_CALLER 没有给偏移 */
+    u64 lo, hi;                 /* 闭区间 */
+    char name[FILTER_NAME_MAX]; /* 结尾 '*' 表示前缀匹配 */
+};
+
+bool g_lh_filter = false;
+_Atomic u64 g_lh_filter_cache[LH_FILTER_CACHE_SLOTS];
+
+static struct filter_rule g_rules[FILTER_RULES_MAX];
+static int g_nr_rules;
+static bool g_has_include;
+static bool g_has_caller_rules;         /* 有 func: / caller: 规则，决定与调用点有关 */
+static _Atomic u32 g_evict_next;        /* 探测范围满时轮流替换的位置 */
+
+/* ========== 解析 ========== */
+static bool parse_range(const char *s, u64 *lo, u64 *hi)
+{
+    char *end;
+
+    *lo = strtoull(s, &end, 0);
+    if (end == s)
+        return false;
+    *hi = *lo;
+    if (*end == '-') {
+        s = end + 1;
+        *hi = strtoull(s, &end, 0);
+        if (end == s || *hi < *lo)
+            return false;
+    }
+    return *end == '\0';
+}
+
+static bool parse_rule(const char *s, struct filter_rule *r)
+{
+    const char *arg;
+
+    memset(r, 0, sizeof(*r));
+    if (strncmp(s, "sym:", 4) == 0) {
+        r->kind = FILTER_SYM;
+        arg = s + 4;
+    } else if (strncmp(s, "func:", 5) == 0) {
+        r->kind = FILTER_FUNC;
+        arg = s + 5;
+    } else if (strncmp(s, "caller:", 7) == 0) {
+        const char *plus;
+
+        r->kind = FILTER_CALLER;
+        arg = s + 7;
+        plus = strrchr(arg, '+');
+        if (plus) {
+            if (!parse_range(plus + 1, &r->lo, &r->hi))
+                return false;
+            snprintf(r->name, sizeof(r->name), "%.*s", (int)(plus - arg), arg);
+        } else {
+            r->any_offset = true;
+            snprintf(r->name, sizeof(r->name), "%s", arg);
+        }
+        return r->name[0] != '\0';
+    } else {
+        r->kind = FILTER_ADDR;
+        return parse_range(s, &r->lo, &r->hi);
+    }
+
+    snprintf(r->name, sizeof(r->name), "%s", arg);
+    return r->name[0] != '\0';
+}
+
+static void parse_list(const char *var, bool exclude)
+{
+    const char *list = getenv(var);
+    char buf[FILTER_NAME_MAX];
+
+    while (list && *list) {
+        size_t len = strcspn(list, ",");
+
+        if (len && len < sizeof(buf)) {
+            memcpy(buf, list, len);
+            buf[len] = '\0';
+            if (g_nr_rules < FILTER_RULES_MAX && parse_rule(buf, &g_rules[g_nr_rules])) {
+                g_rules[g_nr_rules].exclude = exclude;
+                g_has_include |= !exclude;
+                g_has_caller_rules |= g_rules[g_nr_rules].kind == FILTER_FUNC ||
+                                      g_rules[g_nr_rules].kind == FILTER_CALLER;
+                g_nr_rules++;
+            } else {
+                fprintf(stderr, "liblh: ignoring %s rule '%s'\n", var, buf);
+            }
+        }
+        list += len;
+        if (*list == ',')
+            list++;
+    }
+}
+
+void lh_filter_init(void)
+{
+    parse_list("LH_EXCLUDE", true);
+    parse_list("LH_INCLUDE", false);
+    g_lh_filter = g_nr_rules > 0;
+}
+
+/* ========== 匹配 ========== */
+static bool name_match(const char *pattern, const char *name)
+{
+    size_t n = strlen(pattern);
+
+    if (!name)
+        return false;
+    if (n && pattern[n - 1] == '*')
+        return strncmp(pattern, name, n - 1) == 0;
+    return strcmp(pattern, name) == 0;
+}
+
+static const char *base_name(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+
+    return slash ? slash + 1 : path;
+}
+
+/* 锁所在数据符号：要求地址确实落在符号范围内，堆上的锁没有符号 */
+static const char *lock_symbol(u64 lock_addr)
+{
+    Dl_info info;
+    const ElfW(Sym) *sym = NULL;
+
+    if (!dladdr1((void *)(uintptr_t)lock_addr, &info, (void **)&sym, RTLD_DL_SYMENT) ||
+        !info.dli_sname || !sym)
+        return NULL;
+    if (lock_addr >= (u64)(uintptr_t)info.dli_saddr + sym->st_size)
+        return NULL;
+    return info.dli_sname;
+}
+
+static bool rule_match(const struct filter_rule *r, u64 lock_addr, const void *caller,
+                       const Dl_info *ci, bool ci_ok)
+{
+    switch (r->kind) {
+    case FILTER_ADDR:
+        return lock_addr >= r->lo && lock_addr <= r->hi;
+    case FILTER_SYM:
+        return name_match(r->name, lock_symbol(lock_addr));
+    case FILTER_FUNC:
+        return ci_ok && name_match(r->name, ci->dli_sname);
+    case FILTER_CALLER:
+        if (!ci_ok || !ci->dli_fname ||
+            strcmp(base_name(r->name), base_name(ci->dli_fname)) != 0)
+            return false;
+        if (r->any_offset)
+            return true;
+        u64 off = (u64)((uintptr_t)caller - (uintptr_t)ci->dli_fbase);
+        return off >= r->lo && off <= r->hi;
+    }
+    return false;
+}
+
+static bool decide(u64 lock_addr, const void *caller)
+{
+    Dl_info ci;
+    bool ci_ok = g_has_caller_rules && caller && dladdr(caller, &ci);
+    bool included = false;
+
+    for (int i = 0; i < g_nr_rules; i++) {
+        const struct filter_rule *r = &g_rules[i];
+
+        if (r->exclude && rule_match(r, lock_addr, caller, &ci, ci_ok))
+            return false;
+        if (!r->exclude && !included)
+            included = rule_match(r, lock_addr, caller, &ci, ci_ok);
+    }
+    return g_has_include ? included : true;
+}
+
+/*
+ * 解析并缓存。并发解析同一把锁时 CAS 失败的一方采用已写入的结果，
+ * 保证同一把锁 lock / unlock 看到相同决定。
+ * 地址不是 8 字节对齐，或有 func: / caller: 规则且探测范围已满时不缓存，
+ * 返回关闭：这个决定只取决于锁，每次调用都一样，也不再每次调用 dladdr。
+ */
+bool lh_filter_resolve(u64 lock_addr, const void *caller)
+{
+    u32 h = lh_filter_slot(lock_addr);
+    bool decided = false, on = false;
+    u64 v = 0;
+
+    if (!lock_addr || (lock_addr & LH_FILTER_FLAG_MASK))
+        return false;
+
+    for (int i = 0; i < LH_FILTER_PROBE_MAX; i++) {
+        _Atomic u64 *slot = &g_lh_filter_cache[(h + i) & (LH_FILTER_CACHE_SLOTS - 1)];
+        u64 cur = atomic_load_explicit(slot, memory_order_relaxed);
+
+        if ((cur & ~LH_FILTER_FLAG_MASK) == lock_addr)
+            return cur & LH_FILTER_ON;
+        if (cur && cur != LH_FILTER_TOMBSTONE)
+            continue;
+        if (!decided) {
+            on = decide(lock_addr, caller);
+            v = lock_addr | LH_FILTER_RESOLVED | (on ? LH_FILTER_ON : 0);
+            decided = true;
+        }
+        if (atomic_compare_exchange_strong(slot, &cur, v))
+            return on;
+        if ((cur & ~LH_FILTER_FLAG_MASK) == lock_addr)
+            return cur & LH_FILTER_ON;
+    }
+
+    if (g_has_caller_rules)
+        return false;
+
+    /* 决定只取决于地址：替换一项，被换出的锁下次重新解析得到同样结果 */
+    if (!decided) {
+        on = decide(lock_addr, caller);
+        v = lock_addr | LH_FILTER_RESOLVED | (on ? LH_FILTER_ON : 0);
+    }
+    u32 victim = atomic_fetch_add_explicit(&g_evict_next, 1, memory_order_relaxed);
+    atomic_store_explicit(&g_lh_filter_cache[(h + victim % LH_FILTER_PROBE_MAX) &
+                                             (LH_FILTER_CACHE_SLOTS - 1)],
+                          v, memory_order_relaxed);
+    return on;
+}
+
+void lh_filter_forget(u64 lock_addr)
+{
+    u32 h = lh_filter_slot(lock_addr);
+
+    if (!lock_addr || (lock_addr & LH_FILTER_FLAG_MASK))
+        return;
+
+    for (int i = 0; i < LH_FILTER_PROBE_MAX; i++) {
+        _Atomic u64 *slot = &g_lh_filter_cache[(h + i) & (LH_FILTER_CACHE_SLOTS - 1)];
+        u64 cur = atomic_load_explicit(slot, memory_order_relaxed);
+
+        if (!cur)
+            return;
+        if ((cur & ~LH_FILTER_FLAG_MASK) == lock_addr)
+            atomic_compare_exchange_strong(slot, &cur, LH_FILTER_TOMBSTONE);
+    }
+}
@@ -0,0 +1,59 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * lh_filter.h - 按锁选择是否启用 handoff（LH_INCLUDE / LH_EXCLUDE）
+ *
+ * 规则在每把锁第一次被拦截时解析一次，结果连同锁地址缓存在一个 u64 里
+ * （地址低位存决定），之后 fast path 只读这一位。pthread_mutex_destroy /
+ * pthread_rwlock_destroy 把缓存项换成墓碑，同一地址上新建的锁重新解析。
+ * 没有配置规则时 g_lh_filter 为 false，拦截函数不做任何查找。
+ */
+#ifndef __LH_FILTER_H
+#define __LH_FILTER_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "../common/lh_shared.h"
+
+#define LH_FILTER_CACHE_SLOTS   16384   /* 2 的幂 */
+#define LH_FILTER_PROBE_MAX     16
+#define LH_FILTER_RESOLVED      0x1ULL  /* slot 已解析 */
+#define LH_FILTER_ON            0x2ULL  /* 该锁启用 handoff */
+#define LH_FILTER_TOMBSTONE     LH_FILTER_RESOLVED      /* 锁已销毁，slot 可重用，探测不在此停止 */
+#define LH_FILTER_FLAG_MASK     0x7ULL
+
+extern bool g_lh_filter;
+extern _Atomic u64 g_lh_filter_cache[LH_FILTER_CACHE_SLOTS];
+
+/* 读取 LH_INCLUDE / LH_EXCLUDE，有规则时置 g_lh_filter */
+void lh_filter_init(void);
+
+/* 缓存未命中时匹配规则并写入缓存，caller 为加锁调用点 */
+bool lh_filter_resolve(u64 lock_addr, const void *caller);
+
+/* 锁被销毁：清掉缓存的决定 */
+void lh_filter_forget(u64 lock_addr);
+
+static inline u32 lh_filter_slot(u64 lock_addr)
+{
+    return (u32)((lock_addr >> 3) * 0x9E3779B97F4A7C15ULL >> 40);
+}
+
+/* 该锁是否走 handoff 路径 */
+static inline bool lh_filter_enabled(u64 lock_addr, const void *caller)
+{
+    u32 h = lh_filter_slot(lock_addr);
+
+    for (int i = 0; i < LH_FILTER_PROBE_MAX; i++) {
+        u64 v = atomic_load_explicit(&g_lh_filter_cache[(h + i) & (LH_FILTER_CACHE_SLOTS - 1)],
+                                     memory_order_relaxed);
+
+        if ((v & ~LH_FILTER_FLAG_MASK) == lock_addr && v)
+            return v & LH_FILTER_ON;
+        if (!v)
+            break;
+    }
+    return lh_filter_resolve(lock_addr, caller);
+}
+
+#endif /* __LH_FILTER_H */
@@ -0,0 +1,402 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * lh_order.c - handoff 顺序
+ *
+ * LH_HANDOFF_ORDER 选择 unlock 时把锁交给哪个 waiter：
+ *
+ *   race   不指定，沿用 yield 后谁先 trylock 成功谁拿到（默认）
+ *   fifo   等得最久的 waiter：最公平，尾延迟最可控
+ *   lifo   最近开始等的 waiter：它的数据最可能还在 cache 里，吞吐高
+ *   cpu    与 unlock 者在同一 CPU 上的 waiter（调度器把 waiter 定向到 owner CPU），
+ *          没有时按 fifo
+ *
+ * LH_HANDOFF_AGE_US 是老化上限：任何等待超过它的 waiter 下一个被服务
+ * （有多个时取最老的），不管策略是什么。非 race 策略默认 LH_HANDOFF_AGE_US，
+ * race 默认不老化；设为 0 关闭。
+ *
+ * LH_HANDOFF_COHORT=K 在策略之前加一层 NUMA cohort：unlock 者节点上有 waiter 且
+ * 连续交给该节点不到 K 次时，只在同节点的 waiter 里按策略选（race 按 fifo），
+ * 否则按策略在全部 waiter 里选。老化上限仍然优先。CPU 所在节点由 launcher
+ * 经 LH_CPU_NODES 传入（与调度器同一份），只有一个节点时不启用。
+ *
+ * 队列按锁地址开放寻址，不回收：没有登记 waiter 的队列可以被新的锁接管。
+ * 接管时先把 lock_addr 改成 地址|1（关闭），确认没有 waiter 后才换成新地址；
+ * waiter 认领记录后再核对 lock_addr，核对通过才写 start_us，成为可选的 waiter。
+ * 两边都是 seq_cst，所以被选中（grant 或 native 交接）的记录一定属于当前这把锁。
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "lh_order.h"
+
+bool g_lh_order = false;
+int g_lh_order_policy = LH_ORDER_RACE;
+u32 g_lh_order_age_us = 0;
+u32 g_lh_order_cohort = 0;
+u8 g_lh_cpu_node[LH_CPU_TABLE_SLOTS];
+struct lh_order_queue g_lh_order_queues[LH_ORDER_QUEUES];
+
+/* ========== 配置 ========== */
+static const char *const g_policy_names[] = {
+    [LH_ORDER_RACE] = "race",
+    [LH_ORDER_FIFO] = "fifo",
+    [LH_ORDER_LIFO] = "lifo",
+    [LH_ORDER_CPU]  = "cpu",
+};
+
+/*
+ * LH_CPU_NODES（launcher 从 sysfs 读出后导出，与调度器用的是同一份）：
+ * 按 CPU 号排列的节点号 "0,0,1,1"。填 g_lh_cpu_node，返回出现过的节点数，
+ * 没有这个变量时按单节点处理。
+ */
+static int load_cpu_nodes(void)
+{
+    const char *p = getenv("LH_CPU_NODES");
+    u64 seen[256 / 64] = { 0 };
+    int nr = 0;
+
+    for (int cpu = 0; p && *p && cpu < LH_CPU_TABLE_SLOTS; cpu++) {
+        char *end;
+        unsigned long n = strtoul(p, &end, 10);
+
+        if (end == p || n > 255)
+            break;
+        g_lh_cpu_node[cpu] = (u8)n;
+        if (!(seen[n / 64] & (1ULL << (n % 64)))) {
+            seen[n / 64] |= 1ULL << (n % 64);
+            nr++;
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+    return nr ? nr : 1;
+}
+
+void lh_order_init(bool native)
+{
+    const char *order = getenv("LH_HANDOFF_ORDER");
+    const char *age = getenv("LH_HANDOFF_AGE_US");
+    const char *cohort = getenv("LH_HANDOFF_COHORT");
+
+    if (order && *order) {
+        int i;
+
+        for (i = 0; i < (int)(sizeof(g_policy_names) / sizeof(g_policy_names[0])); i++) {
+            if (strcmp(order, g_policy_names[i]) == 0)
+                break;
+        }
+        if (i < (int)(sizeof(g_policy_names) / sizeof(g_policy_names[0])))
+            g_lh_order_policy = i;
+        else
+            fprintf(stderr, "liblh: ignoring LH_HANDOFF_ORDER '%s'\n", order);
+    }
+    g_lh_order_age_us = g_lh_order_policy != LH_ORDER_RACE ? LH_HANDOFF_AGE_US : 0;
+    if (age && *age)
+        g_lh_order_age_us = (u32)strtoul(age, NULL, 0);
+    if (cohort && *cohort && (g_lh_order_cohort = (u32)strtoul(cohort, NULL, 0)) &&
+        load_cpu_nodes() < 2)
+        g_lh_order_cohort = 0;
+
+    /* native mutex 的 waiter 总要登记，交接时 race 按 fifo（见 lh_order_handoff） */
+    g_lh_order = g_lh_order_policy != LH_ORDER_RACE || g_lh_order_age_us ||
+                 g_lh_order_cohort || native;
+}
+
+/* ========== 队列 ========== */
+static inline u32 queue_idx(u64 lock_addr)
+{
+    return (u32)lh_mix64(lock_addr) & (LH_ORDER_QUEUES - 1);
+}
+
+/* 没有登记的 waiter，可以被别的锁接管 */
+static bool queue_idle(struct lh_order_queue *q)
+{
+    for (int i = 0; i < LH_ORDER_WAITERS; i++) {
+        if (atomic_load(&q->w[i].tid))
+            return false;
+    }
+    return true;
+}
+
+struct lh_order_queue *lh_order_queue_find(u64 lock_addr)
+{
+    u32 h = queue_idx(lock_addr);
+
+    for (int i = 0; i < LH_ORDER_PROBE_MAX; i++) {
+        struct lh_order_queue *q = &g_lh_order_queues[(h + i) & (LH_ORDER_QUEUES - 1)];
+        u64 cur = atomic_load_explicit(&q->lock_addr, memory_order_acquire);
+
+        if (cur == lock_addr)
+            return q;
+        if (!cur)
+            break;
+    }
+    return NULL;
+}
+
+/* 接管空闲队列：关闭 → 确认空闲 → 换地址；仍有 waiter 时恢复原地址 */
+static bool queue_take_over(struct lh_order_queue *q, u64 lock_addr)
+{
+    u64 cur = atomic_load(&q->lock_addr);
+
+    if ((cur & 1) || !atomic_compare_exchange_strong(&q->lock_addr, &cur, cur | 1))
+        return false;
+    if (!queue_idle(q)) {
+        atomic_store(&q->lock_addr, cur);
+        return false;
+    }
+    atomic_store_explicit(&q->grant_tid, 0, memory_order_relaxed);
+    atomic_store(&q->lock_addr, lock_addr);
+    return true;
+}
+
+/* 找到或建立 lock_addr 的队列：先用空位，探测范围内都被占用时接管一个空闲队列 */
+static struct lh_order_queue *queue_get(u64 lock_addr)
+{
+    u32 h = queue_idx(lock_addr);
+    struct lh_order_queue *victim = NULL;
+
+    for (int i = 0; i < LH_ORDER_PROBE_MAX; i++) {
+        struct lh_order_queue *q = &g_lh_order_queues[(h + i) & (LH_ORDER_QUEUES - 1)];
+        u64 cur = atomic_load_explicit(&q->lock_addr, memory_order_acquire);
+
+        if (!cur && atomic_compare_exchange_strong(&q->lock_addr, &cur, lock_addr))
+            return q;
+        if (cur == lock_addr)
+            return q;
+        if (!victim && queue_idle(q))
+            victim = q;
+    }
+    return victim && queue_take_over(victim, lock_addr) ? victim : NULL;
+}
+
+/* ========== waiter ========== */
+void lh_order_join(struct lh_order_ticket *tk, u64 lock_addr, u32 tid, s32 cpu, u64 start_ns)
+{
+    struct lh_order_queue *q = queue_get(lock_addr);
+
+    tk->q = NULL;
+    if (!q)
+        return;
+
+    for (int i = 0; i < LH_ORDER_WAITERS; i++) {
+        struct lh_order_waiter *w = &q->w[i];
+        u32 cur = 0;
+
+        if (!atomic_compare_exchange_strong(&w->tid, &cur, tid))
+            continue;
+        /* 认领之后核对：队列在此期间被别的锁接管（或正在接管）就放弃 */
+        if (atomic_load(&q->lock_addr) != lock_addr) {
+            atomic_store(&w->tid, 0);
+            return;
+        }
+        w->cpu = (s16)cpu;
+        w->node = lh_order_cpu_node(cpu);
+        atomic_store_explicit(&w->state, LH_ORDER_WAITING, memory_order_relaxed);
+        atomic_store_explicit(&w->start_us, lh_order_us(start_ns) | 1, memory_order_release);
+        tk->q = q;
+        tk->idx = i;
+        return;
+    }
+}
+
+/* 只在自己拿到锁之后或非 native 锁上调用，此时不会有人再把锁交给这个记录 */
+void lh_order_leave(struct lh_order_ticket *tk, u32 tid)
+{
+    struct lh_order_queue *q = tk->q;
+    u32 g = tid;
+
+    if (!q)
+        return;
+    atomic_store_explicit(&q->w[tk->idx].start_us, 0, memory_order_relaxed);
+    atomic_store_explicit(&q->w[tk->idx].tid, 0, memory_order_release);
+    atomic_compare_exchange_strong(&q->grant_tid, &g, 0);
+    tk->q = NULL;
+}
+
+/* ========== 选择下一个 owner ========== */
+
+/* 一次扫描得到的各策略候选（下标，-1 = 没有） */
+struct order_pick {
+    int oldest, newest, same_cpu;
+    u32 oldest_age, newest_age, same_cpu_age;
+};
+
+/*
+ * 扫描 state 为 WAITING/PARKED 的记录，skip 为已经失败的记录位图；
+ * node >= 0 时只看该节点上（remote 时只看其它节点上）的 waiter
+ */
+static void scan_waiters(struct lh_order_queue *q, u32 tid, s32 cpu, int node, bool remote,
+                         u32 now_us, u32 skip, struct order_pick *pk)
+{
+    pk->oldest = pk->newest = pk->same_cpu = -1;
+    pk->oldest_age = pk->same_cpu_age = 0;
+    pk->newest_age = UINT32_MAX;
+
+    for (int i = 0; i < LH_ORDER_WAITERS; i++) {
+        struct lh_order_waiter *w = &q->w[i];
+        u32 t = atomic_load_explicit(&w->tid, memory_order_acquire);
+        u32 start = atomic_load_explicit(&w->start_us, memory_order_acquire);
+        u32 age;
+
+        if (!t || t == tid || !start || (skip & (1u << i)) ||
+            (node >= 0 && (w->node == node) == remote) ||
+            atomic_load_explicit(&w->state, memory_order_relaxed) == LH_ORDER_HANDED)
+            continue;
+        age = now_us - start;
+        if (pk->oldest < 0 || age > pk->oldest_age) {
+            pk->oldest = i;
+            pk->oldest_age = age;
+        }
+        if (pk->newest < 0 || age < pk->newest_age) {
+            pk->newest = i;
+            pk->newest_age = age;
+        }
+        if (w->cpu == cpu && cpu >= 0 && (pk->same_cpu < 0 || age > pk->same_cpu_age)) {
+            pk->same_cpu = i;
+            pk->same_cpu_age = age;
+        }
+    }
+}
+
+static int pick_policy(const struct order_pick *pk, int policy)
+{
+    switch (policy) {
+    case LH_ORDER_FIFO:
+        return pk->oldest;
+    case LH_ORDER_LIFO:
+        return pk->newest;
+    case LH_ORDER_CPU:
+        return pk->same_cpu >= 0 ? pk->same_cpu : pk->oldest;
+    default:
+        return -1;
+    }
+}
+
+/*
+ * 按老化上限、cohort、策略依次选一个；-1 = 没有。
+ * cohort：本节点连续交接不到 K 次时先在本节点里选，到 K 次后先在其它节点里选，
+ * 这两种情况下 race 按 fifo（cohort 本身就是一种指定）。
+ */
+static int pick_next(struct lh_order_queue *q, int policy, u32 tid, s32 cpu, u32 now_us, u32 skip)
+{
+    struct order_pick all, cohort;
+    int node = lh_order_cpu_node(cpu);
+
+    scan_waiters(q, tid, cpu, -1, false, now_us, skip, &all);
+    if (g_lh_order_age_us && all.oldest >= 0 && all.oldest_age >= g_lh_order_age_us)
+        return all.oldest;
+
+    if (g_lh_order_cohort && cpu >= 0) {
+        bool exhausted = q->cohort_node == node && q->cohort_run >= g_lh_order_cohort;
+
+        scan_waiters(q, tid, cpu, node, exhausted, now_us, skip, &cohort);
+        if (cohort.oldest >= 0)
+            return pick_policy(&cohort, policy != LH_ORDER_RACE ? policy : LH_ORDER_FIFO);
+    }
+    return pick_policy(&all, policy);
+}
+
+/* 记录交接去向：连续交给同一节点的次数（持锁者调用，不需要原子操作） */
+static void cohort_note(struct lh_order_queue *q, int next)
+{
+    u16 node = q->w[next].node;
+
+    if (!g_lh_order_cohort)
+        return;
+    q->cohort_run = q->cohort_node == node ? q->cohort_run + 1 : 1;
+    q->cohort_node = node;
+}
+
+void lh_order_grant(u64 lock_addr, u32 tid, s32 cpu, u64 now_ns)
+{
+    struct lh_order_queue *q = lh_order_queue_find(lock_addr);
+    u32 now_us = lh_order_us(now_ns);
+    int next;
+
+    if (!q)
+        return;
+
+    next = pick_next(q, g_lh_order_policy, tid, cpu, now_us, 0);
+    if (next >= 0)
+        cohort_note(q, next);
+    atomic_store_explicit(&q->grant_us, now_us, memory_order_relaxed);
+    atomic_store_explicit(&q->grant_tid, next >= 0 ? atomic_load(&q->w[next].tid) : 0,
+                          memory_order_release);
+}
+
+/* ========== native mutex 交接 ========== */
+static long futex(_Atomic u32 *uaddr, int op, u32 val, const struct timespec *ts)
+{
+    return syscall(SYS_futex, uaddr, op | FUTEX_PRIVATE_FLAG, val, ts, NULL, 0);
+}
+
+bool lh_order_handoff(u64 lock_addr, u32 tid, s32 cpu, u64 now_ns)
+{
+    struct lh_order_queue *q = lh_order_queue_find(lock_addr);
+    u32 now_us = lh_order_us(now_ns);
+    int policy = g_lh_order_policy != LH_ORDER_RACE ? g_lh_order_policy : LH_ORDER_FIFO;
+    u32 skip = 0;
+
+    if (!q)
+        return false;
+
+    for (int n = 0; n < LH_ORDER_WAITERS; n++) {
+        int i = pick_next(q, policy, tid, cpu, now_us, skip);
+        _Atomic u32 *state;
+        u32 s;
+
+        if (i < 0)
+            return false;
+        state = &q->w[i].state;
+        s = atomic_load(state);
+        /* release：临界区的写对新 owner 可见 */
+        if (s != LH_ORDER_HANDED && atomic_compare_exchange_strong(state, &s, LH_ORDER_HANDED)) {
+            cohort_note(q, i);
+            if (s == LH_ORDER_PARKED)
+                futex(state, FUTEX_WAKE, 1, NULL);
+            return true;
+        }
+        skip |= 1u << i;
+    }
+    return false;
+}
+
+void lh_order_wake_parked(u64 lock_addr)
+{
+    struct lh_order_queue *q = lh_order_queue_find(lock_addr);
+
+    for (int i = 0; q && i < LH_ORDER_WAITERS; i++) {
+        if (atomic_load(&q->w[i].state) == LH_ORDER_PARKED)
+            futex(&q->w[i].state, FUTEX_WAKE, 1, NULL);
+    }
+}
+
+bool lh_order_park_prepare(struct lh_order_ticket *tk)
+{
+    u32 s = LH_ORDER_WAITING;
+
+    return !atomic_compare_exchange_strong(lh_order_state(tk), &s, LH_ORDER_PARKED) &&
+           s == LH_ORDER_HANDED;
+}
+
+bool lh_order_unpark(struct lh_order_ticket *tk)
+{
+    u32 s = LH_ORDER_PARKED;
+
+    return !atomic_compare_exchange_strong(lh_order_state(tk), &s, LH_ORDER_WAITING) &&
+           s == LH_ORDER_HANDED;
+}
+
+bool lh_order_park(struct lh_order_ticket *tk, u32 timeout_us)
+{
+    struct timespec ts = { timeout_us / 1000000, (timeout_us % 1000000) * 1000 };
+
+    futex(lh_order_state(tk), FUTEX_WAIT, LH_ORDER_PARKED, &ts);
+    return lh_order_unpark(tk);
+}
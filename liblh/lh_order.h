@@ -0,0 +1,148 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * lh_order.h - handoff 顺序（LH_HANDOFF_ORDER / LH_HANDOFF_AGE_US）
+ *
+ * 每把正在被等待的锁在进程内有一个队列，waiter 开始等待时登记（tid、CPU、
+ * 开始时间）。unlock 者在真实 unlock 之前按顺序策略选出下一个 owner 写入
+ * grant_tid；其它 waiter 和新来的加锁者看到锁已指定给别人时不 trylock，
+ * 直到被指定者拿到锁或超过 LH_HANDOFF_GRANT_US。
+ * 只影响谁去 trylock，互斥仍由真实锁保证；队列满或被复用时退化为 RACE。
+ *
+ * LH_HANDOFF_COHORT=K（多 NUMA 节点时生效）：最多连续 K 次把锁交给与 unlock 者
+ * 同节点的 waiter，之后才按策略跨节点交接，锁保护的数据留在一个节点的 cache 里。
+ *
+ * native mutex（LH_NATIVE_MUTEX，见 liblh.c）不用 grant：锁字由 liblh 维护，
+ * unlock 者把 waiter 记录的 state 从 WAITING/PARKED 改为 HANDED，锁字保持
+ * 加锁状态，所有权直接转给该 waiter，第三个线程没有机会插队。
+ */
+#ifndef __LH_ORDER_H
+#define __LH_ORDER_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "../common/lh_shared.h"
+
+#define LH_ORDER_QUEUES         256     /* 2 的幂 */
+#define LH_ORDER_PROBE_MAX      4
+#define LH_ORDER_WAITERS        6       /* 每把锁登记的 waiter 数，多出的不参与排序 */
+
+/* lh_order_waiter.state */
+#define LH_ORDER_WAITING        0
+#define LH_ORDER_PARKED         1       /* 在 state 上 futex 等待，交接时需要唤醒 */
+#define LH_ORDER_HANDED         2       /* native mutex 已直接交给该 waiter */
+
+struct lh_order_waiter {
+    _Atomic u32 tid;                    /* 0 = 空 */
+    s16 cpu;                            /* 最近一次 trylock 时所在 CPU */
+    u16 node;                           /* cpu 所在 NUMA 节点 */
+    _Atomic u32 start_us;               /* 开始等待（微秒低 32 位），0 = 登记中，不可选 */
+    _Atomic u32 state;                  /* LH_ORDER_WAITING / PARKED / HANDED */
+};
+
+/*
+ * 两条 cacheline。lock_addr 从不清零：从 0 变为某把锁，或在队列空闲时被新锁接管
+ * （先改成 地址|1 关闭，确认没有 waiter 后再换成新地址，见 lh_order.c）。
+ */
+struct lh_order_queue {
+    _Atomic u64 lock_addr;
+    _Atomic u32 grant_tid;              /* 指定的下一个 owner，0 = 不指定 */
+    _Atomic u32 grant_us;               /* 指定时间 */
+    struct lh_order_waiter w[LH_ORDER_WAITERS];
+    u16 cohort_node;                    /* 最近一次交接给了哪个节点（只由持锁者写） */
+    u16 cohort_run;                     /* 连续交给该节点的次数 */
+    u8 pad[2 * CACHELINE_SIZE - 20 - LH_ORDER_WAITERS * sizeof(struct lh_order_waiter)];
+} __attribute__((aligned(2 * CACHELINE_SIZE)));
+
+_Static_assert(sizeof(struct lh_order_queue) == 2 * CACHELINE_SIZE, "order queue must fit two cachelines");
+
+/* 一个 waiter 在队列中的位置，q == NULL 表示没登记上 */
+struct lh_order_ticket {
+    struct lh_order_queue *q;
+    int idx;
+};
+
+extern bool g_lh_order;             /* 启用了顺序或老化，false 时下面的函数都不调用 */
+extern int g_lh_order_policy;       /* LH_ORDER_* */
+extern u32 g_lh_order_age_us;       /* 0 = 不老化 */
+extern u32 g_lh_order_cohort;       /* 连续同节点交接上限，0 = 不分节点 */
+extern u8 g_lh_cpu_node[LH_CPU_TABLE_SLOTS];  /* CPU → NUMA 节点（LH_CPU_NODES） */
+extern struct lh_order_queue g_lh_order_queues[LH_ORDER_QUEUES];
+
+/* 读取 LH_HANDOFF_ORDER / LH_HANDOFF_AGE_US / LH_HANDOFF_COHORT，启用时置 g_lh_order（native mutex 总要登记 waiter） */
+void lh_order_init(bool native);
+
+/* trylock 失败后登记为 lock_addr 的 waiter */
+void lh_order_join(struct lh_order_ticket *tk, u64 lock_addr, u32 tid, s32 cpu, u64 start_ns);
+
+/* 拿到锁或回退到阻塞加锁时注销，消费掉指定给自己的 grant */
+void lh_order_leave(struct lh_order_ticket *tk, u32 tid);
+
+/* 真实 unlock 之前调用：按策略选出下一个 owner（没有合适的 waiter 时清除指定） */
+void lh_order_grant(u64 lock_addr, u32 tid, s32 cpu, u64 now_ns);
+
+/* 按锁地址找队列，没有时返回 NULL */
+struct lh_order_queue *lh_order_queue_find(u64 lock_addr);
+
+/* native mutex unlock：把锁直接交给按策略选出的 waiter，没有可交的返回 false */
+bool lh_order_handoff(u64 lock_addr, u32 tid, s32 cpu, u64 now_ns);
+
+/* native mutex 真正释放后唤醒 park 的 waiter 重新竞争 */
+void lh_order_wake_parked(u64 lock_addr);
+
+/*
+ * park 分三步，保证不丢唤醒：先把 state 置为 PARKED（返回 true 表示已经交给自己），
+ * 调用者再检查锁字（空闲就自己拿，之后 unpark），锁仍被持有才 lh_order_park 睡眠。
+ * unlock 者先改锁字再看 state，两边至少有一方看到对方的写。
+ */
+bool lh_order_park_prepare(struct lh_order_ticket *tk);
+
+/* 在 state 上等待交接或超时，回到 WAITING；返回 true 表示锁已交给自己 */
+bool lh_order_park(struct lh_order_ticket *tk, u32 timeout_us);
+
+/* 不睡眠，回到 WAITING；返回 true 表示锁已交给自己 */
+bool lh_order_unpark(struct lh_order_ticket *tk);
+
+static inline _Atomic u32 *lh_order_state(struct lh_order_ticket *tk)
+{
+    return &tk->q->w[tk->idx].state;
+}
+
+/* native mutex 的所有权已交给该 waiter */
+static inline bool lh_order_handed(struct lh_order_ticket *tk)
+{
+    return atomic_load_explicit(lh_order_state(tk), memory_order_acquire) == LH_ORDER_HANDED;
+}
+
+static inline u16 lh_order_cpu_node(s32 cpu)
+{
+    return cpu >= 0 && cpu < LH_CPU_TABLE_SLOTS ? g_lh_cpu_node[cpu] : 0;
+}
+
+static inline u32 lh_order_us(u64 ns)
+{
+    return (u32)(ns / 1000);
+}
+
+/* 锁已指定给 tid 以外的线程且指定还没过期 */
+static inline bool lh_order_granted_other(struct lh_order_queue *q, u32 tid, u64 now_ns)
+{
+    u32 g = atomic_load_explicit(&q->grant_tid, memory_order_acquire);
+
+    if (!g || g == tid)
+        return false;
+    return lh_order_us(now_ns) - atomic_load_explicit(&q->grant_us, memory_order_relaxed) <
+           LH_HANDOFF_GRANT_US;
+}
+
+/* 已登记的 waiter 现在可以 trylock（顺带更新所在 CPU 和节点） */
+static inline bool lh_order_may_try(struct lh_order_ticket *tk, u32 tid, s32 cpu, u64 now_ns)
+{
+    struct lh_order_waiter *w = &tk->q->w[tk->idx];
+
+    w->cpu = (s16)cpu;
+    w->node = lh_order_cpu_node(cpu);
+    return !lh_order_granted_other(tk->q, tid, now_ns);
+}
+
+#endif /* __LH_ORDER_H */
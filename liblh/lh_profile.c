@@ -0,0 +1,393 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * lh_profile.c - 锁竞争 / 加锁顺序 profiler
+ *
+ * LH_PROFILE=1 开启，统计每把锁的：
+ * - 获取次数、竞争次数（trylock 失败）、累计/最大等待时间、累计持有时间
+ * - 竞争最多的加锁调用点（返回地址，输出为 "模块+偏移"，用 addr2line 离线符号化）
+ * 以及观察到的加锁顺序对 (A 持有时获取 B)，A→B 与 B→A 都出现时标记为顺序冲突。
+ *
+ * 退出时按累计等待时间排序输出到 stderr 或 LH_PROFILE_OUT 指定的文件，
+ * LH_PROFILE_TOP 控制输出条数（默认 20）。
+ *
+ * 表都是固定大小、开放寻址、CAS 占位，不分配内存也不加锁，
+ * 因为这里本身就运行在被拦截的 pthread 函数里。表满后新锁不再统计。
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include "lh_profile.h"
+
+/* ========== 配置常量 ========== */
+#define PROF_LOCK_SLOTS     16384   /* 2 的幂 */
+#define PROF_PAIR_SLOTS     16384   /* 2 的幂 */
+#define PROF_CALLSITES      4       /* 每把锁记录的竞争调用点数 */
+#define PROF_HELD_MAX       16      /* 每线程跟踪的嵌套深度 */
+#define PROF_PROBE_MAX      64
+#define PROF_TOP_DEFAULT    20
+
+/* ========== 数据结构 ========== */
+struct prof_callsite {
+    _Atomic(const void *) pc;
+    _Atomic u64 count;
+};
+
+struct prof_lock {
+    _Atomic u64 addr;               /* 0 = 空 */
+    _Atomic u64 acquisitions;
+    _Atomic u64 contended;
+    _Atomic u64 wait_ns;
+    _Atomic u64 max_wait_ns;
+    _Atomic u64 hold_ns;
+    struct prof_callsite sites[PROF_CALLSITES];
+};
+
+struct prof_pair {
+    _Atomic u64 first;              /* 0 = 空 */
+    _Atomic u64 second;
+    _Atomic u64 count;
+};
+
+struct prof_held {
+    u64 addr;
+    u64 t_acquire_ns;
+};
+
+bool g_lh_profile = false;
+
+static struct prof_lock *g_locks;
+static struct prof_pair *g_pairs;
+static _Atomic u64 g_dropped;
+static atomic_bool g_reported;
+static const char *g_out_path;
+static int g_top = PROF_TOP_DEFAULT;
+
+static __thread struct prof_held tls_held[PROF_HELD_MAX];
+static __thread int tls_nr_held;        /* tls_held[] 有效个数 */
+static __thread int tls_nr_untracked;   /* 超出跟踪深度、仍持有的锁 */
+
+/* ========== 辅助函数 ========== */
+static inline u64 prof_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline u64 prof_hash(u64 x)
+{
+    return lh_mix64(x);
+}
+
+/* 锁常按固定步长排列（数组），线性组合会让不同的 pair 得到同一个 key */
+static inline u64 prof_pair_hash(u64 first, u64 second)
+{
+    return prof_hash(first ^ prof_hash(second));
+}
+
+static inline void atomic_max(_Atomic u64 *p, u64 v)
+{
+    u64 cur = atomic_load_explicit(p, memory_order_relaxed);
+    while (v > cur &&
+           !atomic_compare_exchange_weak_explicit(p, &cur, v, memory_order_relaxed,
+                                                  memory_order_relaxed))
+        ;
+}
+
+/* 查找或占用 lock 的 slot */
+static struct prof_lock *prof_lock_get(u64 addr)
+{
+    u64 h = prof_hash(addr);
+
+    for (int i = 0; i < PROF_PROBE_MAX; i++) {
+        struct prof_lock *l = &g_locks[(h + i) & (PROF_LOCK_SLOTS - 1)];
+        u64 cur = atomic_load_explicit(&l->addr, memory_order_acquire);
+
+        if (cur == addr)
+            return l;
+        if (cur == 0) {
+            if (atomic_compare_exchange_strong(&l->addr, &cur, addr) || cur == addr)
+                return l;
+        }
+    }
+    atomic_fetch_add_explicit(&g_dropped, 1, memory_order_relaxed);
+    return NULL;
+}
+
+static void prof_pair_record(u64 first, u64 second)
+{
+    u64 h = prof_pair_hash(first, second);
+
+    for (int i = 0; i < PROF_PROBE_MAX; i++) {
+        struct prof_pair *p = &g_pairs[(h + i) & (PROF_PAIR_SLOTS - 1)];
+        u64 cur = atomic_load_explicit(&p->first, memory_order_acquire);
+
+        if (cur == 0) {
+            if (atomic_compare_exchange_strong(&p->first, &cur, first)) {
+                atomic_store_explicit(&p->second, second, memory_order_release);
+                atomic_fetch_add_explicit(&p->count, 1, memory_order_relaxed);
+                return;
+            }
+        }
+        /* second 可能刚被占位者写入，读到 0 时视为不匹配继续探测 */
+        if (cur == first &&
+            atomic_load_explicit(&p->second, memory_order_acquire) == second) {
+            atomic_fetch_add_explicit(&p->count, 1, memory_order_relaxed);
+            return;
+        }
+    }
+    atomic_fetch_add_explicit(&g_dropped, 1, memory_order_relaxed);
+}
+
+static void prof_callsite_record(struct prof_lock *l, const void *pc)
+{
+    for (int i = 0; i < PROF_CALLSITES; i++) {
+        struct prof_callsite *s = &l->sites[i];
+        const void *cur = atomic_load_explicit(&s->pc, memory_order_acquire);
+
+        if (cur == NULL &&
+            !atomic_compare_exchange_strong(&s->pc, &cur, pc) && cur != pc)
+            continue;
+        if (cur == NULL || cur == pc) {
+            atomic_fetch_add_explicit(&s->count, 1, memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+/* ========== 钩子 ========== */
+void lh_profile_acquired(u64 lock_addr, const void *callsite, u64 wait_ns)
+{
+    struct prof_lock *l = prof_lock_get(lock_addr);
+
+    if (l) {
+        atomic_fetch_add_explicit(&l->acquisitions, 1, memory_order_relaxed);
+        if (wait_ns) {
+            atomic_fetch_add_explicit(&l->contended, 1, memory_order_relaxed);
+            atomic_fetch_add_explicit(&l->wait_ns, wait_ns, memory_order_relaxed);
+            atomic_max(&l->max_wait_ns, wait_ns);
+            prof_callsite_record(l, callsite);
+        }
+    }
+
+    /* 加锁顺序：已持有的每把锁 → 这把锁 */
+    for (int i = 0; i < tls_nr_held; i++) {
+        if (tls_held[i].addr != lock_addr)
+            prof_pair_record(tls_held[i].addr, lock_addr);
+    }
+
+    if (tls_nr_held < PROF_HELD_MAX) {
+        tls_held[tls_nr_held].addr = lock_addr;
+        tls_held[tls_nr_held].t_acquire_ns = prof_now_ns();
+        tls_nr_held++;
+    } else {
+        tls_nr_untracked++;
+    }
+}
+
+void lh_profile_released(u64 lock_addr)
+{
+    int n = tls_nr_held;
+
+    for (int i = n - 1; i >= 0; i--) {
+        if (tls_held[i].addr != lock_addr)
+            continue;
+
+        struct prof_lock *l = prof_lock_get(lock_addr);
+        if (l)
+            atomic_fetch_add_explicit(&l->hold_ns, prof_now_ns() - tls_held[i].t_acquire_ns,
+                                      memory_order_relaxed);
+        memmove(&tls_held[i], &tls_held[i + 1], (n - i - 1) * sizeof(tls_held[0]));
+        tls_nr_held--;
+        return;
+    }
+
+    /* 超出跟踪深度的锁：只调整计数 */
+    if (tls_nr_untracked)
+        tls_nr_untracked--;
+}
+
+/* ========== 报告 ========== */
+
+/* 输出 "模块+0x偏移 (符号)"，offset 可直接交给 addr2line -e 模块 */
+static void print_callsite(FILE *f, const void *pc)
+{
+    Dl_info info;
+
+    if (pc && dladdr(pc, &info) && info.dli_fname) {
+        fprintf(f, "%s+0x%lx", info.dli_fname,
+                (unsigned long)((uintptr_t)pc - (uintptr_t)info.dli_fbase));
+        if (info.dli_sname)
+            fprintf(f, " (%s)", info.dli_sname);
+    } else {
+        fprintf(f, "%p", pc);
+    }
+}
+
+static int cmp_lock_wait(const void *a, const void *b)
+{
+    const struct prof_lock *x = *(const struct prof_lock *const *)a;
+    const struct prof_lock *y = *(const struct prof_lock *const *)b;
+    u64 wx = atomic_load(&x->wait_ns), wy = atomic_load(&y->wait_ns);
+    u64 ax = atomic_load(&x->acquisitions), ay = atomic_load(&y->acquisitions);
+    u64 lx = atomic_load(&x->addr), ly = atomic_load(&y->addr);
+
+    /* 最后按锁地址，只有同一个元素比较时才返回 0（qsort 要求全序） */
+    if (wx != wy)
+        return wx < wy ? 1 : -1;
+    if (ax != ay)
+        return ax < ay ? 1 : -1;
+    return lx == ly ? 0 : (lx < ly ? -1 : 1);
+}
+
+static int cmp_pair_count(const void *a, const void *b)
+{
+    const struct prof_pair *x = *(const struct prof_pair *const *)a;
+    const struct prof_pair *y = *(const struct prof_pair *const *)b;
+    u64 cx = atomic_load(&x->count), cy = atomic_load(&y->count);
+
+    return cx == cy ? 0 : (cx < cy ? 1 : -1);
+}
+
+static bool pair_seen(u64 first, u64 second)
+{
+    u64 h = prof_pair_hash(first, second);
+
+    for (int i = 0; i < PROF_PROBE_MAX; i++) {
+        struct prof_pair *p = &g_pairs[(h + i) & (PROF_PAIR_SLOTS - 1)];
+        u64 cur = atomic_load(&p->first);
+
+        if (cur == 0)
+            return false;
+        if (cur == first && atomic_load(&p->second) == second)
+            return true;
+    }
+    return false;
+}
+
+static void report_locks(FILE *f)
+{
+    static struct prof_lock *sorted[PROF_LOCK_SLOTS];
+    int n = 0;
+
+    for (int i = 0; i < PROF_LOCK_SLOTS; i++) {
+        if (atomic_load(&g_locks[i].addr) && atomic_load(&g_locks[i].acquisitions))
+            sorted[n++] = &g_locks[i];
+    }
+    qsort(sorted, n, sizeof(sorted[0]), cmp_lock_wait);
+
+    fprintf(f, "%d locks seen, top %d by total wait:\n\n", n, n < g_top ? n : g_top);
+    fprintf(f, "%-18s %12s %10s %7s %12s %10s %10s %12s\n",
+            "lock", "acquired", "contended", "cont%", "wait_ms", "avg_us", "max_us", "hold_ms");
+
+    for (int i = 0; i < n && i < g_top; i++) {
+        struct prof_lock *l = sorted[i];
+        u64 acq = atomic_load(&l->acquisitions);
+        u64 cont = atomic_load(&l->contended);
+        u64 wait = atomic_load(&l->wait_ns);
+
+        fprintf(f, "0x%016lx %12lu %10lu %6.1f%% %12.3f %10.2f %10.2f %12.3f\n",
+                (unsigned long)atomic_load(&l->addr), acq, cont,
+                acq ? 100.0 * cont / acq : 0.0,
+                wait / 1e6, cont ? wait / 1e3 / cont : 0.0,
+                atomic_load(&l->max_wait_ns) / 1e3,
+                atomic_load(&l->hold_ns) / 1e6);
+
+        for (int j = 0; j < PROF_CALLSITES; j++) {
+            const void *pc = atomic_load(&l->sites[j].pc);
+            if (!pc)
+                break;
+            fprintf(f, "    %10lu  ", atomic_load(&l->sites[j].count));
+            print_callsite(f, pc);
+            fprintf(f, "\n");
+        }
+    }
+}
+
+static void report_pairs(FILE *f)
+{
+    static struct prof_pair *sorted[PROF_PAIR_SLOTS];
+    int n = 0, inversions = 0;
+
+    for (int i = 0; i < PROF_PAIR_SLOTS; i++) {
+        if (atomic_load(&g_pairs[i].first) && atomic_load(&g_pairs[i].count))
+            sorted[n++] = &g_pairs[i];
+    }
+    qsort(sorted, n, sizeof(sorted[0]), cmp_pair_count);
+
+    fprintf(f, "\n%d lock-order pairs (held -> acquired):\n", n);
+    for (int i = 0; i < n; i++) {
+        struct prof_pair *p = sorted[i];
+        u64 a = atomic_load(&p->first), b = atomic_load(&p->second);
+        bool inverted = pair_seen(b, a);
+
+        if (inverted)
+            inversions++;
+        if (i < g_top || inverted)
+            fprintf(f, "  0x%016lx -> 0x%016lx %10lu%s\n", (unsigned long)a,
+                    (unsigned long)b, atomic_load(&p->count),
+                    inverted ? "  ORDER INVERSION" : "");
+    }
+    if (inversions)
+        fprintf(f, "%d pairs also seen in reverse order (potential deadlock)\n", inversions);
+}
+
+void lh_profile_report(void)
+{
+    FILE *f = stderr;
+
+    if (!g_lh_profile || atomic_exchange(&g_reported, true))
+        return;
+
+    /* 报告期间不再统计（dladdr / stdio 内部可能加锁） */
+    g_lh_profile = false;
+
+    if (g_out_path) {
+        f = fopen(g_out_path, "w");
+        if (!f)
+            f = stderr;
+    }
+
+    fprintf(f, "=== liblh lock profile (pid %d) ===\n", getpid());
+    report_locks(f);
+    report_pairs(f);
+    if (atomic_load(&g_dropped))
+        fprintf(f, "\n%lu events dropped (profile tables full)\n",
+                (unsigned long)atomic_load(&g_dropped));
+
+    if (f != stderr)
+        fclose(f);
+}
+
+static void profile_atexit(void)
+{
+    lh_profile_report();
+}
+
+void lh_profile_init(void)
+{
+    const char *s = getenv("LH_PROFILE");
+
+    if (!s || strcmp(s, "0") == 0)
+        return;
+
+    g_locks = calloc(PROF_LOCK_SLOTS, sizeof(*g_locks));
+    g_pairs = calloc(PROF_PAIR_SLOTS, sizeof(*g_pairs));
+    if (!g_locks || !g_pairs)
+        return;
+
+    g_out_path = getenv("LH_PROFILE_OUT");
+    s = getenv("LH_PROFILE_TOP");
+    if (s && atoi(s) > 0)
+        g_top = atoi(s);
+
+    atexit(profile_atexit);
+    g_lh_profile = true;
+}
@@ -0,0 +1,29 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * lh_profile.h - 锁竞争 / 加锁顺序 profiler（LH_PROFILE=1）
+ *
+ * 由 liblh.c 的拦截点调用，进程退出时输出按等待时间排序的报告。
+ * 未开启时每个钩子只是一次分支。
+ */
+#ifndef __LH_PROFILE_H
+#define __LH_PROFILE_H
+
+#include <stdbool.h>
+
+#include "../common/lh_shared.h"
+
+extern bool g_lh_profile;
+
+/* 读取 LH_PROFILE / LH_PROFILE_OUT / LH_PROFILE_TOP，开启时注册退出报告 */
+void lh_profile_init(void);
+
+/* 获取成功后调用：wait_ns 为 trylock 失败到拿到锁的时间（0 = 无竞争） */
+void lh_profile_acquired(u64 lock_addr, const void *callsite, u64 wait_ns);
+
+/* 释放前调用 */
+void lh_profile_released(u64 lock_addr);
+
+/* 立即输出报告（退出时自动调用） */
+void lh_profile_report(void);
+
+#endif /* __LH_PROFILE_H */
@@ -0,0 +1,251 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * lh_spinlock.h - 与调度器协作的用户态 spinlock
+ *
+ * 三种锁：lh_spinlock_t（test-and-test-and-set）、lh_ticket_t（FIFO）、
+ * lh_mcs_t（队列锁，每个 waiter 自旋在自己的 node 上）。
+ *
+ * 持锁者把自己的 tid / CPU 写进锁里并标记 IN_CS；waiter 每
+ * LH_SPIN_CHECK_INTERVAL 次 pause 查一次 cpu_table（lh_owner_running），
+ * owner 一旦不在 CPU 上就停止空转，带 waiter hint（定向 owner CPU）sched_yield。
+ * 没有 liblh / 调度器时无法判断 owner 状态，spin LH_SPIN_MAX 次后同样 yield。
+ *
+ * ticket / MCS 交接时新 owner 尚未写入 tid（可能还没被调度上来），
+ * 这段时间只 spin LH_SPIN_HANDOFF_MAX 次。
+ */
+#ifndef __LH_SPINLOCK_H
+#define __LH_SPINLOCK_H
+
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "liblh.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LH_SPIN_CHECK_INTERVAL  16          /* 每多少次 pause 检查一次 owner */
+#define LH_SPIN_MAX             (1 << 14)   /* 无法判断 owner 时的 spin 上限 */
+#define LH_SPIN_HANDOFF_MAX     256         /* owner 尚未发布（交接中）时的 spin 上限 */
+
+/* 持锁者信息：持锁者写，waiter 读 */
+struct lh_lock_owner {
+    unsigned int tid;       /* 0 = 未知 */
+    int cpu;
+};
+
+#define LH_LOCK_OWNER_INIT  { 0, -1 }
+
+/* ========== 内部辅助 ========== */
+static __thread unsigned int __lh_tid_cache;
+
+static inline unsigned int __lh_tid(void)
+{
+    if (__builtin_expect(!__lh_tid_cache, 0))
+        __lh_tid_cache = (unsigned int)syscall(SYS_gettid);
+    return __lh_tid_cache;
+}
+
+static inline void __lh_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __asm__ volatile("pause" ::: "memory");
+#elif defined(__aarch64__)
+    __asm__ volatile("yield" ::: "memory");
+#else
+    __asm__ volatile("" ::: "memory");
+#endif
+}
+
+static inline void __lh_owner_publish(struct lh_lock_owner *o)
+{
+    __atomic_store_n(&o->cpu, lh_current_cpu(), __ATOMIC_RELAXED);
+    __atomic_store_n(&o->tid, __lh_tid(), __ATOMIC_RELAXED);
+}
+
+static inline void __lh_owner_clear(struct lh_lock_owner *o)
+{
+    __atomic_store_n(&o->tid, 0, __ATOMIC_RELAXED);
+}
+
+/* 等待一轮：owner 在运行就 pause，否则带 hint yield */
+static inline void __lh_spin_wait(const void *lock, struct lh_lock_owner *o,
+                                  unsigned int *spins)
+{
+    unsigned int n = ++*spins;
+
+    if (n % LH_SPIN_CHECK_INTERVAL == 0) {
+        unsigned int tid = __atomic_load_n(&o->tid, __ATOMIC_RELAXED);
+        int cpu = __atomic_load_n(&o->cpu, __ATOMIC_RELAXED);
+
+        if (!lh_owner_running(tid, cpu) || n >= LH_SPIN_MAX ||
+            (!tid && n >= LH_SPIN_HANDOFF_MAX)) {
+            lh_wait_begin_cpu(lock, tid ? cpu : -1);
+            sched_yield();
+            lh_wait_end();
+            *spins = 0;
+            return;
+        }
+    }
+    __lh_cpu_relax();
+}
+
+static inline void __lh_acquired(struct lh_lock_owner *o)
+{
+    __lh_owner_publish(o);
+    lh_cs_enter();
+}
+
+static inline void __lh_releasing(struct lh_lock_owner *o)
+{
+    __lh_owner_clear(o);
+    lh_cs_exit();
+}
+
+/* ========== lh_spinlock_t: TTAS ========== */
+typedef struct {
+    unsigned int locked;
+    struct lh_lock_owner owner;
+} lh_spinlock_t;
+
+#define LH_SPINLOCK_INIT    { 0, LH_LOCK_OWNER_INIT }
+
+static inline int lh_spin_trylock(lh_spinlock_t *l)
+{
+    if (__atomic_load_n(&l->locked, __ATOMIC_RELAXED) ||
+        __atomic_exchange_n(&l->locked, 1, __ATOMIC_ACQUIRE))
+        return 0;
+    __lh_acquired(&l->owner);
+    return 1;
+}
+
+static inline void lh_spin_lock(lh_spinlock_t *l)
+{
+    unsigned int spins = 0;
+
+    while (__atomic_exchange_n(&l->locked, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&l->locked, __ATOMIC_RELAXED))
+            __lh_spin_wait(l, &l->owner, &spins);
+    }
+    __lh_acquired(&l->owner);
+}
+
+static inline void lh_spin_unlock(lh_spinlock_t *l)
+{
+    __lh_releasing(&l->owner);
+    __atomic_store_n(&l->locked, 0, __ATOMIC_RELEASE);
+}
+
+/* ========== lh_ticket_t: FIFO ticket lock ========== */
+typedef struct {
+    unsigned int next;
+    unsigned int serving;
+    struct lh_lock_owner owner;
+} lh_ticket_t;
+
+#define LH_TICKET_INIT      { 0, 0, LH_LOCK_OWNER_INIT }
+
+static inline int lh_ticket_trylock(lh_ticket_t *l)
+{
+    unsigned int s = __atomic_load_n(&l->serving, __ATOMIC_RELAXED);
+    unsigned int expected = s;
+
+    if (!__atomic_compare_exchange_n(&l->next, &expected, s + 1, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return 0;
+    __lh_acquired(&l->owner);
+    return 1;
+}
+
+static inline void lh_ticket_lock(lh_ticket_t *l)
+{
+    unsigned int my = __atomic_fetch_add(&l->next, 1, __ATOMIC_RELAXED);
+    unsigned int spins = 0;
+
+    while (__atomic_load_n(&l->serving, __ATOMIC_ACQUIRE) != my)
+        __lh_spin_wait(l, &l->owner, &spins);
+    __lh_acquired(&l->owner);
+}
+
+static inline void lh_ticket_unlock(lh_ticket_t *l)
+{
+    unsigned int s = __atomic_load_n(&l->serving, __ATOMIC_RELAXED);
+
+    __lh_releasing(&l->owner);
+    __atomic_store_n(&l->serving, s + 1, __ATOMIC_RELEASE);
+}
+
+/* ========== lh_mcs_t: MCS 队列锁 ==========
+ * 每次加锁由调用者提供 node（通常在栈上），unlock 时传同一个 node。
+ */
+struct lh_mcs_node {
+    struct lh_mcs_node *next;
+    unsigned int locked;
+};
+
+typedef struct {
+    struct lh_mcs_node *tail;
+    struct lh_lock_owner owner;
+} lh_mcs_t;
+
+#define LH_MCS_INIT         { 0, LH_LOCK_OWNER_INIT }
+
+static inline int lh_mcs_trylock(lh_mcs_t *l, struct lh_mcs_node *n)
+{
+    struct lh_mcs_node *expected = 0;
+
+    n->next = 0;
+    n->locked = 0;
+    if (!__atomic_compare_exchange_n(&l->tail, &expected, n, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        return 0;
+    __lh_acquired(&l->owner);
+    return 1;
+}
+
+static inline void lh_mcs_lock(lh_mcs_t *l, struct lh_mcs_node *n)
+{
+    struct lh_mcs_node *prev;
+    unsigned int spins = 0;
+
+    n->next = 0;
+    n->locked = 0;
+    prev = __atomic_exchange_n(&l->tail, n, __ATOMIC_ACQ_REL);
+    if (prev) {
+        __atomic_store_n(&prev->next, n, __ATOMIC_RELEASE);
+        while (!__atomic_load_n(&n->locked, __ATOMIC_ACQUIRE))
+            __lh_spin_wait(l, &l->owner, &spins);
+    }
+    __lh_acquired(&l->owner);
+}
+
+static inline void lh_mcs_unlock(lh_mcs_t *l, struct lh_mcs_node *n)
+{
+    struct lh_mcs_node *next = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE);
+
+    __lh_releasing(&l->owner);
+    if (!next) {
+        struct lh_mcs_node *expected = n;
+
+        if (__atomic_compare_exchange_n(&l->tail, &expected, 0, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            return;
+        /* 后继已经 xchg 了 tail，等它把自己挂上来（它可能刚好被抢占） */
+        for (unsigned int i = 1;
+             !(next = __atomic_load_n(&n->next, __ATOMIC_ACQUIRE)); i++) {
+            if (i % LH_SPIN_HANDOFF_MAX == 0)
+                sched_yield();
+            else
+                __lh_cpu_relax();
+        }
+    }
+    __atomic_store_n(&next->locked, 1, __ATOMIC_RELEASE);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LH_SPINLOCK_H */
@@ -1,7 +1,13 @@
 /* SPDX-License-Identifier: MIT */
 /*
  * liblh.so - LD_PRELOAD 锁 shim
- * 拦截 pthread_mutex_lock/trylock/unlock，发布 hints 到共享内存
+ * 拦截 pthread_mutex_* / pthread_rwlock_* / pthread_cond_*wait 及其
+ * __pthread_* 别名，发布 hints 到共享内存。
+ *
+ * C++ std::mutex / std::timed_mutex / std::shared_mutex / std::condition_variable
+ * 在 libstdc++ 中经 PLT 调用上述函数，因此同样被覆盖。
+ * glibc 内部的锁（malloc arena、stdio 等）直接使用 lll_lock，不经过任何
+ * 可被 LD_PRELOAD 替换的符号，这里覆盖不到。
  */
 #define _GNU_SOURCE
 #include <pthread.h>
@@ -14,37 +20,84 @@
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/syscall.h>
+#include <linux/futex.h>
 #include <sched.h>
 #include <time.h>
 #include <errno.h>
 
 #include "../common/lh_shared.h"
+#include "liblh.h"
 #include "rseq.h"
+#include "lh_profile.h"
+#include "lh_filter.h"
+#include "lh_order.h"
+#include "lh_delegate.h"
 
 /* ========== 配置常量 ========== */
-#define SPIN_TRIES          100     /* trylock 前先 spin 的次数 */
+#define SPIN_TRIES          100     /* owner 状态未知时 trylock 前 spin 的次数 */
 #define SPIN_PAUSE_ITERS    10      /* 每次 spin pause 的迭代 */
+#define NATIVE_PARK_US      1000    /* native mutex park 上限：cond_wait 在 glibc 内部解锁，不会唤醒 park 的 waiter */
+#define DELEGATE_PARK_US    1000    /* lh_delegate 睡眠上限：持锁者不一定经过 liblh 的 unlock，不会 kick */
 
 /* ========== 真实函数指针 ========== */
 static int (*real_pthread_mutex_lock)(pthread_mutex_t *) = NULL;
 static int (*real_pthread_mutex_trylock)(pthread_mutex_t *) = NULL;
 static int (*real_pthread_mutex_unlock)(pthread_mutex_t *) = NULL;
+static int (*real_pthread_mutex_timedlock)(pthread_mutex_t *,
+                                           const struct timespec *) = NULL;
+static int (*real_pthread_mutex_clocklock)(pthread_mutex_t *, clockid_t,
+                                           const struct timespec *) = NULL;
+
+static int (*real_pthread_rwlock_rdlock)(pthread_rwlock_t *) = NULL;
+static int (*real_pthread_rwlock_tryrdlock)(pthread_rwlock_t *) = NULL;
+static int (*real_pthread_rwlock_timedrdlock)(pthread_rwlock_t *,
+                                              const struct timespec *) = NULL;
+static int (*real_pthread_rwlock_wrlock)(pthread_rwlock_t *) = NULL;
+static int (*real_pthread_rwlock_trywrlock)(pthread_rwlock_t *) = NULL;
+static int (*real_pthread_rwlock_timedwrlock)(pthread_rwlock_t *,
+                                              const struct timespec *) = NULL;
+static int (*real_pthread_rwlock_unlock)(pthread_rwlock_t *) = NULL;
+
+static int (*real_pthread_mutex_destroy)(pthread_mutex_t *) = NULL;
+static int (*real_pthread_rwlock_destroy)(pthread_rwlock_t *) = NULL;
+
+static int (*real_pthread_cond_wait)(pthread_cond_t *, pthread_mutex_t *) = NULL;
+static int (*real_pthread_cond_timedwait)(pthread_cond_t *, pthread_mutex_t *,
+                                          const struct timespec *) = NULL;
+static int (*real_pthread_cond_clockwait)(pthread_cond_t *, pthread_mutex_t *,
+                                          clockid_t, const struct timespec *) = NULL;
+
+/* ========== 每把锁的 waiter 计数 ==========
+ * unlock 据此决定是否 yield。按锁地址哈希计数（liblh.h __lh_waiter_idx），不存 tag：
+ * 冲突只会让 unlock 多 yield 一次，不会漏掉真正的 waiter。
+ * waiter 开始 yield 时加一（waiter_slot_set / lh_wait_begin），拿到锁或放弃时减一，
+ * 回退到阻塞加锁睡眠期间保持计数。
+ */
+_Atomic u32 g_lh_lock_waiters[LH_LOCK_WAITER_SLOTS];
 
 /* ========== 共享内存指针 ========== */
-static struct lh_lock_bucket *g_lock_table = NULL;
-static struct lh_waiter_slot *g_waiter_table = NULL;
-static struct lh_cs_slot *g_cs_table = NULL;
+/* lock_table / thread_table 按 NUMA 节点分区，下标为节点号，个数为 0 表示没有该表 */
+static struct lh_lock_bucket *g_lock_table[LH_NUMA_NODES_MAX];
+static struct lh_thread_slot *g_thread_table[LH_NUMA_NODES_MAX];
+static int g_nr_lock_parts = 0;
+static int g_nr_thread_parts = 0;
+static struct lh_cpu_slot *g_cpu_table = NULL;
 
 /* ========== 配置 ========== */
 static u64 g_hash_salt = 0x12345678deadbeef;
 static int g_yield_budget = LH_YIELD_BUDGET;
 static int g_fallback_us = LH_FALLBACK_US;
+static int g_spin_us = LH_SPIN_US;
 static bool g_initialized = false;
 static bool g_enabled = true;
+static bool g_native_mutex = false; /* LH_NATIVE_MUTEX=1 */
 
 /* ========== TLS 缓存 ========== */
 static __thread u32 tls_tid = 0;
 static __thread bool tls_tid_cached = false;
+static __thread struct lh_thread_hints tls_hints;
+/* 每次发布 hint 都要读：initial-exec 避免 __tls_get_addr（LD_PRELOAD 时有静态 TLS） */
+static __thread int tls_node __attribute__((tls_model("initial-exec"))) = -1;
 
 /* ========== CPU pause 指令 ========== */
 static inline void cpu_relax(void)
@@ -77,6 +130,25 @@ static inline s32 get_cpu(void)
     return sched_getcpu();
 }
 
+/* home 节点：线程第一次发布 hint 时所在的 NUMA 节点，之后不变 */
+static inline u32 home_node(void)
+{
+    if (__builtin_expect(tls_node < 0, 0)) {
+        unsigned int cpu, node;
+
+        tls_node = getcpu(&cpu, &node) == 0 ? (int)node : 0;
+    }
+    return (u32)tls_node;
+}
+
+/* 节点号超出分区数（launcher 截断了节点数）时折回 */
+static inline u32 home_part(int nr_parts)
+{
+    u32 node = home_node();
+
+    return node < (u32)nr_parts ? node : node % (u32)nr_parts;
+}
+
 static inline u64 get_time_ns(void)
 {
     struct timespec ts;
@@ -91,173 +163,442 @@ static inline u32 bucket_idx(u64 lock_addr)
     return LH_BUCKET_IDX(lock_addr, g_hash_salt);
 }
 
-static inline u32 tag_from_addr(u64 lock_addr)
+static inline u32 ewma_tag(u64 lock_addr)
+{
+    return LH_EWMA_TAG(lock_addr, g_hash_salt);
+}
+
+/* tag 即锁地址：两路 tag 在行首，acquire load 后再读 entry */
+static inline void lock_bucket_tags(struct lh_lock_bucket *b, u64 tags[LH_LOCK_WAYS])
 {
-    return LH_TAG_FROM_ADDR(lock_addr, g_hash_salt);
+    for (int i = 0; i < LH_LOCK_WAYS; i++)
+        tags[i] = atomic_load_explicit(&b->tag[i], memory_order_acquire);
+}
+
+static inline int lock_bucket_find(struct lh_lock_bucket *b, u64 lock_addr)
+{
+    u64 tags[LH_LOCK_WAYS];
+
+    lock_bucket_tags(b, tags);
+    for (int i = 0; i < LH_LOCK_WAYS; i++) {
+        if (tags[i] == lock_addr)
+            return i;
+    }
+    return -1;
+}
+
+static void lock_entry_fill(struct lh_lock_bucket *b, int way, u64 lock_addr,
+                            u32 tid, s32 cpu)
+{
+    struct lh_lock_entry *e = &b->way[way];
+    u32 etag = ewma_tag(lock_addr);
+
+    /* entry 之前属于别的锁：持锁时间预测作废 */
+    if (e->ewma_tag != etag) {
+        e->ewma_tag = etag;
+        e->hold_ewma_ns = 0;
+    }
+    e->owner_tid = tid;
+    e->owner_cpu = cpu;
+    e->t_start_ns = get_time_ns();
+    atomic_store_explicit(&b->tag[way], lock_addr, memory_order_release);
+}
+
+/*
+ * 在所有分区中查找锁地址（先查 home 分区），找到时返回 bucket 和 way。
+ * owner 只写自己的 home 分区，其它节点的线程持有时 entry 在对方分区里。
+ */
+static struct lh_lock_bucket *lock_table_find(u64 lock_addr, int *way)
+{
+    u32 idx = bucket_idx(lock_addr);
+    u32 home;
+
+    if (!g_nr_lock_parts)
+        return NULL;
+    home = home_part(g_nr_lock_parts);
+    *way = lock_bucket_find(&g_lock_table[home][idx], lock_addr);
+    if (*way >= 0)
+        return &g_lock_table[home][idx];
+
+    for (int n = 0; n < g_nr_lock_parts; n++) {
+        if ((u32)n == home)
+            continue;
+        *way = lock_bucket_find(&g_lock_table[n][idx], lock_addr);
+        if (*way >= 0)
+            return &g_lock_table[n][idx];
+    }
+    return NULL;
 }
 
 static void lock_table_insert(u64 lock_addr, u32 tid, s32 cpu)
 {
-    if (!g_lock_table)
+    if (!g_nr_lock_parts)
         return;
 
-    u32 bidx = bucket_idx(lock_addr);
-    u32 tag = tag_from_addr(lock_addr);
-    struct lh_lock_bucket *bucket = &g_lock_table[bidx];
-
-    for (int i = 0; i < 2; i++) {
-        u32 old_tag = atomic_load_explicit(&bucket->way[i].tag,
-                                           memory_order_acquire);
-        if (old_tag == 0 || old_tag == tag) {
-            bucket->way[i].owner_tid = tid;
-            bucket->way[i].owner_cpu = cpu;
-            bucket->way[i].gen++;
-            bucket->way[i].t_start_ns = get_time_ns();
-            atomic_store_explicit(&bucket->way[i].tag, tag,
-                                  memory_order_release);
+    struct lh_lock_bucket *bucket =
+        &g_lock_table[home_part(g_nr_lock_parts)][bucket_idx(lock_addr)];
+    u32 etag = ewma_tag(lock_addr);
+    u64 tags[LH_LOCK_WAYS];
+    int empty = -1;
+
+    /* 优先用同一把锁上次用过的 way，保留它的持锁时间 EWMA */
+    lock_bucket_tags(bucket, tags);
+    for (int i = 0; i < LH_LOCK_WAYS; i++) {
+        if (tags[i] == lock_addr ||
+            (tags[i] == 0 && bucket->way[i].ewma_tag == etag)) {
+            lock_entry_fill(bucket, i, lock_addr, tid, cpu);
             return;
         }
+        if (tags[i] == 0 && empty < 0)
+            empty = i;
     }
 
-    bucket->way[0].owner_tid = tid;
-    bucket->way[0].owner_cpu = cpu;
-    bucket->way[0].gen++;
-    bucket->way[0].t_start_ns = get_time_ns();
-    atomic_store_explicit(&bucket->way[0].tag, tag, memory_order_release);
+    lock_entry_fill(bucket, empty >= 0 ? empty : 0, lock_addr, tid, cpu);
 }
 
-static void lock_table_remove(u64 lock_addr)
+/* 释放：把本次持锁时间折进 EWMA，再清除 tag */
+static void lock_entry_release(struct lh_lock_bucket *b, int way)
 {
-    if (!g_lock_table)
-        return;
+    struct lh_lock_entry *e = &b->way[way];
+    u64 hold = get_time_ns() - e->t_start_ns;
+    u64 ewma = e->hold_ewma_ns;
+
+    if (hold > UINT32_MAX)
+        hold = UINT32_MAX;
+    if (ewma)
+        ewma = ewma + ((s64)(hold - ewma) >> LH_HOLD_EWMA_SHIFT);
+    else
+        ewma = hold ? hold : 1;
+    e->hold_ewma_ns = (u32)ewma;
+
+    atomic_store_explicit(&b->tag[way], 0, memory_order_release);
+}
 
-    u32 bidx = bucket_idx(lock_addr);
-    u32 tag = tag_from_addr(lock_addr);
-    struct lh_lock_bucket *bucket = &g_lock_table[bidx];
+static void lock_table_remove(u64 lock_addr)
+{
+    int way;
+    struct lh_lock_bucket *bucket = lock_table_find(lock_addr, &way);
 
-    for (int i = 0; i < 2; i++) {
-        u32 old_tag = atomic_load_explicit(&bucket->way[i].tag,
-                                           memory_order_acquire);
-        if (old_tag == tag) {
-            atomic_store_explicit(&bucket->way[i].tag, 0,
-                                  memory_order_release);
-            return;
-        }
-    }
+    if (bucket)
+        lock_entry_release(bucket, way);
 }
 
-static s32 lock_table_get_owner_cpu(u64 lock_addr)
+/* 查询 owner（tid + 加锁时的 CPU），没有记录返回 false */
+static bool lock_table_get_owner(u64 lock_addr, u32 *tid, s32 *cpu)
 {
-    if (!g_lock_table)
-        return -1;
+    int way;
+    struct lh_lock_bucket *bucket = lock_table_find(lock_addr, &way);
 
-    u32 bidx = bucket_idx(lock_addr);
-    u32 tag = tag_from_addr(lock_addr);
-    struct lh_lock_bucket *bucket = &g_lock_table[bidx];
+    if (!bucket)
+        return false;
+    *tid = bucket->way[way].owner_tid;
+    *cpu = bucket->way[way].owner_cpu;
+    return true;
+}
 
-    for (int i = 0; i < 2; i++) {
-        u32 entry_tag = atomic_load_explicit(&bucket->way[i].tag,
-                                             memory_order_acquire);
-        if (entry_tag == tag) {
-            return bucket->way[i].owner_cpu;
-        }
-    }
-    return -1;
+/* 只删除自己作为 owner 的 entry（rwlock unlock 时区分读写者） */
+static bool lock_table_remove_owned(u64 lock_addr, u32 tid)
+{
+    int way;
+    struct lh_lock_bucket *bucket = lock_table_find(lock_addr, &way);
+
+    if (!bucket || bucket->way[way].owner_tid != tid)
+        return false;
+    lock_entry_release(bucket, way);
+    return true;
 }
 
-/* 检查是否有 waiter 在等待这个锁 */
+/* 检查是否有 waiter 在等待这个锁（yield 中或回退到阻塞加锁后睡眠中） */
 static bool has_waiters_for_lock(u64 lock_addr)
 {
-    if (!g_waiter_table)
-        return false;
+    return atomic_load_explicit(&g_lh_lock_waiters[__lh_waiter_idx((const void *)(uintptr_t)lock_addr)],
+                                memory_order_relaxed) != 0;
+}
 
-    /* 简单检查：遍历部分 slot 看是否有人在等这个锁 */
-    /* 这是 best-effort，不需要精确 */
-    u32 start = (u32)(lock_addr >> 6) % LH_WAITER_TABLE_SLOTS;
-    for (int i = 0; i < 16; i++) {
-        u32 idx = (start + i) % LH_WAITER_TABLE_SLOTS;
-        struct lh_waiter_slot *slot = &g_waiter_table[idx];
-        if (atomic_load_explicit(&slot->flags, memory_order_acquire) == LH_WAITER_ACTIVE) {
-            if (slot->lock_addr == lock_addr) {
-                return true;
-            }
-        }
-    }
-    return false;
+/* ========== cpu_table 操作 ========== */
+
+/* owner 是否仍在 CPU 上；没有调度器信息时按在运行处理 */
+static bool owner_on_cpu(u32 tid, s32 cpu)
+{
+    if (!g_cpu_table || cpu < 0 || cpu >= LH_CPU_TABLE_SLOTS)
+        return true;
+
+    return atomic_load_explicit(&g_cpu_table[cpu].curr_tid,
+                                memory_order_relaxed) == tid;
 }
 
-/* ========== waiter_table 操作 ========== */
+enum lh_owner_state {
+    LH_OWNER_UNKNOWN,       /* 没有 owner 记录或没有 cpu_table */
+    LH_OWNER_RUNNING,
+    LH_OWNER_OFF_CPU,
+};
+
+static enum lh_owner_state lock_owner_state(u64 lock_addr, s32 *owner_cpu)
+{
+    u32 tid;
+    s32 cpu;
+
+    *owner_cpu = -1;
+    if (!lock_table_get_owner(lock_addr, &tid, &cpu))
+        return LH_OWNER_UNKNOWN;
+
+    *owner_cpu = cpu;
+    if (!g_cpu_table || cpu < 0 || cpu >= LH_CPU_TABLE_SLOTS)
+        return LH_OWNER_UNKNOWN;
+    return owner_on_cpu(tid, cpu) ? LH_OWNER_RUNNING : LH_OWNER_OFF_CPU;
+}
+
+/* ========== thread_table 操作 ==========
+ * 每线程一个 slot，cs 状态（in_cs + held 栈）与 waiter 状态在同一条 cacheline。
+ * slot 在本线程 home 分区里；读者按 slot->tid 在各分区中找到它。
+ */
+
+static inline struct lh_thread_slot *thread_slot(u32 tid)
+{
+    return &g_thread_table[home_part(g_nr_thread_parts)][LH_THREAD_SLOT_IDX(tid)];
+}
 
-static void waiter_slot_set(u32 tid, u64 lock_addr, s32 target_cpu)
+static void waiter_slot_set(u32 tid, u64 lock_addr, s32 target_cpu, u64 start_ns)
 {
-    if (!g_waiter_table)
+    atomic_fetch_add_explicit(&g_lh_lock_waiters[__lh_waiter_idx((const void *)(uintptr_t)lock_addr)],
+                              1, memory_order_relaxed);
+    if (!g_nr_thread_parts)
         return;
 
-    u32 idx = LH_WAITER_SLOT_IDX(tid);
-    struct lh_waiter_slot *slot = &g_waiter_table[idx];
+    struct lh_thread_slot *slot = thread_slot(tid);
 
     slot->tid = tid;
     slot->lock_addr = lock_addr;
     slot->target_cpu = target_cpu;
-    atomic_store_explicit(&slot->flags, LH_WAITER_ACTIVE,
+    slot->wait_start_us = lh_order_us(start_ns) | 1;
+    atomic_store_explicit(&slot->waiter_flags, LH_WAITER_ACTIVE,
                           memory_order_release);
 }
 
-static void waiter_slot_clear(u32 tid)
+/*
+ * 回退到阻塞加锁前调用：waiter 字段保持有效，只把标记改成 PARKED。
+ * futex 唤醒时调度器仍能把它放到 owner CPU 附近，unlock 者也知道还有人在等。
+ */
+static void waiter_slot_park(u32 tid, s32 target_cpu)
 {
-    if (!g_waiter_table)
+    if (!g_nr_thread_parts)
         return;
 
-    u32 idx = LH_WAITER_SLOT_IDX(tid);
-    struct lh_waiter_slot *slot = &g_waiter_table[idx];
+    struct lh_thread_slot *slot = thread_slot(tid);
 
-    atomic_store_explicit(&slot->flags, LH_WAITER_INACTIVE,
-                          memory_order_release);
+    if (target_cpu >= 0)
+        slot->target_cpu = target_cpu;
+    atomic_store_explicit(&slot->waiter_flags, LH_WAITER_PARKED, memory_order_release);
 }
 
-/* ========== cs_table 操作 ========== */
+static void waiter_slot_clear(u32 tid, u64 lock_addr)
+{
+    atomic_fetch_sub_explicit(&g_lh_lock_waiters[__lh_waiter_idx((const void *)(uintptr_t)lock_addr)],
+                              1, memory_order_relaxed);
+    if (!g_nr_thread_parts)
+        return;
+
+    struct lh_thread_slot *slot = thread_slot(tid);
+
+    atomic_store_explicit(&slot->waiter_flags, LH_WAITER_INACTIVE, memory_order_release);
+    /* 下一次等待（可能来自 liblh.h 的 inline API）不能沿用这次的起点 */
+    slot->wait_start_us = 0;
+}
 
 static void cs_slot_enter(u32 tid)
 {
-    if (!g_cs_table)
+    if (!g_nr_thread_parts)
         return;
 
-    u32 idx = LH_CS_SLOT_IDX(tid);
-    atomic_fetch_add_explicit(&g_cs_table[idx].in_cs, 1, memory_order_release);
+    struct lh_thread_slot *slot = thread_slot(tid);
+
+    /* 同一行上顺带写 tid：按 tid 取模冲突的线程交替使用时由最近进入的认领 */
+    slot->tid = tid;
+    atomic_fetch_add_explicit(&slot->in_cs, 1, memory_order_release);
 }
 
 static void cs_slot_leave(u32 tid)
 {
-    if (!g_cs_table)
+    if (!g_nr_thread_parts)
         return;
 
-    u32 idx = LH_CS_SLOT_IDX(tid);
-    u32 old = atomic_fetch_sub_explicit(&g_cs_table[idx].in_cs, 1,
-                                        memory_order_release);
+    struct lh_thread_slot *slot = thread_slot(tid);
+    u32 old = atomic_fetch_sub_explicit(&slot->in_cs, 1, memory_order_release);
     if (old == 0) {
-        atomic_store_explicit(&g_cs_table[idx].in_cs, 0, memory_order_release);
+        atomic_store_explicit(&slot->in_cs, 0, memory_order_release);
+    }
+}
+
+/*
+ * 每线程持有的锁栈：只由本线程写，调度器读（best-effort）。
+ * 先写 held[n] 再发布 nr_held；释放可以不按顺序，找到后把上面的往下挪。
+ */
+static void cs_slot_push_lock(u32 tid, u64 lock_addr)
+{
+    if (!g_nr_thread_parts)
+        return;
+
+    struct lh_thread_slot *slot = thread_slot(tid);
+    u32 n = slot->nr_held;
+
+    if (n >= LH_HELD_LOCKS_MAX)
+        return;
+    slot->held[n] = lock_addr;
+    atomic_thread_fence(memory_order_release);
+    slot->nr_held = n + 1;
+}
+
+static void cs_slot_pop_lock(u32 tid, u64 lock_addr)
+{
+    if (!g_nr_thread_parts)
+        return;
+
+    struct lh_thread_slot *slot = thread_slot(tid);
+    u32 n = slot->nr_held;
+
+    if (n > LH_HELD_LOCKS_MAX)
+        n = LH_HELD_LOCKS_MAX;
+    for (int i = (int)n - 1; i >= 0; i--) {
+        if (slot->held[i] != lock_addr)
+            continue;
+        for (u32 j = i; j + 1 < n; j++)
+            slot->held[j] = slot->held[j + 1];
+        atomic_thread_fence(memory_order_release);
+        slot->nr_held = n - 1;
+        return;
     }
 }
 
 /* ========== hint 发布 ========== */
 
-static void on_lock_acquired(pthread_mutex_t *mutex)
+static void on_lock_acquired(u64 lock_addr)
 {
     u32 tid = get_tid();
     s32 cpu = get_cpu();
-    u64 lock_addr = (u64)(uintptr_t)mutex;
 
     cs_slot_enter(tid);
     lock_table_insert(lock_addr, tid, cpu);
+    cs_slot_push_lock(tid, lock_addr);
 }
 
-static void on_lock_release(pthread_mutex_t *mutex)
+static void on_lock_release(u64 lock_addr)
 {
     u32 tid = get_tid();
-    u64 lock_addr = (u64)(uintptr_t)mutex;
 
+    cs_slot_pop_lock(tid, lock_addr);
     cs_slot_leave(tid);
     lock_table_remove(lock_addr);
+    if (g_lh_profile)
+        lh_profile_released(lock_addr);
+}
+
+/* ========== profiler 钩子 (LH_PROFILE) ==========
+ * 调用点取拦截函数的返回地址，所以必须在拦截函数里展开。
+ * wait 从第一次 trylock 失败开始计时，0 表示无竞争。
+ */
+#define PROFILE_WAIT_START()    (g_lh_profile ? get_time_ns() : 0)
+
+static inline u64 profile_wait_ns(u64 wait_start_ns)
+{
+    u64 w;
+
+    if (!wait_start_ns)
+        return 0;
+    w = get_time_ns() - wait_start_ns;
+    return w ? w : 1;
+}
+
+#define PROFILE_ACQUIRED(lock_addr, wait_start_ns)                          \
+    do {                                                                    \
+        if (g_lh_profile)                                                   \
+            lh_profile_acquired((lock_addr), __builtin_return_address(0),   \
+                                profile_wait_ns(wait_start_ns));            \
+    } while (0)
+
+/* ========== 标注 API (liblh.h) ==========
+ * liblh.h 的 inline fast path 直接写本线程的 slot，不依赖共享结构体布局，
+ * 这里把字段地址交给它。
+ */
+_Static_assert(LH_WAITER_ACTIVE == 1 && LH_WAITER_INACTIVE == 0,
+               "liblh.h writes waiter flags as 1/0");
+
+static struct lh_thread_hints *api_thread_hints(void)
+{
+    if (!g_initialized || !g_enabled || !g_nr_thread_parts)
+        return NULL;
+
+    if (!tls_hints.in_cs) {
+        u32 tid = get_tid();
+        struct lh_thread_slot *w = thread_slot(tid);
+
+        w->tid = tid;
+        tls_hints.tid = tid;
+        tls_hints.in_cs = (unsigned int *)&w->in_cs;
+        tls_hints.waiter_flags = (unsigned int *)&w->waiter_flags;
+        tls_hints.waiter_tid = &w->tid;
+        tls_hints.waiter_lock_addr = &w->lock_addr;
+        tls_hints.waiter_target_cpu = &w->target_cpu;
+        tls_hints.waiter_start_us = &w->wait_start_us;
+        tls_hints.lock_waiters = (unsigned int *)g_lh_lock_waiters;
+    }
+    return &tls_hints;
+}
+
+static void api_owner_begin(const void *addr)
+{
+    u32 tid = get_tid();
+
+    if (!g_enabled)
+        return;
+    lock_table_insert((u64)(uintptr_t)addr, tid, get_cpu());
+    cs_slot_push_lock(tid, (u64)(uintptr_t)addr);
+}
+
+static void api_owner_end(const void *addr)
+{
+    u32 tid = get_tid();
+
+    if (!g_enabled)
+        return;
+    cs_slot_pop_lock(tid, (u64)(uintptr_t)addr);
+    lock_table_remove_owned((u64)(uintptr_t)addr, tid);
+}
+
+static void api_handoff_hint(const void *addr)
+{
+    if (g_enabled && has_waiters_for_lock((u64)(uintptr_t)addr))
+        sched_yield();
+}
+
+static int api_current_cpu(void)
+{
+    return get_cpu();
+}
+
+static void api_delegate(pthread_mutex_t *lock, void (*fn)(void *), void *arg);
+
+static struct lh_api g_api = {
+    .version = LH_API_VERSION,
+    .thread_hints = api_thread_hints,
+    .owner_begin = api_owner_begin,
+    .owner_end = api_owner_end,
+    .handoff_hint = api_handoff_hint,
+    .current_cpu = api_current_cpu,
+    .delegate = api_delegate,
+};
+
+static void init_api(void)
+{
+    if (!g_enabled || !g_cpu_table)
+        return;
+    g_api.cpu_curr = (const unsigned int *)&g_cpu_table[0].curr_tid;
+    g_api.cpu_stride = sizeof(struct lh_cpu_slot) / sizeof(unsigned int);
+    g_api.nr_cpu_slots = LH_CPU_TABLE_SLOTS;
+}
+
+const struct lh_api *liblh_api(void)
+{
+    return &g_api;
 }
 
 /* ========== 初始化 ========== */
@@ -267,44 +608,70 @@ static void init_real_funcs(void)
     real_pthread_mutex_lock = dlsym(RTLD_NEXT, "pthread_mutex_lock");
     real_pthread_mutex_trylock = dlsym(RTLD_NEXT, "pthread_mutex_trylock");
     real_pthread_mutex_unlock = dlsym(RTLD_NEXT, "pthread_mutex_unlock");
+    real_pthread_mutex_timedlock = dlsym(RTLD_NEXT, "pthread_mutex_timedlock");
+    real_pthread_mutex_clocklock = dlsym(RTLD_NEXT, "pthread_mutex_clocklock");
+
+    real_pthread_rwlock_rdlock = dlsym(RTLD_NEXT, "pthread_rwlock_rdlock");
+    real_pthread_rwlock_tryrdlock = dlsym(RTLD_NEXT, "pthread_rwlock_tryrdlock");
+    real_pthread_rwlock_timedrdlock = dlsym(RTLD_NEXT, "pthread_rwlock_timedrdlock");
+    real_pthread_rwlock_wrlock = dlsym(RTLD_NEXT, "pthread_rwlock_wrlock");
+    real_pthread_rwlock_trywrlock = dlsym(RTLD_NEXT, "pthread_rwlock_trywrlock");
+    real_pthread_rwlock_timedwrlock = dlsym(RTLD_NEXT, "pthread_rwlock_timedwrlock");
+    real_pthread_rwlock_unlock = dlsym(RTLD_NEXT, "pthread_rwlock_unlock");
+
+    real_pthread_mutex_destroy = dlsym(RTLD_NEXT, "pthread_mutex_destroy");
+    real_pthread_rwlock_destroy = dlsym(RTLD_NEXT, "pthread_rwlock_destroy");
+
+    real_pthread_cond_wait = dlsym(RTLD_NEXT, "pthread_cond_wait");
+    real_pthread_cond_timedwait = dlsym(RTLD_NEXT, "pthread_cond_timedwait");
+    real_pthread_cond_clockwait = dlsym(RTLD_NEXT, "pthread_cond_clockwait");
+}
+
+/* "fd0,fd1,..."：每个 NUMA 节点一个分区，按节点号排列；返回映射成功的分区数 */
+static int map_partitions(const char *fds, size_t size, void **parts)
+{
+    int n = 0;
+
+    while (fds && *fds && n < LH_NUMA_NODES_MAX) {
+        char *end;
+        int fd = (int)strtol(fds, &end, 10);
+        void *p;
+
+        if (end == fds)
+            break;
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+            break;
+        parts[n++] = p;
+        fds = *end == ',' ? end + 1 : end;
+    }
+    return n;
 }
 
 static void init_shared_memory(void)
 {
     const char *lock_fd_str = getenv("LH_LOCK_TABLE_FD");
-    const char *waiter_fd_str = getenv("LH_WAITER_TABLE_FD");
-    const char *cs_fd_str = getenv("LH_CS_TABLE_FD");
+    const char *thread_fd_str = getenv("LH_THREAD_TABLE_FD");
     const char *salt_str = getenv("LH_HASH_SALT");
 
     if (salt_str) {
         g_hash_salt = strtoull(salt_str, NULL, 16);
     }
 
-    if (lock_fd_str) {
-        int fd = atoi(lock_fd_str);
-        size_t size = sizeof(struct lh_lock_bucket) * LH_LOCK_TABLE_BUCKETS;
-        g_lock_table = mmap(NULL, size, PROT_READ | PROT_WRITE,
-                            MAP_SHARED, fd, 0);
-        if (g_lock_table == MAP_FAILED)
-            g_lock_table = NULL;
-    }
-
-    if (waiter_fd_str) {
-        int fd = atoi(waiter_fd_str);
-        size_t size = sizeof(struct lh_waiter_slot) * LH_WAITER_TABLE_SLOTS;
-        g_waiter_table = mmap(NULL, size, PROT_READ | PROT_WRITE,
-                              MAP_SHARED, fd, 0);
-        if (g_waiter_table == MAP_FAILED)
-            g_waiter_table = NULL;
-    }
-
-    if (cs_fd_str) {
-        int fd = atoi(cs_fd_str);
-        size_t size = sizeof(struct lh_cs_slot) * LH_CS_TABLE_SLOTS;
-        g_cs_table = mmap(NULL, size, PROT_READ | PROT_WRITE,
-                          MAP_SHARED, fd, 0);
-        if (g_cs_table == MAP_FAILED)
-            g_cs_table = NULL;
+    g_nr_lock_parts = map_partitions(lock_fd_str,
+                                     sizeof(struct lh_lock_bucket) * LH_LOCK_TABLE_BUCKETS,
+                                     (void **)g_lock_table);
+    g_nr_thread_parts = map_partitions(thread_fd_str,
+                                       sizeof(struct lh_thread_slot) * LH_THREAD_TABLE_SLOTS,
+                                       (void **)g_thread_table);
+
+    const char *cpu_fd_str = getenv("LH_CPU_TABLE_FD");
+    if (cpu_fd_str) {
+        int fd = atoi(cpu_fd_str);
+        size_t size = sizeof(struct lh_cpu_slot) * LH_CPU_TABLE_SLOTS;
+        g_cpu_table = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+        if (g_cpu_table == MAP_FAILED)
+            g_cpu_table = NULL;
     }
 
     const char *budget_str = getenv("LH_YIELD_BUDGET");
@@ -315,9 +682,17 @@ static void init_shared_memory(void)
     if (fallback_str)
         g_fallback_us = atoi(fallback_str);
 
+    const char *spin_str = getenv("LH_SPIN_US");
+    if (spin_str)
+        g_spin_us = atoi(spin_str);
+
     const char *enabled_str = getenv("LH_ENABLED");
     if (enabled_str && strcmp(enabled_str, "0") == 0)
         g_enabled = false;
+
+    const char *native_str = getenv("LH_NATIVE_MUTEX");
+    if (native_str && strcmp(native_str, "1") == 0)
+        g_native_mutex = true;
 }
 
 __attribute__((constructor))
@@ -325,115 +700,395 @@ static void liblh_init(void)
 {
     init_real_funcs();
     init_shared_memory();
+    init_api();
+    lh_profile_init();
+    lh_filter_init();
+    lh_order_init(g_native_mutex);
     g_initialized = true;
 }
 
-/* ========== 拦截函数 ========== */
+/* ========== 竞争路径 ========== */
+
+/* 未初始化或被禁用时直接调用下一个实现 */
+#define LH_PASSTHROUGH(real, name, ...)                                 \
+    do {                                                                \
+        if (!g_initialized || !g_enabled || !(real)) {                  \
+            __typeof__(real) fn = dlsym(RTLD_NEXT, name);               \
+            return fn ? fn(__VA_ARGS__) : EINVAL;                       \
+        }                                                               \
+    } while (0)
+
+/* 被 LH_INCLUDE / LH_EXCLUDE 关闭的锁直接调用真实实现（见 lh_filter.c） */
+#define LH_FILTERED(lock, real, ...)                                    \
+    do {                                                                \
+        if (g_lh_filter &&                                              \
+            !lh_filter_enabled((u64)(uintptr_t)(lock),                  \
+                               __builtin_return_address(0)))            \
+            return real(__VA_ARGS__);                                   \
+    } while (0)
+
+/* 锁已指定给别的 waiter（LH_HANDOFF_ORDER）时 fast path 不插队，直接进竞争路径排队 */
+static inline bool handoff_reserved(void *lock)
+{
+    struct lh_order_queue *q;
 
-int pthread_mutex_lock(pthread_mutex_t *mutex)
+    if (!g_lh_order || !(q = lh_order_queue_find((u64)(uintptr_t)lock)))
+        return false;
+    return lh_order_granted_other(q, get_tid(), get_time_ns());
+}
+
+/* 真实 unlock 之前指定下一个 owner，避免释放后被新来的线程抢走 */
+static inline void handoff_grant(u64 lock_addr)
 {
-    if (!g_initialized || !g_enabled || !real_pthread_mutex_lock) {
-        int (*fn)(pthread_mutex_t *) = dlsym(RTLD_NEXT, "pthread_mutex_lock");
-        return fn ? fn(mutex) : EINVAL;
-    }
+    if (g_lh_order)
+        lh_order_grant(lock_addr, get_tid(), get_cpu(), get_time_ns());
+}
 
-    /* Fast path: trylock */
-    int ret = real_pthread_mutex_trylock(mutex);
-    if (ret == 0) {
-        on_lock_acquired(mutex);
+typedef int (*lh_lock_fn)(void *lock);
+typedef int (*lh_park_fn)(void *lock, struct lh_order_ticket *tk);
+
+static int mutex_trylock_fn(void *lock)
+{
+    return real_pthread_mutex_trylock(lock);
+}
+
+static int mutex_lock_fn(void *lock)
+{
+    return real_pthread_mutex_lock(lock);
+}
+
+static int rwlock_tryrdlock_fn(void *lock)
+{
+    return real_pthread_rwlock_tryrdlock(lock);
+}
+
+static int rwlock_rdlock_fn(void *lock)
+{
+    return real_pthread_rwlock_rdlock(lock);
+}
+
+static int rwlock_trywrlock_fn(void *lock)
+{
+    return real_pthread_rwlock_trywrlock(lock);
+}
+
+static int rwlock_wrlock_fn(void *lock)
+{
+    return real_pthread_rwlock_wrlock(lock);
+}
+
+/* ========== native mutex (LH_NATIVE_MUTEX=1) ==========
+ * 默认类型（PTHREAD_MUTEX_NORMAL，进程私有，无 elision）的 mutex 由 liblh 自己
+ * 维护锁字 __data.__lock，与 glibc 的协议兼容：0 = 空闲，1 = 持有，2 = 持有且可能
+ * 有 waiter。因此 PTHREAD_MUTEX_INITIALIZER、trylock / timedlock（仍走 glibc）、
+ * cond_wait 内部的解锁和重新加锁都可以混用；__owner / __nusers 也照 glibc 维护，
+ * pthread_mutex_destroy 的检查不受影响。
+ *
+ * 竞争时 waiter 登记到 lh_order 队列。unlock 看到 2 时按 LH_HANDOFF_ORDER
+ * （race 按 fifo）选出一个 waiter，锁字保持 2，把所有权直接交给它，
+ * 第三个线程拿不到这把锁；没有可交的 waiter 才真正释放并唤醒 futex 上的线程。
+ * 超过 yield 预算的 waiter 在自己的队列记录上 futex park，交接时被定向唤醒；
+ * 没登记上队列的 waiter 按 glibc 的方式睡在锁字上。
+ */
+static inline bool native_mutex(pthread_mutex_t *m)
+{
+    return g_native_mutex && m->__data.__kind == PTHREAD_MUTEX_NORMAL;
+}
+
+static inline _Atomic int *native_word(void *lock)
+{
+    return (_Atomic int *)&((pthread_mutex_t *)lock)->__data.__lock;
+}
+
+/* 与 glibc 加锁后相同的簿记 */
+static inline void native_acquired(pthread_mutex_t *m)
+{
+    m->__data.__owner = (int)get_tid();
+    m->__data.__nusers++;
+}
+
+/* 竞争中的 trylock：拿到时置 2（还有人在排队），拿不到时把 1 改成 2 让 unlock 走交接路径 */
+static int native_trylock_fn(void *lock)
+{
+    _Atomic int *w = native_word(lock);
+    int v = atomic_load_explicit(w, memory_order_relaxed);
+
+    if (v == 0 && atomic_compare_exchange_strong(w, &v, 2))
         return 0;
-    }
+    if (v == 1)
+        atomic_compare_exchange_strong(w, &v, 2);
+    return EBUSY;
+}
 
-    /* 竞争路径 */
-    u32 tid = get_tid();
-    u64 lock_addr = (u64)(uintptr_t)mutex;
-    u64 start_ns = get_time_ns();
-    int yield_count = 0;
-    int spin_count = 0;
+/* 没登记上队列：与 glibc lll_lock 相同，睡在锁字上 */
+static int native_lock_fn(void *lock)
+{
+    _Atomic int *w = native_word(lock);
 
-    /* Phase 1: 先 spin 几次（不 yield） */
-    while (spin_count < SPIN_TRIES) {
-        for (int i = 0; i < SPIN_PAUSE_ITERS; i++) {
-            cpu_relax();
-        }
-        spin_count++;
+    while (atomic_exchange(w, 2) != 0)
+        syscall(SYS_futex, w, FUTEX_WAIT_PRIVATE, 2, NULL, NULL, 0);
+    return 0;
+}
+
+/* 超过 yield 预算：在队列记录上 park，直到锁交给自己或锁空闲时自己拿到 */
+static int native_park_fn(void *lock, struct lh_order_ticket *tk)
+{
+    _Atomic int *w = native_word(lock);
+
+    while (1) {
+        int v;
 
-        ret = real_pthread_mutex_trylock(mutex);
-        if (ret == 0) {
-            on_lock_acquired(mutex);
+        if (lh_order_park_prepare(tk))
             return 0;
+        /* 先 PARKED 再看锁字：unlock 者先改锁字再看 state，不会丢唤醒 */
+        v = atomic_load(w);
+        while (v != 2) {
+            if (v == 0 && atomic_compare_exchange_strong(w, &v, 2)) {
+                lh_order_unpark(tk);
+                return 0;
+            }
+            if (v == 1 && atomic_compare_exchange_strong(w, &v, 2))
+                break;
         }
+        if (lh_order_park(tk, NATIVE_PARK_US))
+            return 0;
     }
+}
 
-    /* Phase 2: spin 失败，进入 yield 路径 */
-    s32 target_cpu = lock_table_get_owner_cpu(lock_addr);
-    waiter_slot_set(tid, lock_addr, target_cpu);
+static int native_unlock(pthread_mutex_t *m)
+{
+    _Atomic int *w = native_word(m);
+    u64 lock_addr = (u64)(uintptr_t)m;
+    int one = 1;
+
+    m->__data.__owner = 0;
+    m->__data.__nusers--;
+    if (atomic_compare_exchange_strong(w, &one, 0))
+        return 0;
+
+    /* 有 waiter：直接交接，锁字保持 2 */
+    if (lh_order_handoff(lock_addr, get_tid(), get_cpu(), get_time_ns()))
+        return 0;
+
+    atomic_exchange(w, 0);
+    syscall(SYS_futex, w, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+    lh_order_wake_parked(lock_addr);
+    return 0;
+}
+
+/*
+ * trylock 失败后的路径（adaptive）：
+ * - owner 在 CPU 上：spin，最多 LH_SPIN_US
+ * - owner 被换下：不再 spin，发布 waiter hint 并 yield
+ * - owner 状态未知（没有调度器信息）：沿用固定 SPIN_TRIES 次 spin
+ * yield 后 owner 重新上 CPU 且仍在 spin 期限内会回到 spin。
+ * yield 次数或总时间超过阈值回退到阻塞加锁，睡眠期间 waiter hint 保持为 PARKED。
+ * 只负责拿到锁，hint 由调用者发布。
+ * 启用 LH_HANDOFF_ORDER 时先登记到锁的队列，锁指定给别人时只 spin / yield 不 trylock。
+ * native mutex 还要检查锁是否已被直接交给自己，超过阈值时用 park_fn 在队列里等待。
+ */
+static int lh_lock_contended(void *lock, lh_lock_fn try_fn, lh_lock_fn block_fn,
+                             lh_park_fn park_fn)
+{
+    u32 tid = get_tid();
+    u64 lock_addr = (u64)(uintptr_t)lock;
+    u64 start_ns = get_time_ns();
+    u64 spin_deadline_ns = start_ns + (u64)g_spin_us * 1000;
+    struct lh_order_ticket ticket = { NULL, 0 };
+    bool waiting = false;
+    int yield_count = 0;
+    int spin_count = 0;
+    int ret;
+
+    if (g_lh_order)
+        lh_order_join(&ticket, lock_addr, tid, get_cpu(), start_ns);
 
     while (1) {
-        /* yield 让调度器把我们放到 owner CPU */
-        sched_yield();
-        yield_count++;
+        s32 owner_cpu;
+        enum lh_owner_state st = lock_owner_state(lock_addr, &owner_cpu);
+        u64 now_ns = get_time_ns();
+        bool spin;
+
+        if (st == LH_OWNER_RUNNING)
+            spin = now_ns < spin_deadline_ns;
+        else if (st == LH_OWNER_UNKNOWN)
+            spin = spin_count < SPIN_TRIES;
+        else
+            spin = false;
+
+        if (spin) {
+            for (int i = 0; i < SPIN_PAUSE_ITERS; i++) {
+                cpu_relax();
+            }
+            spin_count++;
+        } else {
+            /* yield 让调度器把我们放到 owner CPU（owner 可能迁移了，每次更新） */
+            if (!waiting) {
+                waiter_slot_set(tid, lock_addr, owner_cpu, start_ns);
+                waiting = true;
+            } else if (g_nr_thread_parts) {
+                thread_slot(tid)->target_cpu = owner_cpu;
+            }
+            sched_yield();
+            yield_count++;
+        }
 
-        /* 重试 trylock */
-        ret = real_pthread_mutex_trylock(mutex);
-        if (ret == 0) {
-            waiter_slot_clear(tid);
-            on_lock_acquired(mutex);
+        if (ticket.q && park_fn && lh_order_handed(&ticket)) {
+            lh_order_leave(&ticket, tid);
+            if (waiting)
+                waiter_slot_clear(tid, lock_addr);
             return 0;
         }
-
-        /* 更新 target_cpu（owner 可能迁移了） */
-        target_cpu = lock_table_get_owner_cpu(lock_addr);
-        if (g_waiter_table) {
-            u32 idx = LH_WAITER_SLOT_IDX(tid);
-            g_waiter_table[idx].target_cpu = target_cpu;
+        if ((!ticket.q || lh_order_may_try(&ticket, tid, get_cpu(), get_time_ns())) &&
+            try_fn(lock) == 0) {
+            lh_order_leave(&ticket, tid);
+            if (waiting)
+                waiter_slot_clear(tid, lock_addr);
+            return 0;
         }
 
-        /* 降级检查 */
+        /* 降级检查：只在开始 yield 之后计算 */
+        if (!waiting)
+            continue;
         u64 elapsed_us = (get_time_ns() - start_ns) / 1000;
         if (yield_count >= g_yield_budget || elapsed_us >= (u64)g_fallback_us) {
-            waiter_slot_clear(tid);
-            /* 回退到真实 pthread_mutex_lock */
-            ret = real_pthread_mutex_lock(mutex);
-            if (ret == 0) {
-                on_lock_acquired(mutex);
+            /* 睡眠期间保留 waiter hint（PARKED），拿到锁后再清除 */
+            waiter_slot_park(tid, owner_cpu);
+            if (ticket.q && park_fn) {
+                ret = park_fn(lock, &ticket);
+                lh_order_leave(&ticket, tid);
+            } else {
+                lh_order_leave(&ticket, tid);
+                /* 回退到真实的阻塞加锁 */
+                ret = block_fn(lock);
             }
+            waiter_slot_clear(tid, lock_addr);
             return ret;
         }
     }
 }
 
+/* ========== 拦截函数: mutex ========== */
+
+int pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+    LH_PASSTHROUGH(real_pthread_mutex_lock, "pthread_mutex_lock", mutex);
+    LH_FILTERED(mutex, real_pthread_mutex_lock, mutex);
+
+    /* Fast path: trylock（native mutex 的锁字与 glibc 兼容，同样用 glibc 的 trylock） */
+    bool native = native_mutex(mutex);
+    u64 wait_start_ns = 0;
+    int ret = !native && handoff_reserved(mutex) ? EBUSY : real_pthread_mutex_trylock(mutex);
+    if (ret != 0) {
+        wait_start_ns = PROFILE_WAIT_START();
+        if (native) {
+            ret = lh_lock_contended(mutex, native_trylock_fn, native_lock_fn, native_park_fn);
+            native_acquired(mutex);
+        } else {
+            ret = lh_lock_contended(mutex, mutex_trylock_fn, mutex_lock_fn, NULL);
+        }
+    }
+
+    if (ret == 0) {
+        on_lock_acquired((u64)(uintptr_t)mutex);
+        PROFILE_ACQUIRED((u64)(uintptr_t)mutex, wait_start_ns);
+    }
+    return ret;
+}
+
 int pthread_mutex_trylock(pthread_mutex_t *mutex)
 {
-    if (!g_initialized || !g_enabled || !real_pthread_mutex_trylock) {
-        int (*fn)(pthread_mutex_t *) = dlsym(RTLD_NEXT, "pthread_mutex_trylock");
-        return fn ? fn(mutex) : EINVAL;
+    LH_PASSTHROUGH(real_pthread_mutex_trylock, "pthread_mutex_trylock", mutex);
+    LH_FILTERED(mutex, real_pthread_mutex_trylock, mutex);
+
+    int ret = real_pthread_mutex_trylock(mutex);
+    if (ret == 0) {
+        on_lock_acquired((u64)(uintptr_t)mutex);
+        PROFILE_ACQUIRED((u64)(uintptr_t)mutex, 0);
     }
+    return ret;
+}
 
+/*
+ * 带超时的加锁没有排队路径：锁已指定给别的 waiter（LH_HANDOFF_ORDER）时先让出 CPU
+ * 等它拿走，指定最多保持 LH_HANDOFF_GRANT_US，然后才 trylock / 进 glibc，
+ * 和 pthread_mutex_lock 的 fast path 一样不插队。native mutex 由锁字直接交接，不用等。
+ */
+static inline void handoff_wait_reserved(pthread_mutex_t *mutex)
+{
+    while (!native_mutex(mutex) && handoff_reserved(mutex))
+        sched_yield();
+}
+
+/* 带超时的加锁（std::timed_mutex）：不走 yield 路径，超时语义交给 glibc */
+int pthread_mutex_timedlock(pthread_mutex_t *mutex, const struct timespec *abstime)
+{
+    LH_PASSTHROUGH(real_pthread_mutex_timedlock, "pthread_mutex_timedlock",
+                   mutex, abstime);
+    LH_FILTERED(mutex, real_pthread_mutex_timedlock, mutex, abstime);
+
+    u64 wait_start_ns = 0;
+    handoff_wait_reserved(mutex);
     int ret = real_pthread_mutex_trylock(mutex);
+    if (ret != 0) {
+        wait_start_ns = PROFILE_WAIT_START();
+        handoff_wait_reserved(mutex);
+        ret = real_pthread_mutex_timedlock(mutex, abstime);
+    }
+
     if (ret == 0) {
-        on_lock_acquired(mutex);
+        on_lock_acquired((u64)(uintptr_t)mutex);
+        PROFILE_ACQUIRED((u64)(uintptr_t)mutex, wait_start_ns);
     }
     return ret;
 }
 
-int pthread_mutex_unlock(pthread_mutex_t *mutex)
+int pthread_mutex_clocklock(pthread_mutex_t *mutex, clockid_t clockid,
+                            const struct timespec *abstime)
 {
-    if (!g_initialized || !g_enabled || !real_pthread_mutex_unlock) {
-        int (*fn)(pthread_mutex_t *) = dlsym(RTLD_NEXT, "pthread_mutex_unlock");
-        return fn ? fn(mutex) : EINVAL;
+    LH_PASSTHROUGH(real_pthread_mutex_clocklock, "pthread_mutex_clocklock",
+                   mutex, clockid, abstime);
+    LH_FILTERED(mutex, real_pthread_mutex_clocklock, mutex, clockid, abstime);
+
+    u64 wait_start_ns = 0;
+    handoff_wait_reserved(mutex);
+    int ret = real_pthread_mutex_trylock(mutex);
+    if (ret != 0) {
+        wait_start_ns = PROFILE_WAIT_START();
+        handoff_wait_reserved(mutex);
+        ret = real_pthread_mutex_clocklock(mutex, clockid, abstime);
     }
 
+    if (ret == 0) {
+        on_lock_acquired((u64)(uintptr_t)mutex);
+        PROFILE_ACQUIRED((u64)(uintptr_t)mutex, wait_start_ns);
+    }
+    return ret;
+}
+
+int pthread_mutex_unlock(pthread_mutex_t *mutex)
+{
+    LH_PASSTHROUGH(real_pthread_mutex_unlock, "pthread_mutex_unlock", mutex);
+    LH_FILTERED(mutex, real_pthread_mutex_unlock, mutex);
+
     u64 lock_addr = (u64)(uintptr_t)mutex;
-    
+
     /* 检查是否有 waiter - 只有有 waiter 时才 yield */
     bool has_waiter = has_waiters_for_lock(lock_addr);
 
     /* 清理 hints */
-    on_lock_release(mutex);
-
-    /* 真实 unlock */
-    int ret = real_pthread_mutex_unlock(mutex);
+    on_lock_release(lock_addr);
+
+    /* 真实 unlock；native mutex 由 liblh 解锁并直接交接 */
+    int ret;
+    if (native_mutex(mutex)) {
+        ret = native_unlock(mutex);
+    } else {
+        handoff_grant(lock_addr);
+        ret = real_pthread_mutex_unlock(mutex);
+    }
+    if (atomic_load_explicit(&g_lh_delegate_nr_queues, memory_order_relaxed))
+        lh_delegate_kick(lock_addr);
 
     /* 只有有 waiter 时才 yield 做 handoff */
     if (has_waiter) {
@@ -442,3 +1097,334 @@ int pthread_mutex_unlock(pthread_mutex_t *mutex)
 
     return ret;
 }
+
+/* ========== 委托执行 (liblh.h lh_delegate) ==========
+ * 锁空闲时直接执行，顺带执行队列里别人的请求；否则把临界区挂到锁的合并队列上
+ * （lh_delegate.c），然后：
+ * - trylock 成功 → 成为 combiner，执行队列里所有请求后解锁。加解锁经过上面的
+ *   拦截函数：combiner 持锁期间是 IN_CS、是 lock_table 里的 owner，整批执行的时间
+ *   计入 hold_ewma_ns，调度器据此给它足够长的 slice，waiter 也定向到它的 CPU
+ * - owner 在 CPU 上：spin 等自己的请求完成（最多 LH_SPIN_US）
+ * - 否则以 PARKED waiter 睡在队列上：combiner 执行完唤醒，持锁者经过 liblh
+ *   unlock 时队列里还有请求也会唤醒一个来 combine
+ */
+static void api_delegate(pthread_mutex_t *lock, void (*fn)(void *), void *arg)
+{
+    u64 lock_addr = (u64)(uintptr_t)lock;
+    struct lh_delegate_req req = { fn, arg, NULL, 0 };
+    struct lh_delegate_queue *q = NULL;
+    u64 start_ns, spin_deadline_ns;
+    bool waiting = false;
+    int spin_count = 0;
+    u32 tid;
+
+    if (g_initialized && g_enabled)
+        q = lh_delegate_queue_get(lock_addr);
+    if (!q) {
+        pthread_mutex_lock(lock);
+        fn(arg);
+        pthread_mutex_unlock(lock);
+        return;
+    }
+
+    if (pthread_mutex_trylock(lock) == 0) {
+        fn(arg);
+        lh_delegate_combine(q, LH_DELEGATE_BATCH_MAX);
+        pthread_mutex_unlock(lock);
+        return;
+    }
+
+    tid = get_tid();
+    start_ns = get_time_ns();
+    spin_deadline_ns = start_ns + (u64)g_spin_us * 1000;
+    lh_delegate_post(q, &req);
+
+    while (!lh_delegate_done(&req)) {
+        enum lh_owner_state st;
+        s32 owner_cpu;
+        bool locked;
+        u32 seq;
+
+        if (pthread_mutex_trylock(lock) == 0) {
+            lh_delegate_combine(q, LH_DELEGATE_BATCH_MAX);
+            pthread_mutex_unlock(lock);
+            continue;
+        }
+
+        st = lock_owner_state(lock_addr, &owner_cpu);
+        if ((st == LH_OWNER_RUNNING && get_time_ns() < spin_deadline_ns) ||
+            (st == LH_OWNER_UNKNOWN && spin_count < SPIN_TRIES)) {
+            for (int i = 0; i < SPIN_PAUSE_ITERS; i++)
+                cpu_relax();
+            spin_count++;
+            continue;
+        }
+
+        /* 睡眠期间保持 waiter hint（PARKED），唤醒时调度器把它放到 owner CPU 附近 */
+        if (!waiting) {
+            waiter_slot_set(tid, lock_addr, owner_cpu, start_ns);
+            waiting = true;
+        }
+        waiter_slot_park(tid, owner_cpu);
+        seq = lh_delegate_park_prepare(q);
+        locked = !lh_delegate_done(&req) && pthread_mutex_trylock(lock) == 0;
+        if (!locked && !lh_delegate_done(&req))
+            lh_delegate_park(q, seq, DELEGATE_PARK_US);
+        lh_delegate_unpark(q);
+        if (locked) {
+            lh_delegate_combine(q, LH_DELEGATE_BATCH_MAX);
+            pthread_mutex_unlock(lock);
+        }
+    }
+
+    if (waiting)
+        waiter_slot_clear(tid, lock_addr);
+}
+
+/* ========== 拦截函数: rwlock ==========
+ * 写者与 mutex 相同（lock_table 记录 owner）；读者可以有多个，
+ * 只标记 IN_CS，不写 lock_table。unlock 时按 lock_table 的 owner_tid 区分。
+ */
+
+static void on_read_acquired(void)
+{
+    cs_slot_enter(get_tid());
+}
+
+int pthread_rwlock_rdlock(pthread_rwlock_t *rwlock)
+{
+    LH_PASSTHROUGH(real_pthread_rwlock_rdlock, "pthread_rwlock_rdlock", rwlock);
+    LH_FILTERED(rwlock, real_pthread_rwlock_rdlock, rwlock);
+
+    u64 wait_start_ns = 0;
+    int ret = handoff_reserved(rwlock) ? EBUSY : real_pthread_rwlock_tryrdlock(rwlock);
+    if (ret != 0) {
+        wait_start_ns = PROFILE_WAIT_START();
+        ret = lh_lock_contended(rwlock, rwlock_tryrdlock_fn, rwlock_rdlock_fn, NULL);
+    }
+
+    if (ret == 0) {
+        on_read_acquired();
+        PROFILE_ACQUIRED((u64)(uintptr_t)rwlock, wait_start_ns);
+    }
+    return ret;
+}
+
+int pthread_rwlock_tryrdlock(pthread_rwlock_t *rwlock)
+{
+    LH_PASSTHROUGH(real_pthread_rwlock_tryrdlock, "pthread_rwlock_tryrdlock", rwlock);
+    LH_FILTERED(rwlock, real_pthread_rwlock_tryrdlock, rwlock);
+
+    int ret = real_pthread_rwlock_tryrdlock(rwlock);
+    if (ret == 0) {
+        on_read_acquired();
+        PROFILE_ACQUIRED((u64)(uintptr_t)rwlock, 0);
+    }
+    return ret;
+}
+
+int pthread_rwlock_timedrdlock(pthread_rwlock_t *rwlock, const struct timespec *abstime)
+{
+    LH_PASSTHROUGH(real_pthread_rwlock_timedrdlock, "pthread_rwlock_timedrdlock",
+                   rwlock, abstime);
+    LH_FILTERED(rwlock, real_pthread_rwlock_timedrdlock, rwlock, abstime);
+
+    int ret = real_pthread_rwlock_timedrdlock(rwlock, abstime);
+    if (ret == 0) {
+        on_read_acquired();
+        PROFILE_ACQUIRED((u64)(uintptr_t)rwlock, 0);
+    }
+    return ret;
+}
+
+int pthread_rwlock_wrlock(pthread_rwlock_t *rwlock)
+{
+    LH_PASSTHROUGH(real_pthread_rwlock_wrlock, "pthread_rwlock_wrlock", rwlock);
+    LH_FILTERED(rwlock, real_pthread_rwlock_wrlock, rwlock);
+
+    u64 wait_start_ns = 0;
+    int ret = handoff_reserved(rwlock) ? EBUSY : real_pthread_rwlock_trywrlock(rwlock);
+    if (ret != 0) {
+        wait_start_ns = PROFILE_WAIT_START();
+        ret = lh_lock_contended(rwlock, rwlock_trywrlock_fn, rwlock_wrlock_fn, NULL);
+    }
+
+    if (ret == 0) {
+        on_lock_acquired((u64)(uintptr_t)rwlock);
+        PROFILE_ACQUIRED((u64)(uintptr_t)rwlock, wait_start_ns);
+    }
+    return ret;
+}
+
+int pthread_rwlock_trywrlock(pthread_rwlock_t *rwlock)
+{
+    LH_PASSTHROUGH(real_pthread_rwlock_trywrlock, "pthread_rwlock_trywrlock", rwlock);
+    LH_FILTERED(rwlock, real_pthread_rwlock_trywrlock, rwlock);
+
+    int ret = real_pthread_rwlock_trywrlock(rwlock);
+    if (ret == 0) {
+        on_lock_acquired((u64)(uintptr_t)rwlock);
+        PROFILE_ACQUIRED((u64)(uintptr_t)rwlock, 0);
+    }
+    return ret;
+}
+
+int pthread_rwlock_timedwrlock(pthread_rwlock_t *rwlock, const struct timespec *abstime)
+{
+    LH_PASSTHROUGH(real_pthread_rwlock_timedwrlock, "pthread_rwlock_timedwrlock",
+                   rwlock, abstime);
+    LH_FILTERED(rwlock, real_pthread_rwlock_timedwrlock, rwlock, abstime);
+
+    int ret = real_pthread_rwlock_timedwrlock(rwlock, abstime);
+    if (ret == 0) {
+        on_lock_acquired((u64)(uintptr_t)rwlock);
+        PROFILE_ACQUIRED((u64)(uintptr_t)rwlock, 0);
+    }
+    return ret;
+}
+
+int pthread_rwlock_unlock(pthread_rwlock_t *rwlock)
+{
+    LH_PASSTHROUGH(real_pthread_rwlock_unlock, "pthread_rwlock_unlock", rwlock);
+    LH_FILTERED(rwlock, real_pthread_rwlock_unlock, rwlock);
+
+    u32 tid = get_tid();
+    u64 lock_addr = (u64)(uintptr_t)rwlock;
+    bool has_waiter = has_waiters_for_lock(lock_addr);
+
+    /* 写者删除自己的 lock_table entry，读者只退出 IN_CS */
+    lock_table_remove_owned(lock_addr, tid);
+    cs_slot_pop_lock(tid, lock_addr);
+    cs_slot_leave(tid);
+    if (g_lh_profile)
+        lh_profile_released(lock_addr);
+    handoff_grant(lock_addr);
+
+    int ret = real_pthread_rwlock_unlock(rwlock);
+
+    if (has_waiter) {
+        sched_yield();
+    }
+
+    return ret;
+}
+
+/* ========== 拦截函数: destroy ==========
+ * 锁销毁后同一地址可能被重新分配给另一把锁，清掉 LH_INCLUDE / LH_EXCLUDE
+ * 缓存的决定，回收 lh_delegate 的队列。销毁失败（锁仍被持有）时保留，unlock 还要用。
+ */
+int pthread_mutex_destroy(pthread_mutex_t *mutex)
+{
+    LH_PASSTHROUGH(real_pthread_mutex_destroy, "pthread_mutex_destroy", mutex);
+
+    int ret = real_pthread_mutex_destroy(mutex);
+    if (ret == 0 && g_lh_filter)
+        lh_filter_forget((u64)(uintptr_t)mutex);
+    if (ret == 0 && atomic_load_explicit(&g_lh_delegate_nr_queues, memory_order_relaxed))
+        lh_delegate_queue_release((u64)(uintptr_t)mutex);
+    return ret;
+}
+
+int pthread_rwlock_destroy(pthread_rwlock_t *rwlock)
+{
+    LH_PASSTHROUGH(real_pthread_rwlock_destroy, "pthread_rwlock_destroy", rwlock);
+
+    int ret = real_pthread_rwlock_destroy(rwlock);
+    if (ret == 0 && g_lh_filter)
+        lh_filter_forget((u64)(uintptr_t)rwlock);
+    return ret;
+}
+
+/* ========== 拦截函数: condvar ==========
+ * 等待期间 glibc 在内部释放/重新获取 mutex，不经过上面的 shim，
+ * 这里在等待前后同步 hints，避免睡眠中的线程仍被当成 owner。
+ */
+
+int pthread_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex)
+{
+    LH_PASSTHROUGH(real_pthread_cond_wait, "pthread_cond_wait", cond, mutex);
+    LH_FILTERED(mutex, real_pthread_cond_wait, cond, mutex);
+
+    u64 lock_addr = (u64)(uintptr_t)mutex;
+
+    on_lock_release(lock_addr);
+    int ret = real_pthread_cond_wait(cond, mutex);
+    on_lock_acquired(lock_addr);
+    PROFILE_ACQUIRED(lock_addr, 0);
+    return ret;
+}
+
+int pthread_cond_timedwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                           const struct timespec *abstime)
+{
+    LH_PASSTHROUGH(real_pthread_cond_timedwait, "pthread_cond_timedwait",
+                   cond, mutex, abstime);
+    LH_FILTERED(mutex, real_pthread_cond_timedwait, cond, mutex, abstime);
+
+    u64 lock_addr = (u64)(uintptr_t)mutex;
+
+    on_lock_release(lock_addr);
+    int ret = real_pthread_cond_timedwait(cond, mutex, abstime);
+    on_lock_acquired(lock_addr);
+    PROFILE_ACQUIRED(lock_addr, 0);
+    return ret;
+}
+
+int pthread_cond_clockwait(pthread_cond_t *cond, pthread_mutex_t *mutex,
+                           clockid_t clockid, const struct timespec *abstime)
+{
+    LH_PASSTHROUGH(real_pthread_cond_clockwait, "pthread_cond_clockwait",
+                   cond, mutex, clockid, abstime);
+    LH_FILTERED(mutex, real_pthread_cond_clockwait, cond, mutex, clockid, abstime);
+
+    u64 lock_addr = (u64)(uintptr_t)mutex;
+
+    on_lock_release(lock_addr);
+    int ret = real_pthread_cond_clockwait(cond, mutex, clockid, abstime);
+    on_lock_acquired(lock_addr);
+    PROFILE_ACQUIRED(lock_addr, 0);
+    return ret;
+}
+
+/* ========== __pthread_* 别名 ==========
+ * glibc 导出的内部名字，老二进制和部分库直接调用它们。
+ */
+int __pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+    return pthread_mutex_lock(mutex);
+}
+
+int __pthread_mutex_trylock(pthread_mutex_t *mutex)
+{
+    return pthread_mutex_trylock(mutex);
+}
+
+int __pthread_mutex_unlock(pthread_mutex_t *mutex)
+{
+    return pthread_mutex_unlock(mutex);
+}
+
+int __pthread_rwlock_rdlock(pthread_rwlock_t *rwlock)
+{
+    return pthread_rwlock_rdlock(rwlock);
+}
+
+int __pthread_rwlock_tryrdlock(pthread_rwlock_t *rwlock)
+{
+    return pthread_rwlock_tryrdlock(rwlock);
+}
+
+int __pthread_rwlock_wrlock(pthread_rwlock_t *rwlock)
+{
+    return pthread_rwlock_wrlock(rwlock);
+}
+
+int __pthread_rwlock_trywrlock(pthread_rwlock_t *rwlock)
+{
+    return pthread_rwlock_trywrlock(rwlock);
+}
+
+int __pthread_rwlock_unlock(pthread_rwlock_t *rwlock)
+{
+    return pthread_rwlock_unlock(rwlock);
+}
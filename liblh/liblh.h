@@ -0,0 +1,240 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * liblh.h - 显式标注 API
+ *
+ * 给 pthread 拦截覆盖不到的同步（手写 spinlock、lock-free + 回退路径）
+ * 手动发布 hints，写入与 liblh 相同的 thread_table / lock_table：
+ *
+ *   lh_cs_enter() / lh_cs_exit()          标记 IN_CS（可嵌套）
+ *   lh_owner_begin(a) / lh_owner_end(a)   登记/清除 a 的 owner（供 waiter 定向）
+ *   lh_wait_begin(a) / lh_wait_end()      标记正在等待 a
+ *   lh_handoff_hint(a)                    释放 a 后调用，有 waiter 时让出 CPU
+ *   lh_owner_running(tid, cpu)            owner 是否正在 CPU 上（调度器发布）
+ *   lh_delegate(m, fn, arg)               在持有 m 的线程上执行 fn(arg)（flat combining）
+ *
+ * 自带的 spinlock / ticket / MCS 锁见 lh_spinlock.h。
+ *
+ * 应用不需要链接 liblh：首次调用时用 dlsym 查找 LD_PRELOAD 进来的 liblh，
+ * 没有 liblh（或 LH_ENABLED=0、共享表未映射）时所有调用都是空操作。
+ * cs / wait 为 inline fast path（一次原子加减或几次 store），
+ * owner / handoff 需要查表，走 liblh 内的函数。
+ *
+ * glibc < 2.34 需要链接 -ldl。
+ */
+#ifndef __LIBLH_H
+#define __LIBLH_H
+
+#include <stdint.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LH_API_VERSION  5
+
+/* 当前线程在共享表中的 slot（由 liblh 填写，应用只通过下面的 inline 函数访问） */
+struct lh_thread_hints {
+    unsigned int tid;
+    unsigned int *in_cs;            /* thread_slot.in_cs */
+    unsigned int *waiter_flags;     /* thread_slot.waiter_flags，最后 release store */
+    unsigned int *waiter_tid;
+    uint64_t *waiter_lock_addr;
+    int32_t *waiter_target_cpu;
+    uint32_t *waiter_start_us;      /* CLOCK_MONOTONIC 微秒低 32 位，0 = 未知；调度器据此判断等待老化 */
+    unsigned int *lock_waiters;     /* 每把锁的 waiter 计数（按 __lh_waiter_idx），unlock / lh_handoff_hint 据此 yield */
+};
+
+#define LH_LOCK_WAITER_SLOTS    4096    /* 2 的幂 */
+
+static inline unsigned int __lh_waiter_idx(const void *addr)
+{
+    return (unsigned int)(((uint64_t)(uintptr_t)addr * 0x9E3779B97F4A7C15ULL) >> 52) &
+           (LH_LOCK_WAITER_SLOTS - 1);
+}
+
+struct lh_api {
+    unsigned int version;
+    struct lh_thread_hints *(*thread_hints)(void);
+    void (*owner_begin)(const void *addr);
+    void (*owner_end)(const void *addr);
+    void (*handoff_hint)(const void *addr);
+    int (*current_cpu)(void);
+    /* per-CPU 当前 tid 表，调度器未提供时为 NULL */
+    const unsigned int *cpu_curr;   /* &cpu_table[0].curr_tid */
+    unsigned int cpu_stride;        /* 相邻 CPU 之间的间隔（unsigned int 个数） */
+    unsigned int nr_cpu_slots;
+    void (*delegate)(pthread_mutex_t *lock, void (*fn)(void *), void *arg);
+};
+
+/* ========== 内部：查找 liblh ========== */
+static const struct lh_api *__lh_api_cache;
+static int __lh_api_resolved;
+static __thread struct lh_thread_hints *__lh_self_cache;
+static __thread int __lh_self_resolved;
+
+static inline const struct lh_api *__lh_api(void)
+{
+    if (__builtin_expect(!__atomic_load_n(&__lh_api_resolved, __ATOMIC_ACQUIRE), 0)) {
+        const struct lh_api *(*get)(void);
+        const struct lh_api *api = NULL;
+
+        *(void **)&get = dlsym(RTLD_DEFAULT, "liblh_api");
+        if (get) {
+            api = get();
+            if (api && api->version != LH_API_VERSION)
+                api = NULL;
+        }
+        __lh_api_cache = api;
+        __atomic_store_n(&__lh_api_resolved, 1, __ATOMIC_RELEASE);
+    }
+    return __lh_api_cache;
+}
+
+static inline struct lh_thread_hints *__lh_self(void)
+{
+    if (__builtin_expect(!__lh_self_resolved, 0)) {
+        const struct lh_api *api = __lh_api();
+
+        __lh_self_cache = api ? api->thread_hints() : NULL;
+        __lh_self_resolved = 1;
+    }
+    return __lh_self_cache;
+}
+
+/* ========== IN_CS ========== */
+static inline void lh_cs_enter(void)
+{
+    struct lh_thread_hints *h = __lh_self();
+
+    if (h)
+        __atomic_fetch_add(h->in_cs, 1, __ATOMIC_RELEASE);
+}
+
+static inline void lh_cs_exit(void)
+{
+    struct lh_thread_hints *h = __lh_self();
+
+    if (h && __atomic_fetch_sub(h->in_cs, 1, __ATOMIC_RELEASE) == 0)
+        __atomic_store_n(h->in_cs, 0, __ATOMIC_RELEASE);
+}
+
+/* ========== waiter ========== */
+
+/* 上一次 lh_wait_begin 还没有 lh_wait_end：撤销它的计数 */
+static inline void __lh_wait_uncount(struct lh_thread_hints *h)
+{
+    if (__atomic_load_n(h->waiter_flags, __ATOMIC_RELAXED))
+        __atomic_fetch_sub(&h->lock_waiters[__lh_waiter_idx((const void *)(uintptr_t)*h->waiter_lock_addr)],
+                           1, __ATOMIC_RELAXED);
+}
+
+/* 已知 owner CPU 时直接定向 */
+static inline void lh_wait_begin_cpu(const void *addr, int target_cpu)
+{
+    struct lh_thread_hints *h = __lh_self();
+    struct timespec ts;
+
+    if (!h)
+        return;
+    __lh_wait_uncount(h);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    *h->waiter_tid = h->tid;
+    *h->waiter_lock_addr = (uint64_t)(uintptr_t)addr;
+    *h->waiter_target_cpu = target_cpu;
+    *h->waiter_start_us = (uint32_t)((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000) | 1;
+    __atomic_fetch_add(&h->lock_waiters[__lh_waiter_idx(addr)], 1, __ATOMIC_RELAXED);
+    __atomic_store_n(h->waiter_flags, 1, __ATOMIC_RELEASE);
+}
+
+/* target_cpu 填 -1，由调度器按 addr 查 lock_table 得到 owner CPU */
+static inline void lh_wait_begin(const void *addr)
+{
+    lh_wait_begin_cpu(addr, -1);
+}
+
+static inline void lh_wait_end(void)
+{
+    struct lh_thread_hints *h = __lh_self();
+
+    if (h) {
+        __lh_wait_uncount(h);
+        __atomic_store_n(h->waiter_flags, 0, __ATOMIC_RELEASE);
+    }
+}
+
+/* ========== owner 运行状态 ==========
+ * 返回 0 表示确定 tid 已不在 cpu 上运行（被抢占/睡眠），继续 spin 没有意义；
+ * 没有调度器信息或参数无效时返回 1（按在运行处理，退化为普通 spin）。
+ * owner 迁移后 cpu 过期也会返回 0，调用者据此 yield 是安全的。
+ */
+static inline int lh_owner_running(unsigned int tid, int cpu)
+{
+    const struct lh_api *api = __lh_api();
+
+    if (!api || !api->cpu_curr || !tid || cpu < 0 ||
+        (unsigned int)cpu >= api->nr_cpu_slots)
+        return 1;
+    return __atomic_load_n(&api->cpu_curr[(unsigned int)cpu * api->cpu_stride],
+                           __ATOMIC_RELAXED) == tid;
+}
+
+static inline int lh_current_cpu(void)
+{
+    const struct lh_api *api = __lh_api();
+
+    return api ? api->current_cpu() : -1;
+}
+
+/* ========== owner / handoff ========== */
+static inline void lh_owner_begin(const void *addr)
+{
+    const struct lh_api *api = __lh_api();
+
+    if (api)
+        api->owner_begin(addr);
+}
+
+static inline void lh_owner_end(const void *addr)
+{
+    const struct lh_api *api = __lh_api();
+
+    if (api)
+        api->owner_end(addr);
+}
+
+static inline void lh_handoff_hint(const void *addr)
+{
+    const struct lh_api *api = __lh_api();
+
+    if (api)
+        api->handoff_hint(addr);
+}
+
+/* ========== 委托执行 ==========
+ * 在持有 lock 的状态下执行 fn(arg)，返回时 fn 已执行完。并发的调用者把 fn 挂到
+ * lock 的合并队列上，拿到锁的那个线程（combiner）一次把队列里的都执行掉，
+ * 锁和数据不用在 CPU 之间来回搬，适合很短、很热的临界区。
+ * fn 可能在别的线程上执行：不能依赖 TLS，不能再对 lock 加锁或 lh_delegate。
+ * 同一把锁可以同时有普通 pthread_mutex_lock 的用户。没有 liblh 时直接加锁执行。
+ */
+static inline void lh_delegate(pthread_mutex_t *lock, void (*fn)(void *), void *arg)
+{
+    const struct lh_api *api = __lh_api();
+
+    if (api) {
+        api->delegate(lock, fn, arg);
+        return;
+    }
+    pthread_mutex_lock(lock);
+    fn(arg);
+    pthread_mutex_unlock(lock);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __LIBLH_H */
@@ -1,14 +1,21 @@
 /* SPDX-License-Identifier: MIT */
 /*
  * rseq.h - Restartable Sequences 支持
- * 用于零 syscall 获取当前 CPU ID
+ * 用于零 syscall 获取当前 CPU ID，以及 per-CPU 临界区
+ *
+ * glibc >= 2.35 在创建线程时已经注册了 rseq（一个线程只能注册一个区域），
+ * 通过 __rseq_offset / __rseq_size 找到它直接使用；glibc 没有注册
+ * （旧版本或 glibc.pthread.rseq=0）时才注册自己的。两者都失败时
+ * rseq_cpu_id() 返回 -1，不再重试 syscall。
  */
 #ifndef __LH_RSEQ_H
 #define __LH_RSEQ_H
 
 #define _GNU_SOURCE
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <sys/syscall.h>
 #include <unistd.h>
 #include <linux/rseq.h>
@@ -21,25 +28,135 @@
 #define RSEQ_SIG 0
 #endif
 
-static __thread volatile struct rseq __rseq_abi __attribute__((tls_model("initial-exec")));
-static __thread volatile bool __rseq_registered = false;
+/* glibc 2.35+ 导出；旧 glibc 上弱引用为 NULL */
+extern const ptrdiff_t __rseq_offset __attribute__((weak));
+extern const unsigned int __rseq_size __attribute__((weak));
 
-static inline int rseq_register(void)
+static __thread volatile struct rseq __lh_rseq_abi
+    __attribute__((tls_model("initial-exec"), aligned(32)));
+static __thread struct rseq *__rseq_area;      /* NULL = 未解析或不可用 */
+static __thread bool __rseq_resolved = false;
+
+/* glibc 已注册的区域：线程指针 + __rseq_offset */
+static inline struct rseq *rseq_glibc_area(void)
+{
+    if (!&__rseq_size || !&__rseq_offset || __rseq_size == 0)
+        return NULL;
+    return (struct rseq *)((char *)__builtin_thread_pointer() + __rseq_offset);
+}
+
+static inline struct rseq *rseq_resolve(void)
+{
+    struct rseq *area = rseq_glibc_area();
+
+    if (!area && syscall(__NR_rseq, &__lh_rseq_abi, sizeof(__lh_rseq_abi), 0, RSEQ_SIG) == 0)
+        area = (struct rseq *)&__lh_rseq_abi;
+    __rseq_area = area;
+    __rseq_resolved = true;
+    return area;
+}
+
+/* 本线程的 rseq 区域，不可用时返回 NULL（每线程只解析一次） */
+static inline struct rseq *rseq_area(void)
 {
-    if (__rseq_registered)
-        return 0;
-    int ret = syscall(__NR_rseq, &__rseq_abi, sizeof(__rseq_abi), 0, RSEQ_SIG);
-    if (ret == 0)
-        __rseq_registered = true;
-    return ret;
+    if (__builtin_expect(__rseq_resolved, 1))
+        return __rseq_area;
+    return rseq_resolve();
 }
 
-/* 获取当前 CPU ID（零 syscall） */
+/* 获取当前 CPU ID（零 syscall），rseq 不可用时返回 -1 */
 static inline int32_t rseq_cpu_id(void)
 {
-    if (!__rseq_registered)
-        rseq_register();
-    return __rseq_abi.cpu_id;
+    struct rseq *rs = rseq_area();
+
+    return rs ? (int32_t)*(volatile uint32_t *)&rs->cpu_id : -1;
+}
+
+/* ========== per-CPU 临界区 ==========
+ * rseq_percpu_add: 当前 CPU 仍是 cpu 时把 *v += count，否则（或在临界区内
+ * 被抢占、迁移、收到信号）返回 -1，调用方重新取 CPU 后重试。
+ * 最后一条 addq 是提交点，之前的任何中断都会让内核跳到 abort。
+ * 目前只有 x86_64 实现（定义 RSEQ_HAS_PERCPU_OPS），其它架构返回 -1。
+ */
+#define __rseq_str_1(x) #x
+#define __rseq_str(x)   __rseq_str_1(x)
+
+#ifdef __x86_64__
+#define RSEQ_HAS_PERCPU_OPS
+
+#define RSEQ_ASM_DEFINE_TABLE(label, start_ip, post_commit_ip, abort_ip)            \
+    ".pushsection __rseq_cs, \"aw\"\n\t"                                            \
+    ".balign 32\n\t"                                                                \
+    __rseq_str(label) ":\n\t"                                                       \
+    ".long 0x0, 0x0\n\t"                                                            \
+    ".quad " __rseq_str(start_ip) ", (" __rseq_str(post_commit_ip) " - "            \
+    __rseq_str(start_ip) "), " __rseq_str(abort_ip) "\n\t"                          \
+    ".popsection\n\t"
+
+/* abort 入口前 4 字节必须是 RSEQ_SIG（ud1 <sig>(%rip),%edi 便于反汇编） */
+#define RSEQ_ASM_DEFINE_ABORT(label, abort_label)                                   \
+    ".pushsection __rseq_failure, \"ax\"\n\t"                                       \
+    ".byte 0x0f, 0xb9, 0x3d\n\t"                                                    \
+    ".long " __rseq_str(RSEQ_SIG) "\n\t"                                            \
+    __rseq_str(label) ":\n\t"                                                       \
+    "jmp %l[" __rseq_str(abort_label) "]\n\t"                                       \
+    ".popsection\n\t"
+
+static inline int rseq_percpu_add(struct rseq *rs, uint64_t *v, uint64_t count, int32_t cpu)
+{
+    __asm__ __volatile__ goto(
+        RSEQ_ASM_DEFINE_TABLE(3, 1f, 2f, 4f)
+        "leaq 3b(%%rip), %%rax\n\t"
+        "movq %%rax, %[rseq_cs]\n\t"
+        "1:\n\t"
+        "cmpl %[cpu], %[cur_cpu]\n\t"
+        "jnz 4f\n\t"
+        "addq %[count], %[v]\n\t"
+        "2:\n\t"
+        RSEQ_ASM_DEFINE_ABORT(4, abort)
+        : /* asm goto 不能有输出 */
+        : [cpu]     "r" (cpu),
+          [cur_cpu] "m" (rs->cpu_id),
+          [rseq_cs] "m" (rs->rseq_cs),
+          [v]       "m" (*v),
+          [count]   "er" (count)
+        : "memory", "cc", "rax"
+        : abort);
+    return 0;
+abort:
+    return -1;
+}
+#else
+static inline int rseq_percpu_add(struct rseq *rs, uint64_t *v, uint64_t count, int32_t cpu)
+{
+    (void)rs; (void)v; (void)count; (void)cpu;
+    return -1;
+}
+#endif
+
+/*
+ * 给当前 CPU 的计数器加 count：counter(cpu) 为 base + cpu * stride 字节处的 u64，
+ * nr_cpus 必须覆盖所有可能的 CPU id。rseq 不可用时退化为原子加
+ * （仍然是同一个数组项，只是可能跨 CPU 争用）；同一进程内两种方式不会混用。
+ */
+static inline void rseq_percpu_counter_add(void *base, size_t stride, uint32_t nr_cpus,
+                                           uint64_t count)
+{
+    struct rseq *rs = rseq_area();
+    int32_t cpu;
+
+#ifdef RSEQ_HAS_PERCPU_OPS
+    while (rs && (cpu = rseq_cpu_id()) >= 0 && (uint32_t)cpu < nr_cpus) {
+        if (rseq_percpu_add(rs, (uint64_t *)((char *)base + (size_t)cpu * stride),
+                            count, cpu) == 0)
+            return;
+    }
+#endif
+    cpu = rs ? rseq_cpu_id() : -1;
+    if (cpu < 0 || (uint32_t)cpu >= nr_cpus)
+        cpu = 0;
+    atomic_fetch_add_explicit((_Atomic uint64_t *)((char *)base + (size_t)cpu * stride),
+                              count, memory_order_relaxed);
 }
 
 #endif /* __LH_RSEQ_H */
@@ -10,24 +10,29 @@
 
 char _license[] SEC("license") = "GPL";
 
-/* ========== 配置常量 ========== */
-#define CACHELINE_SIZE          64
-#define LH_LOCK_TABLE_BUCKETS   1024
-#define LH_WAITER_TABLE_SLOTS   4096
-#define LH_CS_TABLE_SLOTS       4096
-#define LH_MAX_ALLOWED_TGIDS    256
+/* 共享常量与数据结构（lock_table / thread_table / cpu_table 布局）只在 lh_shared.h 定义 */
+#include "../common/lh_shared.h"
+/* 调度决策和锁亲和组算法，与模拟器 tests/lh_sim.c 共用 */
+#include "../common/lh_policy.h"
 
-#define LH_SLICE_NORMAL_NS      (5 * 1000 * 1000)
-#define LH_SLICE_IN_CS_MULT     4
-#define LH_SLICE_WAITER_NS      (1 * 1000 * 1000)
+/* ========== 配置常量 ========== */
+#define LH_FUTEX_CMD_MASK       0x7f    /* 去掉 PRIVATE / CLOCK_REALTIME */
+#define LH_FUTEX_WAIT           0
+#define LH_FUTEX_WAKE           1
+#define LH_FUTEX_LOCK_PI        6
+#define LH_FUTEX_UNLOCK_PI      7
+#define LH_FUTEX_WAIT_BITSET    9
+#define LH_FUTEX_WAKE_BITSET    10
+#define LH_FUTEX_LOCK_PI2       13
 
-#define LH_DSQ_NORMAL           0
-#define LH_DSQ_LOCKWAIT_BASE    1000
+#define LH_PULL_SCAN_MAX        64      /* dispatch 找被抢占的 owner 时最多看 DSQ 的前几个任务 */
+#define LH_COHORT_SCAN_MAX      16      /* dispatch 找同节点 waiter 时最多看 DSQ 的前几个任务 */
 
-#define LH_WAITER_INACTIVE      0
-#define LH_WAITER_ACTIVE        1
+#define CLOCK_MONOTONIC         1
 
-#define SCX_ENQ_PREEMPT         0x1ULL
+/* enum scx_enq_flags */
+#define SCX_ENQ_HEAD            (1ULL << 4)
+#define SCX_ENQ_PREEMPT         (1ULL << 32)
 
 /* 内置 DSQ IDs (from vmlinux.h scx_dsq_id_flags) */
 #define SCX_DSQ_FLAG_BUILTIN    0x8000000000000000ULL
@@ -36,37 +41,6 @@ char _license[] SEC("license") = "GPL";
 #define SCX_DSQ_LOCAL_ON        0xC000000000000000ULL
 #define SCX_DSQ_LOCAL_CPU_MASK  0x00000000FFFFFFFFULL
 
-#define LH_DSQ_LOCKWAIT(cpu)    (LH_DSQ_LOCKWAIT_BASE + (cpu))
-
-/* ========== 数据结构 ========== */
-struct lh_lock_entry {
-    u32 tag;
-    u32 owner_tid;
-    s32 owner_cpu;
-    u32 gen;
-    u64 t_start_ns;
-    u8  pad[CACHELINE_SIZE - (4 + 4 + 4 + 4 + 8)];
-};
-
-struct lh_lock_bucket {
-    struct lh_lock_entry way[2];
-};
-
-struct lh_waiter_slot {
-    u32 flags;
-    u32 tid;
-    u64 lock_addr;
-    s32 target_cpu;
-    u32 pad0;
-    u8  pad[CACHELINE_SIZE - (4 + 4 + 8 + 4 + 4)];
-};
-
-struct lh_cs_slot {
-    u32 in_cs;
-    u32 pad;
-    u8  pad2[CACHELINE_SIZE - 8];
-};
-
 /* ========== BPF Maps ========== */
 struct {
     __uint(type, BPF_MAP_TYPE_HASH);
@@ -75,34 +49,130 @@ struct {
     __type(value, u8);
 } allowed_tgids SEC(".maps");
 
-struct {
+/*
+ * lock_table / thread_table 每个 NUMA 节点一个分区（key = 节点号）。
+ * 分区由 launcher 在 load 之后按节点创建（numa_node = 节点号）并填入，
+ * 这里的内层定义只是模板；map_flags 必须与 launcher 创建的一致。
+ */
+struct lock_table_part {
     __uint(type, BPF_MAP_TYPE_ARRAY);
     __uint(max_entries, LH_LOCK_TABLE_BUCKETS);
     __type(key, u32);
     __type(value, struct lh_lock_bucket);
-    __uint(map_flags, BPF_F_MMAPABLE);
-} lock_table SEC(".maps");
+    __uint(map_flags, BPF_F_MMAPABLE | BPF_F_NUMA_NODE);
+};
 
 struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+    __uint(max_entries, LH_NUMA_NODES_MAX);
+    __type(key, u32);
+    __array(values, struct lock_table_part);
+} lock_tables SEC(".maps");
+
+/* per-thread cs + waiter 状态 */
+struct thread_table_part {
     __uint(type, BPF_MAP_TYPE_ARRAY);
-    __uint(max_entries, LH_WAITER_TABLE_SLOTS);
+    __uint(max_entries, LH_THREAD_TABLE_SLOTS);
     __type(key, u32);
-    __type(value, struct lh_waiter_slot);
-    __uint(map_flags, BPF_F_MMAPABLE);
-} waiter_table SEC(".maps");
+    __type(value, struct lh_thread_slot);
+    __uint(map_flags, BPF_F_MMAPABLE | BPF_F_NUMA_NODE);
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY_OF_MAPS);
+    __uint(max_entries, LH_NUMA_NODES_MAX);
+    __type(key, u32);
+    __array(values, struct thread_table_part);
+} thread_tables SEC(".maps");
 
+/* per-CPU 当前运行的 tid，供用户态 spin 判断 owner 是否在 CPU 上 */
 struct {
     __uint(type, BPF_MAP_TYPE_ARRAY);
-    __uint(max_entries, LH_CS_TABLE_SLOTS);
+    __uint(max_entries, LH_CPU_TABLE_SLOTS);
     __type(key, u32);
-    __type(value, struct lh_cs_slot);
+    __type(value, struct lh_cpu_slot);
     __uint(map_flags, BPF_F_MMAPABLE);
-} cs_table SEC(".maps");
+} cpu_table SEC(".maps");
+
+/* per-CPU：dispatch 连续越过队首取同节点 waiter 的次数（NUMA cohort） */
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, LH_CPU_TABLE_SLOTS);
+    __type(key, u32);
+    __type(value, u32);
+} cohort_skips SEC(".maps");
 
-/* task_storage: 缓存 controlled 状态 */
+/* 阻塞了一条等待链的根 owner：tid → 最近一次被 waiter 发现的时间 */
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, LH_THREAD_TABLE_SLOTS);
+    __type(key, u32);
+    __type(value, u64);
+} chain_boost SEC(".maps");
+
+/*
+ * futex 推断的 owner：key = (tgid, uaddr)。
+ * owner_tid = 0 表示已释放，此时 owner_cpu 为释放者（waker）所在 CPU。
+ */
+struct lh_futex_key {
+    u32 tgid;
+    u32 pad;
+    u64 uaddr;
+};
+
+struct lh_futex_owner {
+    u32 owner_tid;
+    s32 owner_cpu;
+    u64 t_update_ns;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, LH_FUTEX_OWNER_ENTRIES);
+    __type(key, struct lh_futex_key);
+    __type(value, struct lh_futex_owner);
+} futex_owners SEC(".maps");
+
+/*
+ * 锁亲和组：key = (tgid, 锁地址)，成员是反复在这把锁上竞争的线程。
+ * 成员数按周期（LH_GROUP_EPOCH_NS）统计，周期结束时由 group_timer 折算并重新平衡。
+ * 值 struct lh_lock_group 和计票、分配算法在 lh_policy.h，与模拟器共用。
+ */
+struct lh_group_key {
+    u32 tgid;
+    u32 pad;
+    u64 lock_addr;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(max_entries, LH_GROUP_ENTRIES);
+    __type(key, struct lh_group_key);
+    __type(value, struct lh_lock_group);
+} lock_groups SEC(".maps");
+
+struct group_timer_val {
+    struct bpf_timer timer;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, u32);
+    __type(value, struct group_timer_val);
+} group_timer SEC(".maps");
+
+/* task_storage: 缓存 controlled 状态 + futex 推断状态 + 锁亲和组成员关系 */
 struct task_ctx {
     bool controlled;
     bool checked;
+    u64 futex_wait_addr;    /* 正在 FUTEX_WAIT 的地址，0 = 无 */
+    u64 futex_cs_addr;      /* 推断持有的 futex 锁 */
+    u64 futex_cs_ns;        /* 推断开始持有的时间，0 = 无 */
+    u64 group_lock;         /* 竞争最多的锁（多数票），即所属的亲和组 */
+    u32 group_score;        /* >= LH_GROUP_JOIN_SCORE 才算组成员 */
+    u32 group_wait_us;      /* 已计票的那次等待的 wait_start_us，一次等待只计一票 */
+    u64 group_epoch;        /* 已计入成员数的周期 */
 };
 
 struct {
@@ -115,16 +185,23 @@ struct {
 /* ========== 全局变量 ========== */
 const volatile u32 nr_cpus = 1;
 const volatile u64 hash_salt = 0x12345678deadbeef;
-
-/* ========== 辅助宏 ========== */
-#define LH_BUCKET_IDX(lock_addr) \
-    (((u32)((lock_addr) ^ hash_salt) * 2654435761u) % LH_LOCK_TABLE_BUCKETS)
-
-#define LH_TAG_FROM_ADDR(lock_addr) \
-    ((u32)(((lock_addr) ^ hash_salt) >> 32) | 1)
-
-#define LH_WAITER_SLOT_IDX(tid) ((tid) % LH_WAITER_TABLE_SLOTS)
-#define LH_CS_SLOT_IDX(tid)     ((tid) % LH_CS_TABLE_SLOTS)
+const volatile u32 futex_track = 0;    /* launcher -f */
+const volatile u32 nr_nodes = 1;       /* lock_tables / thread_tables 的分区数 */
+const volatile u64 handoff_age_ns = 0; /* waiter 老化上限（launcher -a），0 = 不启用 */
+const volatile u32 cohort_max = 0;     /* 连续优先同节点 waiter 的次数（launcher -k），0 = 不启用 */
+const volatile u8 cpu_node[LH_CPU_TABLE_SLOTS] = {};  /* CPU → NUMA 节点（launcher 从 sysfs 读） */
+const volatile u32 group_place = 0;    /* 锁亲和组放置（launcher -g） */
+const volatile u32 nr_llcs = 1;
+const volatile u16 llc_nr_cpus[LH_LLC_MAX] = {};                 /* 每个 LLC 域的 CPU 数（容量） */
+const volatile s16 llc_cpus[LH_LLC_MAX][LH_LLC_CPUS_MAX] = {};   /* 每个域的 CPU，-1 结束 */
+const volatile u8 cpu_llc[LH_CPU_TABLE_SLOTS] = {};              /* CPU → LLC 域 */
+
+/* 锁亲和组的当前周期和每个 LLC 域已放置的成员数（group_timer 维护） */
+u64 group_epoch = 1;
+u32 llc_load[LH_LLC_MAX];
+
+/* 所有任务共享的 DSQ：init 创建 LH_DSQ_NORMAL，失败时退回 SCX_DSQ_GLOBAL（不拉取 owner） */
+u64 normal_dsq = SCX_DSQ_GLOBAL;
 
 /* ========== 辅助函数 ========== */
 static __always_inline bool is_task_controlled(struct task_struct *p)
@@ -150,118 +227,602 @@ static __always_inline bool is_task_controlled(struct task_struct *p)
     return allowed != NULL;
 }
 
+/* owner 写在自己 home 节点的分区里，按锁地址扫描所有分区 */
+static __always_inline struct lh_lock_entry *lookup_lock_entry(u64 lock_addr)
+{
+    u32 bucket_idx = LH_BUCKET_IDX(lock_addr, hash_salt);
+
+    if (!lock_addr)
+        return NULL;
+
+    for (u32 node = 0; node < LH_NUMA_NODES_MAX && node < nr_nodes; node++) {
+        struct lh_lock_bucket *bucket;
+        void *part;
+
+        part = bpf_map_lookup_elem(&lock_tables, &node);
+        if (!part)
+            continue;
+        bucket = bpf_map_lookup_elem(part, &bucket_idx);
+        if (!bucket)
+            continue;
+
+        /* tag 是完整锁地址，不会匹配到同 bucket 里的其它锁 */
+        if (bucket->tag[0] == lock_addr)
+            return &bucket->way[0];
+        if (bucket->tag[1] == lock_addr)
+            return &bucket->way[1];
+    }
+    return NULL;
+}
+
+/*
+ * slot 只在线程的 home 分区里，按 slot->tid 找。tid 复用时旧线程的 slot
+ * 可能残留在别的分区，优先返回有状态（IN_CS / 持锁 / 等待）的那个。
+ */
+static __always_inline struct lh_thread_slot *lookup_thread(u32 tid)
+{
+    u32 slot_idx = LH_THREAD_SLOT_IDX(tid);
+    struct lh_thread_slot *found = NULL;
+
+    for (u32 node = 0; node < LH_NUMA_NODES_MAX && node < nr_nodes; node++) {
+        struct lh_thread_slot *slot;
+        void *part;
+
+        part = bpf_map_lookup_elem(&thread_tables, &node);
+        if (!part)
+            continue;
+        slot = bpf_map_lookup_elem(part, &slot_idx);
+        if (!slot || slot->tid != tid)
+            continue;
+        if (slot->in_cs || slot->nr_held || slot->waiter_flags != LH_WAITER_INACTIVE)
+            return slot;
+        found = slot;
+    }
+    return found;
+}
+
+/* ACTIVE（yield 中）或 PARKED（在 futex 上睡眠，唤醒时同样定向到 owner CPU） */
+static __always_inline struct lh_thread_slot *lookup_waiter(u32 tid)
+{
+    struct lh_thread_slot *slot = lookup_thread(tid);
+
+    if (!slot || slot->waiter_flags == LH_WAITER_INACTIVE)
+        return NULL;
+    return slot;
+}
+
+/*
+ * 沿 waiter → lock owner → owner 等待的锁 → ... 最多 LH_CHAIN_MAX_HOPS 跳，
+ * 返回链根 owner 所在 CPU。链长 >= 2（owner 自己也在等锁）时，
+ * 在 chain_boost 中标记根 owner，它 enqueue 时获得抢占和最长 slice。
+ */
 static __always_inline s32 get_waiter_target_cpu(struct task_struct *p)
 {
     u32 tid = BPF_CORE_READ(p, pid);
-    u32 slot_idx = LH_WAITER_SLOT_IDX(tid);
-    struct lh_waiter_slot *slot;
+    struct lh_thread_slot *slot;
+    u64 lock_addr;
+    u32 root_tid = 0;
+    s32 root_cpu = -1;
+    int hops = 0;
 
-    slot = bpf_map_lookup_elem(&waiter_table, &slot_idx);
+    slot = lookup_waiter(tid);
     if (!slot)
         return -1;
 
-    if (slot->flags != LH_WAITER_ACTIVE)
-        return -1;
+    lock_addr = slot->lock_addr;
+    for (int i = 0; i < LH_CHAIN_MAX_HOPS; i++) {
+        struct lh_lock_entry *e;
+        struct lh_thread_slot *next;
+        u32 owner_tid;
+
+        if (!lock_addr)
+            break;
+        e = lookup_lock_entry(lock_addr);
+        if (!e)
+            break;
+
+        owner_tid = e->owner_tid;
+        if (!owner_tid || owner_tid == tid)
+            break;
+        root_tid = owner_tid;
+        root_cpu = e->owner_cpu;
+        hops++;
+
+        next = lookup_waiter(owner_tid);
+        if (!next || next->lock_addr == lock_addr)
+            break;
+        lock_addr = next->lock_addr;
+    }
 
-    if (slot->tid != tid)
-        return -1;
+    if (hops >= 2) {
+        u64 now = bpf_ktime_get_ns();
+        bpf_map_update_elem(&chain_boost, &root_tid, &now, BPF_ANY);
+    }
+
+    if (root_cpu >= 0 && root_cpu < (s32)nr_cpus)
+        return root_cpu;
 
+    /* 链上查不到 owner 时用 liblh 填的 target_cpu */
     if (slot->target_cpu >= 0 && slot->target_cpu < (s32)nr_cpus)
         return slot->target_cpu;
 
-    if (slot->lock_addr != 0) {
-        u32 bucket_idx = LH_BUCKET_IDX(slot->lock_addr);
-        u32 tag = LH_TAG_FROM_ADDR(slot->lock_addr);
-        struct lh_lock_bucket *bucket;
+    return -1;
+}
 
-        bucket = bpf_map_lookup_elem(&lock_table, &bucket_idx);
-        if (bucket) {
-            if (bucket->way[0].tag == tag) {
-                s32 cpu = bucket->way[0].owner_cpu;
-                if (cpu >= 0 && cpu < (s32)nr_cpus)
-                    return cpu;
-            }
-            if (bucket->way[1].tag == tag) {
-                s32 cpu = bucket->way[1].owner_cpu;
-                if (cpu >= 0 && cpu < (s32)nr_cpus)
-                    return cpu;
-            }
-        }
-    }
+/* liblh waiter 等待超过老化上限：wait_start_us 是 CLOCK_MONOTONIC 微秒的低 32 位 */
+static __always_inline bool is_waiter_aged(struct task_struct *p)
+{
+    struct lh_thread_slot *slot;
+    u32 now_us;
 
-    return -1;
+    if (!handoff_age_ns)
+        return false;
+    slot = lookup_waiter(BPF_CORE_READ(p, pid));
+    if (!slot || !slot->wait_start_us)
+        return false;
+    now_us = (u32)(bpf_ktime_get_ns() / 1000);
+    return (u64)(u32)(now_us - slot->wait_start_us) * 1000 >= handoff_age_ns;
+}
+
+static __always_inline bool is_chain_root(struct task_struct *p)
+{
+    u32 tid = BPF_CORE_READ(p, pid);
+    u64 *t_ns = bpf_map_lookup_elem(&chain_boost, &tid);
+
+    return t_ns && bpf_ktime_get_ns() - *t_ns < LH_CHAIN_BOOST_TTL_NS;
 }
 
 static __always_inline bool is_task_in_cs(struct task_struct *p)
+{
+    struct lh_thread_slot *slot = lookup_thread(BPF_CORE_READ(p, pid));
+
+    return slot && slot->in_cs != 0;
+}
+
+/*
+ * 按 thread_slot.held 栈顶（最内层锁）找到本线程持有的 lock_entry，
+ * 用 EWMA 预测剩余持锁时间。entry 已不属于本线程或没有样本时不预测。
+ */
+static __always_inline bool predict_cs_remaining(struct task_struct *p, u64 *remaining_ns)
 {
     u32 tid = BPF_CORE_READ(p, pid);
-    u32 slot_idx = LH_CS_SLOT_IDX(tid);
-    struct lh_cs_slot *slot;
+    struct lh_thread_slot *slot;
+    struct lh_lock_entry *e;
+    u64 lock_addr, elapsed, ewma;
+    u32 top;
 
-    slot = bpf_map_lookup_elem(&cs_table, &slot_idx);
+    slot = lookup_thread(tid);
     if (!slot)
         return false;
 
-    return slot->in_cs != 0;
+    /* nr_held == 0 时 top 回绕成很大的值，一并被边界检查挡掉 */
+    top = slot->nr_held - 1;
+    if (top >= LH_HELD_LOCKS_MAX)
+        return false;
+    lock_addr = slot->held[top];
+
+    e = lookup_lock_entry(lock_addr);
+    if (!e || e->owner_tid != tid ||
+        e->ewma_tag != LH_EWMA_TAG(lock_addr, hash_salt))
+        return false;
+
+    ewma = e->hold_ewma_ns;
+    if (!ewma)
+        return false;
+
+    elapsed = bpf_ktime_get_ns() - e->t_start_ns;
+    *remaining_ns = ewma > elapsed ? ewma - elapsed : 0;
+    return true;
 }
 
-/* ========== sched_ext ops ========== */
-SEC("struct_ops/lhandoff_select_cpu")
-s32 BPF_PROG(lhandoff_select_cpu, struct task_struct *p, s32 prev_cpu, u64 wake_flags)
+/* ========== futex 推断 ==========
+ * 没有经过 liblh 的锁（absl::Mutex、folly、jemalloc 等直接用 futex 实现）：
+ * - FUTEX_WAIT 成功返回（被唤醒）的线程视为拿到锁的新 owner
+ * - 对同一地址 FUTEX_WAKE 视为释放，记录释放者 CPU 供被唤醒者定向
+ * 无竞争的加解锁不进内核，看不到；推断结果超过 LH_FUTEX_TTL_NS 即失效，
+ * 避免把 condvar 等非锁用途的 futex 长期当成 IN_CS。
+ */
+static __always_inline struct task_ctx *futex_task_ctx(struct task_struct *p)
 {
-    /* 确保 prev_cpu 有效 */
-    if (prev_cpu < 0 || prev_cpu >= (s32)nr_cpus)
-        prev_cpu = 0;
+    if (!futex_track)
+        return NULL;
+    return bpf_task_storage_get(&task_ctx_map, p, NULL, 0);
+}
 
-    if (!is_task_controlled(p))
-        return prev_cpu;
+static __always_inline bool futex_fresh(u64 t_ns)
+{
+    return t_ns && bpf_ktime_get_ns() - t_ns < LH_FUTEX_TTL_NS;
+}
+
+static __always_inline bool is_task_in_futex_cs(struct task_struct *p)
+{
+    struct task_ctx *ctx = futex_task_ctx(p);
+
+    return ctx && futex_fresh(ctx->futex_cs_ns);
+}
+
+static __always_inline s32 get_futex_target_cpu(struct task_struct *p)
+{
+    struct task_ctx *ctx = futex_task_ctx(p);
+    struct lh_futex_owner *owner;
+    struct lh_futex_key key = {};
+
+    if (!ctx || !ctx->futex_wait_addr)
+        return -1;
+
+    key.tgid = BPF_CORE_READ(p, tgid);
+    key.uaddr = ctx->futex_wait_addr;
+    owner = bpf_map_lookup_elem(&futex_owners, &key);
+    if (!owner || !futex_fresh(owner->t_update_ns))
+        return -1;
 
-    /* IN_CS owner: 保持在当前 CPU */
-    if (is_task_in_cs(p))
+    if (owner->owner_cpu >= 0 && owner->owner_cpu < (s32)nr_cpus)
+        return owner->owner_cpu;
+    return -1;
+}
+
+/* ========== 锁亲和组 ==========
+ * 计票和域分配见 lh_policy.h。select_cpu 只在组的域里有空闲 CPU 时把线程放过去
+ * （软放置），waiter 定向和 IN_CS 保持优先。
+ */
+static __always_inline bool group_enabled(void)
+{
+    return group_place && nr_llcs >= 2;
+}
+
+/* waiter 每次进入调度路径时调用，一次等待（wait_start_us 相同）只计一票 */
+static __always_inline void group_note(struct task_struct *p, s32 owner_cpu)
+{
+    struct lh_group_key key = {};
+    struct lh_thread_slot *slot;
+    struct lh_lock_group *g;
+    struct task_ctx *ctx;
+    u64 lock_addr;
+
+    if (!group_enabled())
+        return;
+    ctx = bpf_task_storage_get(&task_ctx_map, p, NULL, 0);
+    slot = lookup_waiter(BPF_CORE_READ(p, pid));
+    if (!ctx || !slot || !slot->lock_addr || !slot->wait_start_us ||
+        slot->wait_start_us == ctx->group_wait_us)
+        return;
+    ctx->group_wait_us = slot->wait_start_us;
+    lock_addr = slot->lock_addr;
+
+    if (!lh_policy_group_vote(&ctx->group_lock, &ctx->group_score, &ctx->group_epoch, lock_addr))
+        return;
+
+    key.tgid = BPF_CORE_READ(p, tgid);
+    key.lock_addr = lock_addr;
+    g = bpf_map_lookup_elem(&lock_groups, &key);
+    if (!g) {
+        struct lh_lock_group init = { .home_llc = -1 };
+
+        bpf_map_update_elem(&lock_groups, &key, &init, BPF_NOEXIST);
+        g = bpf_map_lookup_elem(&lock_groups, &key);
+        if (!g)
+            return;
+    }
+    g->owner_cpu = owner_cpu;
+    if (ctx->group_epoch != group_epoch) {
+        ctx->group_epoch = group_epoch;
+        __sync_fetch_and_add(&g->members_next, 1);
+    }
+}
+
+static long group_fold(void *map, struct lh_group_key *key, struct lh_lock_group *g, void *data)
+{
+    lh_policy_group_fold(g, llc_load);
+    return 0;
+}
+
+static long group_balance(void *map, struct lh_group_key *key, struct lh_lock_group *g, void *data)
+{
+    lh_policy_group_balance(g, llc_load, llc_nr_cpus, nr_llcs, cpu_llc);
+    return 0;
+}
+
+static int group_timer_fn(void *map, int *key, struct bpf_timer *timer)
+{
+    for (int llc = 0; llc < LH_LLC_MAX; llc++)
+        llc_load[llc] = 0;
+    bpf_for_each_map_elem(&lock_groups, group_fold, NULL, 0);
+    bpf_for_each_map_elem(&lock_groups, group_balance, NULL, 0);
+    group_epoch++;
+
+    bpf_timer_start(timer, LH_GROUP_EPOCH_NS, 0);
+    return 0;
+}
+
+/*
+ * 组的域里的 CPU：prev_cpu 已在域里就留在原地，否则取域里一个空闲 CPU
+ * （*claimed = true，空闲标记已被清除）；没有时 -1
+ */
+static __always_inline s32 group_target_cpu(struct task_struct *p, s32 prev_cpu, bool *claimed)
+{
+    struct lh_group_key key = {};
+    struct lh_lock_group *g;
+    struct task_ctx *ctx;
+    s32 home;
+
+    *claimed = false;
+    if (!group_enabled())
+        return -1;
+    ctx = bpf_task_storage_get(&task_ctx_map, p, NULL, 0);
+    if (!ctx || ctx->group_score < LH_GROUP_JOIN_SCORE)
+        return -1;
+
+    key.tgid = BPF_CORE_READ(p, tgid);
+    key.lock_addr = ctx->group_lock;
+    g = bpf_map_lookup_elem(&lock_groups, &key);
+    if (!g || g->members < 2)
+        return -1;
+    home = g->home_llc;
+    if (home < 0 || home >= LH_LLC_MAX)
+        return -1;
+
+    if (prev_cpu >= 0 && prev_cpu < LH_CPU_TABLE_SLOTS && cpu_llc[prev_cpu] == home)
         return prev_cpu;
+    for (int i = 0; i < LH_LLC_CPUS_MAX; i++) {
+        s32 cpu = llc_cpus[home][i];
+
+        if (cpu < 0)
+            break;
+        if (scx_bpf_test_and_clear_cpu_idle(cpu)) {
+            *claimed = true;
+            return cpu;
+        }
+    }
+    return -1;
+}
+
+/* 采集策略需要的任务状态 */
+static __always_inline void load_task_state(struct task_struct *p,
+                                            struct lh_task_state *t)
+{
+    t->controlled = is_task_controlled(p);
+    t->in_cs = false;
+    t->cs_predicted = false;
+    t->cs_remaining_ns = 0;
+    t->chain_root = false;
+    t->waiter_cpu = -1;
+    t->waiter_aged = false;
+    t->group_cpu = -1;
+
+    if (!t->controlled)
+        return;
 
-    /* waiter: 尝试定向到 owner CPU */
-    s32 target = get_waiter_target_cpu(p);
-    if (target >= 0 && target < (s32)nr_cpus)
-        return target;
+    t->in_cs = is_task_in_cs(p) || is_task_in_futex_cs(p);
+    if (t->in_cs) {
+        t->cs_predicted = predict_cs_remaining(p, &t->cs_remaining_ns);
+        t->chain_root = is_chain_root(p);
+    }
+    t->waiter_cpu = get_waiter_target_cpu(p);
+    if (t->waiter_cpu >= 0) {
+        t->waiter_aged = is_waiter_aged(p);
+        group_note(p, t->waiter_cpu);
+    } else {
+        t->waiter_cpu = get_futex_target_cpu(p);
+    }
+}
 
-    return prev_cpu;
+/* ========== sched_ext ops ========== */
+SEC("struct_ops/lhandoff_select_cpu")
+s32 BPF_PROG(lhandoff_select_cpu, struct task_struct *p, s32 prev_cpu, u64 wake_flags)
+{
+    struct lh_task_state t;
+    bool claimed = false;
+    s32 cpu;
+
+    load_task_state(p, &t);
+    if (!t.in_cs && t.waiter_cpu < 0)
+        t.group_cpu = group_target_cpu(p, prev_cpu, &claimed);
+    cpu = lh_policy_select_cpu(&t, prev_cpu, nr_cpus);
+
+    /*
+     * 为组占下的空闲 CPU 已清除空闲标记，不会再被别人选中：直接插入它的 local DSQ
+     * （跳过 ops.enqueue），否则线程进共享 DSQ 后可能被别的 CPU 取走，那个 CPU 白白空着
+     */
+    if (claimed && cpu == t.group_cpu) {
+        struct lh_enq_decision d;
+
+        lh_policy_enqueue(&t, &d);
+        scx_bpf_dsq_insert(p, SCX_DSQ_LOCAL, d.slice_ns, 0);
+    }
+    return cpu;
 }
 
 SEC("struct_ops/lhandoff_enqueue")
 void BPF_PROG(lhandoff_enqueue, struct task_struct *p, u64 enq_flags)
 {
-    u64 slice = LH_SLICE_NORMAL_NS;
+    struct lh_task_state t;
+    struct lh_enq_decision d;
 
-    if (!is_task_controlled(p)) {
-        /* 非受控任务：使用 global DSQ */
-        scx_bpf_dsq_insert(p, SCX_DSQ_GLOBAL, LH_SLICE_NORMAL_NS, 0);
-        return;
+    load_task_state(p, &t);
+    lh_policy_enqueue(&t, &d);
+
+    /* select_cpu 已直接插入 local DSQ 的任务不经过这里，其余都进共享 DSQ，老化的 waiter 插到队首 */
+    scx_bpf_dsq_insert(p, normal_dsq, d.slice_ns,
+                       (d.preempt ? SCX_ENQ_PREEMPT : 0) | (d.head ? SCX_ENQ_HEAD : 0));
+}
+
+/* ========== owner 拉取（proxy execution） ==========
+ * waiter 让出 CPU（yield 或回退到 futex 睡眠）时，它等的锁的 owner 如果可运行
+ * 但不在任何 CPU 上（被抢占后排在 DSQ 里），把 owner 移到这个 CPU 的 local DSQ：
+ * waiter 让出的 CPU 时间直接用来跑完临界区，而不是给无关的任务。
+ * 需要自定义 DSQ：内核在调用 ops.dispatch 之前会先消费 SCX_DSQ_GLOBAL，
+ * 退回 global DSQ 时 dispatch 只在它为空时被调用，这里什么也不做。
+ */
+
+/* prev 是受控 waiter 且它等的锁的 owner 不在 CPU 上时返回 owner tid，否则 0 */
+static __always_inline u32 preempted_owner(struct task_struct *prev)
+{
+    u32 tid = BPF_CORE_READ(prev, pid);
+    struct lh_thread_slot *slot;
+    struct lh_lock_entry *e;
+    struct lh_cpu_slot *cs;
+    u32 owner_tid, owner_cpu;
+
+    if (!is_task_controlled(prev))
+        return 0;
+    slot = lookup_waiter(tid);
+    if (!slot)
+        return 0;
+    e = lookup_lock_entry(slot->lock_addr);
+    if (!e)
+        return 0;
+
+    owner_tid = e->owner_tid;
+    owner_cpu = (u32)e->owner_cpu;
+    if (!owner_tid || owner_tid == tid)
+        return 0;
+    cs = bpf_map_lookup_elem(&cpu_table, &owner_cpu);
+    if (cs && cs->curr_tid == owner_tid)
+        return 0;
+    return owner_tid;
+}
+
+/* 在共享 DSQ 里找 owner 移到本 CPU；owner 不在 DSQ 里（在别的 CPU 的 local DSQ、睡眠）时返回 false */
+static __always_inline bool pull_owner(u32 owner_tid)
+{
+    struct bpf_iter_scx_dsq it;
+    struct task_struct *p;
+    bool moved = false;
+
+    if (bpf_iter_scx_dsq_new(&it, LH_DSQ_NORMAL, 0) == 0) {
+        for (int i = 0; i < LH_PULL_SCAN_MAX; i++) {
+            p = bpf_iter_scx_dsq_next(&it);
+            if (!p)
+                break;
+            if (BPF_CORE_READ(p, pid) == owner_tid) {
+                moved = scx_bpf_dsq_move(&it, p, SCX_DSQ_LOCAL, 0);
+                break;
+            }
+        }
     }
+    bpf_iter_scx_dsq_destroy(&it);
+    return moved;
+}
 
-    /* 检查是否是 waiter */
-    s32 target_cpu = get_waiter_target_cpu(p);
-    if (target_cpu >= 0) {
-        /* waiter: 短 slice，dispatch 到 global DSQ 但设置 PREEMPT */
-        scx_bpf_dsq_insert(p, SCX_DSQ_GLOBAL, LH_SLICE_WAITER_NS, SCX_ENQ_PREEMPT);
-        return;
+/* ========== NUMA cohort ==========
+ * 与 liblh 的 LH_HANDOFF_COHORT 对应：dispatch 时优先取等待的锁在本节点上的 waiter
+ * （waiter 的 target_cpu 是 owner CPU），锁保护的数据留在本节点的 cache 里。
+ * 越过队首取任务会让别的任务多等，每个 CPU 连续越过 cohort_max 次后按顺序取一次。
+ */
+static __always_inline bool cpu_on_node(s32 cpu, u8 node)
+{
+    return cpu >= 0 && cpu < LH_CPU_TABLE_SLOTS && cpu_node[cpu] == node;
+}
+
+/* p 是受控 waiter 且它等的锁的 owner 在 node 上 */
+static __always_inline bool is_node_waiter(struct task_struct *p, u8 node)
+{
+    struct lh_thread_slot *slot;
+
+    if (!is_task_controlled(p))
+        return false;
+    slot = lookup_waiter(BPF_CORE_READ(p, pid));
+    return slot && cpu_on_node(slot->target_cpu, node);
+}
+
+/* 把 DSQ 前几个任务里第一个本节点 waiter 移到本 CPU；它就在队首或没找到时返回 false */
+static __always_inline bool pull_cohort_waiter(s32 cpu)
+{
+    struct bpf_iter_scx_dsq it;
+    struct task_struct *p;
+    u32 key = (u32)cpu;
+    u32 *skips;
+    bool moved = false;
+    u8 node;
+
+    if (!cohort_max || nr_nodes < 2 || cpu < 0 || cpu >= LH_CPU_TABLE_SLOTS)
+        return false;
+    skips = bpf_map_lookup_elem(&cohort_skips, &key);
+    if (!skips)
+        return false;
+    if (*skips >= cohort_max) {
+        *skips = 0;
+        return false;
     }
 
-    /* IN_CS owner: 更长 slice */
-    if (is_task_in_cs(p)) {
-        slice = LH_SLICE_NORMAL_NS * LH_SLICE_IN_CS_MULT;
+    node = cpu_node[cpu];
+    if (bpf_iter_scx_dsq_new(&it, LH_DSQ_NORMAL, 0) == 0) {
+        for (int i = 0; i < LH_COHORT_SCAN_MAX; i++) {
+            p = bpf_iter_scx_dsq_next(&it);
+            if (!p)
+                break;
+            if (!is_node_waiter(p, node))
+                continue;
+            if (i > 0)
+                moved = scx_bpf_dsq_move(&it, p, SCX_DSQ_LOCAL, 0);
+            break;
+        }
     }
+    bpf_iter_scx_dsq_destroy(&it);
+    *skips = moved ? *skips + 1 : 0;
+    return moved;
+}
 
-    scx_bpf_dsq_insert(p, SCX_DSQ_GLOBAL, slice, 0);
+SEC("struct_ops/lhandoff_dispatch")
+void BPF_PROG(lhandoff_dispatch, s32 cpu, struct task_struct *prev)
+{
+    u32 owner_tid;
+
+    if (normal_dsq != LH_DSQ_NORMAL)
+        return;
+    owner_tid = prev ? preempted_owner(prev) : 0;
+    if (owner_tid && pull_owner(owner_tid))
+        return;
+    if (pull_cohort_waiter(cpu))
+        return;
+    scx_bpf_dsq_move_to_local(LH_DSQ_NORMAL);
+}
+
+/* 发布 per-CPU 当前 tid：spinning waiter 发现 owner 不在 CPU 上就停止 spin */
+SEC("struct_ops/lhandoff_running")
+void BPF_PROG(lhandoff_running, struct task_struct *p)
+{
+    u32 cpu = bpf_get_smp_processor_id();
+    struct lh_cpu_slot *slot;
+
+    slot = bpf_map_lookup_elem(&cpu_table, &cpu);
+    if (!slot)
+        return;
+
+    slot->curr_tid = BPF_CORE_READ(p, pid);
+    slot->t_running_ns = bpf_ktime_get_ns();
 }
 
-/* 不实现 dispatch - 让内核使用默认行为 */
+SEC("struct_ops/lhandoff_stopping")
+void BPF_PROG(lhandoff_stopping, struct task_struct *p, bool runnable)
+{
+    u32 cpu = bpf_get_smp_processor_id();
+    struct lh_cpu_slot *slot;
+
+    slot = bpf_map_lookup_elem(&cpu_table, &cpu);
+    if (!slot)
+        return;
+
+    if (slot->curr_tid == BPF_CORE_READ(p, pid))
+        slot->curr_tid = 0;
+}
 
 SEC("struct_ops.s/lhandoff_init")
 s32 BPF_PROG(lhandoff_init)
 {
-    /* 使用内置的 SCX_DSQ_GLOBAL，不创建自定义 DSQ */
-    /* 简化版本：所有任务都使用 global DSQ */
+    /* 所有任务共享一个 FIFO DSQ（dispatch 需要能在里面找 owner，见上） */
+    if (scx_bpf_create_dsq(LH_DSQ_NORMAL, -1) == 0)
+        normal_dsq = LH_DSQ_NORMAL;
+
+    /* 锁亲和组的周期性折算与重新平衡 */
+    if (group_enabled()) {
+        u32 key = 0;
+        struct group_timer_val *tv = bpf_map_lookup_elem(&group_timer, &key);
+
+        if (tv && bpf_timer_init(&tv->timer, &group_timer, CLOCK_MONOTONIC) == 0 &&
+            bpf_timer_set_callback(&tv->timer, group_timer_fn) == 0)
+            bpf_timer_start(&tv->timer, LH_GROUP_EPOCH_NS, 0);
+    }
     return 0;
 }
 
@@ -287,11 +848,102 @@ int BPF_PROG(handle_fork, struct task_struct *parent, struct task_struct *child)
     return 0;
 }
 
+/* ========== futex 追踪 (launcher -f) ==========
+ * fentry/fexit 挂在 do_futex 上（futex(2) 各个 op 的公共入口，与架构无关）
+ */
+SEC("fentry/do_futex")
+int BPF_PROG(handle_futex_enter, u32 *uaddr, int op, u32 val, ktime_t *timeout,
+             u32 *uaddr2, u32 val2, u32 val3)
+{
+    struct task_struct *p = bpf_get_current_task_btf();
+    struct task_ctx *tctx;
+    u64 addr = (u64)uaddr;
+
+    if (!futex_track || !is_task_controlled(p))
+        return 0;
+
+    tctx = bpf_task_storage_get(&task_ctx_map, p, NULL, 0);
+    if (!tctx)
+        return 0;
+
+    switch (op & LH_FUTEX_CMD_MASK) {
+    case LH_FUTEX_WAIT:
+    case LH_FUTEX_WAIT_BITSET:
+    case LH_FUTEX_LOCK_PI:
+    case LH_FUTEX_LOCK_PI2:
+        tctx->futex_wait_addr = addr;
+        break;
+
+    case LH_FUTEX_WAKE:
+    case LH_FUTEX_WAKE_BITSET:
+    case LH_FUTEX_UNLOCK_PI: {
+        /* 释放：被唤醒者定向到释放者 CPU */
+        struct lh_futex_key key = {
+            .tgid = BPF_CORE_READ(p, tgid),
+            .uaddr = addr,
+        };
+        struct lh_futex_owner owner = {
+            .owner_tid = 0,
+            .owner_cpu = bpf_get_smp_processor_id(),
+            .t_update_ns = bpf_ktime_get_ns(),
+        };
+        bpf_map_update_elem(&futex_owners, &key, &owner, BPF_ANY);
+
+        if (tctx->futex_cs_addr == addr)
+            tctx->futex_cs_ns = 0;
+        break;
+    }
+    }
+
+    return 0;
+}
+
+SEC("fexit/do_futex")
+int BPF_PROG(handle_futex_exit, u32 *uaddr, int op, u32 val, ktime_t *timeout,
+             u32 *uaddr2, u32 val2, u32 val3, long ret)
+{
+    struct task_struct *p = bpf_get_current_task_btf();
+    struct task_ctx *tctx;
+    u64 addr;
+
+    if (!futex_track)
+        return 0;
+
+    tctx = bpf_task_storage_get(&task_ctx_map, p, NULL, 0);
+    if (!tctx || !tctx->futex_wait_addr)
+        return 0;
+
+    addr = tctx->futex_wait_addr;
+    tctx->futex_wait_addr = 0;
+
+    /* EAGAIN（值已变化）/ ETIMEDOUT / EINTR：没有被唤醒接手 */
+    if (ret != 0)
+        return 0;
+
+    struct lh_futex_key key = {
+        .tgid = BPF_CORE_READ(p, tgid),
+        .uaddr = addr,
+    };
+    struct lh_futex_owner owner = {
+        .owner_tid = BPF_CORE_READ(p, pid),
+        .owner_cpu = bpf_get_smp_processor_id(),
+        .t_update_ns = bpf_ktime_get_ns(),
+    };
+    bpf_map_update_elem(&futex_owners, &key, &owner, BPF_ANY);
+
+    tctx->futex_cs_addr = addr;
+    tctx->futex_cs_ns = owner.t_update_ns;
+    return 0;
+}
+
 /* ========== sched_ext ops 结构体 ========== */
 SEC(".struct_ops.link")
 struct sched_ext_ops lhandoff_ops = {
     .select_cpu     = (void *)lhandoff_select_cpu,
     .enqueue        = (void *)lhandoff_enqueue,
+    .dispatch       = (void *)lhandoff_dispatch,
+    .running        = (void *)lhandoff_running,
+    .stopping       = (void *)lhandoff_stopping,
     .init           = (void *)lhandoff_init,
     .exit           = (void *)lhandoff_exit,
     .name           = "lhandoff",
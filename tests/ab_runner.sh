@@ -0,0 +1,205 @@
+#!/bin/bash
+# SPDX-License-Identifier: MIT
+# ab_runner.sh - A/B 回归测试：交替重复运行 + 显著性判定
+#
+# 每个场景按 A/B 成对运行 RUNS 轮，每轮内 A/B 先后顺序随机，避免
+# 热身、频率漂移、页缓存等随时间变化的因素系统性地偏向某一方。
+# 所有样本写入 samples.csv，由 ab_stats 计算均值/标准差/95% 置信区间和
+# Mann-Whitney U 检验；存在显著且超过阈值的回归时脚本以非零退出。
+#
+# 场景文件每行 "<名称> <命令...>"（# 开头为注释），命令相对仓库根目录，
+# 输出须为 bench_harness CSV（带表头）或 db_bench 风格的
+# "<benchmark> : <x> micros/op" 行；一个命令可输出多个 benchmark，
+# 样本按 "<名称>/<benchmark>" 归类。
+#
+# 环境变量：
+#   RUNS        每个变体重复次数 (默认 10，精确检验在 >= 4 时才可能显著)
+#   METRIC      ops_per_sec|micros_per_op|p50_us|p99_us|p999_us (默认 ops_per_sec)
+#   THRESHOLD   回归阈值百分比 (默认 5)
+#   ALPHA       显著性水平 (默认 0.05)
+#   CPUS        taskset CPU 列表，如 "2-17"；为空则不绑核
+#   SCENARIOS   场景文件 (默认使用下方内置列表)
+#   A_CMD       变体 A 的命令前缀 (默认空，即 native)
+#   B_CMD       变体 B 的命令前缀 (默认 sudo lh_launcher -b <bpf> -l <liblh>)
+#
+# 例：比较两份构建的 lhandoff
+#   A_CMD="sudo /old/launcher/lh_launcher -b /old/scx/scx_lhandoff.bpf.o -l /old/liblh/liblh.so" \
+#   RUNS=12 CPUS=0-15 ./tests/ab_runner.sh
+
+SCRIPT_DIR="$(cd "$(dirname "$0")/.." && pwd)"
+LAUNCHER="$SCRIPT_DIR/launcher/lh_launcher"
+LIBLH="$SCRIPT_DIR/liblh/liblh.so"
+BPF_OBJ="$SCRIPT_DIR/scx/scx_lhandoff.bpf.o"
+AB_STATS="$SCRIPT_DIR/tests/ab_stats"
+
+NCPU=$(nproc)
+RUNS="${RUNS:-10}"
+METRIC="${METRIC:-ops_per_sec}"
+THRESHOLD="${THRESHOLD:-5}"
+ALPHA="${ALPHA:-0.05}"
+CPUS="${CPUS:-}"
+A_CMD="${A_CMD-}"
+B_CMD="${B_CMD-sudo $LAUNCHER -b $BPF_OBJ -l $LIBLH}"
+
+read -r -a A_PREFIX <<< "$A_CMD"
+read -r -a B_PREFIX <<< "$B_CMD"
+
+TIMESTAMP=$(date +%Y%m%d_%H%M%S)
+OUTPUT_DIR="$SCRIPT_DIR/results/ab_$TIMESTAMP"
+LOG_DIR="$OUTPUT_DIR/logs"
+SAMPLES_FILE="$OUTPUT_DIR/samples.csv"
+REPORT_FILE="$OUTPUT_DIR/report.txt"
+mkdir -p "$LOG_DIR"
+
+if [ ! -x "$AB_STATS" ]; then
+    echo "Error: $AB_STATS not found, run: make -C tests"
+    exit 2
+fi
+
+case "$METRIC" in
+    ops_per_sec) STATS_FLAGS=() ;;
+    micros_per_op|p50_us|p99_us|p999_us|max_us) STATS_FLAGS=(-l) ;;
+    *)
+        echo "Error: unknown METRIC '$METRIC'"
+        exit 2
+        ;;
+esac
+
+# ========== 场景 ==========
+SCENARIO_NAMES=()
+SCENARIO_CMDS=()
+
+add_scenario() {
+    SCENARIO_NAMES+=("$1")
+    SCENARIO_CMDS+=("$2")
+}
+
+if [ -n "$SCENARIOS" ]; then
+    while read -r name cmd; do
+        case "$name" in ''|'#'*) continue ;; esac
+        add_scenario "$name" "$cmd"
+    done < "$SCENARIOS"
+else
+    add_scenario "memtable_t$NCPU"   "tests/bench_workloads -w memtable -t $NCPU -d 3 -c"
+    add_scenario "memtable_t$((NCPU * 2))" "tests/bench_workloads -w memtable -t $((NCPU * 2)) -d 3 -c"
+    add_scenario "hashmap_t$((NCPU * 2))"  "tests/bench_workloads -w hashmap -t $((NCPU * 2)) -d 3 -c"
+    add_scenario "lsm_t8"  "tests/bench_lsm --benchmarks=fillrandom,readrandom --threads=8 --num=100000"
+    add_scenario "lsm_t16" "tests/bench_lsm --benchmarks=fillrandom,readrandom --threads=16 --num=100000"
+fi
+
+# ========== 环境检查 ==========
+PIN=()
+if [ -n "$CPUS" ]; then
+    PIN=(taskset -c "$CPUS")
+    ISOLATED=$(cat /sys/devices/system/cpu/isolated 2>/dev/null)
+    if [ -z "$ISOLATED" ]; then
+        echo "Warning: no isolcpus= configured, CPUs $CPUS still shared with the rest of the system"
+    else
+        echo "Isolated CPUs: $ISOLATED (pinned to: $CPUS)"
+    fi
+fi
+
+GOVERNORS=$(cat /sys/devices/system/cpu/cpu*/cpufreq/scaling_governor 2>/dev/null | sort -u | tr '\n' ' ')
+if [ -n "$GOVERNORS" ] && [ "$GOVERNORS" != "performance " ]; then
+    echo "Warning: cpufreq governor is '$GOVERNORS', consider 'performance' for stable results"
+fi
+
+echo "=== A/B Regression Run ==="
+echo "RUNS: $RUNS, METRIC: $METRIC, THRESHOLD: ${THRESHOLD}%, ALPHA: $ALPHA"
+echo "A: ${A_CMD:-(native)}"
+echo "B: ${B_CMD:-(native)}"
+echo "Scenarios: ${SCENARIO_NAMES[*]}"
+echo "OUTPUT_DIR: $OUTPUT_DIR"
+echo ""
+
+# 从一次运行的输出中提取 METRIC，输出 "<scenario>/<benchmark>,<variant>,<value>"
+extract_metric() {
+    local scenario=$1
+    local variant=$2
+    awk -v metric="$METRIC" -v scen="$scenario" -v var="$variant" '
+        /^benchmark,/ {
+            n = split($0, hdr, ",")
+            col = 0
+            for (i = 1; i <= n; i++)
+                if (hdr[i] == metric)
+                    col = i
+            next
+        }
+        col > 0 && /^[A-Za-z0-9_]+,/ {
+            split($0, f, ",")
+            printf "%s/%s,%s,%s\n", scen, f[1], var, f[col]
+            next
+        }
+        /^[A-Za-z0-9_]+ +: +[0-9.]+ micros\/op/ {
+            micros = $3 + 0
+            if (metric == "micros_per_op")
+                v = micros
+            else if (metric == "ops_per_sec" && micros > 0)
+                v = 1e6 / micros
+            else
+                next
+            printf "%s/%s,%s,%.3f\n", scen, $1, var, v
+        }
+    '
+}
+
+# run_one <scenario_idx> <A|B> <run>
+run_one() {
+    local idx=$1
+    local variant=$2
+    local run=$3
+    local name=${SCENARIO_NAMES[$idx]}
+    local cmd
+    read -r -a cmd <<< "${SCENARIO_CMDS[$idx]}"
+    cmd[0]="$SCRIPT_DIR/${cmd[0]}"
+
+    local prefix=()
+    if [ "$variant" = "A" ]; then
+        prefix=("${A_PREFIX[@]}")
+    else
+        prefix=("${B_PREFIX[@]}")
+    fi
+
+    local log="$LOG_DIR/${name}_${variant}_${run}.log"
+    local output
+    output=$("${PIN[@]}" "${prefix[@]}" "${cmd[@]}" 2>"$log.err")
+    local rc=$?
+    echo "$output" > "$log"
+
+    local samples
+    samples=$(echo "$output" | extract_metric "$name" "$variant")
+    if [ $rc -ne 0 ] || [ -z "$samples" ]; then
+        echo "$name,$variant,N/A" >> "$SAMPLES_FILE"
+        echo "  $variant: failed (rc=$rc), see $log.err"
+        return
+    fi
+    echo "$samples" >> "$SAMPLES_FILE"
+    echo "$samples" | awk -F, '{printf "  %s %-28s %s\n", $2, $1, $3}'
+}
+
+echo "# scenario,variant,$METRIC" > "$SAMPLES_FILE"
+
+for run in $(seq 1 "$RUNS"); do
+    echo "========== Run $run/$RUNS =========="
+    for idx in "${!SCENARIO_NAMES[@]}"; do
+        echo "[${SCENARIO_NAMES[$idx]}]"
+        if [ $((RANDOM % 2)) -eq 0 ]; then
+            run_one "$idx" A "$run"
+            run_one "$idx" B "$run"
+        else
+            run_one "$idx" B "$run"
+            run_one "$idx" A "$run"
+        fi
+    done
+done
+
+echo ""
+echo "========== A/B Report ($METRIC, B vs A) =========="
+"$AB_STATS" "${STATS_FLAGS[@]}" -t "$THRESHOLD" -a "$ALPHA" "$SAMPLES_FILE" 2>>"$LOG_DIR/ab_stats.err" | tee "$REPORT_FILE"
+STATUS=${PIPESTATUS[0]}
+
+echo ""
+echo "Samples: $SAMPLES_FILE"
+echo "Report: $REPORT_FILE"
+echo "Logs directory: $LOG_DIR"
+exit "$STATUS"
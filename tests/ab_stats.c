@@ -0,0 +1,352 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * ab_stats.c - A/B 结果统计与回归判定
+ *
+ * 输入（stdin 或文件）：每行 "scenario,variant,value"，variant 为 A 或 B，
+ * 同一 scenario 的 A/B 样本来自交替执行的多次运行（见 ab_runner.sh）。
+ *
+ * 对每个 scenario 输出均值、标准差、95% 置信区间、B 相对 A 的变化，
+ * 以及 Mann-Whitney U 检验的双侧 p 值（小样本无并列时精确计算，
+ * 否则用带并列修正的正态近似）。
+ *
+ * 判定：p < alpha 且变化劣于 -threshold% 记为 REGRESSION，
+ * p < alpha 且优于 +threshold% 记为 IMPROVED，其余为 noise。
+ * 存在 REGRESSION 时退出码为 1。
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#define MAX_SCENARIOS   256
+#define MAX_SAMPLES     1024
+#define MAX_NAME        128
+#define EXACT_MAX_N     20
+
+struct scenario {
+    char name[MAX_NAME];
+    int n[2];
+    double v[2][MAX_SAMPLES];
+};
+
+static struct scenario g_scenarios[MAX_SCENARIOS];
+static int g_num_scenarios = 0;
+
+static bool g_higher_is_better = true;
+static double g_threshold_pct = 5.0;
+static double g_alpha = 0.05;
+
+static struct scenario *find_scenario(const char *name)
+{
+    for (int i = 0; i < g_num_scenarios; i++) {
+        if (strcmp(g_scenarios[i].name, name) == 0)
+            return &g_scenarios[i];
+    }
+    if (g_num_scenarios >= MAX_SCENARIOS)
+        return NULL;
+    struct scenario *s = &g_scenarios[g_num_scenarios++];
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    return s;
+}
+
+/* ========== 描述统计 ========== */
+static double mean(const double *v, int n)
+{
+    double sum = 0;
+    for (int i = 0; i < n; i++)
+        sum += v[i];
+    return n ? sum / n : 0;
+}
+
+static double stddev(const double *v, int n)
+{
+    if (n < 2)
+        return 0;
+    double m = mean(v, n), sum = 0;
+    for (int i = 0; i < n; i++)
+        sum += (v[i] - m) * (v[i] - m);
+    return sqrt(sum / (n - 1));
+}
+
+/* Student t 分布双侧 95% 临界值 */
+static double t_critical_95(int df)
+{
+    static const double table[] = {
+        0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+        2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+        2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045,
+        2.042,
+    };
+    if (df < 1)
+        return INFINITY;
+    if (df <= 30)
+        return table[df];
+    if (df <= 60)
+        return 2.000;
+    if (df <= 120)
+        return 1.980;
+    return 1.960;
+}
+
+static double ci95_halfwidth(const double *v, int n)
+{
+    if (n < 2)
+        return INFINITY;
+    return t_critical_95(n - 1) * stddev(v, n) / sqrt(n);
+}
+
+/* ========== Mann-Whitney U ========== */
+struct ranked {
+    double value;
+    int group;
+};
+
+static int cmp_ranked(const void *a, const void *b)
+{
+    double x = ((const struct ranked *)a)->value;
+    double y = ((const struct ranked *)b)->value;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * 精确分布：count[u] = nA 个 A 与 nB 个 B 的排列中 U_A == u 的个数，
+ * 递推 f(a, b, u) = f(a-1, b, u-b) + f(a, b-1, u)
+ */
+static double mw_exact_p(int na, int nb, double u)
+{
+    int umax = na * nb;
+    double *prev = calloc((size_t)(nb + 1) * (umax + 1), sizeof(double));
+    double *cur = calloc((size_t)(nb + 1) * (umax + 1), sizeof(double));
+#define F(arr, b, uu) arr[(size_t)(b) * (umax + 1) + (uu)]
+
+    /* a = 0: 只有 u = 0 一种 */
+    for (int b = 0; b <= nb; b++)
+        F(prev, b, 0) = 1;
+
+    for (int a = 1; a <= na; a++) {
+        memset(cur, 0, (size_t)(nb + 1) * (umax + 1) * sizeof(double));
+        F(cur, 0, 0) = 1;
+        for (int b = 1; b <= nb; b++) {
+            for (int uu = 0; uu <= a * b; uu++) {
+                double v = F(cur, b - 1, uu);
+                if (uu >= b)
+                    v += F(prev, b, uu - b);
+                F(cur, b, uu) = v;
+            }
+        }
+        double *tmp = prev;
+        prev = cur;
+        cur = tmp;
+    }
+
+    double total = 0, tail = 0;
+    double lo = fmin(u, umax - u);
+    for (int uu = 0; uu <= umax; uu++) {
+        double c = F(prev, nb, uu);
+        total += c;
+        if (uu <= lo + 1e-9)
+            tail += c;
+    }
+#undef F
+    free(prev);
+    free(cur);
+
+    double p = 2.0 * tail / total;
+    return p > 1.0 ? 1.0 : p;
+}
+
+static double mann_whitney_p(const double *a, int na, const double *b, int nb)
+{
+    int n = na + nb;
+    if (na == 0 || nb == 0)
+        return 1.0;
+
+    struct ranked *r = malloc(n * sizeof(*r));
+    for (int i = 0; i < na; i++)
+        r[i] = (struct ranked){ a[i], 0 };
+    for (int i = 0; i < nb; i++)
+        r[na + i] = (struct ranked){ b[i], 1 };
+    qsort(r, n, sizeof(*r), cmp_ranked);
+
+    /* 平均秩，累计并列修正项 */
+    double rank_sum_a = 0, tie_term = 0;
+    bool has_ties = false;
+    for (int i = 0; i < n;) {
+        int j = i;
+        while (j + 1 < n && r[j + 1].value == r[i].value)
+            j++;
+        double avg_rank = (i + j) / 2.0 + 1;
+        int t = j - i + 1;
+        if (t > 1) {
+            has_ties = true;
+            tie_term += (double)t * t * t - t;
+        }
+        for (int k = i; k <= j; k++) {
+            if (r[k].group == 0)
+                rank_sum_a += avg_rank;
+        }
+        i = j + 1;
+    }
+    free(r);
+
+    double u = rank_sum_a - na * (na + 1) / 2.0;
+
+    if (!has_ties && na <= EXACT_MAX_N && nb <= EXACT_MAX_N)
+        return mw_exact_p(na, nb, u);
+
+    double mu = na * nb / 2.0;
+    double sigma2 = na * nb / 12.0 * ((n + 1) - tie_term / ((double)n * (n - 1)));
+    if (sigma2 <= 0)
+        return 1.0;
+    double z = (fabs(u - mu) - 0.5) / sqrt(sigma2);
+    if (z < 0)
+        z = 0;
+    return erfc(z / sqrt(2.0));
+}
+
+/* ========== 输入 ========== */
+static int read_samples(FILE *f)
+{
+    char line[512];
+    int lineno = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *nl = strchr(line, '\n');
+        if (nl)
+            *nl = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+
+        char *save = NULL;
+        char *name = strtok_r(line, ",", &save);
+        char *variant = strtok_r(NULL, ",", &save);
+        char *value = strtok_r(NULL, ",", &save);
+        if (!name || !variant || !value) {
+            fprintf(stderr, "line %d: expected scenario,variant,value\n", lineno);
+            continue;
+        }
+
+        char *end;
+        double v = strtod(value, &end);
+        if (end == value) {
+            /* N/A 等失败的运行 */
+            fprintf(stderr, "line %d: skipping non-numeric value '%s'\n", lineno, value);
+            continue;
+        }
+
+        int g;
+        if (strcmp(variant, "A") == 0)
+            g = 0;
+        else if (strcmp(variant, "B") == 0)
+            g = 1;
+        else {
+            fprintf(stderr, "line %d: variant must be A or B\n", lineno);
+            continue;
+        }
+
+        struct scenario *s = find_scenario(name);
+        if (!s) {
+            fprintf(stderr, "too many scenarios\n");
+            return -1;
+        }
+        if (s->n[g] < MAX_SAMPLES)
+            s->v[g][s->n[g]++] = v;
+    }
+    return 0;
+}
+
+static void print_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [options] [file]\n", prog);
+    fprintf(stderr, "Input lines: scenario,variant(A|B),value\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -l          Lower is better (latency metrics; default: higher is better)\n");
+    fprintf(stderr, "  -t <pct>    Regression threshold in percent (default: 5)\n");
+    fprintf(stderr, "  -a <alpha>  Significance level (default: 0.05)\n");
+    fprintf(stderr, "  -h          Show this help\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hlt:a:")) != -1) {
+        switch (opt) {
+        case 'l':
+            g_higher_is_better = false;
+            break;
+        case 't':
+            g_threshold_pct = atof(optarg);
+            break;
+        case 'a':
+            g_alpha = atof(optarg);
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            return 0;
+        default:
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    FILE *f = stdin;
+    if (optind < argc) {
+        f = fopen(argv[optind], "r");
+        if (!f) {
+            perror(argv[optind]);
+            return 2;
+        }
+    }
+    if (read_samples(f) != 0)
+        return 2;
+    if (f != stdin)
+        fclose(f);
+
+    int regressions = 0;
+
+    printf("%-24s %4s %4s %14s %14s %12s %12s %8s %8s  %s\n",
+           "Scenario", "nA", "nB", "mean(A)", "mean(B)", "ci95(A)", "ci95(B)",
+           "delta", "p", "Verdict");
+
+    for (int i = 0; i < g_num_scenarios; i++) {
+        struct scenario *s = &g_scenarios[i];
+        double ma = mean(s->v[0], s->n[0]);
+        double mb = mean(s->v[1], s->n[1]);
+        double ca = ci95_halfwidth(s->v[0], s->n[0]);
+        double cb = ci95_halfwidth(s->v[1], s->n[1]);
+        double delta = ma != 0 ? (mb - ma) / fabs(ma) * 100.0 : 0;
+        double p = mann_whitney_p(s->v[0], s->n[0], s->v[1], s->n[1]);
+
+        /* 统一成 "正数 = 变好" */
+        double gain = g_higher_is_better ? delta : -delta;
+        const char *verdict = "noise";
+        if (s->n[0] < 2 || s->n[1] < 2) {
+            verdict = "insufficient";
+        } else if (p < g_alpha && gain <= -g_threshold_pct) {
+            verdict = "REGRESSION";
+            regressions++;
+        } else if (p < g_alpha && gain >= g_threshold_pct) {
+            verdict = "IMPROVED";
+        } else if (p < g_alpha) {
+            verdict = "significant, below threshold";
+        }
+
+        printf("%-24s %4d %4d %14.2f %14.2f %12.2f %12.2f %+7.2f%% %8.4f  %s\n",
+               s->name, s->n[0], s->n[1], ma, mb, ca, cb, delta, p, verdict);
+        printf("%-24s %4s %4s %14.2f %14.2f   (stddev)\n", "", "", "",
+               stddev(s->v[0], s->n[0]), stddev(s->v[1], s->n[1]));
+    }
+
+    if (regressions) {
+        printf("\n%d scenario(s) regressed beyond %.1f%% (alpha=%.3f)\n",
+               regressions, g_threshold_pct, g_alpha);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,125 @@
+#!/bin/bash
+# SPDX-License-Identifier: MIT
+# bench_colocate.sh - 受控工作负载 + 不受控背景负载（noisy neighbour）混部测试
+#
+# 对每种背景负载模式，先在 launcher 之外启动 bench_noise（不在 allowlist 中），
+# 再分别以 native / lhandoff 运行 bench_workloads，同时记录受控负载的锁延迟
+# 和背景负载的吞吐，用来判断 IN_CS 偏置和 waiter 定向是否过度挤占邻居。
+#
+# 环境变量：
+#   WORKLOAD       bench_workloads 场景 (默认 memtable)
+#   THREADS        受控线程数 (默认 2 * nproc)
+#   DURATION       每次运行秒数 (默认 5)
+#   NOISE_WORKERS  背景负载线程数 (默认 nproc)
+#   NOISE_MODES    背景负载模式列表 (默认 "none spin churn burst")
+
+set -e
+
+SCRIPT_DIR="$(cd "$(dirname "$0")/.." && pwd)"
+TESTS_DIR="$SCRIPT_DIR/tests"
+LAUNCHER="$SCRIPT_DIR/launcher/lh_launcher"
+LIBLH="$SCRIPT_DIR/liblh/liblh.so"
+BPF_OBJ="$SCRIPT_DIR/scx/scx_lhandoff.bpf.o"
+WORKLOADS="$TESTS_DIR/bench_workloads"
+NOISE="$TESTS_DIR/bench_noise"
+
+NCPU=$(nproc)
+WORKLOAD="${WORKLOAD:-memtable}"
+THREADS="${THREADS:-$((NCPU * 2))}"
+DURATION="${DURATION:-5}"
+NOISE_WORKERS="${NOISE_WORKERS:-$NCPU}"
+NOISE_MODES=(${NOISE_MODES:-none spin churn burst})
+
+TIMESTAMP=$(date +%Y%m%d_%H%M%S)
+OUTPUT_DIR="$SCRIPT_DIR/results/colocate_$TIMESTAMP"
+LOG_DIR="$OUTPUT_DIR/logs"
+RESULT_FILE="$OUTPUT_DIR/results.csv"
+mkdir -p "$LOG_DIR"
+
+for bin in "$WORKLOADS" "$NOISE"; do
+    if [ ! -x "$bin" ]; then
+        echo "Error: $bin not found, run: make -C tests"
+        exit 1
+    fi
+done
+
+echo "=== Co-location Test ==="
+echo "WORKLOAD: $WORKLOAD, THREADS: $THREADS, DURATION: ${DURATION}s"
+echo "NOISE_WORKERS: $NOISE_WORKERS, NOISE_MODES: ${NOISE_MODES[*]}"
+echo "OUTPUT_DIR: $OUTPUT_DIR"
+echo ""
+
+echo "noise_mode,noise_workers,benchmark,threads,mode,ops_per_sec,micros_per_op,p50_us,p99_us,p999_us,max_us,noise_ops_per_sec" > "$RESULT_FILE"
+
+# 背景负载在 run_one 所在的子 shell 退出时一定被停掉（包括 set -e 和中断）
+NOISE_PID=""
+stop_noise() {
+    if [ -n "$NOISE_PID" ]; then
+        kill -TERM "$NOISE_PID" 2>/dev/null || true
+        wait "$NOISE_PID" || true
+        NOISE_PID=""
+    fi
+}
+
+# run_one <noise_mode> <native|lhandoff>
+run_one() {
+    local noise_mode=$1
+    local mode=$2
+    local tag="${noise_mode}_${mode}"
+    local noise_out="$LOG_DIR/noise_${tag}.log"
+    local cmd=("$WORKLOADS" -w "$WORKLOAD" -t "$THREADS" -d "$DURATION" -c)
+
+    trap stop_noise EXIT INT TERM
+    if [ "$noise_mode" != "none" ]; then
+        "$NOISE" -m "$noise_mode" -n "$NOISE_WORKERS" -c > "$noise_out" 2>&1 &
+        NOISE_PID=$!
+        # 受控负载在测量开始/结束时通知 bench_noise，吞吐只按这段窗口算
+        cmd+=(-N "$NOISE_PID")
+        sleep 1
+    fi
+
+    # 工作负载失败时照样记一行 N/A，不让 set -e 跳过后面的清理
+    local output=""
+    if [ "$mode" = "lhandoff" ]; then
+        output=$(sudo "$LAUNCHER" -b "$BPF_OBJ" -l "$LIBLH" "${cmd[@]}" 2>"$LOG_DIR/launcher_${tag}.log") || true
+    else
+        output=$("${cmd[@]}") || true
+    fi
+    echo "$output" > "$LOG_DIR/workload_${tag}.log"
+
+    local noise_ops="N/A"
+    if [ -n "$NOISE_PID" ]; then
+        stop_noise
+        noise_ops=$(cut -d, -f3 "$noise_out")
+    fi
+
+    local line
+    line=$(echo "$output" | grep "^$WORKLOAD," | head -1)
+    if [ -z "$line" ]; then
+        line="$WORKLOAD,$THREADS,$mode,N/A,N/A,N/A,N/A,N/A,N/A"
+    fi
+    echo "$noise_mode,$NOISE_WORKERS,$line,$noise_ops" >> "$RESULT_FILE"
+    echo "$line,$noise_ops"
+}
+
+for noise_mode in "${NOISE_MODES[@]}"; do
+    echo "========== noise: $noise_mode =========="
+    for mode in native lhandoff; do
+        echo -n "$mode: "
+        run_one "$noise_mode" "$mode" | awk -F, '{printf "ops/s=%s p99=%sus p99.9=%sus noise_ops/s=%s\n", $4, $7, $8, $10}'
+    done
+done
+
+echo ""
+echo "========== Results Summary =========="
+SUMMARY_FILE="$OUTPUT_DIR/summary.txt"
+{
+    printf "%-8s %-9s %12s %10s %10s %14s\n" "Noise" "Mode" "Ops/s" "p99(us)" "p99.9(us)" "Noise ops/s"
+    printf "%-8s %-9s %12s %10s %10s %14s\n" "-------" "--------" "-----------" "---------" "---------" "-------------"
+    tail -n +2 "$RESULT_FILE" | awk -F, '{printf "%-8s %-9s %12s %10s %10s %14s\n", $1, $5, $6, $9, $10, $12}'
+} | tee "$SUMMARY_FILE"
+
+echo ""
+echo "Results CSV: $RESULT_FILE"
+echo "Summary: $SUMMARY_FILE"
+echo "Logs directory: $LOG_DIR"
@@ -0,0 +1,154 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * bench_harness.h - 基准测试公共框架
+ *
+ * 提供计时、延迟直方图（百分位）、运行模式探测和统一的 CSV 输出，
+ * 供 bench_workloads 等按时长运行的测试复用。
+ */
+#ifndef __BENCH_HARNESS_H
+#define __BENCH_HARNESS_H
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+static inline uint64_t get_time_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* 被 lh_launcher 启动时环境里一定有 LH_LOCK_TABLE_FD */
+static inline const char *bench_mode(void)
+{
+    const char *mode = getenv("BENCH_MODE");
+    if (mode && *mode)
+        return mode;
+    return getenv("LH_LOCK_TABLE_FD") ? "lhandoff" : "native";
+}
+
+/* ========== 延迟直方图 ==========
+ * log2 分组 + 每组 16 个线性子桶，相对误差 < 1/16，
+ * 覆盖 1ns ~ 2^63ns，每线程一个，结束时合并。
+ */
+#define LAT_SUB_BITS    4
+#define LAT_SUB_BUCKETS (1 << LAT_SUB_BITS)
+#define LAT_GROUPS      64
+#define LAT_BUCKETS     (LAT_GROUPS * LAT_SUB_BUCKETS)
+
+struct lat_hist {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t bucket[LAT_BUCKETS];
+};
+
+static inline unsigned lat_bucket_idx(uint64_t ns)
+{
+    if (ns < LAT_SUB_BUCKETS)
+        return (unsigned)ns;
+    unsigned msb = 63 - __builtin_clzll(ns);
+    unsigned sub = (unsigned)(ns >> (msb - LAT_SUB_BITS)) & (LAT_SUB_BUCKETS - 1);
+    return (msb - LAT_SUB_BITS + 1) * LAT_SUB_BUCKETS + sub;
+}
+
+/* 桶的下界，作为该桶的代表值 */
+static inline uint64_t lat_bucket_value(unsigned idx)
+{
+    if (idx < LAT_SUB_BUCKETS)
+        return idx;
+    unsigned group = idx / LAT_SUB_BUCKETS;
+    unsigned sub = idx % LAT_SUB_BUCKETS;
+    unsigned msb = group + LAT_SUB_BITS - 1;
+    return (1ULL << msb) | ((uint64_t)sub << (msb - LAT_SUB_BITS));
+}
+
+static inline void lat_record(struct lat_hist *h, uint64_t ns)
+{
+    h->count++;
+    h->sum_ns += ns;
+    if (ns > h->max_ns)
+        h->max_ns = ns;
+    h->bucket[lat_bucket_idx(ns)]++;
+}
+
+static inline void lat_merge(struct lat_hist *dst, const struct lat_hist *src)
+{
+    dst->count += src->count;
+    dst->sum_ns += src->sum_ns;
+    if (src->max_ns > dst->max_ns)
+        dst->max_ns = src->max_ns;
+    for (int i = 0; i < LAT_BUCKETS; i++)
+        dst->bucket[i] += src->bucket[i];
+}
+
+static inline uint64_t lat_percentile(const struct lat_hist *h, double pct)
+{
+    if (h->count == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(h->count * pct / 100.0);
+    if (rank >= h->count)
+        rank = h->count - 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < LAT_BUCKETS; i++) {
+        seen += h->bucket[i];
+        if (seen > rank)
+            return lat_bucket_value(i);
+    }
+    return h->max_ns;
+}
+
+/* ========== 结果输出 ==========
+ * CSV 列与 bench_leveldb.sh 的 results.csv 前五列一致，后面追加延迟百分位
+ */
+#define BENCH_CSV_HEADER \
+    "benchmark,threads,mode,ops_per_sec,micros_per_op,p50_us,p99_us,p999_us,max_us"
+
+static inline void bench_report(bool csv, const char *benchmark, int threads,
+                                uint64_t ops, uint64_t elapsed_ns,
+                                const struct lat_hist *lat)
+{
+    double secs = elapsed_ns / 1e9;
+    double ops_per_sec = secs > 0 ? ops / secs : 0;
+    double micros_per_op = ops ? elapsed_ns / 1e3 / ops : 0;
+    double p50 = lat_percentile(lat, 50.0) / 1e3;
+    double p99 = lat_percentile(lat, 99.0) / 1e3;
+    double p999 = lat_percentile(lat, 99.9) / 1e3;
+    double max = lat->max_ns / 1e3;
+
+    if (csv) {
+        printf("%s,%d,%s,%.0f,%.3f,%.2f,%.2f,%.2f,%.2f\n",
+               benchmark, threads, bench_mode(), ops_per_sec, micros_per_op,
+               p50, p99, p999, max);
+    } else {
+        printf("%-12s : %11.3f micros/op; %10.0f ops/s  "
+               "(threads=%d, p50=%.2fus p99=%.2fus p99.9=%.2fus max=%.2fus)\n",
+               benchmark, micros_per_op, ops_per_sec, threads,
+               p50, p99, p999, max);
+    }
+    fflush(stdout);
+}
+
+/* ========== 随机数 ========== */
+static inline uint64_t bench_rand(uint64_t *state)
+{
+    /* xorshift64* */
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static inline double bench_rand_double(uint64_t *state)
+{
+    return (bench_rand(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+#endif /* __BENCH_HARNESS_H */
@@ -1,15 +1,19 @@
 #!/bin/bash
 # LevelDB db_bench 性能测试脚本
+#
+# 默认使用仓库内的 tests/bench_lsm（db_bench 兼容的 LevelDB 式基准），
+# 设置 DB_BENCH 可改用真实 LevelDB 的 db_bench：
+#   DB_BENCH=/path/to/leveldb/build/db_bench DB_DIR=/tmp/leveldb_bench ./tests/bench_leveldb.sh
 
 set -e
 
-DB_BENCH="/home/jz/test/test/leveldb/build/db_bench"
 SCRIPT_DIR="$(cd "$(dirname "$0")/.." && pwd)"
+DB_BENCH="${DB_BENCH:-$SCRIPT_DIR/tests/bench_lsm}"
 LAUNCHER="$SCRIPT_DIR/launcher/lh_launcher"
 LIBLH="$SCRIPT_DIR/liblh/liblh.so"
 BPF_OBJ="$SCRIPT_DIR/scx/scx_lhandoff.bpf.o"
-NUM=100000
-DB_DIR="/tmp/leveldb_bench"
+NUM="${NUM:-100000}"
+DB_DIR="${DB_DIR:-/dev/shm/lh_lsm_bench}"
 
 THREADS=(1 2 4 8 16 32 64 128 256)
 
@@ -44,6 +48,7 @@ EOF
 
 if [ ! -x "$DB_BENCH" ]; then
     echo "Error: db_bench not found at $DB_BENCH"
+    echo "Build the in-tree benchmark with: make -C tests bench_lsm"
     exit 1
 fi
 
@@ -143,6 +148,28 @@ for t in "${THREADS[@]}"; do
     echo "readrandom,$t,lhandoff,$ops_l,$us_l" >> $RESULT_FILE
 done
 
+echo ""
+echo "========== readwhilewriting Tests =========="
+for t in "${THREADS[@]}"; do
+    echo -n "Threads $t: "
+
+    output=$($DB_BENCH --benchmarks=readwhilewriting --threads=$t --num=$NUM --db=$DB_DIR --use_existing_db=1 2>&1)
+    echo "$output" > "$LOG_DIR/readwhilewriting_t${t}_native.log"
+    result=$(extract_result "$output" "readwhilewriting")
+    ops_n=$(echo $result | awk '{print $1}')
+    us_n=$(echo $result | awk '{print $2}')
+    echo -n "native=$ops_n ops/s, "
+    echo "readwhilewriting,$t,native,$ops_n,$us_n" >> $RESULT_FILE
+
+    output=$(sudo $LAUNCHER -b $BPF_OBJ -l $LIBLH $DB_BENCH --benchmarks=readwhilewriting --threads=$t --num=$NUM --db=$DB_DIR --use_existing_db=1 2>&1)
+    echo "$output" > "$LOG_DIR/readwhilewriting_t${t}_lhandoff.log"
+    result=$(extract_result "$output" "readwhilewriting")
+    ops_l=$(echo $result | awk '{print $1}')
+    us_l=$(echo $result | awk '{print $2}')
+    echo "lhandoff=$ops_l ops/s"
+    echo "readwhilewriting,$t,lhandoff,$ops_l,$us_l" >> $RESULT_FILE
+done
+
 sudo rm -rf $DB_DIR 2>/dev/null || true
 
 echo ""
@@ -152,10 +179,10 @@ echo ""
 # 生成摘要文件
 SUMMARY_FILE="$OUTPUT_DIR/summary.txt"
 {
-    printf "%-12s %8s %14s %14s %14s %14s %8s\n" "Benchmark" "Threads" "Native(ops/s)" "lhandoff(ops/s)" "Native(us/op)" "lhandoff(us/op)" "Speedup"
-    printf "%-12s %8s %14s %14s %14s %14s %8s\n" "-----------" "-------" "--------------" "---------------" "--------------" "---------------" "-------"
+    printf "%-16s %8s %14s %14s %14s %14s %8s\n" "Benchmark" "Threads" "Native(ops/s)" "lhandoff(ops/s)" "Native(us/op)" "lhandoff(us/op)" "Speedup"
+    printf "%-16s %8s %14s %14s %14s %14s %8s\n" "----------------" "-------" "--------------" "---------------" "--------------" "---------------" "-------"
 
-    for bench in fillrandom readrandom; do
+    for bench in fillrandom readrandom readwhilewriting; do
         for t in "${THREADS[@]}"; do
             native_ops=$(grep "^$bench,$t,native" $RESULT_FILE | cut -d, -f4)
             native_us=$(grep "^$bench,$t,native" $RESULT_FILE | cut -d, -f5)
@@ -164,9 +191,9 @@ SUMMARY_FILE="$OUTPUT_DIR/summary.txt"
 
             if [ "$native_ops" != "N/A" ] && [ "$lhandoff_ops" != "N/A" ] && [ -n "$native_ops" ] && [ -n "$lhandoff_ops" ]; then
                 speedup=$(echo "scale=2; $lhandoff_ops / $native_ops" | bc 2>/dev/null || echo "N/A")
-                printf "%-12s %8d %14s %15s %14s %15s %7sx\n" "$bench" "$t" "$native_ops" "$lhandoff_ops" "$native_us" "$lhandoff_us" "$speedup"
+                printf "%-16s %8d %14s %15s %14s %15s %7sx\n" "$bench" "$t" "$native_ops" "$lhandoff_ops" "$native_us" "$lhandoff_us" "$speedup"
             else
-                printf "%-12s %8d %14s %15s %14s %15s %8s\n" "$bench" "$t" "$native_ops" "$lhandoff_ops" "$native_us" "$lhandoff_us" "N/A"
+                printf "%-16s %8d %14s %15s %14s %15s %8s\n" "$bench" "$t" "$native_ops" "$lhandoff_ops" "$native_us" "$lhandoff_us" "N/A"
             fi
         done
     done
@@ -0,0 +1,1266 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * bench_lsm.c - 无外部依赖的 LevelDB 式存储引擎基准
+ *
+ * 按 LevelDB 的锁结构实现一个最小 LSM：
+ * - DB mutex + condvar 写者队列（group commit），队首写者释放 mutex 写日志
+ * - skiplist memtable，由独立 mutex 保护
+ * - 后台线程 flush immutable memtable / 合并 L0 table，writer 在 condvar 上 stall
+ * - 分片 mutex 的 LRU block cache
+ * - 日志和 table 文件写入 tmpfs（默认 /dev/shm），use_existing_db 时
+ *   加载 table 并重放日志恢复
+ *
+ * 命令行和输出格式与 db_bench 兼容，可直接由 bench_leveldb.sh 驱动：
+ *   bench_lsm --benchmarks=fillrandom,readrandom --threads=8 --num=100000
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#include "bench_harness.h"
+
+/* ========== 配置 ========== */
+static int g_num = 100000;
+static int g_threads = 1;
+static int g_value_size = 100;
+static bool g_use_existing_db = false;
+static const char *g_db_dir = "/dev/shm/lh_lsm_bench";
+static const char *g_benchmarks = "fillseq,fillrandom,readrandom";
+static size_t g_write_buffer_size = 4 << 20;
+static size_t g_cache_size = 8 << 20;
+
+#define SKIPLIST_MAX_HEIGHT     12
+#define ARENA_BLOCK_SIZE        (1 << 20)
+#define BLOCK_SIZE              4096
+#define MAX_GROUP_BYTES         (1 << 20)
+#define L0_COMPACTION_TRIGGER   4
+#define L0_STOP_WRITES_TRIGGER  12
+#define CACHE_SHARDS            16
+#define MAX_TABLES              64
+
+/* ========== Arena ========== */
+struct arena_block {
+    struct arena_block *next;
+    size_t used;
+    char data[];
+};
+
+struct arena {
+    struct arena_block *head;
+    size_t bytes;
+};
+
+static void *arena_alloc(struct arena *a, size_t size)
+{
+    size = (size + 7) & ~(size_t)7;
+    if (!a->head || a->head->used + size > ARENA_BLOCK_SIZE) {
+        size_t cap = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        struct arena_block *b = malloc(sizeof(*b) + cap);
+        b->next = a->head;
+        b->used = 0;
+        a->head = b;
+    }
+    void *p = a->head->data + a->head->used;
+    a->head->used += size;
+    a->bytes += size;
+    return p;
+}
+
+static void arena_free(struct arena *a)
+{
+    struct arena_block *b = a->head;
+    while (b) {
+        struct arena_block *next = b->next;
+        free(b);
+        b = next;
+    }
+    a->head = NULL;
+    a->bytes = 0;
+}
+
+/* ========== SkipList memtable ========== */
+struct sl_node {
+    uint64_t key;
+    char *value;
+    int height;
+    struct sl_node *next[];
+};
+
+struct memtable {
+    pthread_mutex_t lock;
+    struct arena arena;
+    struct sl_node *head;
+    int max_height;
+    uint64_t count;
+    uint64_t rng;
+    atomic_int refs;
+};
+
+static struct sl_node *sl_new_node(struct memtable *m, uint64_t key, int height)
+{
+    struct sl_node *n = arena_alloc(&m->arena,
+                                    sizeof(*n) + height * sizeof(struct sl_node *));
+    n->key = key;
+    n->value = NULL;
+    n->height = height;
+    for (int i = 0; i < height; i++)
+        n->next[i] = NULL;
+    return n;
+}
+
+static struct memtable *memtable_new(void)
+{
+    struct memtable *m = calloc(1, sizeof(*m));
+    pthread_mutex_init(&m->lock, NULL);
+    m->head = sl_new_node(m, 0, SKIPLIST_MAX_HEIGHT);
+    m->max_height = 1;
+    m->rng = 0xdeadbeef;
+    atomic_store(&m->refs, 1);
+    return m;
+}
+
+static void memtable_ref(struct memtable *m)
+{
+    atomic_fetch_add(&m->refs, 1);
+}
+
+static void memtable_unref(struct memtable *m)
+{
+    if (atomic_fetch_sub(&m->refs, 1) == 1) {
+        arena_free(&m->arena);
+        pthread_mutex_destroy(&m->lock);
+        free(m);
+    }
+}
+
+static int sl_random_height(struct memtable *m)
+{
+    int h = 1;
+    while (h < SKIPLIST_MAX_HEIGHT && (bench_rand(&m->rng) & 3) == 0)
+        h++;
+    return h;
+}
+
+/* 调用者持有 m->lock */
+static void sl_insert(struct memtable *m, uint64_t key, const char *value)
+{
+    struct sl_node *prev[SKIPLIST_MAX_HEIGHT];
+    struct sl_node *x = m->head;
+
+    for (int level = m->max_height - 1; level >= 0; level--) {
+        while (x->next[level] && x->next[level]->key < key)
+            x = x->next[level];
+        prev[level] = x;
+    }
+
+    char *v = arena_alloc(&m->arena, g_value_size);
+    memcpy(v, value, g_value_size);
+
+    struct sl_node *found = prev[0]->next[0];
+    if (found && found->key == key) {
+        found->value = v;
+        return;
+    }
+
+    int height = sl_random_height(m);
+    if (height > m->max_height) {
+        for (int i = m->max_height; i < height; i++)
+            prev[i] = m->head;
+        m->max_height = height;
+    }
+
+    struct sl_node *n = sl_new_node(m, key, height);
+    n->value = v;
+    for (int i = 0; i < height; i++) {
+        n->next[i] = prev[i]->next[i];
+        prev[i]->next[i] = n;
+    }
+    m->count++;
+}
+
+static bool memtable_get(struct memtable *m, uint64_t key, char *out)
+{
+    bool found = false;
+
+    pthread_mutex_lock(&m->lock);
+    struct sl_node *x = m->head;
+    for (int level = m->max_height - 1; level >= 0; level--) {
+        while (x->next[level] && x->next[level]->key < key)
+            x = x->next[level];
+    }
+    x = x->next[0];
+    if (x && x->key == key) {
+        memcpy(out, x->value, g_value_size);
+        found = true;
+    }
+    pthread_mutex_unlock(&m->lock);
+    return found;
+}
+
+/* ========== Table (内存中的 L0 sstable) ========== */
+struct table {
+    uint64_t id;                /* 文件编号，与日志共用编号空间 */
+    uint32_t nentries;
+    uint32_t nblocks;
+    uint32_t entries_per_block;
+    uint64_t *block_first_key;
+    char *data;                 /* 每条: u64 key + value */
+    atomic_int refs;
+};
+
+static atomic_uint_fast64_t g_next_file_number = 1;
+
+static void file_path(char *buf, size_t len, uint64_t number, const char *suffix)
+{
+    snprintf(buf, len, "%s/%06lu.%s", g_db_dir, number, suffix);
+}
+
+static inline size_t entry_size(void)
+{
+    return sizeof(uint64_t) + g_value_size;
+}
+
+static struct table *table_new(uint32_t nentries)
+{
+    struct table *t = calloc(1, sizeof(*t));
+    t->id = atomic_fetch_add(&g_next_file_number, 1);
+    t->nentries = nentries;
+    t->entries_per_block = BLOCK_SIZE / entry_size();
+    if (t->entries_per_block == 0)
+        t->entries_per_block = 1;
+    t->nblocks = (nentries + t->entries_per_block - 1) / t->entries_per_block;
+    t->block_first_key = malloc((t->nblocks + 1) * sizeof(uint64_t));
+    t->data = malloc((size_t)nentries * entry_size() + 1);
+    atomic_store(&t->refs, 1);
+    return t;
+}
+
+static void table_finish(struct table *t)
+{
+    for (uint32_t b = 0; b < t->nblocks; b++)
+        memcpy(&t->block_first_key[b],
+               t->data + (size_t)b * t->entries_per_block * entry_size(),
+               sizeof(uint64_t));
+}
+
+static void table_ref(struct table *t)
+{
+    atomic_fetch_add(&t->refs, 1);
+}
+
+static void table_unref(struct table *t)
+{
+    if (atomic_fetch_sub(&t->refs, 1) == 1) {
+        free(t->block_first_key);
+        free(t->data);
+        free(t);
+    }
+}
+
+struct table_file_header {
+    uint32_t nentries;
+    uint32_t value_size;
+};
+
+static int table_write_file(struct table *t)
+{
+    char path[512];
+    file_path(path, sizeof(path), t->id, "sst");
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    struct table_file_header hdr = { t->nentries, (uint32_t)g_value_size };
+    size_t size = (size_t)t->nentries * entry_size();
+    int ret = 0;
+    if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+        write(fd, t->data, size) != (ssize_t)size) {
+        perror(path);
+        ret = -1;
+    }
+    close(fd);
+    return ret;
+}
+
+static struct table *table_load_file(uint64_t number)
+{
+    char path[512];
+    file_path(path, sizeof(path), number, "sst");
+
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+
+    struct table_file_header hdr;
+    struct table *t = NULL;
+    if (fread(&hdr, sizeof(hdr), 1, f) == 1 && hdr.value_size == (uint32_t)g_value_size) {
+        t = table_new(hdr.nentries);
+        t->id = number;
+        if (fread(t->data, entry_size(), hdr.nentries, f) != hdr.nentries) {
+            table_unref(t);
+            t = NULL;
+        } else {
+            table_finish(t);
+        }
+    }
+    fclose(f);
+    if (!t)
+        fprintf(stderr, "Ignoring incompatible table %s\n", path);
+    return t;
+}
+
+static struct table *table_from_memtable(struct memtable *m)
+{
+    struct table *t = table_new(m->count);
+    char *p = t->data;
+    for (struct sl_node *x = m->head->next[0]; x; x = x->next[0]) {
+        memcpy(p, &x->key, sizeof(uint64_t));
+        memcpy(p + sizeof(uint64_t), x->value, g_value_size);
+        p += entry_size();
+    }
+    table_finish(t);
+    return t;
+}
+
+/* 多路合并，tables[0] 最新，相同 key 保留最新 */
+static struct table *table_merge(struct table **tables, int n)
+{
+    uint32_t total = 0;
+    uint32_t pos[MAX_TABLES] = { 0 };
+    for (int i = 0; i < n; i++)
+        total += tables[i]->nentries;
+
+    struct table *out = table_new(total);
+    char *p = out->data;
+    uint32_t count = 0;
+
+    while (1) {
+        int best = -1;
+        uint64_t best_key = 0;
+        for (int i = 0; i < n; i++) {
+            if (pos[i] >= tables[i]->nentries)
+                continue;
+            uint64_t k;
+            memcpy(&k, tables[i]->data + (size_t)pos[i] * entry_size(), sizeof(k));
+            if (best < 0 || k < best_key) {
+                best = i;
+                best_key = k;
+            }
+        }
+        if (best < 0)
+            break;
+
+        memcpy(p, tables[best]->data + (size_t)pos[best] * entry_size(), entry_size());
+        p += entry_size();
+        count++;
+
+        for (int i = 0; i < n; i++) {
+            if (pos[i] >= tables[i]->nentries)
+                continue;
+            uint64_t k;
+            memcpy(&k, tables[i]->data + (size_t)pos[i] * entry_size(), sizeof(k));
+            if (k == best_key)
+                pos[i]++;
+        }
+    }
+
+    out->nentries = count;
+    out->nblocks = (count + out->entries_per_block - 1) / out->entries_per_block;
+    table_finish(out);
+    return out;
+}
+
+/* ========== 分片 LRU block cache ========== */
+struct cache_entry {
+    uint64_t key;               /* table_id << 32 | block_idx */
+    uint32_t nentries;
+    int refs;
+    bool in_cache;
+    struct cache_entry *hash_next;
+    struct cache_entry *lru_prev;
+    struct cache_entry *lru_next;
+    char *data;
+};
+
+struct cache_shard {
+    pthread_mutex_t lock;
+    size_t usage;
+    size_t capacity;
+    uint32_t nbuckets;
+    struct cache_entry **buckets;
+    struct cache_entry lru;     /* 哨兵：lru.next 最旧 */
+} __attribute__((aligned(64)));
+
+static struct cache_shard g_cache[CACHE_SHARDS];
+
+static void cache_init(void)
+{
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        struct cache_shard *s = &g_cache[i];
+        pthread_mutex_init(&s->lock, NULL);
+        s->usage = 0;
+        s->capacity = g_cache_size / CACHE_SHARDS;
+        s->nbuckets = 1024;
+        s->buckets = calloc(s->nbuckets, sizeof(struct cache_entry *));
+        s->lru.lru_next = s->lru.lru_prev = &s->lru;
+    }
+}
+
+static inline uint32_t cache_hash(uint64_t key)
+{
+    key *= 0x9E3779B97F4A7C15ULL;
+    return (uint32_t)(key >> 32);
+}
+
+static void lru_remove(struct cache_entry *e)
+{
+    e->lru_prev->lru_next = e->lru_next;
+    e->lru_next->lru_prev = e->lru_prev;
+}
+
+static void lru_append(struct cache_shard *s, struct cache_entry *e)
+{
+    e->lru_next = &s->lru;
+    e->lru_prev = s->lru.lru_prev;
+    e->lru_prev->lru_next = e;
+    e->lru_next->lru_prev = e;
+}
+
+static void cache_entry_free(struct cache_entry *e)
+{
+    free(e->data);
+    free(e);
+}
+
+/* 调用者持有 s->lock；返回 true 表示 e 可以释放 */
+static bool cache_unref_locked(struct cache_entry *e)
+{
+    return --e->refs == 0;
+}
+
+static void cache_hash_remove(struct cache_shard *s, struct cache_entry *e)
+{
+    struct cache_entry **pp = &s->buckets[cache_hash(e->key) % s->nbuckets];
+    while (*pp && *pp != e)
+        pp = &(*pp)->hash_next;
+    if (*pp)
+        *pp = e->hash_next;
+}
+
+static struct cache_entry *cache_lookup(uint64_t key)
+{
+    uint32_t h = cache_hash(key);
+    struct cache_shard *s = &g_cache[h % CACHE_SHARDS];
+
+    pthread_mutex_lock(&s->lock);
+    struct cache_entry *e = s->buckets[h % s->nbuckets];
+    while (e && e->key != key)
+        e = e->hash_next;
+    if (e) {
+        e->refs++;
+        lru_remove(e);
+        lru_append(s, e);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return e;
+}
+
+static struct cache_entry *cache_insert(uint64_t key, char *data, uint32_t nentries)
+{
+    uint32_t h = cache_hash(key);
+    struct cache_shard *s = &g_cache[h % CACHE_SHARDS];
+    struct cache_entry *e = calloc(1, sizeof(*e));
+    struct cache_entry *victims = NULL;
+
+    e->key = key;
+    e->data = data;
+    e->nentries = nentries;
+    e->refs = 2;                /* cache 自身 + 调用者 */
+    e->in_cache = true;
+
+    pthread_mutex_lock(&s->lock);
+
+    /* 并发 miss 时可能已有相同 key，替换旧的 */
+    struct cache_entry *old = s->buckets[h % s->nbuckets];
+    while (old && old->key != key)
+        old = old->hash_next;
+    if (old) {
+        cache_hash_remove(s, old);
+        lru_remove(old);
+        old->in_cache = false;
+        s->usage -= BLOCK_SIZE;
+        if (cache_unref_locked(old)) {
+            old->hash_next = victims;
+            victims = old;
+        }
+    }
+
+    e->hash_next = s->buckets[h % s->nbuckets];
+    s->buckets[h % s->nbuckets] = e;
+    lru_append(s, e);
+    s->usage += BLOCK_SIZE;
+
+    while (s->usage > s->capacity && s->lru.lru_next != &s->lru) {
+        struct cache_entry *v = s->lru.lru_next;
+        if (v == e)
+            break;
+        cache_hash_remove(s, v);
+        lru_remove(v);
+        v->in_cache = false;
+        s->usage -= BLOCK_SIZE;
+        if (cache_unref_locked(v)) {
+            v->hash_next = victims;
+            victims = v;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    while (victims) {
+        struct cache_entry *next = victims->hash_next;
+        cache_entry_free(victims);
+        victims = next;
+    }
+    return e;
+}
+
+static void cache_release(struct cache_entry *e)
+{
+    struct cache_shard *s = &g_cache[cache_hash(e->key) % CACHE_SHARDS];
+    bool free_it;
+
+    pthread_mutex_lock(&s->lock);
+    free_it = cache_unref_locked(e);
+    pthread_mutex_unlock(&s->lock);
+
+    if (free_it)
+        cache_entry_free(e);
+}
+
+/* 在 table 中查找：index 二分 → block cache → block 内二分 */
+static bool table_get(struct table *t, uint64_t key, char *out)
+{
+    if (t->nblocks == 0 || key < t->block_first_key[0])
+        return false;
+
+    uint32_t lo = 0, hi = t->nblocks - 1;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi + 1) / 2;
+        if (t->block_first_key[mid] <= key)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    uint32_t first = lo * t->entries_per_block;
+    uint32_t n = t->nentries - first;
+    if (n > t->entries_per_block)
+        n = t->entries_per_block;
+
+    uint64_t ckey = (t->id << 32) | lo;
+    struct cache_entry *e = cache_lookup(ckey);
+    if (!e) {
+        /* 模拟从文件读取 block */
+        char *data = malloc((size_t)n * entry_size());
+        memcpy(data, t->data + (size_t)first * entry_size(), (size_t)n * entry_size());
+        e = cache_insert(ckey, data, n);
+    }
+
+    bool found = false;
+    int l = 0, h = (int)e->nentries - 1;
+    while (l <= h) {
+        int mid = (l + h) / 2;
+        uint64_t k;
+        memcpy(&k, e->data + (size_t)mid * entry_size(), sizeof(k));
+        if (k == key) {
+            memcpy(out, e->data + (size_t)mid * entry_size() + sizeof(uint64_t),
+                   g_value_size);
+            found = true;
+            break;
+        }
+        if (k < key)
+            l = mid + 1;
+        else
+            h = mid - 1;
+    }
+
+    cache_release(e);
+    return found;
+}
+
+/* ========== Version: 当前 table 列表的不可变快照 ========== */
+struct version {
+    int ntables;
+    struct table *tables[MAX_TABLES];   /* [0] 最新 */
+    atomic_int refs;
+};
+
+static struct version *version_new(void)
+{
+    struct version *v = calloc(1, sizeof(*v));
+    atomic_store(&v->refs, 1);
+    return v;
+}
+
+static void version_ref(struct version *v)
+{
+    atomic_fetch_add(&v->refs, 1);
+}
+
+static void version_unref(struct version *v)
+{
+    if (atomic_fetch_sub(&v->refs, 1) == 1) {
+        for (int i = 0; i < v->ntables; i++)
+            table_unref(v->tables[i]);
+        free(v);
+    }
+}
+
+/* ========== DB ========== */
+struct writer {
+    uint64_t key;
+    const char *value;
+    bool done;
+    pthread_cond_t cv;
+    struct writer *next;
+};
+
+struct db {
+    pthread_mutex_t mutex;
+    pthread_cond_t bg_work_cv;      /* 后台线程等待 */
+    pthread_cond_t bg_done_cv;      /* writer 等待 flush/compaction */
+    struct writer *writers_head;
+    struct writer *writers_tail;
+    struct memtable *mem;
+    struct memtable *imm;
+    struct version *current;
+    bool shutting_down;
+    pthread_t bg_thread;
+
+    int log_fd;
+    uint64_t log_number;
+    uint64_t first_log_number;      /* 更早的日志属于恢复数据，只在恢复完成后删除 */
+    char *log_buf;
+    size_t log_buf_cap;
+};
+
+static struct db g_db;
+
+static int log_open(struct db *db, uint64_t number)
+{
+    char path[512];
+    file_path(path, sizeof(path), number, "log");
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    if (db->log_fd >= 0)
+        close(db->log_fd);
+    db->log_fd = fd;
+    db->log_number = number;
+    return 0;
+}
+
+/* 调用者持有 db->mutex 且是队首 writer */
+static void make_room_for_write(struct db *db)
+{
+    while (1) {
+        if (db->mem->arena.bytes < g_write_buffer_size) {
+            return;
+        } else if (db->imm) {
+            pthread_cond_wait(&db->bg_done_cv, &db->mutex);
+        } else if (db->current->ntables >= L0_STOP_WRITES_TRIGGER) {
+            pthread_cond_wait(&db->bg_done_cv, &db->mutex);
+        } else {
+            if (log_open(db, atomic_fetch_add(&g_next_file_number, 1)) != 0)
+                exit(1);
+            db->imm = db->mem;
+            db->mem = memtable_new();
+            pthread_cond_signal(&db->bg_work_cv);
+        }
+    }
+}
+
+static void delete_files_range(const char *suffix, uint64_t lo, uint64_t hi);
+
+static void install_version(struct db *db, struct version *v)
+{
+    struct version *old = db->current;
+    db->current = v;
+    version_unref(old);
+}
+
+static void *bg_thread_fn(void *arg)
+{
+    struct db *db = arg;
+
+    pthread_mutex_lock(&db->mutex);
+    while (!db->shutting_down) {
+        if (db->imm) {
+            struct memtable *imm = db->imm;
+            uint64_t log_number = db->log_number;
+            pthread_mutex_unlock(&db->mutex);
+            struct table *t = table_from_memtable(imm);
+            table_write_file(t);
+            /* imm 已持久化为 table，之前的日志不再需要 */
+            delete_files_range("log", db->first_log_number, log_number);
+            pthread_mutex_lock(&db->mutex);
+
+            struct version *v = version_new();
+            v->tables[0] = t;
+            v->ntables = 1;
+            for (int i = 0; i < db->current->ntables && v->ntables < MAX_TABLES; i++) {
+                table_ref(db->current->tables[i]);
+                v->tables[v->ntables++] = db->current->tables[i];
+            }
+            install_version(db, v);
+            db->imm = NULL;
+            memtable_unref(imm);
+            pthread_cond_broadcast(&db->bg_done_cv);
+        } else if (db->current->ntables >= L0_COMPACTION_TRIGGER) {
+            struct version *base = db->current;
+            version_ref(base);
+            pthread_mutex_unlock(&db->mutex);
+            struct table *merged = table_merge(base->tables, base->ntables);
+            table_write_file(merged);
+            pthread_mutex_lock(&db->mutex);
+
+            /* 合并期间可能有新 flush 的 table 插在前面 */
+            int newer = db->current->ntables - base->ntables;
+            struct version *v = version_new();
+            for (int i = 0; i < newer; i++) {
+                table_ref(db->current->tables[i]);
+                v->tables[v->ntables++] = db->current->tables[i];
+            }
+            v->tables[v->ntables++] = merged;
+            for (int i = 0; i < base->ntables; i++) {
+                char path[512];
+                file_path(path, sizeof(path), base->tables[i]->id, "sst");
+                unlink(path);
+            }
+            version_unref(base);
+            install_version(db, v);
+            pthread_cond_broadcast(&db->bg_done_cv);
+        } else {
+            pthread_cond_wait(&db->bg_work_cv, &db->mutex);
+        }
+    }
+    pthread_mutex_unlock(&db->mutex);
+    return NULL;
+}
+
+static void db_write(struct db *db, uint64_t key, const char *value)
+{
+    struct writer w;
+    w.key = key;
+    w.value = value;
+    w.done = false;
+    w.next = NULL;
+    pthread_cond_init(&w.cv, NULL);
+
+    pthread_mutex_lock(&db->mutex);
+    if (db->writers_tail)
+        db->writers_tail->next = &w;
+    else
+        db->writers_head = &w;
+    db->writers_tail = &w;
+
+    while (!w.done && db->writers_head != &w)
+        pthread_cond_wait(&w.cv, &db->mutex);
+
+    if (w.done) {
+        pthread_mutex_unlock(&db->mutex);
+        pthread_cond_destroy(&w.cv);
+        return;
+    }
+
+    make_room_for_write(db);
+    struct memtable *mem = db->mem;
+
+    /* BuildBatchGroup */
+    struct writer *last = &w;
+    size_t rec_size = entry_size();
+    size_t size = rec_size;
+    size_t max_size = MAX_GROUP_BYTES;
+    if (size <= (128 << 10))
+        max_size = size + (128 << 10);
+    while (last->next && size + rec_size <= max_size) {
+        last = last->next;
+        size += rec_size;
+    }
+
+    if (db->log_buf_cap < size) {
+        db->log_buf = realloc(db->log_buf, size);
+        db->log_buf_cap = size;
+    }
+
+    /* 写日志和插入 memtable 期间释放 DB mutex */
+    pthread_mutex_unlock(&db->mutex);
+
+    char *p = db->log_buf;
+    for (struct writer *x = &w;; x = x->next) {
+        memcpy(p, &x->key, sizeof(uint64_t));
+        memcpy(p + sizeof(uint64_t), x->value, g_value_size);
+        p += rec_size;
+        if (x == last)
+            break;
+    }
+    if (write(db->log_fd, db->log_buf, size) != (ssize_t)size) {
+        perror("log write");
+        exit(1);
+    }
+
+    pthread_mutex_lock(&mem->lock);
+    for (struct writer *x = &w;; x = x->next) {
+        sl_insert(mem, x->key, x->value);
+        if (x == last)
+            break;
+    }
+    pthread_mutex_unlock(&mem->lock);
+
+    pthread_mutex_lock(&db->mutex);
+
+    struct writer *x = &w;
+    while (1) {
+        struct writer *next = x->next;
+        if (x != &w) {
+            x->done = true;
+            pthread_cond_signal(&x->cv);
+        }
+        if (x == last) {
+            db->writers_head = next;
+            if (!next)
+                db->writers_tail = NULL;
+            break;
+        }
+        x = next;
+    }
+    if (db->writers_head)
+        pthread_cond_signal(&db->writers_head->cv);
+
+    pthread_mutex_unlock(&db->mutex);
+    pthread_cond_destroy(&w.cv);
+}
+
+static bool db_get(struct db *db, uint64_t key, char *out)
+{
+    pthread_mutex_lock(&db->mutex);
+    struct memtable *mem = db->mem;
+    struct memtable *imm = db->imm;
+    struct version *v = db->current;
+    memtable_ref(mem);
+    if (imm)
+        memtable_ref(imm);
+    version_ref(v);
+    pthread_mutex_unlock(&db->mutex);
+
+    bool found = memtable_get(mem, key, out);
+    if (!found && imm)
+        found = memtable_get(imm, key, out);
+    for (int i = 0; !found && i < v->ntables; i++)
+        found = table_get(v->tables[i], key, out);
+
+    pthread_mutex_lock(&db->mutex);
+    memtable_unref(mem);
+    if (imm)
+        memtable_unref(imm);
+    version_unref(v);
+    pthread_mutex_unlock(&db->mutex);
+
+    return found;
+}
+
+/* ========== 打开 / 恢复 / 关闭 ========== */
+#define MAX_DB_FILES    4096
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* 列出 db 目录中指定后缀的文件编号（升序），返回个数 */
+static int list_files(const char *suffix, uint64_t *numbers, int max)
+{
+    DIR *dir = opendir(g_db_dir);
+    if (!dir)
+        return 0;
+
+    int n = 0;
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL && n < max) {
+        unsigned long num;
+        char sfx[8];
+        if (sscanf(de->d_name, "%lu.%7s", &num, sfx) == 2 &&
+            strcmp(sfx, suffix) == 0)
+            numbers[n++] = num;
+    }
+    closedir(dir);
+    qsort(numbers, n, sizeof(uint64_t), cmp_u64);
+    return n;
+}
+
+/* 删除编号在 [lo, hi) 内的文件 */
+static void delete_files_range(const char *suffix, uint64_t lo, uint64_t hi)
+{
+    uint64_t numbers[MAX_DB_FILES];
+    int n = list_files(suffix, numbers, MAX_DB_FILES);
+    for (int i = 0; i < n && numbers[i] < hi; i++) {
+        if (numbers[i] < lo)
+            continue;
+        char path[512];
+        file_path(path, sizeof(path), numbers[i], suffix);
+        unlink(path);
+    }
+}
+
+static void recover_db(struct db *db, const uint64_t *logs, int nlogs)
+{
+    uint64_t tables[MAX_DB_FILES];
+    int ntables = list_files("sst", tables, MAX_DB_FILES);
+
+    /* version 中 [0] 最新 */
+    for (int i = ntables - 1; i >= 0 && db->current->ntables < MAX_TABLES; i--) {
+        struct table *t = table_load_file(tables[i]);
+        if (t)
+            db->current->tables[db->current->ntables++] = t;
+    }
+
+    size_t rec_size = entry_size();
+    char *rec = malloc(rec_size);
+    uint64_t records = 0;
+
+    for (int i = 0; i < nlogs; i++) {
+        char path[512];
+        file_path(path, sizeof(path), logs[i], "log");
+        FILE *f = fopen(path, "rb");
+        if (!f)
+            continue;
+        while (fread(rec, rec_size, 1, f) == 1) {
+            uint64_t key;
+            memcpy(&key, rec, sizeof(key));
+            db_write(db, key, rec + sizeof(uint64_t));
+            records++;
+        }
+        fclose(f);
+    }
+    free(rec);
+
+    /* 等待后台把恢复出来的数据刷成 table */
+    pthread_mutex_lock(&db->mutex);
+    while (db->imm || db->current->ntables >= L0_COMPACTION_TRIGGER)
+        pthread_cond_wait(&db->bg_done_cv, &db->mutex);
+    pthread_mutex_unlock(&db->mutex);
+
+    fprintf(stderr, "Recovered %d tables and %lu log records\n",
+            db->current->ntables, records);
+}
+
+static int db_open(struct db *db)
+{
+    memset(db, 0, sizeof(*db));
+    pthread_mutex_init(&db->mutex, NULL);
+    pthread_cond_init(&db->bg_work_cv, NULL);
+    pthread_cond_init(&db->bg_done_cv, NULL);
+    db->mem = memtable_new();
+    db->current = version_new();
+    db->log_fd = -1;
+
+    if (mkdir(g_db_dir, 0755) != 0 && errno != EEXIST) {
+        perror(g_db_dir);
+        return -1;
+    }
+
+    if (!g_use_existing_db) {
+        delete_files_range("log", 0, UINT64_MAX);
+        delete_files_range("sst", 0, UINT64_MAX);
+    }
+
+    uint64_t logs[MAX_DB_FILES], tables[MAX_DB_FILES];
+    int nlogs = list_files("log", logs, MAX_DB_FILES);
+    int ntables = list_files("sst", tables, MAX_DB_FILES);
+    uint64_t next = 1;
+    if (nlogs > 0 && logs[nlogs - 1] >= next)
+        next = logs[nlogs - 1] + 1;
+    if (ntables > 0 && tables[ntables - 1] >= next)
+        next = tables[ntables - 1] + 1;
+    atomic_store(&g_next_file_number, next);
+
+    /* 新日志编号排在已有文件之后，恢复时重放的记录写入新日志 */
+    if (log_open(db, atomic_fetch_add(&g_next_file_number, 1)) != 0)
+        return -1;
+    db->first_log_number = db->log_number;
+
+    pthread_create(&db->bg_thread, NULL, bg_thread_fn, db);
+
+    if (nlogs > 0 || ntables > 0) {
+        recover_db(db, logs, nlogs);
+        for (int i = 0; i < nlogs; i++) {
+            char path[512];
+            file_path(path, sizeof(path), logs[i], "log");
+            unlink(path);
+        }
+    }
+    return 0;
+}
+
+static void db_close(struct db *db)
+{
+    pthread_mutex_lock(&db->mutex);
+    db->shutting_down = true;
+    pthread_cond_broadcast(&db->bg_work_cv);
+    pthread_mutex_unlock(&db->mutex);
+    pthread_join(db->bg_thread, NULL);
+
+    if (db->log_fd >= 0)
+        close(db->log_fd);
+    if (db->imm)
+        memtable_unref(db->imm);
+    memtable_unref(db->mem);
+    version_unref(db->current);
+    free(db->log_buf);
+}
+
+/* ========== 基准 ========== */
+enum bench_type {
+    BENCH_FILLSEQ,
+    BENCH_FILLRANDOM,
+    BENCH_READRANDOM,
+    BENCH_READWHILEWRITING,
+};
+
+struct thread_state {
+    int id;
+    uint64_t rng;
+    uint64_t done;
+    uint64_t found;
+    uint64_t bytes;
+    uint64_t start_ns;
+    uint64_t finish_ns;
+    pthread_t thread;
+} __attribute__((aligned(64)));
+
+static enum bench_type g_bench;
+static pthread_barrier_t g_bench_barrier;
+static atomic_int g_readers_done = 0;
+static char *g_value_gen = NULL;       /* 随机 value 源 */
+#define VALUE_GEN_SIZE  (1 << 20)
+
+static const char *random_value(uint64_t *rng)
+{
+    return g_value_gen + bench_rand(rng) % (VALUE_GEN_SIZE - g_value_size);
+}
+
+static void do_write(struct thread_state *ts, bool seq)
+{
+    for (int i = 0; i < g_num; i++) {
+        uint64_t key = seq ? (uint64_t)i : bench_rand(&ts->rng) % g_num;
+        db_write(&g_db, key, random_value(&ts->rng));
+        ts->bytes += entry_size();
+        ts->done++;
+    }
+}
+
+static void do_read(struct thread_state *ts)
+{
+    char *value = malloc(g_value_size);
+    for (int i = 0; i < g_num; i++) {
+        uint64_t key = bench_rand(&ts->rng) % g_num;
+        if (db_get(&g_db, key, value))
+            ts->found++;
+        ts->done++;
+    }
+    free(value);
+}
+
+static void *bench_thread(void *arg)
+{
+    struct thread_state *ts = arg;
+
+    pthread_barrier_wait(&g_bench_barrier);
+    ts->start_ns = get_time_ns();
+
+    switch (g_bench) {
+    case BENCH_FILLSEQ:
+        do_write(ts, true);
+        break;
+    case BENCH_FILLRANDOM:
+        do_write(ts, false);
+        break;
+    case BENCH_READRANDOM:
+        do_read(ts);
+        break;
+    case BENCH_READWHILEWRITING:
+        if (ts->id > 0) {
+            do_read(ts);
+            atomic_fetch_add(&g_readers_done, 1);
+        } else {
+            /* 额外的 writer 线程，readers 全部结束后停止，不计入统计 */
+            while (atomic_load(&g_readers_done) < g_threads) {
+                uint64_t key = bench_rand(&ts->rng) % g_num;
+                db_write(&g_db, key, random_value(&ts->rng));
+            }
+        }
+        break;
+    }
+
+    ts->finish_ns = get_time_ns();
+    return NULL;
+}
+
+static void run_benchmark(const char *name, enum bench_type type)
+{
+    int nthreads = g_threads + (type == BENCH_READWHILEWRITING ? 1 : 0);
+    int first = type == BENCH_READWHILEWRITING ? 1 : 0;
+    struct thread_state *ts = aligned_alloc(64, nthreads * sizeof(*ts));
+    memset(ts, 0, nthreads * sizeof(*ts));
+
+    g_bench = type;
+    atomic_store(&g_readers_done, 0);
+    pthread_barrier_init(&g_bench_barrier, NULL, nthreads);
+
+    for (int i = 0; i < nthreads; i++) {
+        ts[i].id = i;
+        ts[i].rng = 1000 + i * 0x9E3779B97F4A7C15ULL;
+        pthread_create(&ts[i].thread, NULL, bench_thread, &ts[i]);
+    }
+    for (int i = 0; i < nthreads; i++)
+        pthread_join(ts[i].thread, NULL);
+    pthread_barrier_destroy(&g_bench_barrier);
+
+    /* 与 db_bench 的 Stats::Merge 相同：micros/op = 各线程耗时之和 / 总操作数 */
+    uint64_t done = 0, found = 0, bytes = 0;
+    uint64_t start = UINT64_MAX, finish = 0;
+    double seconds = 0;
+    for (int i = first; i < nthreads; i++) {
+        done += ts[i].done;
+        found += ts[i].found;
+        bytes += ts[i].bytes;
+        seconds += (ts[i].finish_ns - ts[i].start_ns) / 1e9;
+        if (ts[i].start_ns < start)
+            start = ts[i].start_ns;
+        if (ts[i].finish_ns > finish)
+            finish = ts[i].finish_ns;
+    }
+    if (done < 1)
+        done = 1;
+
+    char extra[128] = "";
+    double elapsed = (finish - start) / 1e9;
+    if (bytes > 0 && elapsed > 0)
+        snprintf(extra, sizeof(extra), "%6.1f MB/s", bytes / 1048576.0 / elapsed);
+    else if (type == BENCH_READRANDOM || type == BENCH_READWHILEWRITING)
+        snprintf(extra, sizeof(extra), "(%lu of %lu found)", found, done);
+
+    printf("%-12s : %11.3f micros/op;%s%s\n", name, seconds * 1e6 / done,
+           extra[0] ? " " : "", extra);
+    fflush(stdout);
+
+    free(ts);
+}
+
+static void print_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [--flag=value ...]\n", prog);
+    fprintf(stderr, "Flags (db_bench compatible subset):\n");
+    fprintf(stderr, "  --benchmarks=a,b,...   fillseq|fillrandom|readrandom|readwhilewriting\n");
+    fprintf(stderr, "  --num=N                Operations per thread / key space (default: 100000)\n");
+    fprintf(stderr, "  --threads=N            Threads (default: 1)\n");
+    fprintf(stderr, "  --value_size=N         Value size in bytes (default: 100)\n");
+    fprintf(stderr, "  --db=DIR               Log/table directory, tmpfs recommended (default: /dev/shm/lh_lsm_bench)\n");
+    fprintf(stderr, "  --use_existing_db=0|1  Recover from existing files instead of destroying\n");
+    fprintf(stderr, "  --write_buffer_size=N  Memtable size in bytes (default: 4MB)\n");
+    fprintf(stderr, "  --cache_size=N         Block cache size in bytes (default: 8MB)\n");
+}
+
+static bool parse_flag(const char *arg, const char *name, const char **val)
+{
+    size_t len = strlen(name);
+    if (strncmp(arg, name, len) == 0 && arg[len] == '=') {
+        *val = arg + len + 1;
+        return true;
+    }
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; i++) {
+        const char *v;
+        if (parse_flag(argv[i], "--benchmarks", &v))
+            g_benchmarks = v;
+        else if (parse_flag(argv[i], "--num", &v))
+            g_num = atoi(v);
+        else if (parse_flag(argv[i], "--threads", &v))
+            g_threads = atoi(v);
+        else if (parse_flag(argv[i], "--value_size", &v))
+            g_value_size = atoi(v);
+        else if (parse_flag(argv[i], "--db", &v))
+            g_db_dir = v;
+        else if (parse_flag(argv[i], "--use_existing_db", &v))
+            g_use_existing_db = atoi(v) != 0;
+        else if (parse_flag(argv[i], "--write_buffer_size", &v))
+            g_write_buffer_size = strtoull(v, NULL, 10);
+        else if (parse_flag(argv[i], "--cache_size", &v))
+            g_cache_size = strtoull(v, NULL, 10);
+        else {
+            print_usage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+
+    if (g_num < 1 || g_threads < 1 || g_value_size < 1 ||
+        g_value_size > VALUE_GEN_SIZE / 2) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    g_value_gen = malloc(VALUE_GEN_SIZE);
+    uint64_t rng = 301;
+    for (int i = 0; i < VALUE_GEN_SIZE; i++)
+        g_value_gen[i] = ' ' + bench_rand(&rng) % 95;
+
+    cache_init();
+    if (db_open(&g_db) != 0)
+        return 1;
+
+    printf("Keys:       %d bytes each\n", (int)sizeof(uint64_t));
+    printf("Values:     %d bytes each\n", g_value_size);
+    printf("Entries:    %d\n", g_num);
+    printf("Threads:    %d\n", g_threads);
+    printf("DB:         %s\n", g_db_dir);
+    printf("------------------------------------------------\n");
+
+    char *list = strdup(g_benchmarks);
+    char *save = NULL;
+    for (char *name = strtok_r(list, ",", &save); name;
+         name = strtok_r(NULL, ",", &save)) {
+        if (strcmp(name, "fillseq") == 0)
+            run_benchmark(name, BENCH_FILLSEQ);
+        else if (strcmp(name, "fillrandom") == 0)
+            run_benchmark(name, BENCH_FILLRANDOM);
+        else if (strcmp(name, "readrandom") == 0)
+            run_benchmark(name, BENCH_READRANDOM);
+        else if (strcmp(name, "readwhilewriting") == 0)
+            run_benchmark(name, BENCH_READWHILEWRITING);
+        else
+            fprintf(stderr, "Unknown benchmark '%s'\n", name);
+    }
+    free(list);
+
+    db_close(&g_db);
+    free(g_value_gen);
+    return 0;
+}
@@ -1,6 +1,10 @@
 /* SPDX-License-Identifier: MIT */
 /*
  * bench_mutex.c - 简单的 mutex 性能测试
+ *
+ * "Contended (lh_delegate)" 与 "Contended" 是同一个临界区，改用 liblh.h 的
+ * lh_delegate 执行；不加载 liblh 时退化为普通加锁，可直接对比
+ * LD_PRELOAD=liblh/liblh.so 前后。
  */
 #define _GNU_SOURCE
 #include <stdio.h>
@@ -11,6 +15,8 @@
 #include <unistd.h>
 #include <sched.h>
 
+#include "../liblh/liblh.h"
+
 #define ITERATIONS 1000000
 #define NUM_THREADS 4
 
@@ -65,8 +71,31 @@ static void *contended_thread(void *arg)
     return NULL;
 }
 
+static void contended_cs(void *arg)
+{
+    (void)arg;
+    g_counter++;
+    for (volatile int j = 0; j < 10; j++);
+}
+
+static void *delegate_thread(void *arg)
+{
+    int id = *(int *)arg;
+    int iters = ITERATIONS / NUM_THREADS;
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(id % sysconf(_SC_NPROCESSORS_ONLN), &cpuset);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+
+    for (int i = 0; i < iters; i++)
+        lh_delegate(&g_mutex, contended_cs, NULL);
+
+    return NULL;
+}
+
 /* 竞争测试 */
-static void bench_contended(void)
+static void bench_contended(const char *name, void *(*worker)(void *))
 {
     pthread_t threads[NUM_THREADS];
     int ids[NUM_THREADS];
@@ -77,7 +106,7 @@ static void bench_contended(void)
     start = get_time_ns();
     for (int i = 0; i < NUM_THREADS; i++) {
         ids[i] = i;
-        pthread_create(&threads[i], NULL, contended_thread, &ids[i]);
+        pthread_create(&threads[i], NULL, worker, &ids[i]);
     }
     for (int i = 0; i < NUM_THREADS; i++) {
         pthread_join(threads[i], NULL);
@@ -85,8 +114,8 @@ static void bench_contended(void)
     end = get_time_ns();
 
     double ns_per_op = (double)(end - start) / ITERATIONS;
-    printf("Contended (%d threads): %.2f ns/op, counter=%lu\n",
-           NUM_THREADS, ns_per_op, g_counter);
+    printf("%s (%d threads): %.2f ns/op, counter=%lu\n",
+           name, NUM_THREADS, ns_per_op, g_counter);
 }
 
 /* handoff 测试：模拟 owner-waiter 交替 */
@@ -142,7 +171,7 @@ static void bench_handoff(void)
     printf("Handoff: %.2f ns/handoff\n", ns_per_handoff);
 }
 
-int main(int argc, char *argv[])
+int main(void)
 {
     printf("=== Mutex Benchmark ===\n");
     printf("Iterations: %d\n\n", ITERATIONS);
@@ -151,7 +180,8 @@ int main(int argc, char *argv[])
     bench_uncontended();
 
     printf("\n--- Contended ---\n");
-    bench_contended();
+    bench_contended("Contended", contended_thread);
+    bench_contended("Contended (lh_delegate)", delegate_thread);
 
     printf("\n--- Handoff ---\n");
     bench_handoff();
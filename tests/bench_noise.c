@@ -0,0 +1,276 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * bench_noise.c - 不受 lhandoff 控制的背景负载（noisy neighbour）
+ *
+ * 由 bench_colocate.sh 直接启动（不经过 launcher，因此不在 allowlist 中），
+ * 与受控工作负载同时运行，用来衡量 IN_CS 偏置和 waiter 定向
+ * 从邻居那里抢走了多少 CPU。
+ *
+ * 模式：
+ * - spin  : N 个纯计算线程
+ * - churn : N 个线程不断 fork 短命子进程
+ * - burst : N 个线程按周期突发计算（busy/idle 交替）
+ *
+ * 运行到 -d 指定的秒数或收到 SIGTERM/SIGINT 为止，退出时输出吞吐。
+ * 受控负载用 SIGUSR1/SIGUSR2 标出自己的测量窗口（bench_workloads -N）：
+ * 收到过窗口时只统计窗口内的 ops 和时间，排除启动、launcher 加载 BPF
+ * 和受控负载退出之后的部分；多个窗口累加。
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/wait.h>
+
+#include "bench_harness.h"
+
+enum noise_mode {
+    NOISE_SPIN,
+    NOISE_CHURN,
+    NOISE_BURST,
+};
+
+static enum noise_mode g_mode = NOISE_SPIN;
+static int g_workers = 1;
+static int g_duration_s = 0;            /* 0 = 直到收到信号 */
+static int g_burst_period_ms = 100;
+static int g_burst_busy_ms = 20;
+static int g_churn_work = 20000;        /* 子进程内的计算量 */
+static bool g_csv = false;
+
+static volatile sig_atomic_t g_stop = 0;
+
+#define WORK_CHUNK  10000
+
+struct worker {
+    pthread_t thread;
+    _Atomic uint64_t ops;
+} __attribute__((aligned(64)));
+
+static struct worker *g_workers_state = NULL;
+
+static uint64_t total_ops(void)
+{
+    uint64_t ops = 0;
+
+    for (int i = 0; i < g_workers; i++)
+        ops += atomic_load_explicit(&g_workers_state[i].ops, memory_order_relaxed);
+    return ops;
+}
+
+static const char *mode_name(enum noise_mode m)
+{
+    switch (m) {
+    case NOISE_SPIN:  return "spin";
+    case NOISE_CHURN: return "churn";
+    case NOISE_BURST: return "burst";
+    }
+    return "unknown";
+}
+
+static inline void do_work(int loops)
+{
+    volatile uint64_t sum = 0;
+    for (int i = 0; i < loops; i++)
+        sum += i;
+}
+
+/* ops = 完成的 WORK_CHUNK 个数 */
+static void spin_loop(struct worker *w)
+{
+    while (!g_stop) {
+        do_work(WORK_CHUNK);
+        atomic_fetch_add_explicit(&w->ops, 1, memory_order_relaxed);
+    }
+}
+
+/* ops = 完成的子进程个数 */
+static void churn_loop(struct worker *w)
+{
+    while (!g_stop) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            do_work(g_churn_work);
+            _exit(0);
+        }
+        if (pid < 0) {
+            usleep(1000);
+            continue;
+        }
+        waitpid(pid, NULL, 0);
+        atomic_fetch_add_explicit(&w->ops, 1, memory_order_relaxed);
+    }
+}
+
+/* ops = 突发期内完成的 WORK_CHUNK 个数 */
+static void burst_loop(struct worker *w)
+{
+    uint64_t period_ns = (uint64_t)g_burst_period_ms * 1000000ULL;
+    uint64_t busy_ns = (uint64_t)g_burst_busy_ms * 1000000ULL;
+    uint64_t next = get_time_ns();
+
+    while (!g_stop) {
+        uint64_t busy_end = next + busy_ns;
+        while (!g_stop && get_time_ns() < busy_end) {
+            do_work(WORK_CHUNK);
+            atomic_fetch_add_explicit(&w->ops, 1, memory_order_relaxed);
+        }
+
+        next += period_ns;
+        uint64_t now = get_time_ns();
+        if (next > now)
+            usleep((next - now) / 1000);
+        else
+            next = now;
+    }
+}
+
+static void *worker_thread(void *arg)
+{
+    struct worker *w = arg;
+
+    switch (g_mode) {
+    case NOISE_SPIN:
+        spin_loop(w);
+        break;
+    case NOISE_CHURN:
+        churn_loop(w);
+        break;
+    case NOISE_BURST:
+        burst_loop(w);
+        break;
+    }
+    return NULL;
+}
+
+static void print_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [options]\n", prog);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -m <mode>   spin|churn|burst (default: spin)\n");
+    fprintf(stderr, "  -n <n>      Worker threads (default: 1)\n");
+    fprintf(stderr, "  -d <sec>    Duration, 0 = until SIGTERM/SIGINT (default: 0)\n");
+    fprintf(stderr, "  -p <ms>     Burst period (default: 100)\n");
+    fprintf(stderr, "  -b <ms>     Busy time per burst period (default: 20)\n");
+    fprintf(stderr, "  -w <loops>  Work per churned child process (default: 20000)\n");
+    fprintf(stderr, "  -c          CSV output: noise_mode,noise_workers,noise_ops_per_sec\n");
+    fprintf(stderr, "  -h          Show this help\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hm:n:d:p:b:w:c")) != -1) {
+        switch (opt) {
+        case 'm':
+            if (strcmp(optarg, "spin") == 0)
+                g_mode = NOISE_SPIN;
+            else if (strcmp(optarg, "churn") == 0)
+                g_mode = NOISE_CHURN;
+            else if (strcmp(optarg, "burst") == 0)
+                g_mode = NOISE_BURST;
+            else {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'n':
+            g_workers = atoi(optarg);
+            break;
+        case 'd':
+            g_duration_s = atoi(optarg);
+            break;
+        case 'p':
+            g_burst_period_ms = atoi(optarg);
+            break;
+        case 'b':
+            g_burst_busy_ms = atoi(optarg);
+            break;
+        case 'w':
+            g_churn_work = atoi(optarg);
+            break;
+        case 'c':
+            g_csv = true;
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            return 0;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (g_workers < 1 || g_duration_s < 0 || g_burst_period_ms < 1 ||
+        g_burst_busy_ms < 0 || g_burst_busy_ms > g_burst_period_ms) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    /* 信号只由主线程用 sigtimedwait 取，工作线程继承屏蔽字 */
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    g_workers_state = aligned_alloc(64, g_workers * sizeof(struct worker));
+    memset(g_workers_state, 0, g_workers * sizeof(struct worker));
+
+    uint64_t start = get_time_ns();
+    for (int i = 0; i < g_workers; i++)
+        pthread_create(&g_workers_state[i].thread, NULL, worker_thread,
+                       &g_workers_state[i]);
+
+    /* 测量窗口：win_start != 0 表示窗口打开中 */
+    uint64_t win_start = 0, win_start_ops = 0;
+    uint64_t win_ns = 0, win_ops = 0;
+    bool windowed = false;
+
+    uint64_t end = start + (uint64_t)g_duration_s * 1000000000ULL;
+    while (g_duration_s == 0 || get_time_ns() < end) {
+        struct timespec ts = { 0, 10000000 };
+        int sig = sigtimedwait(&mask, NULL, &ts);
+
+        if (sig == SIGTERM || sig == SIGINT)
+            break;
+        if (sig == SIGUSR1 && !win_start) {
+            win_start_ops = total_ops();
+            win_start = get_time_ns();
+        } else if (sig == SIGUSR2 && win_start) {
+            win_ops += total_ops() - win_start_ops;
+            win_ns += get_time_ns() - win_start;
+            win_start = 0;
+            windowed = true;
+        }
+    }
+    g_stop = 1;
+
+    for (int i = 0; i < g_workers; i++)
+        pthread_join(g_workers_state[i].thread, NULL);
+    uint64_t elapsed = get_time_ns() - start;
+
+    uint64_t ops = total_ops();
+    if (windowed) {
+        ops = win_ops;
+        elapsed = win_ns;
+    }
+    double ops_per_sec = elapsed ? ops * 1e9 / elapsed : 0;
+
+    if (g_csv)
+        printf("%s,%d,%.0f\n", mode_name(g_mode), g_workers, ops_per_sec);
+    else
+        printf("noise %-6s: %d workers, %.0f ops/s over %.2f s\n",
+               mode_name(g_mode), g_workers, ops_per_sec, elapsed / 1e9);
+
+    free(g_workers_state);
+    return 0;
+}
@@ -0,0 +1,647 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * bench_workloads.c - 模拟生产环境锁模式的工作负载集
+ *
+ * 场景：
+ * 1. hashmap  - 分段锁哈希表（N 把锁，Zipfian key 倾斜）
+ * 2. alloc    - 全局分配器锁，极短临界区
+ * 3. memtable - LevelDB 式 memtable mutex + condvar 写者队列（group commit）
+ * 4. queue    - 有界生产者/消费者队列（mutex + 两个 condvar）
+ * 5. nested   - 两级锁按固定顺序嵌套（表锁 → 分片锁）
+ *
+ * 分别覆盖 lock_table 哈希（大量锁）、waiter 定向（少量热锁）
+ * 和 IN_CS 偏置（持锁期间释放/重获、嵌套持锁）的不同路径。
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <math.h>
+#include <unistd.h>
+#include <sched.h>
+#include <string.h>
+#include <signal.h>
+
+#include "bench_harness.h"
+
+/* ========== 配置 ========== */
+static int g_num_threads = 8;
+static int g_duration_s = 5;
+static int g_num_locks = 64;
+static double g_zipf_theta = 0.99;
+static bool g_csv = false;
+static pid_t g_noise_pid = 0;          /* bench_noise 的 pid：测量开始/结束时通知它记录窗口 */
+
+#define KEY_SPACE           (1 << 20)
+#define STRIPE_SLOTS        64          /* 每个分段的 key 槽位 */
+#define ALLOC_POOL_BLOCKS   4096
+#define MEMTABLE_CAPACITY   (1 << 16)
+#define MAX_BATCH_WRITERS   16
+#define QUEUE_CAPACITY      256
+#define NESTED_TABLES       8
+#define NESTED_SHARDS       16
+
+static atomic_int g_stop = 0;
+
+struct worker_result {
+    uint64_t ops;
+    struct lat_hist lat;
+} __attribute__((aligned(64)));
+
+static struct worker_result *g_results = NULL;
+
+static inline void burn_cycles(int loops)
+{
+    for (volatile int i = 0; i < loops; i++)
+        ;
+}
+
+/* ========== Zipfian 生成器 (YCSB) ========== */
+struct zipf_gen {
+    uint64_t n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+};
+
+static double zeta(uint64_t n, double theta)
+{
+    double sum = 0;
+    for (uint64_t i = 1; i <= n; i++)
+        sum += 1.0 / pow((double)i, theta);
+    return sum;
+}
+
+static void zipf_init(struct zipf_gen *z, uint64_t n, double theta)
+{
+    z->n = n;
+    z->theta = theta;
+    z->alpha = 1.0 / (1.0 - theta);
+    z->zetan = zeta(n, theta);
+    double zeta2 = zeta(2, theta);
+    z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / z->zetan);
+}
+
+static uint64_t zipf_next(const struct zipf_gen *z, uint64_t *rng)
+{
+    if (z->theta <= 0)
+        return bench_rand(rng) % z->n;
+
+    double u = bench_rand_double(rng);
+    double uz = u * z->zetan;
+    if (uz < 1.0)
+        return 0;
+    if (uz < 1.0 + pow(0.5, z->theta))
+        return 1;
+    return (uint64_t)(z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+}
+
+/* 打散热点 key，避免热 key 全部落在相邻分段 */
+static inline uint64_t scramble(uint64_t key)
+{
+    key *= 0x9E3779B97F4A7C15ULL;
+    return key ^ (key >> 29);
+}
+
+/* ========== 场景 1: 分段锁哈希表 ========== */
+struct stripe {
+    pthread_mutex_t lock;
+    uint64_t keys[STRIPE_SLOTS];
+    uint64_t vals[STRIPE_SLOTS];
+} __attribute__((aligned(64)));
+
+static struct stripe *g_stripes = NULL;
+static struct zipf_gen g_zipf;
+
+static void hashmap_setup(void)
+{
+    g_stripes = aligned_alloc(64, sizeof(struct stripe) * g_num_locks);
+    memset(g_stripes, 0, sizeof(struct stripe) * g_num_locks);
+    for (int i = 0; i < g_num_locks; i++)
+        pthread_mutex_init(&g_stripes[i].lock, NULL);
+    zipf_init(&g_zipf, KEY_SPACE, g_zipf_theta);
+}
+
+static void hashmap_teardown(void)
+{
+    for (int i = 0; i < g_num_locks; i++)
+        pthread_mutex_destroy(&g_stripes[i].lock);
+    free(g_stripes);
+    g_stripes = NULL;
+}
+
+static void hashmap_op(int id, uint64_t *rng, struct worker_result *r)
+{
+    (void)id;
+    uint64_t key = scramble(zipf_next(&g_zipf, rng));
+    struct stripe *s = &g_stripes[key % g_num_locks];
+    uint32_t slot = (key / g_num_locks) % STRIPE_SLOTS;
+    bool is_put = (bench_rand(rng) % 10) == 0;
+
+    uint64_t t0 = get_time_ns();
+    pthread_mutex_lock(&s->lock);
+    uint64_t t1 = get_time_ns();
+
+    /* 线性探测，模拟一次 bucket 查找 */
+    for (int i = 0; i < 4; i++) {
+        uint32_t idx = (slot + i) % STRIPE_SLOTS;
+        if (s->keys[idx] == key || s->keys[idx] == 0) {
+            if (is_put) {
+                s->keys[idx] = key;
+                s->vals[idx]++;
+            }
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&s->lock);
+
+    lat_record(&r->lat, t1 - t0);
+    burn_cycles(200);
+}
+
+/* ========== 场景 2: 全局分配器锁 ========== */
+static pthread_mutex_t g_alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+static void *g_free_list = NULL;
+static void *g_alloc_pool = NULL;
+
+static void alloc_setup(void)
+{
+    g_alloc_pool = aligned_alloc(64, (size_t)ALLOC_POOL_BLOCKS * 64);
+    g_free_list = NULL;
+    for (int i = 0; i < ALLOC_POOL_BLOCKS; i++) {
+        void **blk = (void **)((char *)g_alloc_pool + (size_t)i * 64);
+        *blk = g_free_list;
+        g_free_list = blk;
+    }
+}
+
+static void alloc_teardown(void)
+{
+    free(g_alloc_pool);
+    g_alloc_pool = NULL;
+}
+
+static void *pool_alloc(struct lat_hist *lat)
+{
+    uint64_t t0 = get_time_ns();
+    pthread_mutex_lock(&g_alloc_lock);
+    lat_record(lat, get_time_ns() - t0);
+    void **blk = g_free_list;
+    if (blk)
+        g_free_list = *blk;
+    pthread_mutex_unlock(&g_alloc_lock);
+    return blk;
+}
+
+static void pool_free(void *p, struct lat_hist *lat)
+{
+    uint64_t t0 = get_time_ns();
+    pthread_mutex_lock(&g_alloc_lock);
+    lat_record(lat, get_time_ns() - t0);
+    *(void **)p = g_free_list;
+    g_free_list = p;
+    pthread_mutex_unlock(&g_alloc_lock);
+}
+
+static void alloc_op(int id, uint64_t *rng, struct worker_result *r)
+{
+    (void)id;
+    (void)rng;
+    void *blks[4];
+    int n = 0;
+
+    for (int i = 0; i < 4; i++) {
+        blks[i] = pool_alloc(&r->lat);
+        if (blks[i]) {
+            memset(blks[i], id, 64);
+            n = i + 1;
+        }
+    }
+    burn_cycles(50);
+    for (int i = n - 1; i >= 0; i--) {
+        if (blks[i])
+            pool_free(blks[i], &r->lat);
+    }
+}
+
+/* ========== 场景 3: LevelDB 式 memtable 写者队列 ==========
+ * 与 DBImpl::Write 相同的结构：写者排队，队首写者合并后续 batch，
+ * 释放 mutex 写日志，重新加锁后插入 memtable，再唤醒被合并的写者。
+ * 读者持 mutex 只做 Ref/Unref（获取 version 快照）。
+ */
+struct writer {
+    pthread_cond_t cv;
+    uint64_t key;
+    bool done;
+    struct writer *next;
+};
+
+static pthread_mutex_t g_db_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct writer *g_writers_head = NULL;
+static struct writer *g_writers_tail = NULL;
+static uint64_t *g_memtable = NULL;
+static uint64_t g_memtable_size = 0;
+static uint64_t g_version_refs = 0;
+static char g_log_buf[4096];
+
+static void memtable_setup(void)
+{
+    g_memtable = calloc(MEMTABLE_CAPACITY, sizeof(uint64_t));
+    g_memtable_size = 0;
+    g_writers_head = g_writers_tail = NULL;
+}
+
+static void memtable_teardown(void)
+{
+    free(g_memtable);
+    g_memtable = NULL;
+}
+
+static void memtable_write(uint64_t key, struct lat_hist *lat)
+{
+    struct writer w;
+    pthread_cond_init(&w.cv, NULL);
+    w.key = key;
+    w.done = false;
+    w.next = NULL;
+
+    uint64_t t0 = get_time_ns();
+    pthread_mutex_lock(&g_db_mutex);
+    if (g_writers_tail)
+        g_writers_tail->next = &w;
+    else
+        g_writers_head = &w;
+    g_writers_tail = &w;
+
+    while (!w.done && g_writers_head != &w)
+        pthread_cond_wait(&w.cv, &g_db_mutex);
+
+    if (w.done) {
+        pthread_mutex_unlock(&g_db_mutex);
+        pthread_cond_destroy(&w.cv);
+        lat_record(lat, get_time_ns() - t0);
+        return;
+    }
+
+    /* 队首：合并 batch */
+    struct writer *last = &w;
+    int nbatch = 1;
+    while (last->next && nbatch < MAX_BATCH_WRITERS) {
+        last = last->next;
+        nbatch++;
+    }
+
+    /* 写日志期间释放 mutex */
+    pthread_mutex_unlock(&g_db_mutex);
+    for (int i = 0; i < nbatch; i++)
+        memset(g_log_buf, (int)key + i, 256);
+    burn_cycles(300);
+    pthread_mutex_lock(&g_db_mutex);
+
+    /* 插入 memtable，满了就模拟一次切换 */
+    for (struct writer *p = &w;; p = p->next) {
+        if (g_memtable_size >= MEMTABLE_CAPACITY)
+            g_memtable_size = 0;
+        g_memtable[g_memtable_size++] = p->key;
+        if (p == last)
+            break;
+    }
+
+    /* 出队并唤醒 */
+    struct writer *p = &w;
+    while (1) {
+        struct writer *next = p->next;
+        if (p != &w) {
+            p->done = true;
+            pthread_cond_signal(&p->cv);
+        }
+        if (p == last) {
+            g_writers_head = next;
+            if (!next)
+                g_writers_tail = NULL;
+            break;
+        }
+        p = next;
+    }
+    if (g_writers_head)
+        pthread_cond_signal(&g_writers_head->cv);
+
+    pthread_mutex_unlock(&g_db_mutex);
+    pthread_cond_destroy(&w.cv);
+    lat_record(lat, get_time_ns() - t0);
+}
+
+static void memtable_read(uint64_t key, struct lat_hist *lat)
+{
+    uint64_t t0 = get_time_ns();
+
+    pthread_mutex_lock(&g_db_mutex);
+    g_version_refs++;
+    uint64_t size = g_memtable_size;
+    pthread_mutex_unlock(&g_db_mutex);
+
+    /* 无锁读取 memtable（只读取，不关心一致性） */
+    volatile uint64_t found = 0;
+    uint64_t start = size > 64 ? size - 64 : 0;
+    for (uint64_t i = start; i < size; i++) {
+        if (g_memtable[i] == key)
+            found = 1;
+    }
+    (void)found;
+
+    pthread_mutex_lock(&g_db_mutex);
+    g_version_refs--;
+    pthread_mutex_unlock(&g_db_mutex);
+
+    lat_record(lat, get_time_ns() - t0);
+}
+
+static void memtable_op(int id, uint64_t *rng, struct worker_result *r)
+{
+    uint64_t key = bench_rand(rng) % KEY_SPACE;
+
+    /* 偶数线程写，奇数线程读 */
+    if (id % 2 == 0)
+        memtable_write(key, &r->lat);
+    else
+        memtable_read(key, &r->lat);
+}
+
+/* ========== 场景 4: 生产者/消费者队列 ========== */
+static pthread_mutex_t g_queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_queue_not_empty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t g_queue_not_full = PTHREAD_COND_INITIALIZER;
+static uint64_t g_queue[QUEUE_CAPACITY];
+static uint32_t g_queue_head = 0;
+static uint32_t g_queue_count = 0;
+
+static void queue_setup(void)
+{
+    g_queue_head = 0;
+    g_queue_count = 0;
+}
+
+static void queue_stop(void)
+{
+    /* 唤醒所有可能仍在等待的线程 */
+    pthread_mutex_lock(&g_queue_lock);
+    pthread_cond_broadcast(&g_queue_not_empty);
+    pthread_cond_broadcast(&g_queue_not_full);
+    pthread_mutex_unlock(&g_queue_lock);
+}
+
+static void queue_op(int id, uint64_t *rng, struct worker_result *r)
+{
+    uint64_t t0 = get_time_ns();
+
+    pthread_mutex_lock(&g_queue_lock);
+    if (id % 2 == 0) {
+        while (g_queue_count == QUEUE_CAPACITY && !atomic_load(&g_stop))
+            pthread_cond_wait(&g_queue_not_full, &g_queue_lock);
+        if (g_queue_count < QUEUE_CAPACITY) {
+            g_queue[(g_queue_head + g_queue_count) % QUEUE_CAPACITY] = bench_rand(rng);
+            g_queue_count++;
+            pthread_cond_signal(&g_queue_not_empty);
+        }
+    } else {
+        while (g_queue_count == 0 && !atomic_load(&g_stop))
+            pthread_cond_wait(&g_queue_not_empty, &g_queue_lock);
+        if (g_queue_count > 0) {
+            g_queue_head = (g_queue_head + 1) % QUEUE_CAPACITY;
+            g_queue_count--;
+            pthread_cond_signal(&g_queue_not_full);
+        }
+    }
+    pthread_mutex_unlock(&g_queue_lock);
+
+    lat_record(&r->lat, get_time_ns() - t0);
+    burn_cycles(100);
+}
+
+/* ========== 场景 5: 嵌套两级锁 ========== */
+struct nested_table {
+    pthread_mutex_t lock;
+    uint64_t version;
+    struct {
+        pthread_mutex_t lock;
+        uint64_t data[7];
+    } shard[NESTED_SHARDS];
+};
+
+static struct nested_table g_tables[NESTED_TABLES];
+
+static void nested_setup(void)
+{
+    for (int t = 0; t < NESTED_TABLES; t++) {
+        pthread_mutex_init(&g_tables[t].lock, NULL);
+        g_tables[t].version = 0;
+        for (int s = 0; s < NESTED_SHARDS; s++)
+            pthread_mutex_init(&g_tables[t].shard[s].lock, NULL);
+    }
+}
+
+static void nested_teardown(void)
+{
+    for (int t = 0; t < NESTED_TABLES; t++) {
+        pthread_mutex_destroy(&g_tables[t].lock);
+        for (int s = 0; s < NESTED_SHARDS; s++)
+            pthread_mutex_destroy(&g_tables[t].shard[s].lock);
+    }
+}
+
+static void nested_op(int id, uint64_t *rng, struct worker_result *r)
+{
+    (void)id;
+    struct nested_table *t = &g_tables[bench_rand(rng) % NESTED_TABLES];
+    int s = bench_rand(rng) % NESTED_SHARDS;
+
+    uint64_t t0 = get_time_ns();
+    pthread_mutex_lock(&t->lock);
+    t->version++;
+    burn_cycles(50);
+
+    pthread_mutex_lock(&t->shard[s].lock);
+    for (int i = 0; i < 7; i++)
+        t->shard[s].data[i] += t->version;
+    burn_cycles(50);
+    pthread_mutex_unlock(&t->shard[s].lock);
+
+    pthread_mutex_unlock(&t->lock);
+    lat_record(&r->lat, get_time_ns() - t0);
+
+    burn_cycles(200);
+}
+
+/* ========== 调度框架 ========== */
+struct workload {
+    const char *name;
+    void (*setup)(void);
+    void (*stop)(void);         /* 可选：唤醒阻塞在 condvar 上的线程 */
+    void (*teardown)(void);     /* 可选 */
+    void (*op)(int id, uint64_t *rng, struct worker_result *r);
+};
+
+static const struct workload g_workloads[] = {
+    { "hashmap",  hashmap_setup,  NULL,       hashmap_teardown,  hashmap_op },
+    { "alloc",    alloc_setup,    NULL,       alloc_teardown,    alloc_op },
+    { "memtable", memtable_setup, NULL,       memtable_teardown, memtable_op },
+    { "queue",    queue_setup,    queue_stop, NULL,              queue_op },
+    { "nested",   nested_setup,   NULL,       nested_teardown,   nested_op },
+};
+
+#define NUM_WORKLOADS (int)(sizeof(g_workloads) / sizeof(g_workloads[0]))
+
+static const struct workload *g_current = NULL;
+static pthread_barrier_t g_start_barrier;
+
+static void *worker_thread(void *arg)
+{
+    int id = (int)(intptr_t)arg;
+    struct worker_result *r = &g_results[id];
+    uint64_t rng = 0x9E3779B97F4A7C15ULL * (id + 1);
+
+    pthread_barrier_wait(&g_start_barrier);
+
+    while (!atomic_load_explicit(&g_stop, memory_order_relaxed)) {
+        g_current->op(id, &rng, r);
+        r->ops++;
+    }
+    return NULL;
+}
+
+static void run_workload(const struct workload *w)
+{
+    pthread_t *threads = malloc(g_num_threads * sizeof(pthread_t));
+    g_results = aligned_alloc(64, g_num_threads * sizeof(struct worker_result));
+    memset(g_results, 0, g_num_threads * sizeof(struct worker_result));
+
+    g_current = w;
+    atomic_store(&g_stop, 0);
+    w->setup();
+
+    pthread_barrier_init(&g_start_barrier, NULL, g_num_threads + 1);
+    for (int i = 0; i < g_num_threads; i++)
+        pthread_create(&threads[i], NULL, worker_thread, (void *)(intptr_t)i);
+
+    pthread_barrier_wait(&g_start_barrier);
+    if (g_noise_pid)
+        kill(g_noise_pid, SIGUSR1);
+    uint64_t start = get_time_ns();
+    sleep(g_duration_s);
+    atomic_store(&g_stop, 1);
+    uint64_t elapsed = get_time_ns() - start;
+    if (g_noise_pid)
+        kill(g_noise_pid, SIGUSR2);
+
+    if (w->stop)
+        w->stop();
+
+    for (int i = 0; i < g_num_threads; i++)
+        pthread_join(threads[i], NULL);
+    pthread_barrier_destroy(&g_start_barrier);
+
+    if (w->teardown)
+        w->teardown();
+
+    /* 汇总 */
+    struct lat_hist *total = calloc(1, sizeof(*total));
+    uint64_t ops = 0;
+    for (int i = 0; i < g_num_threads; i++) {
+        ops += g_results[i].ops;
+        lat_merge(total, &g_results[i].lat);
+    }
+
+    bench_report(g_csv, w->name, g_num_threads, ops, elapsed, total);
+
+    free(total);
+    free(g_results);
+    g_results = NULL;
+    free(threads);
+}
+
+static void print_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [options]\n", prog);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -w <name>   Workload: hashmap|alloc|memtable|queue|nested|all (default: all)\n");
+    fprintf(stderr, "  -t <n>      Threads (default: 8)\n");
+    fprintf(stderr, "  -d <sec>    Duration per workload (default: 5)\n");
+    fprintf(stderr, "  -l <n>      Stripe locks for hashmap (default: 64)\n");
+    fprintf(stderr, "  -z <theta>  Zipfian skew for hashmap, 0 = uniform (default: 0.99)\n");
+    fprintf(stderr, "  -c          CSV output\n");
+    fprintf(stderr, "  -N <pid>    Send SIGUSR1/SIGUSR2 to bench_noise at measurement start/end\n");
+    fprintf(stderr, "  -h          Show this help\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const char *which = "all";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hw:t:d:l:z:cN:")) != -1) {
+        switch (opt) {
+        case 'w':
+            which = optarg;
+            break;
+        case 't':
+            g_num_threads = atoi(optarg);
+            break;
+        case 'd':
+            g_duration_s = atoi(optarg);
+            break;
+        case 'l':
+            g_num_locks = atoi(optarg);
+            break;
+        case 'z':
+            g_zipf_theta = atof(optarg);
+            break;
+        case 'c':
+            g_csv = true;
+            break;
+        case 'N':
+            g_noise_pid = atoi(optarg);
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            return 0;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (g_num_threads < 1 || g_duration_s < 1 || g_num_locks < 1 ||
+        g_zipf_theta < 0 || g_zipf_theta >= 1.0 || g_noise_pid < 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (g_csv) {
+        printf("%s\n", BENCH_CSV_HEADER);
+    } else {
+        printf("========================================\n");
+        printf("Lock Pattern Workloads\n");
+        printf("CPUs: %ld, Threads: %d, Duration: %ds, Mode: %s\n",
+               sysconf(_SC_NPROCESSORS_ONLN), g_num_threads, g_duration_s,
+               bench_mode());
+        printf("========================================\n");
+    }
+
+    int ran = 0;
+    for (int i = 0; i < NUM_WORKLOADS; i++) {
+        if (strcmp(which, "all") == 0 || strcmp(which, g_workloads[i].name) == 0) {
+            run_workload(&g_workloads[i]);
+            ran++;
+        }
+    }
+
+    if (!ran) {
+        fprintf(stderr, "Unknown workload: %s\n", which);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,1162 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * lh_sim.c - lhandoff 调度策略离散事件模拟器
+ *
+ * 在 N 个虚拟 CPU 上重放锁 trace（或合成负载），调度决策直接调用
+ * common/lh_policy.h 中与 BPF 调度器相同的 select_cpu/enqueue 策略，
+ * 用于在没有 sched_ext 内核和 root 的机器上（包括 CI）快速评估策略改动。
+ *
+ * 模型：
+ * - 每个线程循环执行 op：think（CPU 计算）→ sleep（离开 CPU）→ 加锁 → 临界区 → 解锁
+ * - 调度：单个共享 FIFO DSQ（对应 LH_DSQ_NORMAL），slice 由 enqueue 决策给出，
+ *   slice 用完或 yield 时重新 enqueue（不经过 select_cpu），唤醒时先 select_cpu；
+ *   共享 DSQ 上 SCX_ENQ_PREEMPT 不生效，这里只统计次数
+ * - owner 拉取（与 BPF dispatch 一致，-P 关闭）：waiter yield 或回退阻塞时，
+ *   锁的 owner 在 DSQ 里排队就移到让出的 CPU 上运行
+ * - 空闲 CPU 只在被 kick 时取任务：默认优先 kick select_cpu 选中的 CPU，
+ *   选中的 CPU 忙时 kick 任意空闲 CPU（-K 关闭后者）
+ * - 锁模式 liblh：与 liblh.c 一致，spin → yield（写 waiter hint）→ 超出预算回退阻塞，
+ *   解锁时有 yield waiter 则 owner yield；锁模式 native：竞争即阻塞，解锁唤醒一个
+ * - owner_cpu 在加锁时记录（与 lock_table 一致，owner 迁移后不更新）
+ * - 每把锁维护持锁时间 EWMA（与 liblh 写入 lock_entry.hold_ewma_ns 一致），
+ *   IN_CS slice 按预测剩余持锁时间给出（-H 关闭，使用固定上限）
+ * - handoff 顺序（-O / -A，与 liblh/lh_order.c 一致）：liblh 模式下 trylock 失败即登记，
+ *   解锁时按策略指定下一个 owner，其它任务在指定有效期内不拿锁；
+ *   从阻塞中被唤醒的任务（glibc 内部加锁）不受指定约束。队列容量不限
+ * - LLC 拓扑（-L n）：CPU 按编号均分成 n 个合成的 LLC 域，统计锁在不同域之间
+ *   交接的次数。锁亲和组（-g，对应 launcher -g）的计票、周期折算和域分配调用
+ *   lh_policy.h 中与 BPF 相同的函数；唤醒时组的域里有空闲 CPU 就占下它并直接
+ *   在上面运行（BPF 的 SCX_DSQ_LOCAL 插入）
+ *
+ * trace 格式：每行 "tid lock cs_ns think_ns [sleep_ns]"，同一 tid 的行按顺序执行，
+ * # 开头为注释。
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "../common/lh_shared.h"
+#include "../common/lh_policy.h"
+#include "bench_harness.h"
+
+#define SIM_MAX_CPUS        1024
+#define SIM_MAX_THREADS     4096
+#define SIM_MAX_LOCKS       65536
+
+/* liblh 默认参数的时间成本 */
+#define SIM_SPIN_NS         2000    /* Phase 1: SPIN_TRIES 次 trylock */
+#define SIM_YIELD_NS        1000    /* 一次 sched_yield 系统调用 */
+#define SIM_CTX_SWITCH_NS   1500    /* 上下文切换 */
+
+enum sim_policy {
+    POLICY_LHANDOFF,    /* lh_policy.h */
+    POLICY_DEFAULT,     /* 不受控：prev_cpu，普通 slice */
+};
+
+enum lock_mode {
+    LOCK_LIBLH,
+    LOCK_NATIVE,
+};
+
+enum task_state {
+    TS_RUNNABLE,
+    TS_RUNNING,
+    TS_BLOCKED,
+    TS_SLEEPING,
+    TS_EXITED,
+};
+
+/* 运行中任务正在消耗 CPU 的阶段 */
+enum task_phase {
+    PH_THINK,
+    PH_ACQUIRE,         /* 瞬时：尝试加锁 */
+    PH_SPIN,
+    PH_YIELD,
+    PH_CS,
+};
+
+struct sim_op {
+    u32 lock;
+    u64 cs_ns;
+    u64 think_ns;
+    u64 sleep_ns;
+};
+
+struct sim_task {
+    int id;
+    enum task_state state;
+    enum task_phase phase;
+    u64 remaining;          /* 当前阶段剩余 CPU 时间 */
+    u64 overhead;           /* 阶段开始前要消耗的开销（上下文切换） */
+    u64 slice_ns;
+    u64 slice_end;
+    u64 wake_at;
+    int cpu;
+    int last_cpu;
+
+    /* op 来源：trace 数组或合成 */
+    struct sim_op *ops;
+    int nr_ops;
+    int cap_ops;
+    int next_op;
+    struct sim_op cur;
+    uint64_t rng;
+
+    /* 锁状态 */
+    bool in_cs;
+    bool waiting;           /* liblh waiter hint 有效 */
+    bool spun;
+    bool queued;            /* 已登记到锁的 handoff 顺序队列 */
+    bool fell_back;         /* 回退过阻塞加锁（waiter hint 保持为 PARKED） */
+    s32 park_cpu;           /* 回退时 owner 所在 CPU（thread_slot.target_cpu） */
+    int yields;
+    u64 wait_start;
+    u64 cs_start;
+
+    /* 锁亲和组（task_ctx 的 group_*），group_lock 为锁号 + 1，0 = 无 */
+    u64 group_lock;
+    u32 group_score;
+    u64 group_epoch;
+    u64 group_voted;        /* 已计票的那次等待的 wait_start + 1 */
+
+    u64 ops_done;
+    struct sim_task *next;  /* global DSQ 或锁等待队列 */
+};
+
+struct sim_lock {
+    int owner;              /* task id，-1 = 空闲 */
+    s32 owner_cpu;
+    u64 hold_ewma_ns;       /* 0 = 尚无样本 */
+    int yield_waiters;
+    int grant;              /* 指定的下一个 owner，-1 = 不指定 */
+    u64 grant_at;
+    s32 last_cpu;           /* 上一个 owner 加锁时的 CPU，统计跨 LLC 交接 */
+    struct lh_lock_group group;
+    struct sim_task *blocked_head;
+    struct sim_task *blocked_tail;
+};
+
+struct sim_cpu {
+    struct sim_task *curr;
+    struct sim_task *prev;
+    u64 last_update;
+};
+
+/* ========== 配置 ========== */
+static enum sim_policy g_policy = POLICY_LHANDOFF;
+static enum lock_mode g_lock_mode = LOCK_LIBLH;
+static int g_nr_cpus = 4;
+static int g_nr_threads = 8;
+static int g_nr_locks = 1;
+static u64 g_cs_ns = 20000;
+static u64 g_think_ns = 20000;
+static u64 g_sleep_ns = 0;
+static u64 g_duration_ns = 1000000000ULL;
+static u64 g_spin_ns = SIM_SPIN_NS;
+static u64 g_yield_ns = SIM_YIELD_NS;
+static u64 g_ctx_ns = SIM_CTX_SWITCH_NS;
+static int g_yield_budget = LH_YIELD_BUDGET;
+static u64 g_fallback_ns = LH_FALLBACK_US * 1000ULL;
+static bool g_kick_any_idle = true;
+static bool g_hold_predict = true;
+static bool g_owner_pull = true;
+static bool g_csv = false;
+static int g_order = LH_ORDER_RACE;
+static s64 g_age_ns = -1;           /* -1 = 按顺序策略取默认 */
+static int g_nr_llcs = 0;           /* 合成 LLC 域数，0 = 没有拓扑 */
+static bool g_group_place = false;  /* 锁亲和组放置（需要 >= 2 个域） */
+static uint64_t g_seed = 1;
+static const char *g_trace_path = NULL;
+
+/* ========== 状态 ========== */
+static struct sim_task *g_tasks;
+static struct sim_lock *g_locks;
+static struct sim_cpu g_cpus[SIM_MAX_CPUS];
+static struct sim_task *g_dsq_head, *g_dsq_tail;
+static u64 g_now;
+
+/* 合成 LLC 拓扑与锁亲和组周期（BPF 的 rodata 和 group_epoch / llc_load） */
+static u8 g_cpu_llc[LH_CPU_TABLE_SLOTS];
+static u16 g_llc_nr_cpus[LH_LLC_MAX];
+static u32 g_llc_load[LH_LLC_MAX];
+static u64 g_group_epoch = 1;
+static u64 g_group_next_ns = LH_GROUP_EPOCH_NS;
+
+static struct {
+    u64 ops;
+    u64 migrations;
+    u64 ctx_switches;
+    u64 lhp;                /* 持锁时 slice 用完被换下 */
+    u64 yields;
+    u64 fallbacks;
+    u64 preempt_requests;
+    u64 owner_pulls;
+    u64 llc_handoffs;       /* 锁交给另一个 LLC 域里的 CPU */
+    u64 group_direct;       /* 唤醒时为组占下空闲 CPU 直接运行 */
+    u64 idle_ns;
+    struct lat_hist wait;
+} g_stats;
+
+/* ========== global DSQ ========== */
+static void dsq_push(struct sim_task *t)
+{
+    t->next = NULL;
+    if (g_dsq_tail)
+        g_dsq_tail->next = t;
+    else
+        g_dsq_head = t;
+    g_dsq_tail = t;
+}
+
+/* SCX_ENQ_HEAD */
+static void dsq_push_head(struct sim_task *t)
+{
+    t->next = g_dsq_head;
+    g_dsq_head = t;
+    if (!g_dsq_tail)
+        g_dsq_tail = t;
+}
+
+static void dsq_remove(struct sim_task *t)
+{
+    struct sim_task **pp = &g_dsq_head, *prev = NULL;
+
+    while (*pp && *pp != t) {
+        prev = *pp;
+        pp = &(*pp)->next;
+    }
+    if (!*pp)
+        return;
+    *pp = t->next;
+    if (g_dsq_tail == t)
+        g_dsq_tail = prev;
+    t->next = NULL;
+}
+
+static struct sim_task *dsq_pop(void)
+{
+    struct sim_task *t = g_dsq_head;
+    if (t) {
+        g_dsq_head = t->next;
+        if (!g_dsq_head)
+            g_dsq_tail = NULL;
+        t->next = NULL;
+    }
+    return t;
+}
+
+/* ========== 策略接口 ========== */
+static void task_state_for_policy(const struct sim_task *t, struct lh_task_state *st)
+{
+    st->controlled = (g_policy == POLICY_LHANDOFF);
+    st->in_cs = t->in_cs;
+    st->cs_predicted = false;
+    st->cs_remaining_ns = 0;
+    st->chain_root = false;     /* 模拟的 op 只持有一把锁，不会形成链 */
+    st->waiter_cpu = -1;
+    st->waiter_aged = false;
+    st->group_cpu = -1;         /* 唤醒时由 group_target_cpu 填 */
+
+    if (t->in_cs && g_hold_predict) {
+        u64 ewma = g_locks[t->cur.lock].hold_ewma_ns;
+        u64 elapsed = g_now - t->cs_start;
+        if (ewma) {
+            st->cs_predicted = true;
+            st->cs_remaining_ns = ewma > elapsed ? ewma - elapsed : 0;
+        }
+    }
+
+    if (t->waiting) {
+        struct sim_lock *l = &g_locks[t->cur.lock];
+        if (l->owner >= 0)
+            st->waiter_cpu = l->owner_cpu;
+        else if (t->fell_back)
+            st->waiter_cpu = t->park_cpu;
+        st->waiter_aged = g_age_ns > 0 && g_now - t->wait_start >= (u64)g_age_ns;
+    }
+}
+
+/* ========== 锁亲和组 ========== */
+static bool group_enabled(void)
+{
+    return g_policy == POLICY_LHANDOFF && g_group_place && g_nr_llcs >= 2;
+}
+
+/* CPU 按编号均分到 g_nr_llcs 个域 */
+static void group_topology(void)
+{
+    for (int c = 0; c < g_nr_cpus; c++) {
+        g_cpu_llc[c] = (u8)((long)c * g_nr_llcs / g_nr_cpus);
+        g_llc_nr_cpus[g_cpu_llc[c]]++;
+    }
+}
+
+/* waiter 每次进入调度路径时调用，一次等待只计一票（BPF group_note） */
+static void group_note(struct sim_task *t, s32 owner_cpu)
+{
+    struct lh_lock_group *g = &g_locks[t->cur.lock].group;
+
+    if (!group_enabled() || t->group_voted == t->wait_start + 1)
+        return;
+    t->group_voted = t->wait_start + 1;
+    if (!lh_policy_group_vote(&t->group_lock, &t->group_score, &t->group_epoch,
+                              (u64)t->cur.lock + 1))
+        return;
+    g->owner_cpu = owner_cpu;
+    if (t->group_epoch != g_group_epoch) {
+        t->group_epoch = g_group_epoch;
+        g->members_next++;
+    }
+}
+
+/* 周期结束：折算成员数并重新分配域（BPF group_timer_fn） */
+static void group_tick(void)
+{
+    memset(g_llc_load, 0, sizeof(g_llc_load));
+    for (int i = 0; i < g_nr_locks; i++)
+        lh_policy_group_fold(&g_locks[i].group, g_llc_load);
+    for (int i = 0; i < g_nr_locks; i++)
+        lh_policy_group_balance(&g_locks[i].group, g_llc_load, g_llc_nr_cpus,
+                                (u32)g_nr_llcs, g_cpu_llc);
+    g_group_epoch++;
+    g_group_next_ns += LH_GROUP_EPOCH_NS;
+}
+
+/* 组的域里的 CPU：prev_cpu 已在域里就留在原地，否则占下域里一个空闲 CPU（*claimed） */
+static s32 group_target_cpu(const struct sim_task *t, s32 prev_cpu, bool *claimed)
+{
+    const struct lh_lock_group *g;
+    s32 home;
+
+    *claimed = false;
+    if (!group_enabled() || t->group_score < LH_GROUP_JOIN_SCORE)
+        return -1;
+    g = &g_locks[t->group_lock - 1].group;
+    home = g->home_llc;
+    if (g->members < 2 || home < 0)
+        return -1;
+
+    if (prev_cpu >= 0 && g_cpu_llc[prev_cpu] == home)
+        return prev_cpu;
+    for (int c = 0; c < g_nr_cpus; c++) {
+        if (g_cpu_llc[c] == home && !g_cpus[c].curr) {
+            *claimed = true;
+            return c;
+        }
+    }
+    return -1;
+}
+
+static void schedule_cpu(int cpu);
+static void run_task(int cpu, struct sim_task *t);
+
+/* wakeup = true 时经过 select_cpu（对应 ttwu），否则只 enqueue（yield / slice 用完） */
+static void enqueue_task(struct sim_task *t, bool wakeup)
+{
+    struct lh_task_state st;
+    struct lh_enq_decision d;
+    s32 target = t->last_cpu;
+    bool claimed = false;
+
+    task_state_for_policy(t, &st);
+    if (st.waiter_cpu >= 0 && t->waiting)
+        group_note(t, st.waiter_cpu);
+    if (wakeup) {
+        if (!st.in_cs && st.waiter_cpu < 0)
+            st.group_cpu = group_target_cpu(t, t->last_cpu, &claimed);
+        target = lh_policy_select_cpu(&st, t->last_cpu, g_nr_cpus);
+    }
+    lh_policy_enqueue(&st, &d);
+
+    if (d.preempt)
+        g_stats.preempt_requests++;
+
+    t->state = TS_RUNNABLE;
+    t->slice_ns = d.slice_ns;
+
+    /* 为组占下的空闲 CPU：直接在上面运行，不进共享 DSQ */
+    if (claimed && target == st.group_cpu) {
+        g_stats.group_direct++;
+        run_task(target, t);
+        return;
+    }
+    if (d.head)
+        dsq_push_head(t);
+    else
+        dsq_push(t);
+
+    if (!wakeup)
+        return;
+
+    /* kick 空闲 CPU */
+    if (target >= 0 && !g_cpus[target].curr) {
+        schedule_cpu(target);
+        return;
+    }
+    if (g_kick_any_idle) {
+        for (int c = 0; c < g_nr_cpus; c++) {
+            if (!g_cpus[c].curr) {
+                schedule_cpu(c);
+                return;
+            }
+        }
+    }
+}
+
+/* CPU 空出后从 global DSQ 取下一个任务 */
+static void schedule_cpu(int cpu)
+{
+    run_task(cpu, dsq_pop());
+}
+
+/* t 开始在 cpu 上运行，t 为 NULL 时 CPU 空闲 */
+static void run_task(int cpu, struct sim_task *t)
+{
+    struct sim_cpu *c = &g_cpus[cpu];
+
+    c->curr = t;
+    c->last_update = g_now;
+    if (!t)
+        return;
+
+    if (c->prev != t) {
+        t->overhead += g_ctx_ns;
+        g_stats.ctx_switches++;
+    }
+    if (t->last_cpu >= 0 && t->last_cpu != cpu)
+        g_stats.migrations++;
+
+    t->state = TS_RUNNING;
+    t->cpu = cpu;
+    t->last_cpu = cpu;
+    t->slice_end = g_now + t->slice_ns;
+    c->prev = t;
+}
+
+/* 当前任务离开 CPU */
+static void put_prev(struct sim_task *t)
+{
+    g_cpus[t->cpu].curr = NULL;
+    t->cpu = -1;
+}
+
+/* ========== op 来源 ========== */
+static double rand_exp(uint64_t *rng, double mean)
+{
+    if (mean <= 0)
+        return 0;
+    double u = bench_rand_double(rng);
+    return -mean * log(1.0 - u);
+}
+
+static bool next_op(struct sim_task *t)
+{
+    if (t->ops) {
+        if (t->next_op >= t->nr_ops)
+            return false;
+        t->cur = t->ops[t->next_op++];
+        return true;
+    }
+
+    t->cur.lock = g_nr_locks > 1 ? bench_rand(&t->rng) % g_nr_locks : 0;
+    t->cur.cs_ns = (u64)rand_exp(&t->rng, g_cs_ns) + 1;
+    t->cur.think_ns = (u64)rand_exp(&t->rng, g_think_ns);
+    t->cur.sleep_ns = (u64)rand_exp(&t->rng, g_sleep_ns);
+    return true;
+}
+
+/* 开始下一个 op；返回 false 表示任务结束 */
+static bool start_op(struct sim_task *t)
+{
+    if (!next_op(t)) {
+        t->state = TS_EXITED;
+        return false;
+    }
+    t->phase = PH_THINK;
+    t->remaining = t->cur.think_ns;
+    return true;
+}
+
+/* ========== 锁 ========== */
+static void lock_block(struct sim_task *t, struct sim_lock *l)
+{
+    t->state = TS_BLOCKED;
+    t->next = NULL;
+    if (l->blocked_tail)
+        l->blocked_tail->next = t;
+    else
+        l->blocked_head = t;
+    l->blocked_tail = t;
+}
+
+static void lock_wake_one(struct sim_lock *l)
+{
+    struct sim_task *w = l->blocked_head;
+    if (!w)
+        return;
+    l->blocked_head = w->next;
+    if (!l->blocked_head)
+        l->blocked_tail = NULL;
+    /* 被唤醒后重新竞争（允许插队），与 futex 语义一致 */
+    w->phase = PH_ACQUIRE;
+    w->remaining = 0;
+    enqueue_task(w, true);
+}
+
+/*
+ * waiter t 让出 CPU（已 put_prev）：它等的锁的 owner 在 DSQ 里排队时移到队首，
+ * 随后 schedule_cpu 在这个 CPU 上取到它（BPF dispatch 里 scx_bpf_dsq_move 到 local DSQ）
+ */
+static void pull_owner(const struct sim_task *t, const struct sim_lock *l)
+{
+    struct sim_task *o;
+
+    if (!g_owner_pull || g_policy != POLICY_LHANDOFF || !t->waiting || l->owner < 0)
+        return;
+    o = &g_tasks[l->owner];
+    if (o->state != TS_RUNNABLE)
+        return;
+    dsq_remove(o);
+    dsq_push_head(o);
+    g_stats.owner_pulls++;
+}
+
+/* ========== handoff 顺序 ========== */
+static bool order_enabled(void)
+{
+    return g_lock_mode == LOCK_LIBLH && (g_order != LH_ORDER_RACE || g_age_ns > 0);
+}
+
+static bool order_granted_other(const struct sim_lock *l, const struct sim_task *t)
+{
+    return l->grant >= 0 && l->grant != t->id &&
+           g_now - l->grant_at < LH_HANDOFF_GRANT_US * 1000ULL;
+}
+
+static void order_leave(struct sim_task *t, struct sim_lock *l)
+{
+    t->queued = false;
+    if (l->grant == t->id)
+        l->grant = -1;
+}
+
+/* 解锁时按策略指定下一个 owner（lh_order_grant） */
+static void order_grant(struct sim_lock *l, const struct sim_task *rel)
+{
+    struct sim_task *oldest = NULL, *newest = NULL, *same_cpu = NULL;
+    struct sim_task *next;
+
+    for (int i = 0; i < g_nr_threads; i++) {
+        struct sim_task *w = &g_tasks[i];
+        int cpu = w->cpu >= 0 ? w->cpu : w->last_cpu;
+
+        if (!w->queued || w == rel || &g_locks[w->cur.lock] != l)
+            continue;
+        if (!oldest || w->wait_start < oldest->wait_start)
+            oldest = w;
+        if (!newest || w->wait_start > newest->wait_start)
+            newest = w;
+        if (cpu == rel->cpu && (!same_cpu || w->wait_start < same_cpu->wait_start))
+            same_cpu = w;
+    }
+
+    if (g_age_ns > 0 && oldest && g_now - oldest->wait_start >= (u64)g_age_ns)
+        next = oldest;
+    else if (g_order == LH_ORDER_FIFO)
+        next = oldest;
+    else if (g_order == LH_ORDER_LIFO)
+        next = newest;
+    else if (g_order == LH_ORDER_CPU)
+        next = same_cpu ? same_cpu : oldest;
+    else
+        next = NULL;
+
+    l->grant = next ? next->id : -1;
+    l->grant_at = g_now;
+}
+
+static void clear_waiter(struct sim_task *t, struct sim_lock *l)
+{
+    if (t->waiting) {
+        t->waiting = false;
+        l->yield_waiters--;
+    }
+}
+
+/*
+ * 运行中的任务尝试加锁。
+ * 返回 true 表示任务继续占用 CPU，false 表示已离开 CPU。
+ */
+static bool try_acquire(struct sim_task *t)
+{
+    struct sim_lock *l = &g_locks[t->cur.lock];
+
+    if (l->owner < 0 && (t->fell_back || !order_granted_other(l, t))) {
+        clear_waiter(t, l);
+        order_leave(t, l);
+        if (g_nr_llcs && l->last_cpu >= 0 && g_cpu_llc[l->last_cpu] != g_cpu_llc[t->cpu])
+            g_stats.llc_handoffs++;
+        l->owner = t->id;
+        l->owner_cpu = t->cpu;
+        l->last_cpu = t->cpu;
+        lat_record(&g_stats.wait, g_now - t->wait_start);
+        t->in_cs = true;
+        t->cs_start = g_now;
+        t->phase = PH_CS;
+        t->remaining = t->cur.cs_ns;
+        return true;
+    }
+
+    if (g_lock_mode == LOCK_NATIVE) {
+        put_prev(t);
+        lock_block(t, l);
+        return false;
+    }
+
+    if (order_enabled() && !t->queued && !t->fell_back)
+        t->queued = true;
+
+    /* Phase 1: spin */
+    if (!t->spun) {
+        t->spun = true;
+        t->phase = PH_SPIN;
+        t->remaining = g_spin_ns;
+        return true;
+    }
+
+    /* 降级检查 */
+    if (t->yields >= g_yield_budget || g_now - t->wait_start >= g_fallback_ns) {
+        /* waiter hint 不清除：唤醒时仍定向到 owner CPU，unlock 者仍会 yield */
+        if (!t->waiting) {
+            t->waiting = true;
+            l->yield_waiters++;
+        }
+        if (l->owner >= 0)
+            t->park_cpu = l->owner_cpu;
+        order_leave(t, l);
+        t->fell_back = true;
+        g_stats.fallbacks++;
+        put_prev(t);
+        lock_block(t, l);
+        pull_owner(t, l);
+        return false;
+    }
+
+    /* Phase 2: 写 waiter hint 后 yield */
+    if (!t->waiting) {
+        t->waiting = true;
+        l->yield_waiters++;
+    }
+    t->phase = PH_YIELD;
+    t->remaining = g_yield_ns;
+    return true;
+}
+
+/* 当前阶段的 CPU 时间耗尽；返回 true 表示任务继续占用 CPU */
+static bool phase_done(struct sim_task *t)
+{
+    switch (t->phase) {
+    case PH_THINK:
+        if (t->cur.sleep_ns) {
+            put_prev(t);
+            t->state = TS_SLEEPING;
+            t->wake_at = g_now + t->cur.sleep_ns;
+            /* 醒来后从 think 结束处继续 */
+            t->remaining = 0;
+            t->cur.sleep_ns = 0;
+            return false;
+        }
+        t->phase = PH_ACQUIRE;
+        t->wait_start = g_now;
+        t->spun = false;
+        t->fell_back = false;
+        t->park_cpu = -1;
+        t->yields = 0;
+        return try_acquire(t);
+
+    case PH_ACQUIRE:
+    case PH_SPIN:
+        return try_acquire(t);
+
+    case PH_YIELD:
+        t->yields++;
+        g_stats.yields++;
+        t->phase = PH_ACQUIRE;
+        put_prev(t);
+        enqueue_task(t, false);
+        pull_owner(t, &g_locks[t->cur.lock]);
+        return false;
+
+    case PH_CS: {
+        struct sim_lock *l = &g_locks[t->cur.lock];
+        bool has_waiter = l->yield_waiters > 0;
+
+        u64 hold = g_now - t->cs_start;
+
+        l->hold_ewma_ns = l->hold_ewma_ns ?
+            l->hold_ewma_ns + (((s64)hold - (s64)l->hold_ewma_ns) >> LH_HOLD_EWMA_SHIFT) :
+            (hold ? hold : 1);
+        if (order_enabled())
+            order_grant(l, t);
+        l->owner = -1;
+        l->owner_cpu = -1;
+        t->in_cs = false;
+        t->ops_done++;
+        g_stats.ops++;
+        lock_wake_one(l);
+
+        if (!start_op(t)) {
+            put_prev(t);
+            return false;
+        }
+        /* liblh: 有 waiter 时 unlock 后 yield 做 handoff */
+        if (g_lock_mode == LOCK_LIBLH && has_waiter) {
+            put_prev(t);
+            enqueue_task(t, false);
+            return false;
+        }
+        return true;
+    }
+    }
+    return true;
+}
+
+/* ========== 事件循环 ========== */
+static u64 cpu_next_event(const struct sim_cpu *c)
+{
+    const struct sim_task *t = c->curr;
+    u64 done = c->last_update + t->overhead + t->remaining;
+    return done < t->slice_end ? done : t->slice_end;
+}
+
+/* 把 [last_update, now) 的 CPU 时间记到当前任务上 */
+static void cpu_account(struct sim_cpu *c)
+{
+    struct sim_task *t = c->curr;
+    u64 delta = g_now - c->last_update;
+    c->last_update = g_now;
+
+    u64 o = delta < t->overhead ? delta : t->overhead;
+    t->overhead -= o;
+    delta -= o;
+    t->remaining -= delta < t->remaining ? delta : t->remaining;
+}
+
+static void run_cpu_event(int cpu)
+{
+    struct sim_cpu *c = &g_cpus[cpu];
+    struct sim_task *t = c->curr;
+
+    /* 同一时刻可能连续完成多个零长度阶段 */
+    while (t && c->curr == t && t->overhead == 0 && t->remaining == 0) {
+        if (!phase_done(t))
+            break;
+    }
+
+    if (t && c->curr == t) {
+        if (g_now < t->slice_end)
+            return;
+        /* slice 用完 */
+        if (t->in_cs)
+            g_stats.lhp++;
+        put_prev(t);
+        enqueue_task(t, false);
+    }
+    if (!c->curr)
+        schedule_cpu(cpu);
+}
+
+static void simulate(void)
+{
+    for (int i = 0; i < g_nr_threads; i++) {
+        struct sim_task *t = &g_tasks[i];
+        if (start_op(t))
+            enqueue_task(t, true);
+    }
+
+    u64 idle_since[SIM_MAX_CPUS];
+    for (int c = 0; c < g_nr_cpus; c++)
+        idle_since[c] = 0;
+
+    while (g_now < g_duration_ns) {
+        u64 next = UINT64_MAX;
+        int kind = -1, who = -1;
+
+        for (int c = 0; c < g_nr_cpus; c++) {
+            if (!g_cpus[c].curr)
+                continue;
+            u64 e = cpu_next_event(&g_cpus[c]);
+            if (e < next) {
+                next = e;
+                kind = 0;
+                who = c;
+            }
+        }
+        for (int i = 0; i < g_nr_threads; i++) {
+            if (g_tasks[i].state == TS_SLEEPING && g_tasks[i].wake_at < next) {
+                next = g_tasks[i].wake_at;
+                kind = 1;
+                who = i;
+            }
+        }
+        if (kind < 0)
+            break;  /* 所有任务结束或死锁 */
+        if (next > g_duration_ns)
+            next = g_duration_ns;
+
+        /* 推进时间 */
+        g_now = next;
+        for (int c = 0; c < g_nr_cpus; c++) {
+            if (g_cpus[c].curr)
+                cpu_account(&g_cpus[c]);
+        }
+        if (g_now >= g_duration_ns)
+            break;
+        while (group_enabled() && g_now >= g_group_next_ns)
+            group_tick();
+
+        bool was_idle[SIM_MAX_CPUS];
+        for (int c = 0; c < g_nr_cpus; c++)
+            was_idle[c] = !g_cpus[c].curr;
+
+        if (kind == 0) {
+            run_cpu_event(who);
+        } else {
+            enqueue_task(&g_tasks[who], true);
+        }
+
+        /* 空闲时间统计 */
+        for (int c = 0; c < g_nr_cpus; c++) {
+            bool idle = !g_cpus[c].curr;
+            if (was_idle[c] && !idle)
+                g_stats.idle_ns += g_now - idle_since[c];
+            else if (!was_idle[c] && idle)
+                idle_since[c] = g_now;
+        }
+    }
+
+    for (int c = 0; c < g_nr_cpus; c++) {
+        if (!g_cpus[c].curr)
+            g_stats.idle_ns += g_now - idle_since[c];
+    }
+}
+
+/* ========== trace 读取 ========== */
+static int load_trace(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        perror(path);
+        return -1;
+    }
+
+    static long tid_map[SIM_MAX_THREADS];
+    int nr = 0, max_lock = 0;
+    char line[256];
+
+    g_tasks = calloc(SIM_MAX_THREADS, sizeof(*g_tasks));
+    while (fgets(line, sizeof(line), f)) {
+        long tid;
+        unsigned long lock, cs, think, sleep_ns = 0;
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (sscanf(line, "%ld %lu %lu %lu %lu", &tid, &lock, &cs, &think, &sleep_ns) < 4) {
+            fprintf(stderr, "bad trace line: %s", line);
+            continue;
+        }
+        if (lock >= SIM_MAX_LOCKS) {
+            fprintf(stderr, "lock id %lu too large\n", lock);
+            continue;
+        }
+
+        int idx = -1;
+        for (int i = 0; i < nr; i++) {
+            if (tid_map[i] == tid) {
+                idx = i;
+                break;
+            }
+        }
+        if (idx < 0) {
+            if (nr >= SIM_MAX_THREADS) {
+                fprintf(stderr, "too many threads in trace\n");
+                fclose(f);
+                return -1;
+            }
+            idx = nr;
+            tid_map[nr++] = tid;
+        }
+
+        struct sim_task *t = &g_tasks[idx];
+        if (t->nr_ops == t->cap_ops) {
+            t->cap_ops = t->cap_ops ? t->cap_ops * 2 : 64;
+            t->ops = realloc(t->ops, t->cap_ops * sizeof(*t->ops));
+        }
+        t->ops[t->nr_ops++] = (struct sim_op){ lock, cs, think, sleep_ns };
+        if ((int)lock > max_lock)
+            max_lock = lock;
+    }
+    fclose(f);
+
+    g_nr_threads = nr;
+    g_nr_locks = max_lock + 1;
+    return nr > 0 ? 0 : -1;
+}
+
+/* ========== 输出 ========== */
+static const char *policy_name(void)
+{
+    return g_policy == POLICY_LHANDOFF ? "lhandoff" : "default";
+}
+
+static const char *lock_mode_name(void)
+{
+    return g_lock_mode == LOCK_LIBLH ? "liblh" : "native";
+}
+
+static const char *order_name(void)
+{
+    static const char *const names[] = { "race", "fifo", "lifo", "cpu" };
+
+    return names[g_order];
+}
+
+static void report(void)
+{
+    double secs = g_now / 1e9;
+    double ops_per_sec = secs > 0 ? g_stats.ops / secs : 0;
+    double util = g_now ? 100.0 * (1.0 - (double)g_stats.idle_ns / ((double)g_now * g_nr_cpus)) : 0;
+    double p50 = lat_percentile(&g_stats.wait, 50.0) / 1e3;
+    double p99 = lat_percentile(&g_stats.wait, 99.0) / 1e3;
+    double p999 = lat_percentile(&g_stats.wait, 99.9) / 1e3;
+
+    if (g_csv) {
+        printf("policy,lock_mode,order,cpus,threads,locks,ops_per_sec,p50_wait_us,p99_wait_us,"
+               "p999_wait_us,max_wait_us,migrations,ctx_switches,lhp,yields,fallbacks,cpu_util_pct,"
+               "llcs,llc_handoffs,group_direct\n");
+        printf("%s,%s,%s,%d,%d,%d,%.0f,%.2f,%.2f,%.2f,%.2f,%lu,%lu,%lu,%lu,%lu,%.1f,%d,%lu,%lu\n",
+               policy_name(), lock_mode_name(), order_name(), g_nr_cpus, g_nr_threads, g_nr_locks,
+               ops_per_sec, p50, p99, p999, g_stats.wait.max_ns / 1e3,
+               g_stats.migrations, g_stats.ctx_switches, g_stats.lhp,
+               g_stats.yields, g_stats.fallbacks, util,
+               g_nr_llcs, g_stats.llc_handoffs, g_stats.group_direct);
+        return;
+    }
+
+    printf("========================================\n");
+    printf("policy=%s lock=%s order=%s age=%.0fus cpus=%d threads=%d locks=%d\n",
+           policy_name(), lock_mode_name(), order_name(), g_age_ns / 1e3,
+           g_nr_cpus, g_nr_threads, g_nr_locks);
+    printf("----------------------------------------\n");
+    printf("Simulated time:     %.3f s\n", secs);
+    printf("Lock ops:           %lu\n", g_stats.ops);
+    printf("Throughput:         %.0f ops/s\n", ops_per_sec);
+    printf("Wait p50/p99/p99.9: %.2f / %.2f / %.2f us (max %.2f us)\n",
+           p50, p99, p999, g_stats.wait.max_ns / 1e3);
+    printf("Migrations:         %lu\n", g_stats.migrations);
+    printf("Context switches:   %lu\n", g_stats.ctx_switches);
+    printf("Holder preemptions: %lu\n", g_stats.lhp);
+    printf("Yields:             %lu\n", g_stats.yields);
+    printf("Fallbacks:          %lu\n", g_stats.fallbacks);
+    printf("PREEMPT requests:   %lu\n", g_stats.preempt_requests);
+    printf("Owner pulls:        %lu\n", g_stats.owner_pulls);
+    if (g_nr_llcs) {
+        printf("LLC domains:        %d\n", g_nr_llcs);
+        printf("Cross-LLC handoffs: %lu\n", g_stats.llc_handoffs);
+        printf("Group direct runs:  %lu\n", g_stats.group_direct);
+    }
+    printf("CPU utilization:    %.1f%%\n", util);
+    printf("========================================\n");
+}
+
+static void print_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [options]\n", prog);
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -p <policy>  lhandoff|default (default: lhandoff)\n");
+    fprintf(stderr, "  -m <mode>    Lock mode: liblh|native (default: liblh)\n");
+    fprintf(stderr, "  -c <n>       Virtual CPUs (default: 4)\n");
+    fprintf(stderr, "  -t <n>       Threads, synthetic workload (default: 8)\n");
+    fprintf(stderr, "  -l <n>       Locks, synthetic workload (default: 1)\n");
+    fprintf(stderr, "  -C <ns>      Mean critical section, exponential (default: 20000)\n");
+    fprintf(stderr, "  -T <ns>      Mean think time on CPU (default: 20000)\n");
+    fprintf(stderr, "  -S <ns>      Mean off-CPU sleep per op (default: 0)\n");
+    fprintf(stderr, "  -d <ms>      Simulated duration (default: 1000)\n");
+    fprintf(stderr, "  -r <file>    Replay trace: \"tid lock cs_ns think_ns [sleep_ns]\" per line\n");
+    fprintf(stderr, "  -x <ns>      Context switch cost (default: %d)\n", SIM_CTX_SWITCH_NS);
+    fprintf(stderr, "  -y <ns>      sched_yield cost (default: %d)\n", SIM_YIELD_NS);
+    fprintf(stderr, "  -b <n>       Yield budget (default: %d)\n", LH_YIELD_BUDGET);
+    fprintf(stderr, "  -K           Only kick the CPU chosen by select_cpu\n");
+    fprintf(stderr, "  -H           Disable hold-time prediction (fixed IN_CS slice)\n");
+    fprintf(stderr, "  -P           Disable owner pull onto a yielding waiter's CPU\n");
+    fprintf(stderr, "  -O <order>   Handoff order: race|fifo|lifo|cpu (default: race)\n");
+    fprintf(stderr, "  -A <us>      Waiter aging bound, 0 = off (default: %d unless race)\n",
+            LH_HANDOFF_AGE_US);
+    fprintf(stderr, "  -L <n>       Split CPUs into n synthetic LLC domains, count cross-LLC handoffs\n");
+    fprintf(stderr, "  -g           Lock-affinity group placement across the -L domains\n");
+    fprintf(stderr, "  -s <seed>    Random seed (default: 1)\n");
+    fprintf(stderr, "  -o           CSV output\n");
+    fprintf(stderr, "  -h           Show this help\n");
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+
+    while ((opt = getopt(argc, argv, "hp:m:c:t:l:C:T:S:d:r:x:y:b:KHPO:A:L:gs:o")) != -1) {
+        switch (opt) {
+        case 'p':
+            if (strcmp(optarg, "lhandoff") == 0)
+                g_policy = POLICY_LHANDOFF;
+            else if (strcmp(optarg, "default") == 0)
+                g_policy = POLICY_DEFAULT;
+            else {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'm':
+            if (strcmp(optarg, "liblh") == 0)
+                g_lock_mode = LOCK_LIBLH;
+            else if (strcmp(optarg, "native") == 0)
+                g_lock_mode = LOCK_NATIVE;
+            else {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'c':
+            g_nr_cpus = atoi(optarg);
+            break;
+        case 't':
+            g_nr_threads = atoi(optarg);
+            break;
+        case 'l':
+            g_nr_locks = atoi(optarg);
+            break;
+        case 'C':
+            g_cs_ns = strtoull(optarg, NULL, 0);
+            break;
+        case 'T':
+            g_think_ns = strtoull(optarg, NULL, 0);
+            break;
+        case 'S':
+            g_sleep_ns = strtoull(optarg, NULL, 0);
+            break;
+        case 'd':
+            g_duration_ns = strtoull(optarg, NULL, 0) * 1000000ULL;
+            break;
+        case 'r':
+            g_trace_path = optarg;
+            break;
+        case 'x':
+            g_ctx_ns = strtoull(optarg, NULL, 0);
+            break;
+        case 'y':
+            g_yield_ns = strtoull(optarg, NULL, 0);
+            break;
+        case 'b':
+            g_yield_budget = atoi(optarg);
+            break;
+        case 'K':
+            g_kick_any_idle = false;
+            break;
+        case 'H':
+            g_hold_predict = false;
+            break;
+        case 'P':
+            g_owner_pull = false;
+            break;
+        case 'O':
+            if (strcmp(optarg, "race") == 0)
+                g_order = LH_ORDER_RACE;
+            else if (strcmp(optarg, "fifo") == 0)
+                g_order = LH_ORDER_FIFO;
+            else if (strcmp(optarg, "lifo") == 0)
+                g_order = LH_ORDER_LIFO;
+            else if (strcmp(optarg, "cpu") == 0)
+                g_order = LH_ORDER_CPU;
+            else {
+                print_usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'A':
+            g_age_ns = (s64)strtoll(optarg, NULL, 0) * 1000;
+            break;
+        case 'L':
+            g_nr_llcs = atoi(optarg);
+            break;
+        case 'g':
+            g_group_place = true;
+            break;
+        case 's':
+            g_seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'o':
+            g_csv = true;
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            return 0;
+        default:
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (g_nr_cpus < 1 || g_nr_cpus > SIM_MAX_CPUS || g_nr_locks < 1 ||
+        g_nr_locks > SIM_MAX_LOCKS || g_duration_ns == 0 ||
+        g_nr_llcs < 0 || g_nr_llcs > LH_LLC_MAX || g_nr_llcs > g_nr_cpus) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if (g_trace_path) {
+        if (load_trace(g_trace_path) != 0) {
+            fprintf(stderr, "failed to load trace %s\n", g_trace_path);
+            return 1;
+        }
+    } else {
+        if (g_nr_threads < 1 || g_nr_threads > SIM_MAX_THREADS) {
+            print_usage(argv[0]);
+            return 1;
+        }
+        g_tasks = calloc(g_nr_threads, sizeof(*g_tasks));
+    }
+
+    if (g_age_ns < 0)
+        g_age_ns = g_order != LH_ORDER_RACE ? LH_HANDOFF_AGE_US * 1000LL : 0;
+
+    g_locks = calloc(g_nr_locks, sizeof(*g_locks));
+    for (int i = 0; i < g_nr_locks; i++) {
+        g_locks[i].owner = -1;
+        g_locks[i].owner_cpu = -1;
+        g_locks[i].grant = -1;
+        g_locks[i].last_cpu = -1;
+        g_locks[i].group.home_llc = -1;
+        g_locks[i].group.owner_cpu = -1;
+    }
+    if (g_nr_llcs)
+        group_topology();
+    for (int i = 0; i < g_nr_threads; i++) {
+        struct sim_task *t = &g_tasks[i];
+        t->id = i;
+        t->cpu = -1;
+        t->last_cpu = -1;
+        t->rng = g_seed * 0x9E3779B97F4A7C15ULL + i + 1;
+    }
+
+    simulate();
+    report();
+
+    for (int i = 0; i < g_nr_threads; i++)
+        free(g_tasks[i].ops);
+    free(g_tasks);
+    free(g_locks);
+    return 0;
+}
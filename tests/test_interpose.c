@@ -0,0 +1,1291 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * test_interpose.c - liblh 拦截覆盖测试
+ *
+ * 不需要 sched_ext / root：用 memfd 代替 BPF map 创建 lock_table / thread_table /
+ * cpu_table（前两个按两个 NUMA 节点分区），设置与 launcher 相同的 LH_*_FD 环境变量，
+ * 带 LD_PRELOAD 重新 exec 自己。
+ * 子进程持锁时检查共享表里是否有本线程的 owner 记录和 IN_CS 标记，
+ * 解锁后检查记录已清除。
+ *
+ * 覆盖：pthread_mutex_*、__pthread_mutex_*、pthread_rwlock_*（读/写）、
+ * pthread_cond_wait（等待期间不应仍是 owner），以及 test_interpose_cxx.cpp 中的
+ * std::mutex / std::timed_mutex / std::recursive_mutex / std::shared_mutex /
+ * std::condition_variable，liblh.h 的显式标注 API，lh_spinlock.h 的锁，
+ * rseq.h（glibc 已注册的 rseq 区域与 per-CPU 计数），
+ * LH_PROFILE 报告（子进程开启 profiler，输出到临时文件），LH_EXCLUDE
+ * （按符号排除 lh_test_excluded_lock，需要 -rdynamic 链接），以及
+ * LH_HANDOFF_ORDER=fifo 下的交接顺序。
+ * 子进程跑两轮，第二轮设置 LH_NATIVE_MUTEX=1（liblh 自己维护默认 mutex 的锁字），
+ * 上面的用例再跑一遍，另加 native mutex 专项。
+ *
+ * 用法: ./test_interpose [path/to/liblh.so]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <libgen.h>
+#include <dlfcn.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <sched.h>
+
+#include "../common/lh_shared.h"
+#include "test_interpose.h"
+#include "../liblh/liblh.h"
+#include "../liblh/lh_spinlock.h"
+#include "../liblh/rseq.h"
+#include "../liblh/lh_order.h"
+#include "../liblh/lh_filter.h"
+#include "../liblh/lh_delegate.h"
+
+#define TEST_HASH_SALT  0x0123456789abcdefULL
+
+#define TEST_NODES      2       /* lock_table / thread_table 分区数，模拟双节点 */
+
+static struct lh_lock_bucket *g_lock_table[TEST_NODES];
+static struct lh_thread_slot *g_thread_table[TEST_NODES];
+static struct lh_cpu_slot *g_cpu_table;
+
+static int g_passed = 0;
+static int g_failed = 0;
+
+/* ========== 共享表检查 ========== */
+static u32 gettid_u32(void)
+{
+    return (u32)syscall(SYS_gettid);
+}
+
+/* 与 liblh / BPF 相同的查找：扫描所有分区，返回 lock 的 entry 所在分区 */
+static struct lh_lock_entry *entry_lookup(const void *lock, int *part)
+{
+    u64 addr = (u64)(uintptr_t)lock;
+
+    for (int n = 0; n < TEST_NODES; n++) {
+        struct lh_lock_bucket *b = &g_lock_table[n][LH_BUCKET_IDX(addr, TEST_HASH_SALT)];
+
+        for (int i = 0; i < LH_LOCK_WAYS; i++) {
+            if (atomic_load(&b->tag[i]) == addr) {
+                if (part)
+                    *part = n;
+                return &b->way[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+/* lock_table 认为谁持有 lock，没有记录返回 0 */
+static u32 owner_lookup(const void *lock)
+{
+    struct lh_lock_entry *e = entry_lookup(lock, NULL);
+
+    return e ? e->owner_tid : 0;
+}
+
+static s32 owner_cpu_lookup(const void *lock)
+{
+    struct lh_lock_entry *e = entry_lookup(lock, NULL);
+
+    return e ? e->owner_cpu : -1;
+}
+
+/* 本线程的 slot：与 BPF 一样按 slot->tid 在各分区中找，尚未认领时返回 NULL */
+static struct lh_thread_slot *slot_lookup(u32 tid, int *part)
+{
+    for (int n = 0; n < TEST_NODES; n++) {
+        struct lh_thread_slot *slot = &g_thread_table[n][LH_THREAD_SLOT_IDX(tid)];
+
+        if (slot->tid == tid) {
+            if (part)
+                *part = n;
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+static bool owner_recorded(const void *lock, u32 tid)
+{
+    return owner_lookup(lock) == tid;
+}
+
+/* 释放后 entry 保留该锁的持锁时间 EWMA */
+static u32 hold_ewma_recorded(const void *lock)
+{
+    u64 addr = (u64)(uintptr_t)lock;
+    u32 tag = LH_EWMA_TAG(addr, TEST_HASH_SALT);
+
+    for (int n = 0; n < TEST_NODES; n++) {
+        struct lh_lock_bucket *b = &g_lock_table[n][LH_BUCKET_IDX(addr, TEST_HASH_SALT)];
+
+        for (int i = 0; i < LH_LOCK_WAYS; i++) {
+            if (b->way[i].ewma_tag == tag)
+                return b->way[i].hold_ewma_ns;
+        }
+    }
+    return 0;
+}
+
+static u64 held_top(u32 tid)
+{
+    struct lh_thread_slot *slot = slot_lookup(tid, NULL);
+
+    return slot && slot->nr_held ? slot->held[slot->nr_held - 1] : 0;
+}
+
+unsigned lh_test_cs_depth(unsigned tid)
+{
+    struct lh_thread_slot *slot = slot_lookup(tid, NULL);
+
+    return slot ? atomic_load(&slot->in_cs) : 0;
+}
+
+unsigned lh_test_tid(void)
+{
+    return gettid_u32();
+}
+
+void lh_test_expect(const char *name, const void *lock, int expect_owner, int expect_in_cs)
+{
+    u32 tid = gettid_u32();
+    bool owner = owner_recorded(lock, tid);
+    bool in_cs = lh_test_cs_depth(tid) > 0;
+    bool ok = true;
+
+    if (expect_owner >= 0 && owner != (expect_owner != 0))
+        ok = false;
+    if (expect_in_cs >= 0 && in_cs != (expect_in_cs != 0))
+        ok = false;
+
+    printf("  %-44s %s (owner=%d in_cs=%d)\n", name, ok ? "PASS" : "FAIL", owner, in_cs);
+    if (ok)
+        g_passed++;
+    else
+        g_failed++;
+}
+
+void lh_test_check(const char *name, int ok)
+{
+    printf("  %-44s %s\n", name, ok ? "PASS" : "FAIL");
+    if (ok)
+        g_passed++;
+    else
+        g_failed++;
+}
+
+/* ========== C 用例 ========== */
+static void test_mutex(void)
+{
+    pthread_mutex_t m = PTHREAD_MUTEX_INITIALIZER;
+
+    pthread_mutex_lock(&m);
+    lh_test_expect("pthread_mutex_lock", &m, 1, 1);
+    pthread_mutex_unlock(&m);
+    lh_test_expect("pthread_mutex_unlock", &m, 0, 0);
+
+    lh_test_check("pthread_mutex_trylock", pthread_mutex_trylock(&m) == 0);
+    lh_test_expect("pthread_mutex_trylock held", &m, 1, 1);
+    pthread_mutex_unlock(&m);
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += 1;
+    lh_test_check("pthread_mutex_timedlock", pthread_mutex_timedlock(&m, &ts) == 0);
+    lh_test_expect("pthread_mutex_timedlock held", &m, 1, 1);
+    pthread_mutex_unlock(&m);
+    lh_test_expect("pthread_mutex_timedlock released", &m, 0, 0);
+
+    /* 持锁约 1ms，EWMA 应反映持锁时间，cs_slot 指向这把锁 */
+    pthread_mutex_lock(&m);
+    lh_test_check("cs_slot.held top",
+                  held_top(gettid_u32()) == (u64)(uintptr_t)&m);
+    usleep(1000);
+    pthread_mutex_unlock(&m);
+    u32 ewma = hold_ewma_recorded(&m);
+    lh_test_check("hold-time EWMA updated", ewma > 0 && ewma < 1000 * 1000 * 1000);
+}
+
+/*
+ * glibc 的 __pthread_* 只有兼容版本，新程序无法直接链接，
+ * 按老二进制的方式通过符号查找解析（LD_PRELOAD 的库优先）
+ */
+static void test_pthread_aliases(void)
+{
+    pthread_mutex_t m = PTHREAD_MUTEX_INITIALIZER;
+    pthread_rwlock_t rw = PTHREAD_RWLOCK_INITIALIZER;
+    int (*__pthread_mutex_lock)(pthread_mutex_t *) = dlsym(RTLD_DEFAULT, "__pthread_mutex_lock");
+    int (*__pthread_mutex_unlock)(pthread_mutex_t *) = dlsym(RTLD_DEFAULT, "__pthread_mutex_unlock");
+    int (*__pthread_rwlock_wrlock)(pthread_rwlock_t *) = dlsym(RTLD_DEFAULT, "__pthread_rwlock_wrlock");
+    int (*__pthread_rwlock_unlock)(pthread_rwlock_t *) = dlsym(RTLD_DEFAULT, "__pthread_rwlock_unlock");
+
+    if (!__pthread_mutex_lock || !__pthread_mutex_unlock ||
+        !__pthread_rwlock_wrlock || !__pthread_rwlock_unlock) {
+        lh_test_check("__pthread_* symbols resolved", 0);
+        return;
+    }
+
+    __pthread_mutex_lock(&m);
+    lh_test_expect("__pthread_mutex_lock", &m, 1, 1);
+    __pthread_mutex_unlock(&m);
+    lh_test_expect("__pthread_mutex_unlock", &m, 0, 0);
+
+    __pthread_rwlock_wrlock(&rw);
+    lh_test_expect("__pthread_rwlock_wrlock", &rw, 1, 1);
+    __pthread_rwlock_unlock(&rw);
+    lh_test_expect("__pthread_rwlock_unlock", &rw, 0, 0);
+}
+
+/* 嵌套加锁：held 栈按加锁顺序记录，可以不按顺序释放 */
+static void test_nested(void)
+{
+    pthread_mutex_t a = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_t b = PTHREAD_MUTEX_INITIALIZER;
+    pthread_mutex_t c = PTHREAD_MUTEX_INITIALIZER;
+    struct lh_thread_slot *slot;
+
+    pthread_mutex_lock(&a);
+    slot = slot_lookup(gettid_u32(), NULL);
+    lh_test_check("nested: thread slot claimed", slot != NULL);
+    if (!slot) {
+        pthread_mutex_unlock(&a);
+        return;
+    }
+    pthread_mutex_lock(&b);
+    pthread_mutex_lock(&c);
+    lh_test_check("nested: 3 locks held",
+                  slot->nr_held == 3 && slot->held[0] == (u64)(uintptr_t)&a &&
+                  slot->held[1] == (u64)(uintptr_t)&b &&
+                  slot->held[2] == (u64)(uintptr_t)&c);
+
+    /* 先放中间的 b */
+    pthread_mutex_unlock(&b);
+    lh_test_check("nested: out-of-order release",
+                  slot->nr_held == 2 && slot->held[0] == (u64)(uintptr_t)&a &&
+                  slot->held[1] == (u64)(uintptr_t)&c);
+    lh_test_expect("nested: still owner of a", &a, 1, 1);
+
+    pthread_mutex_unlock(&c);
+    pthread_mutex_unlock(&a);
+    lh_test_check("nested: stack empty", slot->nr_held == 0);
+    lh_test_expect("nested: all released", &a, 0, 0);
+}
+
+/*
+ * 大量相邻的堆上 mutex（高位地址相同）：同时持有其中一部分，
+ * 统计没被持有的锁在 lock_table 里查到 owner 的次数（误匹配），应为 0；
+ * 持有的锁绝大多数应能查到（bucket 哈希分布均匀，2-way 冲突淘汰很少）。
+ */
+#define MANY_LOCKS      4096
+#define MANY_HELD_STRIDE 7      /* 每 7 把持有 1 把，与未持有的锁交错 */
+
+static void test_many_locks(void)
+{
+    pthread_mutex_t *locks = calloc(MANY_LOCKS, sizeof(*locks));
+    u32 tid = gettid_u32();
+    int false_match = 0, found = 0, nr_held = 0;
+
+    if (!locks) {
+        lh_test_check("many locks: alloc", 0);
+        return;
+    }
+    for (int i = 0; i < MANY_LOCKS; i++)
+        pthread_mutex_init(&locks[i], NULL);
+
+    for (int i = 0; i < MANY_LOCKS; i += MANY_HELD_STRIDE) {
+        pthread_mutex_lock(&locks[i]);
+        nr_held++;
+    }
+
+    for (int i = 0; i < MANY_LOCKS; i++) {
+        bool held = i % MANY_HELD_STRIDE == 0;
+        u32 owner = owner_lookup(&locks[i]);
+
+        if (held && owner == tid)
+            found++;
+        else if (!held && owner)
+            false_match++;
+    }
+
+    for (int i = 0; i < MANY_LOCKS; i += MANY_HELD_STRIDE)
+        pthread_mutex_unlock(&locks[i]);
+
+    printf("  %d/%d held locks found, %d false owner matches among %d free locks\n",
+           found, nr_held, false_match, MANY_LOCKS - nr_held);
+    lh_test_check("many locks: no false owner match", false_match == 0);
+    lh_test_check("many locks: >= 90% of held locks found", found * 10 >= nr_held * 9);
+    free(locks);
+}
+
+static void test_rwlock(void)
+{
+    pthread_rwlock_t rw = PTHREAD_RWLOCK_INITIALIZER;
+
+    pthread_rwlock_wrlock(&rw);
+    lh_test_expect("pthread_rwlock_wrlock", &rw, 1, 1);
+    pthread_rwlock_unlock(&rw);
+    lh_test_expect("pthread_rwlock_unlock (writer)", &rw, 0, 0);
+
+    /* 读者只标记 IN_CS，不登记 owner */
+    pthread_rwlock_rdlock(&rw);
+    lh_test_expect("pthread_rwlock_rdlock", &rw, 0, 1);
+    pthread_rwlock_unlock(&rw);
+    lh_test_expect("pthread_rwlock_unlock (reader)", &rw, 0, 0);
+}
+
+/* ========== condvar：等待期间不应是 owner ========== */
+struct cond_ctx {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    volatile unsigned waiter_tid;
+    volatile bool waiting;
+    bool ready;
+    bool waiter_in_cs_while_waiting;
+};
+
+static void *cond_signaler(void *arg)
+{
+    struct cond_ctx *c = arg;
+
+    while (!c->waiting)
+        usleep(1000);
+
+    pthread_mutex_lock(&c->mutex);
+    /* 能拿到锁说明 waiter 已在 cond_wait 中释放了 mutex */
+    c->waiter_in_cs_while_waiting = lh_test_cs_depth(c->waiter_tid) > 0;
+    c->ready = true;
+    pthread_cond_signal(&c->cond);
+    pthread_mutex_unlock(&c->mutex);
+    return NULL;
+}
+
+static void test_cond(void)
+{
+    struct cond_ctx c = {
+        .mutex = PTHREAD_MUTEX_INITIALIZER,
+        .cond = PTHREAD_COND_INITIALIZER,
+    };
+    pthread_t th;
+
+    c.waiter_tid = gettid_u32();
+    pthread_create(&th, NULL, cond_signaler, &c);
+
+    pthread_mutex_lock(&c.mutex);
+    c.waiting = true;
+    while (!c.ready)
+        pthread_cond_wait(&c.cond, &c.mutex);
+    lh_test_expect("pthread_cond_wait reacquired", &c.mutex, 1, 1);
+    pthread_mutex_unlock(&c.mutex);
+    pthread_join(th, NULL);
+
+    lh_test_check("pthread_cond_wait not IN_CS while waiting", !c.waiter_in_cs_while_waiting);
+}
+
+/* ========== liblh.h 标注 API ========== */
+/* tid 在等 addr 时返回 waiter_flags，否则 LH_WAITER_INACTIVE */
+static u32 waiter_state(const void *addr, u32 tid)
+{
+    struct lh_thread_slot *w = slot_lookup(tid, NULL);
+    u32 flags = w ? atomic_load(&w->waiter_flags) : LH_WAITER_INACTIVE;
+
+    return w && w->lock_addr == (u64)(uintptr_t)addr ? flags : LH_WAITER_INACTIVE;
+}
+
+static bool waiter_recorded(const void *addr, u32 tid)
+{
+    return waiter_state(addr, tid) == LH_WAITER_ACTIVE;
+}
+
+/* unlock 是否会认为 addr 上有 waiter（liblh 的每锁 waiter 计数） */
+static bool lock_has_waiters(const void *addr)
+{
+    _Atomic u32 *waiters = dlsym(RTLD_DEFAULT, "g_lh_lock_waiters");
+
+    return waiters && atomic_load(&waiters[__lh_waiter_idx(addr)]) != 0;
+}
+
+/* 在 g_hint_lock 上发布 waiter 后忙等并计数，直到主线程放行 */
+static int g_hint_lock;
+static _Atomic int g_hint_state;        /* 1 = waiter 已发布，2 = 放行 */
+static _Atomic u64 g_hint_spins;
+
+static void *hint_waiter(void *arg)
+{
+    (void)arg;
+    lh_wait_begin(&g_hint_lock);
+    atomic_store(&g_hint_state, 1);
+    while (atomic_load(&g_hint_state) != 2)
+        atomic_fetch_add(&g_hint_spins, 1);
+    lh_wait_end();
+    return NULL;
+}
+
+/*
+ * lh_handoff_hint 的承诺：释放后有 waiter 时让出 CPU。waiter 与主线程绑在同一个
+ * CPU 上忙等，hint 里的 sched_yield 让它运行，计数在调用前后变化。
+ */
+static void test_handoff_hint(void)
+{
+    cpu_set_t old, one;
+    pthread_t th;
+    bool yielded = false;
+    u64 before;
+
+    sched_getaffinity(0, sizeof(old), &old);
+    CPU_ZERO(&one);
+    CPU_SET(sched_getcpu(), &one);
+    sched_setaffinity(0, sizeof(one), &one);
+
+    atomic_store(&g_hint_state, 0);
+    pthread_create(&th, NULL, hint_waiter, NULL);
+    while (atomic_load(&g_hint_state) != 1)
+        sched_yield();
+
+    lh_owner_begin(&g_hint_lock);
+    lh_test_expect("lh_owner_begin with waiter", &g_hint_lock, 1, 0);
+    lh_owner_end(&g_hint_lock);
+    lh_test_expect("lh_owner_end clears lock_table", &g_hint_lock, 0, 0);
+    lh_test_check("hint sees the published waiter", lock_has_waiters(&g_hint_lock));
+    for (int i = 0; i < 10 && !yielded; i++) {
+        before = atomic_load(&g_hint_spins);
+        lh_handoff_hint(&g_hint_lock);
+        yielded = atomic_load(&g_hint_spins) != before;
+    }
+    lh_test_check("lh_handoff_hint yields to the waiter", yielded);
+
+    atomic_store(&g_hint_state, 2);
+    pthread_join(th, NULL);
+    lh_test_check("waiter gone after lh_wait_end", !lock_has_waiters(&g_hint_lock));
+    sched_setaffinity(0, sizeof(old), &old);
+}
+
+static void test_annotations(void)
+{
+    static int spin;
+    u32 tid = gettid_u32();
+
+    lh_cs_enter();
+    lh_test_expect("lh_cs_enter", &spin, 0, 1);
+    lh_cs_enter();
+    lh_cs_exit();
+    lh_test_expect("lh_cs_enter nested", &spin, 0, 1);
+    lh_cs_exit();
+    lh_test_expect("lh_cs_exit", &spin, 0, 0);
+
+    lh_owner_begin(&spin);
+    lh_test_expect("lh_owner_begin", &spin, 1, 0);
+    lh_owner_end(&spin);
+    lh_test_expect("lh_owner_end", &spin, 0, 0);
+
+    lh_wait_begin(&spin);
+    lh_test_check("lh_wait_begin", waiter_recorded(&spin, tid));
+    struct lh_thread_slot *w = slot_lookup(tid, NULL);
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    u32 now_us = (u32)((u64)now.tv_sec * 1000000 + now.tv_nsec / 1000);
+    /* 时间戳最低位被置 1，可能比 now_us 大 1 */
+    lh_test_check("lh_wait_begin stamps wait_start_us",
+                  w && w->wait_start_us && now_us + 1 - w->wait_start_us < 1000000);
+    lh_test_check("lh_wait_begin counted for unlock", lock_has_waiters(&spin));
+    lh_wait_end();
+    lh_test_check("lh_wait_end", !waiter_recorded(&spin, tid));
+    lh_test_check("lh_wait_end uncounted", !lock_has_waiters(&spin));
+
+    test_handoff_hint();
+}
+
+/* ========== lh_spinlock.h ==========
+ * 测试用的 cpu_table 全为 0（没有调度器），所有 owner 都被判为不在 CPU 上，
+ * waiter 每次检查都走 yield 路径；这里验证互斥正确性和 hints。
+ */
+#define SPIN_THREADS    4
+#define SPIN_ITERS      20000
+
+enum spin_kind { SPIN_TTAS, SPIN_TICKET, SPIN_MCS };
+
+static struct {
+    enum spin_kind kind;
+    lh_spinlock_t spin;
+    lh_ticket_t ticket;
+    lh_mcs_t mcs;
+    long counter;
+} g_spin;
+
+static void *spin_worker(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < SPIN_ITERS; i++) {
+        struct lh_mcs_node node;
+
+        switch (g_spin.kind) {
+        case SPIN_TTAS:
+            lh_spin_lock(&g_spin.spin);
+            g_spin.counter++;
+            lh_spin_unlock(&g_spin.spin);
+            break;
+        case SPIN_TICKET:
+            lh_ticket_lock(&g_spin.ticket);
+            g_spin.counter++;
+            lh_ticket_unlock(&g_spin.ticket);
+            break;
+        case SPIN_MCS:
+            lh_mcs_lock(&g_spin.mcs, &node);
+            g_spin.counter++;
+            lh_mcs_unlock(&g_spin.mcs, &node);
+            break;
+        }
+    }
+    return NULL;
+}
+
+static bool spin_contended(enum spin_kind kind)
+{
+    pthread_t th[SPIN_THREADS];
+
+    g_spin.kind = kind;
+    g_spin.counter = 0;
+    for (int i = 0; i < SPIN_THREADS; i++)
+        pthread_create(&th[i], NULL, spin_worker, NULL);
+    for (int i = 0; i < SPIN_THREADS; i++)
+        pthread_join(th[i], NULL);
+    return g_spin.counter == (long)SPIN_THREADS * SPIN_ITERS;
+}
+
+static void test_spinlocks(void)
+{
+    lh_spinlock_t s = LH_SPINLOCK_INIT;
+    lh_ticket_t t = LH_TICKET_INIT;
+    lh_mcs_t m = LH_MCS_INIT;
+    struct lh_mcs_node node;
+    u32 tid = gettid_u32();
+
+    /* cpu_table 上报 tid 在 CPU 2 上运行 */
+    atomic_store(&g_cpu_table[2].curr_tid, tid);
+    lh_test_check("lh_owner_running (on cpu)", lh_owner_running(tid, 2));
+    lh_test_check("lh_owner_running (preempted)", !lh_owner_running(tid + 1, 2));
+    lh_test_check("lh_owner_running (unknown cpu)", lh_owner_running(tid, -1));
+    atomic_store(&g_cpu_table[2].curr_tid, 0);
+
+    lh_spin_lock(&s);
+    lh_test_check("lh_spin_lock owner published", s.owner.tid == tid);
+    lh_test_expect("lh_spin_lock", &s, -1, 1);
+    lh_test_check("lh_spin_trylock while held", !lh_spin_trylock(&s));
+    lh_spin_unlock(&s);
+    lh_test_expect("lh_spin_unlock", &s, -1, 0);
+
+    lh_test_check("lh_ticket_trylock", lh_ticket_trylock(&t));
+    lh_test_expect("lh_ticket held", &t, -1, 1);
+    lh_ticket_unlock(&t);
+    lh_test_expect("lh_ticket_unlock", &t, -1, 0);
+
+    lh_mcs_lock(&m, &node);
+    lh_test_expect("lh_mcs_lock", &m, -1, 1);
+    lh_mcs_unlock(&m, &node);
+    lh_test_expect("lh_mcs_unlock", &m, -1, 0);
+
+    lh_test_check("lh_spinlock_t contended", spin_contended(SPIN_TTAS));
+    lh_test_check("lh_ticket_t contended", spin_contended(SPIN_TICKET));
+    lh_test_check("lh_mcs_t contended", spin_contended(SPIN_MCS));
+}
+
+/* ========== NUMA 分区 ==========
+ * 测试机只有一个节点时 home 分区是 0；另一个分区用来模拟别的节点上的线程。
+ */
+static void test_numa_partitions(void)
+{
+    static pthread_mutex_t m = PTHREAD_MUTEX_INITIALIZER;
+    static pthread_mutex_t foreign = PTHREAD_MUTEX_INITIALIZER;
+    unsigned int cpu, node = 0;
+    u32 tid = gettid_u32();
+    u64 addr = (u64)(uintptr_t)&foreign;
+    int home, part = -1, other;
+    struct lh_lock_bucket *b;
+
+    getcpu(&cpu, &node);
+    home = (int)(node % TEST_NODES);
+    other = (home + 1) % TEST_NODES;
+
+    pthread_mutex_lock(&m);
+    lh_test_check("owner entry in home partition",
+                  entry_lookup(&m, &part) && part == home);
+    lh_test_check("thread slot in home partition",
+                  slot_lookup(tid, &part) && part == home);
+    lh_test_check("no slot claimed in other partition",
+                  g_thread_table[other][LH_THREAD_SLOT_IDX(tid)].tid != tid);
+    pthread_mutex_unlock(&m);
+
+    /* entry 不在 home 分区时，查找和释放也要扫描到它 */
+    b = &g_lock_table[other][LH_BUCKET_IDX(addr, TEST_HASH_SALT)];
+    b->way[0].owner_tid = tid;
+    b->way[0].owner_cpu = 0;
+    atomic_store(&b->tag[0], addr);
+    lh_test_check("foreign-partition owner visible", owner_lookup(&foreign) == tid);
+    lh_owner_end(&foreign);
+    lh_test_check("foreign-partition entry released", atomic_load(&b->tag[0]) == 0);
+}
+
+/* ========== rseq ==========
+ * glibc >= 2.35 已为每个线程注册 rseq，rseq.h 应直接用它（而不是注册失败后
+ * 每次回退 sched_getcpu）；per-CPU 计数在多线程下不丢更新。
+ */
+#define RSEQ_THREADS    4
+#define RSEQ_ITERS      200000
+#define RSEQ_MAX_CPUS   1024
+
+static struct {
+    u64 count;
+    u64 pad[7];
+} g_rseq_counters[RSEQ_MAX_CPUS];
+
+static void *rseq_worker(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < RSEQ_ITERS; i++)
+        rseq_percpu_counter_add(g_rseq_counters, sizeof(g_rseq_counters[0]),
+                                RSEQ_MAX_CPUS, 1);
+    return NULL;
+}
+
+static void test_rseq(void)
+{
+    static pthread_mutex_t m = PTHREAD_MUTEX_INITIALIZER;
+    pthread_t th[RSEQ_THREADS];
+    cpu_set_t old, one;
+    u64 total = 0;
+    int cpu;
+
+    if (&__rseq_size && __rseq_size)
+        lh_test_check("uses glibc rseq area", rseq_area() == rseq_glibc_area());
+    else
+        lh_test_check("registers own rseq area", rseq_area() != NULL);
+
+    /* 绑在当前 CPU 上比较，避免迁移造成误判 */
+    sched_getaffinity(0, sizeof(old), &old);
+    cpu = sched_getcpu();
+    CPU_ZERO(&one);
+    CPU_SET(cpu, &one);
+    sched_setaffinity(0, sizeof(one), &one);
+    lh_test_check("rseq cpu id matches sched_getcpu", rseq_cpu_id() == sched_getcpu());
+    pthread_mutex_lock(&m);
+    lh_test_check("lock_table owner_cpu from rseq", owner_cpu_lookup(&m) == cpu);
+    pthread_mutex_unlock(&m);
+    sched_setaffinity(0, sizeof(old), &old);
+
+    for (int i = 0; i < RSEQ_THREADS; i++)
+        pthread_create(&th[i], NULL, rseq_worker, NULL);
+    for (int i = 0; i < RSEQ_THREADS; i++)
+        pthread_join(th[i], NULL);
+    for (int i = 0; i < RSEQ_MAX_CPUS; i++)
+        total += g_rseq_counters[i].count;
+    lh_test_check("per-cpu counter: no lost updates",
+                  total == (u64)RSEQ_THREADS * RSEQ_ITERS);
+}
+
+/* ========== LH_PROFILE ==========
+ * 以相反顺序嵌套获取两把锁，主动输出报告，检查报告中有这两把锁和顺序冲突标记。
+ */
+static bool file_contains(const char *path, const char *needle)
+{
+    char line[512];
+    bool found = false;
+    FILE *f = fopen(path, "r");
+
+    if (!f)
+        return false;
+    while (!found && fgets(line, sizeof(line), f))
+        found = strstr(line, needle) != NULL;
+    fclose(f);
+    return found;
+}
+
+static void test_profile(void)
+{
+    static pthread_mutex_t a = PTHREAD_MUTEX_INITIALIZER;
+    static pthread_mutex_t b = PTHREAD_MUTEX_INITIALIZER;
+    const char *out = getenv("LH_PROFILE_OUT");
+    void (*report)(void);
+    char addr[32];
+
+    pthread_mutex_lock(&a);
+    pthread_mutex_lock(&b);
+    pthread_mutex_unlock(&b);
+    pthread_mutex_unlock(&a);
+
+    pthread_mutex_lock(&b);
+    pthread_mutex_lock(&a);
+    pthread_mutex_unlock(&a);
+    pthread_mutex_unlock(&b);
+
+    *(void **)&report = dlsym(RTLD_DEFAULT, "lh_profile_report");
+    lh_test_check("lh_profile_report exported", report != NULL);
+    if (!report || !out)
+        return;
+    report();
+
+    snprintf(addr, sizeof(addr), "0x%016lx", (unsigned long)(uintptr_t)&a);
+    lh_test_check("report lists lock", file_contains(out, addr));
+    lh_test_check("report flags order inversion", file_contains(out, "ORDER INVERSION"));
+    unlink(out);
+}
+
+/* ========== LH_INCLUDE / LH_EXCLUDE ==========
+ * 父进程设置 LH_EXCLUDE=sym:lh_test_excluded_lock，该锁不应发布任何 hint，
+ * 其它锁（上面的用例）保持开启。销毁后缓存里不应再有这把锁的决定。
+ */
+pthread_mutex_t lh_test_excluded_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void test_filter(void)
+{
+    static pthread_mutex_t other = PTHREAD_MUTEX_INITIALIZER;
+
+    pthread_mutex_lock(&lh_test_excluded_lock);
+    lh_test_expect("excluded lock: no hints", &lh_test_excluded_lock, 0, 0);
+    pthread_mutex_lock(&other);
+    lh_test_expect("other lock under excluded: handoff on", &other, 1, 1);
+    lh_test_check("held top is the included lock", held_top(gettid_u32()) == (u64)(uintptr_t)&other);
+    pthread_mutex_unlock(&other);
+    pthread_mutex_unlock(&lh_test_excluded_lock);
+    lh_test_expect("excluded lock: after unlock", &lh_test_excluded_lock, 0, 0);
+
+    u64 addr = (u64)(uintptr_t)&lh_test_excluded_lock;
+    _Atomic u64 *cache = dlsym(RTLD_DEFAULT, "g_lh_filter_cache");
+    bool cached = false;
+
+    pthread_mutex_destroy(&lh_test_excluded_lock);
+    for (int i = 0; cache && i < LH_FILTER_PROBE_MAX; i++) {
+        u64 v = atomic_load(&cache[(lh_filter_slot(addr) + i) & (LH_FILTER_CACHE_SLOTS - 1)]);
+        cached |= (v & ~LH_FILTER_FLAG_MASK) == addr;
+    }
+    lh_test_check("destroy drops the cached decision", cache && !cached);
+    pthread_mutex_init(&lh_test_excluded_lock, NULL);
+    pthread_mutex_lock(&lh_test_excluded_lock);
+    lh_test_expect("excluded lock: re-resolved after init", &lh_test_excluded_lock, 0, 0);
+    pthread_mutex_unlock(&lh_test_excluded_lock);
+}
+
+/* ========== LH_HANDOFF_ORDER ==========
+ * 子进程以 fifo 运行（yield 预算放大，waiter 不会回退到阻塞而离开队列）：
+ * 主线程持锁时依次启动三个 waiter，每个登记进队列后再启动下一个，
+ * 解锁后应按登记顺序拿到锁；锁已指定给 waiter 时，解锁者立即重新加锁不能插队。
+ */
+#define ORDER_WAITERS   3
+
+static pthread_mutex_t g_order_lock = PTHREAD_MUTEX_INITIALIZER;
+static int g_order_seq[ORDER_WAITERS + 1];
+static _Atomic int g_order_n;
+
+static void *order_waiter(void *arg)
+{
+    pthread_mutex_lock(&g_order_lock);
+    g_order_seq[atomic_fetch_add(&g_order_n, 1)] = (int)(intptr_t)arg;
+    pthread_mutex_unlock(&g_order_lock);
+    return NULL;
+}
+
+/* liblh 的队列里为 lock 登记了几个 waiter */
+static int order_queued(const void *lock)
+{
+    struct lh_order_queue *(*find)(u64);
+    struct lh_order_queue *q;
+    int n = 0;
+
+    *(void **)&find = dlsym(RTLD_DEFAULT, "lh_order_queue_find");
+    q = find ? find((u64)(uintptr_t)lock) : NULL;
+    for (int i = 0; q && i < LH_ORDER_WAITERS; i++)
+        n += atomic_load(&q->w[i].tid) != 0;
+    return n;
+}
+
+static bool wait_queued(const void *lock, int n)
+{
+    for (int i = 0; i < 20000; i++) {
+        if (order_queued(lock) >= n)
+            return true;
+        usleep(10);
+    }
+    return false;
+}
+
+static void test_handoff_order(void)
+{
+    pthread_t th[ORDER_WAITERS];
+    bool queued = true, fifo = true;
+
+    pthread_mutex_lock(&g_order_lock);
+    for (int i = 0; i < ORDER_WAITERS; i++) {
+        pthread_create(&th[i], NULL, order_waiter, (void *)(intptr_t)(i + 1));
+        queued &= wait_queued(&g_order_lock, i + 1);
+    }
+    lh_test_check("waiters registered in order queue", queued);
+    pthread_mutex_unlock(&g_order_lock);
+    for (int i = 0; i < ORDER_WAITERS; i++)
+        pthread_join(th[i], NULL);
+    for (int i = 0; i < ORDER_WAITERS; i++)
+        fifo &= g_order_seq[i] == i + 1;
+    lh_test_check("fifo: waiters served in arrival order", fifo);
+    lh_test_check("order queue empty afterwards", order_queued(&g_order_lock) == 0);
+
+    /* 解锁者立即重新加锁：锁已指定给 waiter，主线程排在它后面 */
+    atomic_store(&g_order_n, 0);
+    pthread_mutex_lock(&g_order_lock);
+    pthread_create(&th[0], NULL, order_waiter, (void *)(intptr_t)1);
+    queued = wait_queued(&g_order_lock, 1);
+    pthread_mutex_unlock(&g_order_lock);
+    pthread_mutex_lock(&g_order_lock);
+    g_order_seq[atomic_fetch_add(&g_order_n, 1)] = 0;
+    pthread_mutex_unlock(&g_order_lock);
+    pthread_join(th[0], NULL);
+    lh_test_check("granted waiter not barged by unlocker", queued && g_order_seq[0] == 1);
+}
+
+/* ========== 回退阻塞加锁：waiter hint 保持为 PARKED ==========
+ * 子进程的 LH_FALLBACK_US 是 300ms：主线程持锁更久，waiter 回退到阻塞加锁后
+ * thread_slot 仍应记录它在等这把锁，unlock 也应看到它，拿到锁后清除。
+ */
+static pthread_mutex_t g_park_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic u32 g_park_tid;
+
+static void *park_waiter(void *arg)
+{
+    (void)arg;
+    atomic_store(&g_park_tid, gettid_u32());
+    pthread_mutex_lock(&g_park_lock);
+    pthread_mutex_unlock(&g_park_lock);
+    return NULL;
+}
+
+static void test_fallback_parked(void)
+{
+    pthread_t th;
+    u32 tid, state = LH_WAITER_INACTIVE;
+
+    atomic_store(&g_park_tid, 0);
+    pthread_mutex_lock(&g_park_lock);
+    pthread_create(&th, NULL, park_waiter, NULL);
+    for (int i = 0; i < 200 && state != LH_WAITER_PARKED; i++) {
+        usleep(5000);
+        tid = atomic_load(&g_park_tid);
+        state = tid ? waiter_state(&g_park_lock, tid) : LH_WAITER_INACTIVE;
+    }
+    lh_test_check("fallback waiter published as PARKED", state == LH_WAITER_PARKED);
+    lh_test_check("unlock sees the parked waiter", lock_has_waiters(&g_park_lock));
+    pthread_mutex_unlock(&g_park_lock);
+    pthread_join(th, NULL);
+    lh_test_check("parked waiter cleared after acquiring",
+                  waiter_state(&g_park_lock, atomic_load(&g_park_tid)) == LH_WAITER_INACTIVE);
+    lh_test_check("no waiters counted after acquiring", !lock_has_waiters(&g_park_lock));
+}
+
+/* ========== lh_delegate ==========
+ * fn 在持锁状态下执行（可能在别的线程上），调用返回时已执行完；
+ * 委托的调用者和普通加锁的线程混用同一把锁，计数不丢。
+ */
+#define DELEGATE_THREADS    4
+#define DELEGATE_ITERS      20000
+
+static pthread_mutex_t g_delegate_lock = PTHREAD_MUTEX_INITIALIZER;
+static long g_delegate_counter;
+
+struct delegate_probe {
+    int held;           /* fn 执行时锁被持有 */
+    u32 runner;         /* 执行 fn 的线程 */
+    int in_cs;
+};
+
+static void delegate_probe_fn(void *arg)
+{
+    struct delegate_probe *p = arg;
+
+    p->held = pthread_mutex_trylock(&g_delegate_lock) == EBUSY;
+    p->runner = gettid_u32();
+    p->in_cs = lh_test_cs_depth(p->runner) > 0;
+}
+
+static void delegate_inc(void *arg)
+{
+    (void)arg;
+    g_delegate_counter++;
+}
+
+static void *delegate_worker(void *arg)
+{
+    bool plain = arg != NULL;
+
+    for (int i = 0; i < DELEGATE_ITERS; i++) {
+        if (plain) {
+            pthread_mutex_lock(&g_delegate_lock);
+            g_delegate_counter++;
+            pthread_mutex_unlock(&g_delegate_lock);
+        } else {
+            lh_delegate(&g_delegate_lock, delegate_inc, NULL);
+        }
+    }
+    return NULL;
+}
+
+static int g_batch_seq[3];
+static int g_batch_n;
+
+static void delegate_record(void *arg)
+{
+    g_batch_seq[g_batch_n++] = (int)(intptr_t)arg;
+}
+
+/* combine 只执行 max 个，剩下的按顺序留给下一次 */
+static bool delegate_batch_capped(void)
+{
+    static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    struct lh_delegate_queue *(*get)(u64);
+    u32 (*combine)(struct lh_delegate_queue *, u32);
+    struct lh_delegate_req req[3];
+    struct lh_delegate_queue *q;
+    u32 first, second;
+
+    *(void **)&get = dlsym(RTLD_DEFAULT, "lh_delegate_queue_get");
+    *(void **)&combine = dlsym(RTLD_DEFAULT, "lh_delegate_combine");
+    q = get && combine ? get((u64)(uintptr_t)&lock) : NULL;
+    if (!q)
+        return false;
+
+    for (int i = 0; i < 3; i++) {
+        req[i] = (struct lh_delegate_req){ delegate_record, (void *)(intptr_t)(i + 1), NULL, 0 };
+        lh_delegate_post(q, &req[i]);
+    }
+    g_batch_n = 0;
+    pthread_mutex_lock(&lock);
+    first = combine(q, 2);
+    if (lh_delegate_done(&req[2]))
+        first = 0;
+    second = combine(q, 2);
+    pthread_mutex_unlock(&lock);
+    return first == 2 && second == 1 && lh_delegate_done(&req[2]) &&
+           g_batch_seq[0] == 1 && g_batch_seq[1] == 2 && g_batch_seq[2] == 3;
+}
+
+/* destroy 回收队列，之后同一地址能重新建立；堆上逐个建立、销毁的锁不会占满队列表 */
+static bool delegate_queue_released(void)
+{
+    struct lh_delegate_queue *(*find)(u64);
+    _Atomic u32 *nr_queues = dlsym(RTLD_DEFAULT, "g_lh_delegate_nr_queues");
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    bool ok;
+    u32 before;
+
+    *(void **)&find = dlsym(RTLD_DEFAULT, "lh_delegate_queue_find");
+    if (!find || !nr_queues)
+        return false;
+    before = atomic_load(nr_queues);
+
+    lh_delegate(&lock, delegate_inc, NULL);
+    ok = find((u64)(uintptr_t)&lock) != NULL && atomic_load(nr_queues) == before + 1;
+    pthread_mutex_destroy(&lock);
+    ok &= find((u64)(uintptr_t)&lock) == NULL && atomic_load(nr_queues) == before;
+
+    for (int i = 0; i < 2 * LH_DELEGATE_QUEUES; i++) {
+        pthread_mutex_t *m = malloc(sizeof(*m));
+
+        pthread_mutex_init(m, NULL);
+        lh_delegate(m, delegate_inc, NULL);
+        ok &= find((u64)(uintptr_t)m) != NULL;
+        pthread_mutex_destroy(m);
+        free(m);
+    }
+    return ok && atomic_load(nr_queues) == before;
+}
+
+static void test_delegate(void)
+{
+    struct delegate_probe probe = { 0, 0, 0 };
+    pthread_t th[DELEGATE_THREADS + 1];
+    u32 tid = gettid_u32();
+
+    lh_delegate(&g_delegate_lock, delegate_probe_fn, &probe);
+    lh_test_check("lh_delegate runs fn under the lock", probe.held && probe.in_cs);
+    lh_test_check("uncontended lh_delegate runs inline", probe.runner == tid);
+    lh_test_expect("lh_delegate releases the lock", &g_delegate_lock, 0, 0);
+
+    g_delegate_counter = 0;
+    for (int i = 0; i < DELEGATE_THREADS; i++)
+        pthread_create(&th[i], NULL, delegate_worker, NULL);
+    pthread_create(&th[DELEGATE_THREADS], NULL, delegate_worker, (void *)1);
+    for (int i = 0; i <= DELEGATE_THREADS; i++)
+        pthread_join(th[i], NULL);
+    lh_test_check("delegated + plain lockers keep count",
+                  g_delegate_counter == (long)(DELEGATE_THREADS + 1) * DELEGATE_ITERS);
+    lh_test_check("no delegate waiter left behind",
+                  owner_lookup(&g_delegate_lock) == 0 &&
+                  waiter_state(&g_delegate_lock, tid) == LH_WAITER_INACTIVE);
+    lh_test_check("combine capped at max, rest kept in order", delegate_batch_capped());
+    lh_test_check("destroy releases the delegate queue", delegate_queue_released());
+}
+
+/* ========== LH_NATIVE_MUTEX ==========
+ * 第二轮子进程：PTHREAD_MUTEX_NORMAL 的锁字由 liblh 维护。检查与 glibc 的
+ * trylock / timedlock / cond_wait / destroy 互通、__owner 记账，以及多线程
+ * 争用下计数不丢（交接路径、futex 回退路径都会走到）。
+ */
+#define NATIVE_THREADS  4
+#define NATIVE_ITERS    20000
+
+static pthread_mutex_t g_native_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_native_cond = PTHREAD_COND_INITIALIZER;
+static long g_native_counter;
+static int g_native_ready;
+
+static void *native_worker(void *arg)
+{
+    (void)arg;
+    for (int i = 0; i < NATIVE_ITERS; i++) {
+        pthread_mutex_lock(&g_native_lock);
+        g_native_counter++;
+        pthread_mutex_unlock(&g_native_lock);
+    }
+    return NULL;
+}
+
+static void *native_waker(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&g_native_lock);
+    g_native_ready = 1;
+    pthread_cond_signal(&g_native_cond);
+    pthread_mutex_unlock(&g_native_lock);
+    return NULL;
+}
+
+static void test_native_mutex(void)
+{
+    pthread_mutex_t m = PTHREAD_MUTEX_INITIALIZER;
+    pthread_t th[NATIVE_THREADS];
+    struct timespec ts;
+    u32 tid = gettid_u32();
+    bool ok;
+
+    pthread_mutex_lock(&m);
+    lh_test_check("native: __owner is the locking thread", (u32)m.__data.__owner == tid);
+    lh_test_check("native: trylock on held mutex returns EBUSY", pthread_mutex_trylock(&m) == EBUSY);
+    pthread_mutex_unlock(&m);
+    lh_test_check("native: lock word and __owner cleared on unlock",
+                  m.__data.__lock == 0 && m.__data.__owner == 0);
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += 1;
+    ok = pthread_mutex_timedlock(&m, &ts) == 0;
+    pthread_mutex_unlock(&m);
+    lh_test_check("native: glibc timedlock interoperates", ok);
+    lh_test_check("native: destroy after use", pthread_mutex_destroy(&m) == 0);
+
+    g_native_counter = 0;
+    for (int i = 0; i < NATIVE_THREADS; i++)
+        pthread_create(&th[i], NULL, native_worker, NULL);
+    for (int i = 0; i < NATIVE_THREADS; i++)
+        pthread_join(th[i], NULL);
+    lh_test_check("native: no lost updates under contention",
+                  g_native_counter == (long)NATIVE_THREADS * NATIVE_ITERS);
+    lh_test_check("native: lock free after contention", g_native_lock.__data.__lock == 0);
+
+    pthread_mutex_lock(&g_native_lock);
+    pthread_create(&th[0], NULL, native_waker, NULL);
+    while (!g_native_ready)
+        pthread_cond_wait(&g_native_cond, &g_native_lock);
+    ok = (u32)g_native_lock.__data.__owner == tid;
+    pthread_mutex_unlock(&g_native_lock);
+    pthread_join(th[0], NULL);
+    lh_test_check("native: cond_wait reacquires with __owner", ok);
+}
+
+/* ========== 父进程：建表后带 LD_PRELOAD 重新 exec ========== */
+static int create_table(const char *name, size_t size)
+{
+    int fd = memfd_create(name, 0);
+    if (fd < 0 || ftruncate(fd, size) != 0) {
+        perror("memfd_create");
+        exit(2);
+    }
+    return fd;
+}
+
+static void set_fd_env(const char *var, int fd)
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", fd);
+    setenv(var, buf, 1);
+}
+
+/* 与 launcher 相同的格式：每个节点一个分区，"fd0,fd1" */
+static void set_partitions_env(const char *var, const char *name, size_t size)
+{
+    char buf[64];
+    int len = 0;
+
+    for (int n = 0; n < TEST_NODES; n++)
+        len += snprintf(buf + len, sizeof(buf) - len, "%s%d", n ? "," : "",
+                        create_table(name, size));
+    setenv(var, buf, 1);
+}
+
+/* 每一轮用新表（上一轮留下的 EWMA / 队列不影响检查） */
+static int run_child(const char *exe, char *argv[], bool native)
+{
+    pid_t pid;
+    int status;
+
+    set_partitions_env("LH_LOCK_TABLE_FD", "lh_lock_table",
+                       sizeof(struct lh_lock_bucket) * LH_LOCK_TABLE_BUCKETS);
+    set_partitions_env("LH_THREAD_TABLE_FD", "lh_thread_table",
+                       sizeof(struct lh_thread_slot) * LH_THREAD_TABLE_SLOTS);
+    set_fd_env("LH_CPU_TABLE_FD",
+               create_table("lh_cpu_table", sizeof(struct lh_cpu_slot) * LH_CPU_TABLE_SLOTS));
+    setenv("LH_NATIVE_MUTEX", native ? "1" : "0", 1);
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == 0) {
+        execv(exe, argv);
+        perror("execv");
+        _exit(2);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) != pid)
+        return 2;
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 2;
+}
+
+static int respawn_with_liblh(char *argv[])
+{
+    char exe[4096], liblh[4096];
+    ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (n < 0) {
+        perror("readlink");
+        return 2;
+    }
+    exe[n] = '\0';
+
+    if (argv[1]) {
+        if (!realpath(argv[1], liblh)) {
+            perror(argv[1]);
+            return 2;
+        }
+    } else {
+        char dir[4096];
+        snprintf(dir, sizeof(dir), "%s", exe);
+        snprintf(liblh, sizeof(liblh), "%s/../liblh/liblh.so", dirname(dir));
+    }
+    if (access(liblh, R_OK) != 0) {
+        fprintf(stderr, "%s not found, run: make liblh/liblh.so\n", liblh);
+        return 2;
+    }
+
+    char salt[32];
+    snprintf(salt, sizeof(salt), "%llx", (unsigned long long)TEST_HASH_SALT);
+    setenv("LH_HASH_SALT", salt, 1);
+    setenv("LD_PRELOAD", liblh, 1);
+    setenv("LH_TEST_CHILD", "1", 1);
+
+    char profile_out[64];
+    snprintf(profile_out, sizeof(profile_out), "/tmp/lh_test_profile.%d", getpid());
+    setenv("LH_PROFILE", "1", 1);
+    setenv("LH_PROFILE_OUT", profile_out, 1);
+    setenv("LH_EXCLUDE", "sym:lh_test_excluded_lock", 1);
+    setenv("LH_HANDOFF_ORDER", "fifo", 1);
+    setenv("LH_YIELD_BUDGET", "1000000", 1);
+    setenv("LH_FALLBACK_US", "300000", 1);
+
+    /* 两轮：包装 glibc mutex，以及 LH_NATIVE_MUTEX=1（liblh 自己维护锁字） */
+    int ret = run_child(exe, argv, false);
+    int ret_native = run_child(exe, argv, true);
+    return ret ? ret : ret_native;
+}
+
+static void *map_fd(const char *var, int fd, size_t size)
+{
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "cannot map %s\n", var);
+        exit(2);
+    }
+    return p;
+}
+
+static void *map_table(const char *var, size_t size)
+{
+    const char *fd_str = getenv(var);
+
+    return map_fd(var, fd_str ? atoi(fd_str) : -1, size);
+}
+
+static void map_partitions(const char *var, size_t size, void **parts)
+{
+    const char *fds = getenv(var);
+
+    for (int n = 0; n < TEST_NODES; n++) {
+        char *end;
+
+        parts[n] = map_fd(var, fds ? (int)strtol(fds, &end, 10) : -1, size);
+        fds = fds && *end == ',' ? end + 1 : NULL;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    (void)argc;
+
+    if (!getenv("LH_TEST_CHILD"))
+        return respawn_with_liblh(argv);
+
+    map_partitions("LH_LOCK_TABLE_FD", sizeof(struct lh_lock_bucket) * LH_LOCK_TABLE_BUCKETS,
+                   (void **)g_lock_table);
+    map_partitions("LH_THREAD_TABLE_FD", sizeof(struct lh_thread_slot) * LH_THREAD_TABLE_SLOTS,
+                   (void **)g_thread_table);
+    g_cpu_table = map_table("LH_CPU_TABLE_FD",
+                            sizeof(struct lh_cpu_slot) * LH_CPU_TABLE_SLOTS);
+
+    bool native = getenv("LH_NATIVE_MUTEX") && strcmp(getenv("LH_NATIVE_MUTEX"), "1") == 0;
+
+    printf("=== liblh interposition coverage%s ===\n", native ? " (LH_NATIVE_MUTEX=1)" : "");
+    printf("[pthread mutex]\n");
+    test_mutex();
+    printf("[nested locks]\n");
+    test_nested();
+    printf("[lock_table identity]\n");
+    test_many_locks();
+    printf("[__pthread_* aliases]\n");
+    test_pthread_aliases();
+    printf("[pthread rwlock]\n");
+    test_rwlock();
+    printf("[pthread condvar]\n");
+    test_cond();
+    printf("[C++ std]\n");
+    test_cxx_locks();
+    printf("[liblh.h annotations]\n");
+    test_annotations();
+    printf("[lh_spinlock.h]\n");
+    test_spinlocks();
+    printf("[NUMA partitions]\n");
+    test_numa_partitions();
+    printf("[rseq]\n");
+    test_rseq();
+    printf("[LH_EXCLUDE]\n");
+    test_filter();
+    printf("[LH_HANDOFF_ORDER]\n");
+    test_handoff_order();
+    printf("[futex fallback]\n");
+    test_fallback_parked();
+    printf("[lh_delegate]\n");
+    test_delegate();
+    if (native) {
+        printf("[LH_NATIVE_MUTEX]\n");
+        test_native_mutex();
+    }
+    printf("[LH_PROFILE]\n");
+    test_profile();
+
+    printf("\n%d passed, %d failed\n", g_passed, g_failed);
+    return g_failed ? 1 : 0;
+}
@@ -0,0 +1,28 @@
+/* SPDX-License-Identifier: MIT */
+/*
+ * test_interpose.h - test_interpose.c 与 C++ 用例之间的接口
+ */
+#ifndef __TEST_INTERPOSE_H
+#define __TEST_INTERPOSE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * 检查当前线程对 lock 的共享表状态：
+ * expect_owner / expect_in_cs 为 1 = 应存在，0 = 应不存在，-1 = 不检查
+ */
+void lh_test_expect(const char *name, const void *lock, int expect_owner, int expect_in_cs);
+void lh_test_check(const char *name, int ok);
+unsigned lh_test_cs_depth(unsigned tid);
+unsigned lh_test_tid(void);
+
+/* test_interpose_cxx.cpp */
+void test_cxx_locks(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __TEST_INTERPOSE_H */
@@ -0,0 +1,119 @@
+// SPDX-License-Identifier: MIT
+/*
+ * test_interpose_cxx.cpp - C++ 标准库锁的拦截覆盖用例
+ *
+ * libstdc++ 的 std::mutex 等经 __gthread_* 调用 pthread 函数，
+ * 这里确认这些调用最终都经过 liblh 并反映到共享表中。
+ */
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unistd.h>
+
+#include "test_interpose.h"
+
+static void test_std_mutex()
+{
+    std::mutex m;
+
+    m.lock();
+    lh_test_expect("std::mutex::lock", m.native_handle(), 1, 1);
+    m.unlock();
+    lh_test_expect("std::mutex::unlock", m.native_handle(), 0, 0);
+
+    {
+        std::lock_guard<std::mutex> g(m);
+        lh_test_expect("std::lock_guard<std::mutex>", m.native_handle(), 1, 1);
+    }
+    lh_test_expect("std::lock_guard released", m.native_handle(), 0, 0);
+}
+
+static void test_std_timed_mutex()
+{
+    std::timed_mutex m;
+
+    lh_test_check("std::timed_mutex::try_lock_for",
+                  m.try_lock_for(std::chrono::milliseconds(100)));
+    lh_test_expect("std::timed_mutex held", m.native_handle(), 1, 1);
+    m.unlock();
+    lh_test_expect("std::timed_mutex released", m.native_handle(), 0, 0);
+}
+
+static void test_std_recursive_mutex()
+{
+    std::recursive_mutex m;
+
+    m.lock();
+    m.lock();
+    lh_test_expect("std::recursive_mutex nested", m.native_handle(), 1, 1);
+    m.unlock();
+    m.unlock();
+    lh_test_expect("std::recursive_mutex released", m.native_handle(), 0, 0);
+}
+
+static void test_std_shared_mutex()
+{
+    std::shared_mutex m;
+
+    m.lock();
+    lh_test_expect("std::shared_mutex::lock", m.native_handle(), 1, 1);
+    m.unlock();
+    lh_test_expect("std::shared_mutex::unlock", m.native_handle(), 0, 0);
+
+    m.lock_shared();
+    lh_test_expect("std::shared_mutex::lock_shared", m.native_handle(), 0, 1);
+    m.unlock_shared();
+    lh_test_expect("std::shared_mutex::unlock_shared", m.native_handle(), 0, 0);
+}
+
+/* 等待期间由另一个线程检查 waiter 不再处于 IN_CS */
+static void test_std_condition_variable(bool timed)
+{
+    std::mutex m;
+    std::condition_variable cv;
+    unsigned waiter_tid = lh_test_tid();
+    bool waiting = false, ready = false, in_cs_while_waiting = true;
+
+    std::thread signaler([&] {
+        for (;;) {
+            std::lock_guard<std::mutex> g(m);
+            if (waiting)
+                break;
+        }
+        std::lock_guard<std::mutex> g(m);
+        in_cs_while_waiting = lh_test_cs_depth(waiter_tid) > 0;
+        ready = true;
+        cv.notify_one();
+    });
+
+    {
+        std::unique_lock<std::mutex> lk(m);
+        waiting = true;
+        if (timed) {
+            while (!ready)
+                cv.wait_for(lk, std::chrono::seconds(5));
+        } else {
+            cv.wait(lk, [&] { return ready; });
+        }
+        lh_test_expect(timed ? "std::condition_variable::wait_for reacquired"
+                             : "std::condition_variable::wait reacquired",
+                       m.native_handle(), 1, 1);
+    }
+    signaler.join();
+
+    lh_test_check(timed ? "wait_for: not IN_CS while waiting"
+                        : "wait: not IN_CS while waiting",
+                  !in_cs_while_waiting);
+}
+
+extern "C" void test_cxx_locks(void)
+{
+    test_std_mutex();
+    test_std_timed_mutex();
+    test_std_recursive_mutex();
+    test_std_shared_mutex();
+    test_std_condition_variable(false);
+    test_std_condition_variable(true);
+}